@@ -0,0 +1,113 @@
+#include "AsyncLog.h"
+#include "StimApp.h"
+#include "Util.h"
+#include <QDateTime>
+#include <QTextStream>
+#include <QMutexLocker>
+#include <QColor>
+#include <iostream>
+
+AsyncLog *AsyncLog::singleton = 0;
+
+AsyncLog::AsyncLog(QObject *parent)
+    : QThread(parent), nDropped(0), pleaseStop(false),
+      consoleLines(0), consoleSuppressed(0), consoleWindowStart(0)
+{
+    singleton = this;
+}
+
+AsyncLog::~AsyncLog()
+{
+    singleton = 0; // from here on Log() prints synchronously, so nothing more lands in the ring after the final drain
+    pleaseStop.storeRelease(1);
+    wait();
+    drain();
+    QMutexLocker l(&fileMut);
+    if (logFile.isOpen()) logFile.close();
+}
+
+bool AsyncLog::post(int level, const QString & msg)
+{
+    Entry e;
+    e.level = level;
+    e.tid = quintptr(QThread::currentThreadId());
+    e.msecs = QDateTime::currentMSecsSinceEpoch();
+    e.msg = msg;
+    if (ring.push(e)) return true;
+    nDropped.ref(); // ring is full
+    return false;
+}
+
+void AsyncLog::setLogFile(const QString & path)
+{
+    QMutexLocker l(&fileMut);
+    if (logFile.isOpen() && logFile.fileName() == path) return;
+    if (logFile.isOpen()) logFile.close();
+    if (!path.length()) return;
+    logFile.setFileName(path);
+    if (!logFile.open(QIODevice::WriteOnly|QIODevice::Append|QIODevice::Text)) {
+        l.unlock();
+        Error() << "Could not open log file `" << path << "': " << logFile.errorString();
+    }
+}
+
+/* static */
+QString AsyncLog::format(quintptr tid, qint64 msecs, const QString & msg)
+{
+    return QString("[Thread ") + QString::number((unsigned long)tid) + " " + QDateTime::fromMSecsSinceEpoch(msecs).toString("M/dd/yy hh:mm:ss.zzz") + "] " + msg;
+}
+
+void AsyncLog::run()
+{
+    while (!pleaseStop.loadAcquire()) {
+        drain();
+        msleep(DrainPeriodMS);
+    }
+}
+
+void AsyncLog::drain()
+{
+    QMutexLocker dl(&drainMut);
+    QString batch, fileBatch;
+    int batchLevel = -1;
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (now - consoleWindowStart >= 1000) {
+        if (consoleSuppressed && stimApp()) {
+            bool haveFile;
+            { QMutexLocker l(&fileMut); haveFile = logFile.isOpen(); }
+            stimApp()->logLine(QString("(%1 log lines were not shown in the console to keep up%2)").arg(consoleSuppressed).arg(haveFile ? ", see the log file" : " and are lost, no log file is set"), Qt::darkMagenta);
+        }
+        consoleWindowStart = now, consoleLines = consoleSuppressed = 0;
+    }
+    const int dropped = nDropped.fetchAndStoreRelaxed(0);
+    if (dropped) post(Log::WarningLevel, QString("%1 log lines were dropped, logging too fast!").arg(dropped));
+
+    Entry e;
+    while (ring.pop(e)) {
+        const QString line = format(e.tid, e.msecs, e.msg);
+        const int level = e.level;
+
+        fileBatch += line + "\n";
+        if (consoleLines >= ConsoleMaxLinesPerSec) { ++consoleSuppressed; continue; }
+        ++consoleLines;
+        if (level != batchLevel && batch.length()) {
+            if (stimApp()) stimApp()->logLine(batch, Log::levelColor(batchLevel));
+            else std::cerr << batch.toUtf8().constData() << "\n";
+            batch.clear();
+        }
+        if (batch.length()) batch += "\n";
+        batch += line;
+        batchLevel = level;
+    }
+    if (batch.length()) {
+        if (stimApp()) stimApp()->logLine(batch, Log::levelColor(batchLevel));
+        else std::cerr << batch.toUtf8().constData() << "\n";
+    }
+    if (fileBatch.length()) {
+        QMutexLocker l(&fileMut);
+        if (logFile.isOpen()) {
+            logFile.write(fileBatch.toUtf8());
+            logFile.flush();
+        }
+    }
+}
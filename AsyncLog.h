@@ -0,0 +1,73 @@
+#ifndef AsyncLog_H
+#define AsyncLog_H
+
+#include <QThread>
+#include <QAtomicInt>
+#include <QMutex>
+#include <QFile>
+#include <QString>
+#include "LockFreeQueue.h"
+
+/** \brief Background writer for Log(), Debug(), Warning() and Error() lines.
+
+    Log lines are pushed into a fixed-size LockFreeQueue, so logging from the render, DAQ or network
+    threads never takes a lock nor touches the GUI.  The thread id and time
+    are recorded at push time but only formatted here.
+
+    Every DrainPeriodMS the ring is drained: consecutive lines of the same
+    level are coalesced into a single console update, at most
+    ConsoleMaxLinesPerSec lines per second go to the console window (the
+    rest are counted and reported), and all lines are appended to the log
+    file, if one is set (the "logFile" setting).  If the ring is full the
+    line is dropped and counted, never blocking the caller.
+
+    Owned by StimApp.  Before it exists (and after it is gone) Log() prints
+    synchronously like it always did. */
+class AsyncLog : public QThread
+{
+public:
+    AsyncLog(QObject *parent = 0);
+    ~AsyncLog(); ///< stops the thread and drains whatever is left
+
+    static AsyncLog *instance() { return singleton; }
+
+    /// Queues a line for the background writer.  Lock-free and safe to call from any thread.  Returns false if the line was dropped because the ring is full.
+    bool post(int level, const QString & msg);
+
+    /// Appends all log lines to this file from now on.  Empty path means no log file.
+    void setLogFile(const QString & path);
+
+    /// Formats a line the way it appears in the console and the log file
+    static QString format(quintptr tid, qint64 msecs, const QString & msg);
+
+protected:
+    void run();
+
+private:
+    enum { RingSize = 4096, DrainPeriodMS = 25, ConsoleMaxLinesPerSec = 500 };
+
+    struct Entry {
+        int level;
+        quintptr tid;
+        qint64 msecs;
+        QString msg;
+        Entry() : level(0), tid(0), msecs(0) {}
+    };
+
+    void drain(); ///< the consumer side of the ring
+
+    static AsyncLog *singleton;
+
+    LockFreeQueue<Entry, RingSize> ring;
+    QAtomicInt nDropped;
+    QAtomicInt pleaseStop;
+
+    QMutex drainMut; ///< only taken by consumers (the thread, and the final drain in the d'tor), never by post()
+    QMutex fileMut;
+    QFile logFile;
+
+    int consoleLines, consoleSuppressed; ///< rate limiting of console output
+    qint64 consoleWindowStart;
+};
+
+#endif
@@ -0,0 +1,266 @@
+#include "Benchmark.h"
+#include "StimApp.h"
+#include "GLWindow.h"
+#include "StimPlugin.h"
+#include "FrameTimeline.h"
+#include "GLHeaders.h"
+#include "Util.h"
+#include <QAtomicInt>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextStream>
+#include <QTimer>
+#include <cstdlib>
+#include <new>
+#include <iostream>
+
+namespace {
+#ifdef STIMGL_BENCH_ALLOCS
+	volatile bool countingAllocs = false;
+	QAtomicInt nAllocsCounted;
+
+	void *countedAlloc(size_t sz)
+	{
+		if (countingAllocs) nAllocsCounted.ref();
+		return std::malloc(sz ? sz : 1);
+	}
+#endif
+
+	QString jsonStr(const QString & s)
+	{
+		QString r(s);
+		r.replace("\\", "\\\\").replace("\"", "\\\"").replace("\n", "\\n").replace("\r", "\\r").replace("\t", "\\t");
+		return QString("\"") + r + "\"";
+	}
+}
+
+#ifdef STIMGL_BENCH_ALLOCS
+/* Global operator new/delete replacements so that --benchmark can report how
+   many C++ heap allocations a plugin does per frame.  When not counting this
+   is one extra branch on top of malloc.  Qt containers and strings allocate
+   with malloc directly and are NOT counted.  Only compiled in with
+   DEFINES += STIMGL_BENCH_ALLOCS, since it replaces them for the whole
+   program (and for every library it loads). */
+void *operator new(size_t sz)
+{
+	void *p = countedAlloc(sz);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+void *operator new[](size_t sz)
+{
+	void *p = countedAlloc(sz);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+void *operator new(size_t sz, const std::nothrow_t &) Q_DECL_NOTHROW { return countedAlloc(sz); }
+void *operator new[](size_t sz, const std::nothrow_t &) Q_DECL_NOTHROW { return countedAlloc(sz); }
+void operator delete(void *p) Q_DECL_NOTHROW { std::free(p); }
+void operator delete[](void *p) Q_DECL_NOTHROW { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) Q_DECL_NOTHROW { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) Q_DECL_NOTHROW { std::free(p); }
+
+/* static */ bool Benchmark::canCountAllocs() { return true; }
+/* static */ u64 Benchmark::allocCount() { return u64(unsigned(nAllocsCounted.load())); }
+/* static */ void Benchmark::setAllocCounting(bool on) { countingAllocs = on; }
+/* static */ void Benchmark::resetAllocCount() { nAllocsCounted.store(0); }
+#else
+/* static */ bool Benchmark::canCountAllocs() { return false; }
+/* static */ u64 Benchmark::allocCount() { return 0; }
+/* static */ void Benchmark::setAllocCounting(bool) {}
+/* static */ void Benchmark::resetAllocCount() {}
+#endif
+
+/* static */
+bool Benchmark::parseArgs(const QStringList & args, Config & cfg, bool & ok)
+{
+	ok = true;
+	int i = args.indexOf("--benchmark");
+	if (i < 0) return false;
+	if (i+1 >= args.size() || args[i+1].startsWith("--")) {
+		std::cerr << "--benchmark requires a param file argument\n";
+		ok = false;
+		return true;
+	}
+	cfg.paramFile = args[i+1];
+	for (i = 1; i < args.size(); ++i) {
+		const QString & a (args[i]);
+		const bool hasVal = i+1 < args.size();
+		if (a == "--frames" && hasVal) cfg.frames = args[++i].toUInt(&ok);
+		else if (a == "--warmup" && hasVal) cfg.warmup = args[++i].toUInt(&ok);
+		else if (a == "--out" && hasVal) cfg.outFile = args[++i];
+		else if (a == "--set" && hasVal) {
+			cfg.overrides.push_back(args[++i]);
+			if (!cfg.overrides.back().contains("=")) ok = false;
+		}
+		if (!ok) {
+			std::cerr << "Bad value for benchmark option " << a.toUtf8().constData() << "\n";
+			return true;
+		}
+	}
+	if (!cfg.frames) cfg.frames = 1;
+	return true;
+}
+
+Benchmark::Benchmark(const Config & c, QObject *parent)
+	: QObject(parent), cfg(c), plugin(0), measuring(false), endedEarly(false), tStart(0.), tEnd(0.), nFrames(0), nAllocs(0)
+{
+}
+
+bool Benchmark::readParams()
+{
+	QFile f(cfg.paramFile);
+	if (!f.open(QIODevice::ReadOnly|QIODevice::Text)) {
+		Error() << "Benchmark: could not open param file `" << cfg.paramFile << "'";
+		return false;
+	}
+	QTextStream ts(&f);
+	QString line;
+	do {
+		line = ts.readLine().trimmed();
+	} while (!line.length() && !ts.atEnd());
+	pluginName = line;
+	prms.clear();
+	stimApp()->setParamsFromGlobalDefaults(prms);
+	prms.fromString(ts.readAll(), false);
+	if (cfg.overrides.size()) prms.fromString(cfg.overrides.join("\n"), false);
+	if (!pluginName.length()) {
+		Error() << "Benchmark: param file `" << cfg.paramFile << "' does not name a plugin";
+		return false;
+	}
+	return true;
+}
+
+void Benchmark::start()
+{
+	GLWindow *w = stimApp()->glWin();
+	plugin = w->pluginFind(pluginName);
+	if (!plugin) {
+		finish(QString("Plugin '") + pluginName + "' not found");
+		return;
+	}
+	{
+		GLWindow::RenderLock rl(w);
+		w->makeCurrent();
+		glRenderer = (const char *)glGetString(GL_RENDERER);
+		glVersion = (const char *)glGetString(GL_VERSION);
+	}
+	Log() << "Benchmark: " << pluginName << " on " << glRenderer << ", " << cfg.warmup << " warmup frames, " << cfg.frames << " measured frames";
+	plugin->setParams(prms);
+	if (!plugin->start(true)) {
+		plugin->stop();
+		finish(QString("Plugin '") + pluginName + "' failed to start");
+		return;
+	}
+	QTimer *t = new QTimer(this);
+	Connect(t, SIGNAL(timeout()), this, SLOT(poll()));
+	t->start(5);
+}
+
+void Benchmark::poll()
+{
+	GLWindow *w = stimApp()->glWin();
+	FrameTimeline::Snapshot s;
+	w->frameTimeline().snapshot(s, false); // may be rendering in another thread
+	const u64 n = s.hists[FrameTimeline::Total].count();
+	if (w->runningPlugin() != plugin) {
+		// plugin ran out of frames or loops before we were done
+		endedEarly = true;
+		if (!measuring) { finish(QString("Plugin '") + pluginName + "' stopped during warmup"); return; }
+		nFrames = n, nAllocs = allocCount(), tEnd = getTime();
+		finish();
+		return;
+	}
+	if (!measuring) {
+		if (n < cfg.warmup) return;
+		GLWindow::RenderLock rl(w);
+		w->frameTimeline().reset();
+		resetAllocCount();
+		setAllocCounting(true);
+		tStart = getTime();
+		measuring = true;
+	} else if (n >= cfg.frames) {
+		GLWindow::RenderLock rl(w);
+		tEnd = getTime();
+		nAllocs = allocCount();
+		nFrames = w->frameTimeline().histogram(FrameTimeline::Total).count();
+		setAllocCounting(false);
+		plugin->stop();
+		finish();
+	}
+}
+
+void Benchmark::finish(const QString & error)
+{
+	setAllocCounting(false);
+	QTimer *t = findChild<QTimer *>();
+	if (t) t->stop();
+	if (error.length()) Error() << "Benchmark: " << error;
+	const bool ok = writeReport(error) && !error.length();
+	stimApp()->exit(ok ? 0 : 1);
+}
+
+bool Benchmark::writeReport(const QString & error)
+{
+	QFile f;
+	if (cfg.outFile.length()) {
+		f.setFileName(cfg.outFile);
+		if (!f.open(QIODevice::WriteOnly|QIODevice::Truncate|QIODevice::Text)) {
+			Error() << "Benchmark: could not open `" << cfg.outFile << "' for writing";
+			return false;
+		}
+	} else if (!f.open(stdout, QIODevice::WriteOnly|QIODevice::Text)) {
+		return false;
+	}
+	FrameTimeline::Snapshot tl;
+	stimApp()->glWin()->frameTimeline().snapshot(tl, false);
+	const double secs = tEnd - tStart;
+	QTextStream ts(&f);
+	ts.setRealNumberNotation(QTextStream::FixedNotation);
+	ts.setRealNumberPrecision(3);
+	ts << "{\n"
+	   << "  \"plugin\": " << jsonStr(pluginName) << ",\n"
+	   << "  \"paramFile\": " << jsonStr(QFileInfo(cfg.paramFile).fileName()) << ",\n"
+	   << "  \"overrides\": [";
+	for (int i = 0; i < cfg.overrides.size(); ++i) ts << (i ? ", " : "") << jsonStr(cfg.overrides[i]);
+	ts << "],\n"
+	   << "  \"glRenderer\": " << jsonStr(glRenderer) << ",\n"
+	   << "  \"glVersion\": " << jsonStr(glVersion) << ",\n"
+	   << "  \"width\": " << stimApp()->glWin()->width() << ",\n"
+	   << "  \"height\": " << stimApp()->glWin()->height() << ",\n"
+	   << "  \"renderThread\": " << (stimApp()->isRenderThread() ? "true" : "false") << ",\n"
+	   << "  \"ok\": " << (error.length() ? "false" : "true") << ",\n";
+	if (error.length()) ts << "  \"error\": " << jsonStr(error) << ",\n";
+	ts << "  \"endedEarly\": " << (endedEarly ? "true" : "false") << ",\n"
+	   << "  \"warmupFrames\": " << cfg.warmup << ",\n"
+	   << "  \"frames\": " << nFrames << ",\n"
+	   << "  \"seconds\": " << secs << ",\n"
+	   << "  \"framesPerSec\": " << (secs > 0. ? double(nFrames)/secs : 0.) << ",\n";
+	// operator new calls only, see canCountAllocs().  null if not compiled in.
+	if (canCountAllocs())
+		ts << "  \"cppNewCalls\": " << nAllocs << ",\n"
+		   << "  \"cppNewCallsPerFrame\": " << (nFrames ? double(nAllocs)/double(nFrames) : 0.) << ",\n";
+	else
+		ts << "  \"cppNewCalls\": null,\n"
+		   << "  \"cppNewCallsPerFrame\": null,\n";
+	ts << "  \"peakRSSBytes\": " << getPeakRSS() << ",\n"
+	   << "  \"phases_us\": {";
+	for (int i = FrameTimeline::Start+1; i < FrameTimeline::N_Stats; ++i) {
+		const LatencyHistogram & h (tl.hists[i]);
+		ts << (i > FrameTimeline::Start+1 ? "," : "") << "\n    " << jsonStr(FrameTimeline::phaseName(i)) << ": {"
+		   << "\"count\": " << h.count()
+		   << ", \"p50\": " << h.percentile(50.)/1e3
+		   << ", \"p90\": " << h.percentile(90.)/1e3
+		   << ", \"p99\": " << h.percentile(99.)/1e3
+		   << ", \"p99.9\": " << h.percentile(99.9)/1e3
+		   << ", \"max\": " << h.max()/1e3 << "}";
+	}
+	ts << "\n  }\n}\n";
+	ts.flush();
+	if (f.error() != QFile::NoError) {
+		Error() << "Benchmark: error writing report: " << f.errorString();
+		return false;
+	}
+	if (cfg.outFile.length()) Log() << "Benchmark: wrote `" << cfg.outFile << "'";
+	return true;
+}
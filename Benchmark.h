@@ -0,0 +1,79 @@
+#ifndef Benchmark_H
+#define Benchmark_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include "StimParams.h"
+#include "TypeDefs.h"
+
+class StimPlugin;
+
+/** \brief Drives a plugin for the headless --benchmark mode.
+
+    Started by StimApp when the program is run as:
+
+      StimulateOpenGL_II --benchmark params.txt [--frames N] [--warmup N]
+                         [--out results.json] [--set name=value ...]
+
+    In this mode the console window, TCP server, refresh rate calibration and
+    realtime priority are all skipped and vsync is turned off, so the plugin
+    renders unthrottled.  The GLWindow still needs a GL context, so on a
+    machine without a display run it under a virtual X server with a software
+    renderer (eg: xvfb-run with Mesa llvmpipe), or with QT_QPA_PLATFORM=offscreen
+    on Qt builds whose offscreen platform provides OpenGL.
+
+    After the warmup frames the GLWindow::frameTimeline() is reset, N frames
+    are measured, the plugin is stopped and a JSON report with frames/s, the
+    per-phase frame time distributions, operator new call counts (only if
+    built with DEFINES += STIMGL_BENCH_ALLOCS, else null) and the peak RSS
+    is written.  The app then quits with exit status 0, or 1 on error.
+    See Benchmarks/run_benchmarks.sh for the canned suite. */
+class Benchmark : public QObject
+{
+	Q_OBJECT
+public:
+	struct Config {
+		QString paramFile, outFile; ///< outFile empty means stdout
+		unsigned frames, warmup;
+		QStringList overrides; ///< "name=value" strings from --set, applied after the param file
+		Config() : frames(1000), warmup(120) {}
+	};
+
+	/// Returns true if args contain --benchmark, in which case cfg is filled in. ok is set false on a malformed command line.
+	static bool parseArgs(const QStringList & args, Config & cfg, bool & ok);
+
+	Benchmark(const Config & cfg, QObject *parent = 0);
+
+	/// Reads the plugin name and params from the param file (on top of the global defaults) and applies the overrides.  Must be called before start().
+	bool readParams();
+	const StimParams & params() const { return prms; }
+
+	/// True if built with STIMGL_BENCH_ALLOCS, which replaces the global operator new/delete to count calls.  Otherwise allocCount() is always 0.
+	static bool canCountAllocs();
+	/// Number of operator new calls since the last resetAllocCount(), only counted while counting is enabled.  Qt's own (malloc) allocations are not counted.
+	static u64 allocCount();
+	static void setAllocCounting(bool on);
+	static void resetAllocCount();
+
+public slots:
+	/// Starts the plugin.  Called from the event loop once the GLWindow is up.
+	void start();
+
+private slots:
+	void poll();
+
+private:
+	void finish(const QString & error = QString());
+	bool writeReport(const QString & error);
+
+	Config cfg;
+	QString pluginName, glRenderer, glVersion;
+	StimParams prms;
+	StimPlugin *plugin;
+	bool measuring, endedEarly;
+	double tStart, tEnd;
+	u64 nFrames, nAllocs;
+};
+
+#endif
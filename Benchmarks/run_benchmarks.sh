@@ -0,0 +1,79 @@
+#!/bin/bash
+#
+# Runs the canned plugin benchmark suite with StimulateOpenGL_II --benchmark
+# and writes one JSON report per configuration into $BENCH_OUT (default:
+# ./bench_results).  Invoked by `make bench', or directly:
+#
+#   Benchmarks/run_benchmarks.sh path/to/StimulateOpenGL_II
+#
+# Environment:
+#   BENCH_FRAMES  measured frames per config (default 1000)
+#   BENCH_WARMUP  warmup frames per config (default 120)
+#   BENCH_OUT     output directory for the .json reports
+#   BENCH_FMV     .fmv movie for the Movie benchmark (skipped if unset)
+#   BENCH_GIF     .gif movie for the Movie benchmark (skipped if unset)
+#
+# With no $DISPLAY and no $QT_QPA_PLATFORM the runs go through xvfb-run, so
+# on a headless box this renders with Mesa's software rasterizer (llvmpipe).
+
+BIN="$1"
+if [ -z "$BIN" ] || [ ! -x "$BIN" ]; then
+	echo "usage: $0 <path to StimulateOpenGL_II binary>" 1>&2
+	exit 1
+fi
+
+DIR="$(cd "$(dirname "$0")" && pwd)"
+FRAMES="${BENCH_FRAMES:-1000}"
+WARMUP="${BENCH_WARMUP:-120}"
+OUT="${BENCH_OUT:-bench_results}"
+mkdir -p "$OUT" || exit 1
+
+RUN=()
+if [ -z "$DISPLAY" ] && [ -z "$QT_QPA_PLATFORM" ]; then
+	if ! which xvfb-run > /dev/null 2>&1; then
+		echo "No display and xvfb-run not found; set DISPLAY or QT_QPA_PLATFORM" 1>&2
+		exit 1
+	fi
+	RUN=(xvfb-run -a -s "-screen 0 1024x768x24")
+	export LIBGL_ALWAYS_SOFTWARE=1
+fi
+
+FAILED=0
+
+# bench <name> <config> [--set name=value ...]
+bench() {
+	local name="$1" cfg="$2"
+	shift 2
+	echo "== $name"
+	if ! "${RUN[@]}" "$BIN" --benchmark "$DIR/$cfg" --frames "$FRAMES" --warmup "$WARMUP" --out "$OUT/$name.json" "$@" > /dev/null 2> "$OUT/$name.log"; then
+		echo "   FAILED, see $OUT/$name.log" 1>&2
+		FAILED=1
+		return
+	fi
+	grep '"framesPerSec"' "$OUT/$name.json"
+}
+
+for gen in uniform gauss binary; do
+	for fps in single double triple; do
+		bench "checkerflicker_${gen}_${fps}" checkerflicker.txt --set rand_gen=$gen --set fps_mode=$fps
+	done
+done
+
+for n in 10 100 1000; do
+	bench "movingobjects_$n" movingobjects.txt --set numObj=$n
+done
+
+bench movinggrating movinggrating.txt
+
+if [ -n "$BENCH_FMV" ]; then
+	bench movie_fmv movie.txt --set "file=$BENCH_FMV"
+else
+	echo "== movie_fmv skipped, set BENCH_FMV to a .fmv file"
+fi
+if [ -n "$BENCH_GIF" ]; then
+	bench movie_gif movie.txt --set "file=$BENCH_GIF"
+else
+	echo "== movie_gif skipped, set BENCH_GIF to a .gif file"
+fi
+
+exit $FAILED
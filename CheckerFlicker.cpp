@@ -883,7 +883,7 @@ void CheckerFlicker::afterVSync(bool isSimulated)
     }
     // every 45 frames or so, update custom string
     if (frameNum > 0 && !(frameNum%45)) {
-        customStatusBarString.sprintf("Frame gen. %d ms  Avg. %d usec", lastFramegen, frameGenAvg_usec);
+        setSBString(QString().sprintf("Frame gen. %d ms  Avg. %d usec", lastFramegen, frameGenAvg_usec));
     }
 }
 
@@ -190,6 +190,8 @@ protected:
     void drawFrame();
     /// Informs FrameCreator threads to generate more frames and pops off 1 Frame from a FrameCreator queue and loads it onto the video board using FBO
     void afterVSync(bool isSimulated = false);
+    // NB: no canRenderAhead() -- the FrameCreator threads above already prerender, and the frames they made from the
+    // RNG stream can't be taken back, so the ring couldn't be flushed on a realtime param update.
     bool init();
 	unsigned initDelay(void); ///< reimplemented from superclass -- returns an init delay of 500ms
     void cleanup(); 
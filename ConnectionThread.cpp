@@ -3,6 +3,8 @@
 #include "StimApp.h"
 #include "GLWindow.h"
 #include "StimPlugin.h"
+#include "DAQ.h"
+#include "StimGL_SpikeGL_Integration.h"
 #include <QTcpSocket>
 #include <QHostAddress>
 #include <QRegExp>
@@ -353,8 +355,11 @@ QString ConnectionThread::processLine(QTcpSocket & sock,
         if (p && secs > 0.) {
             fskipsPerSec = p->getNumMissedFrames() / secs;
         }
-        strm << "missedFramesPerSec = " << fskipsPerSec << "\n"
-             << "saveDirectory = " << stimApp()->outputDirectory() << "\n"
+        strm << "missedFramesPerSec = " << fskipsPerSec << "\n";
+        stimApp()->glWin()->frameTimeline().writeStats(strm);
+        DAQ::WriteOutputStats(strm);
+        if (stimApp()->spikeGLNotifier()) stimApp()->spikeGLNotifier()->writeStats(strm);
+        strm << "saveDirectory = " << stimApp()->outputDirectory() << "\n"
              << "pluginList = ";
         QList<QString> plugins = stimApp()->glWin()->plugins();
         for (QList<QString>::const_iterator it = plugins.begin(); it != plugins.end(); ++it) {
@@ -37,12 +37,18 @@ ConsoleWindow::ConsoleWindow(QWidget *p, Qt::WindowFlags f)
 	action = m->addAction("&No Dropped Frame Warnings", stimApp(), SLOT(setNoDropFrameWarn(bool)));
     action->setCheckable(true);
     action->setChecked(stimApp()->isNoDropFrameWarn());
+	action = m->addAction("Render In Dedicated &Thread", stimApp(), SLOT(setRenderThread(bool)));
+	action->setCheckable(true);
+	action->setChecked(stimApp()->isRenderThread());
 	action = m->addAction("&Save Frame Vars", stimApp(), SLOT(setSaveFrameVars(bool)));
 	action->setCheckable(true);
 	action->setChecked(stimApp()->isSaveFrameVars());
 	action = m->addAction("Save Param &History", stimApp(), SLOT(setSaveParamHistory(bool)));
 	action->setCheckable(true);
 	action->setChecked(stimApp()->isSaveParamHistory());
+	action = m->addAction("Save Frame &Timing", stimApp(), SLOT(setSaveFrameTiming(bool)));
+	action->setCheckable(true);
+	action->setChecked(stimApp()->isSaveFrameTiming());
 	action = m->addAction("Dump Frames To Disk (SLOW!)", stimApp(), SLOT(setFrameDumpMode(bool)));
 	action->setCheckable(true);
 	action->setChecked(stimApp()->isFrameDumpMode());
@@ -21,7 +21,12 @@
 #include <QSet>
 #include <QMap>
 #include <QMutexLocker>
+#include <QSemaphore>
+#include <QWaitCondition>
+#include <QTextStream>
 #include "TypeDefs.h"
+#include "LockFreeQueue.h"
+#include "FrameTimeline.h"
 
 #define DAQ_TIMEOUT 2.5
 
@@ -308,88 +313,124 @@ namespace DAQ
 		
         DAQTaskDesc() : taskHandle(0), minv(0.), maxv(0.) {}
 	};
-	
-	typedef QMap<QString, DAQTaskDesc> ActiveDAQHandles;
-	
-	static ActiveDAQHandles activeAOHandles, activeDOHandles;
-	
-	static DAQTaskDesc FindAOHandle(const QString & devChan) 
+
+	static void ClearTask(DAQTaskDesc & dtd)
 	{
-		ActiveDAQHandles::iterator it = activeAOHandles.find(devChan);
-		if (it != activeAOHandles.end()) return it.value();
-		return DAQTaskDesc();
+		if (dtd.taskHandle) {
+			DAQmxStopTask(dtd.taskHandle);
+			DAQmxClearTask(dtd.taskHandle);
+			dtd.taskHandle = 0;
+		}
 	}
+#endif
 
-	static DAQTaskDesc FindDOHandle(const QString & devChan) 
+	/// An output channel registered with ResolveDO()/ResolveAO().  Registered channels are never removed, so ChanIds stay valid for the life of the process.
+	struct OutChan {
+		QString name; ///< set once when registered, then read without a lock
+		bool isAO; ///< ditto
+		bool haveLast; ///< iff true, `last' is the value the hardware currently has, used to coalesce redundant writes
+		bool scheduled; ///< iff true, the channel is owned by the hardware-timed output tasks and software writes are ignored
+		double last;
+#ifndef FAKEDAQ
+		DAQTaskDesc dtd; ///< guarded by hwMut
+#endif
+		OutChan() : isAO(false), haveLast(false), scheduled(false), last(0.) {}
+	};
+
+	enum { MaxOutChans = 256 };
+	static OutChan outChans[MaxOutChans];
+	static int nOutChans = 0;
+	/* Lock order is hwMut, then daqMut.  regMut is never held while taking another lock. */
+	static QMutex regMut; ///< guards nOutChans and the registration of outChans, so that resolving a channel never waits on the driver
+	static QMutex hwMut; ///< serializes the writes and everything else that calls into the NI driver, guards the NI tasks
+	static QMutex daqMut; ///< guards the coalescing and scheduled state of outChans, schedOut and the mock backend.  Never held across NI calls.
+
+	static bool mockOn = false;
+	static std::vector<MockWrite> mockWrites;
+	static unsigned nCoalesced = 0;
+
+	/// The FrameSchedule set up by SetupScheduledOutput()
+	struct ScheduledOutput {
+		FrameSchedule sched;
+		QString clockTerm;
+		bool running; ///< set up
+		volatile bool clocking; ///< between RunScheduledOutput() and HoldScheduledOutput(), read without the lock as a fast path
+#ifndef FAKEDAQ
+		TaskHandle doTask, aoTask;
+#endif
+		ScheduledOutput() : running(false), clocking(false)
+#ifndef FAKEDAQ
+		, doTask(0), aoTask(0)
+#endif
+		{}
+	};
+	static ScheduledOutput schedOut;
+	static volatile int curFrameNum = -1; ///< see SetFrameNum()
+
+	static void StopScheduledOutput_Locked();
+
+	static ChanId Resolve(const QString & devChan, bool isAO)
 	{
-		ActiveDAQHandles::iterator it = activeDOHandles.find(devChan);
-		if (it != activeDOHandles.end()) return it.value();
-		return DAQTaskDesc();
-	}
-	
-	static void ClearAOHandle(const QString & devChan) 
-	{
-		ActiveDAQHandles::iterator it = activeAOHandles.find(devChan);
-		if (it != activeAOHandles.end()) {
-			DAQTaskDesc & dtd = it.value();
-			if (dtd.taskHandle) {
-				DAQmxStopTask(dtd.taskHandle);
-				DAQmxClearTask(dtd.taskHandle);
-				dtd.taskHandle = 0;
-			}
-			activeAOHandles.erase(it);
+		if (!devChan.length() || devChan == "off") return -1;
+		QMutexLocker l(&regMut);
+		for (int i = 0; i < nOutChans; ++i)
+			if (outChans[i].isAO == isAO && outChans[i].name == devChan) return i;
+		if (nOutChans >= MaxOutChans) {
+			Error() << "DAQ: too many output channels, cannot register " << devChan;
+			return -1;
 		}
+		OutChan & c (outChans[nOutChans]);
+		c.name = devChan;
+		c.isAO = isAO;
+		return nOutChans++;
 	}
 
-	static void ClearDOHandle(const QString & devChan) 
+	ChanId ResolveDO(const QString & devChan) { return Resolve(devChan, false); }
+	ChanId ResolveAO(const QString & devChan) { return Resolve(devChan, true); }
+
+	/// Returns the channel registered as id, or 0 if there is none
+	static OutChan *FindChan(ChanId id)
 	{
-		ActiveDAQHandles::iterator it = activeDOHandles.find(devChan);
-		if (it != activeDOHandles.end()) {
-			DAQTaskDesc & dtd = it.value();
-			if (dtd.taskHandle) {
-				DAQmxStopTask(dtd.taskHandle);
-				DAQmxClearTask(dtd.taskHandle);
-				dtd.taskHandle = 0;
-			}
-			activeDOHandles.erase(it);
-		}
+		QMutexLocker l(&regMut);
+		return id >= 0 && id < nOutChans ? &outChans[id] : 0;
 	}
-	
-	void ResetDAQ() 
+
+	static int NumChans()
 	{
-        for (ActiveDAQHandles::iterator it = activeAOHandles.begin(); it != activeAOHandles.end(); ++it) {
-			DAQTaskDesc & dtd = it.value();			
-			if (dtd.taskHandle) {
-				DAQmxStopTask(dtd.taskHandle);
-				DAQmxClearTask(dtd.taskHandle);
-				dtd.taskHandle = 0;				
-			}
-		}
-        for (ActiveDAQHandles::iterator it = activeDOHandles.begin(); it != activeDOHandles.end(); ++it) {
-			DAQTaskDesc & dtd = it.value();
-			if (dtd.taskHandle) {
-				DAQmxStopTask(dtd.taskHandle);
-				DAQmxClearTask(dtd.taskHandle);
-				dtd.taskHandle = 0;				
-			}
-		}
-        activeAOHandles.clear();
-        activeDOHandles.clear();
+		QMutexLocker l(&regMut);
+		return nOutChans;
 	}
-#else
-	void ResetDAQ() { Debug() << "DAQ::ResetDAQ() called, unimplemented in FakeDAQ."; }
+
+	QString ChanName(ChanId id)
+	{
+		const OutChan *c = FindChan(id);
+		return c ? c->name : QString();
+	}
+
+	void ResetDAQ() 
+	{
+		AsyncFlush();
+		QMutexLocker h(&hwMut);
+		StopScheduledOutput_Locked();
+		const int n = NumChans();
+#ifndef FAKEDAQ
+		for (int i = 0; i < n; ++i) ClearTask(outChans[i].dtd);
 #endif
+		QMutexLocker l(&daqMut);
+		for (int i = 0; i < n; ++i) outChans[i].haveLast = false;
+	}
 	
 
 #define DEFAULT_DEV "Dev1"
 #define DEFAULT_DO 0
 
-
-    bool WriteDO(const QString & devChan, bool onoff, bool closeDevice)
+	/// Does the actual NI DO write.  Called with hwMut held.
+    static bool WriteDO_HW(OutChan & c, bool onoff, bool closeDevice)
     {
         QString tmp;
+		const QString & devChan (c.name);
 #ifdef FAKEDAQ
-        (void)devChan; (void)onoff; (void)closeDevice;
+        (void)onoff; (void)closeDevice;
 		tmp.sprintf("Writing to fake DO: %s data: %s", devChan.toUtf8().constData(), onoff ? "line_hi" : "line_lo");
         Debug() << tmp;
 		return true;
@@ -400,7 +441,7 @@ namespace DAQ
         // Task parameters
         int      error = 0;
         char        errBuff[2048];
-		DAQTaskDesc dtd = FindDOHandle(devChan);
+		DAQTaskDesc & dtd (c.dtd);
         TaskHandle   & taskHandle (dtd.taskHandle);
 		bool dontClose = false;		
         
@@ -408,8 +449,6 @@ namespace DAQ
         uint32      w_data [1];
 
 		if (!taskHandle) {
-			ClearDOHandle(devChan);
-			
 			// Create Digital Output (DO) Task and Channel
 			DAQmxErrChk (DAQmxCreateTask ("", &taskHandle));
 			DAQmxErrChk (DAQmxCreateDOChan(taskHandle,devChan.toUtf8().constData(),"",DAQmx_Val_ChanPerLine));
@@ -429,7 +468,7 @@ namespace DAQ
 
         DAQmxErrChk (DAQmxWriteDigitalScalarU32(taskHandle,1,DAQ_TIMEOUT,w_data[0],NULL));
 		
-		activeDOHandles[devChan] = dtd;    dontClose = true && !closeDevice;
+		dontClose = true && !closeDevice;
 
         tmp.sprintf("Writing to DO: %s data: 0x%X took %f ms", devChan.toUtf8().constData(),(unsigned int)w_data[0],(getTime()-t0)*1e3);
         Debug() << tmp;
@@ -441,12 +480,7 @@ namespace DAQ
             DAQmxGetExtendedErrorInfo (errBuff, 2048);
 
         if (taskHandle != 0 && !dontClose)
-            {
-                DAQmxStopTask (taskHandle);
-                DAQmxClearTask (taskHandle);
-				taskHandle = 0;
-				activeDOHandles.remove(devChan);
-            }
+			ClearTask(dtd);
 
         if (error) {
             QString e;
@@ -459,11 +493,37 @@ namespace DAQ
 #endif
     }
 		
-	bool WriteAO(const QString & devChan, double volts)
+#ifndef FAKEDAQ
+	/// Picks the narrowest AO range of the device for devChan that holds [lo,hi], or -5,5 if none does
+	static void PickAORange(const QString & devChan, double lo, double hi, double & minv, double & maxv)
+	{
+		static bool didProbe = false;
+		static DeviceRangeMap aoRanges;
+		
+		if (!didProbe) {
+			aoRanges = ProbeAllAORanges();
+			didProbe = true;
+		}
+		minv = -5.; maxv = 5.;
+		
+		bool foundRange = false;
+		
+		for (DeviceRangeMap::const_iterator it = aoRanges.begin(); it != aoRanges.end(); ++it) {
+			const Range & r = it.value();
+			if (devChan.startsWith(it.key()) && hi <= r.max && lo >= r.min)
+				if (!foundRange || r.max-r.min < maxv-minv)
+					minv = r.min, maxv = r.max, foundRange = true;
+		}
+	}
+#endif
+
+	/// Does the actual NI AO write.  Called with hwMut held.
+	static bool WriteAO_HW(OutChan & c, double volts)
     {
         QString tmp;
+		const QString & devChan (c.name);
 #ifdef FAKEDAQ
-		(void)devChan; (void)volts;
+		(void)volts;
 		tmp.sprintf("Writing to fake AO: %s data: %f", devChan.toUtf8().constData(), volts);
         Debug() << tmp;
 		return true;
@@ -473,29 +533,14 @@ namespace DAQ
 		// Task parameters
         int      error = 0;
         char        errBuff[2048];
-		DAQTaskDesc dtd = FindAOHandle(devChan);
+		DAQTaskDesc & dtd (c.dtd);
         TaskHandle   & taskHandle (dtd.taskHandle);
 		bool dontClose = false;
 		
 		if (!taskHandle || volts > dtd.maxv || volts < dtd.minv) {
-			ClearAOHandle(devChan);
-			static bool didProbe = false;
-			static DeviceRangeMap aoRanges;
-			
-			if (!didProbe) {
-				aoRanges = ProbeAllAORanges();
-				didProbe = true;
-			}
-			double & minv = (dtd.minv), & maxv(dtd.maxv);	minv = -5.; maxv = 5.;
-			
-			bool foundRange = false;
-			
-			for (DeviceRangeMap::const_iterator it = aoRanges.begin(); it != aoRanges.end(); ++it) {
-				const Range & r = it.value();
-				if (devChan.startsWith(it.key()) && volts <= r.max && volts >= r.min)
-					if (!foundRange || r.max-r.min < maxv-minv)
-						minv = r.min, maxv = r.max, foundRange = true;
-			}
+			ClearTask(dtd);
+			double & minv = (dtd.minv), & maxv(dtd.maxv);
+			PickAORange(devChan, volts, volts, minv, maxv);
 					
 			// Create Digital Output (DO) Task and Channel
 			DAQmxErrChk (DAQmxCreateTask ("", &taskHandle));
@@ -508,7 +553,7 @@ namespace DAQ
         //  Autostart ON				
         DAQmxErrChk (DAQmxWriteAnalogScalarF64(taskHandle,1,DAQ_TIMEOUT,float64(volts),NULL));
 		
-		activeAOHandles[devChan] = dtd;		dontClose = true;
+		dontClose = true;
 		
         tmp.sprintf("Writing to AO: %s data: %f took %f ms", devChan.toUtf8().constData(),volts,(getTime()-t0)*1e3);
         Debug() << tmp;
@@ -520,12 +565,7 @@ namespace DAQ
             DAQmxGetExtendedErrorInfo (errBuff, 2048);
 		
         if (taskHandle != 0 && !dontClose)
-		{
-			DAQmxStopTask (taskHandle);
-			DAQmxClearTask (taskHandle);
-			taskHandle = 0;
-			activeAOHandles.remove(devChan);
-		}
+			ClearTask(dtd);
 		
         if (error) {
             QString e;
@@ -537,7 +577,483 @@ namespace DAQ
 		return true;
 #endif
     }
-	
+
+	/// Writes value to channel id, either to the hardware or to the mock backend.  If coalesce, the write is skipped if the channel already has this value.  frame is only used by the mock backend.
+	static bool doWrite(ChanId id, double value, bool closeDevice, bool coalesce, int frame)
+	{
+		OutChan *cp = FindChan(id);
+		if (!cp) return false;
+		OutChan & c (*cp);
+		QMutexLocker h(&hwMut); // keeps the writes in order
+		{
+			QMutexLocker l(&daqMut);
+			if (c.scheduled) {
+				Debug() << "DAQ: ignoring software write to " << c.name << ", it is hardware-timed";
+				return false;
+			}
+			if (coalesce && c.haveLast && c.last == value) { ++nCoalesced; return true; }
+			if (mockOn) {
+				MockWrite w;
+				w.t = getTime();
+				w.chan = id;
+				w.isAO = c.isAO;
+				w.value = value;
+				w.frame = frame;
+				mockWrites.push_back(w);
+				c.haveLast = true;
+				c.last = value;
+				return true;
+			}
+		}
+		const bool ok = c.isAO ? WriteAO_HW(c, value) : WriteDO_HW(c, value != 0., closeDevice);
+		QMutexLocker l(&daqMut);
+		c.haveLast = ok;
+		c.last = value;
+		return ok;
+	}
+
+	/** The async output thread.  Writes are posted to a LockFreeQueue with the
+	    time they were queued, and done here in order, so the render thread
+	    never blocks on the NI driver. */
+	class OutputThread : public QThread
+	{
+	public:
+		OutputThread() : nOverflows(0), pleaseStop(0), nPosted(0), nDone(0) {}
+
+		void post(ChanId id, double value);
+		void flush() { waitDone(nPosted.load()); } ///< waits for all the writes posted so far
+		void stop() { flush(); pleaseStop.storeRelease(1); wake.release(); wait(); }
+
+		/// ns from post() to the write completing, copied under latMut
+		LatencyHistogram latency() const { QMutexLocker l(&latMut); return lat; }
+		QAtomicInt nOverflows;
+
+	protected:
+		void run();
+
+	private:
+		void waitDone(int n); ///< blocks until n writes have been retired
+		void retired(); ///< bumps nDone and wakes waitDone()
+
+		struct Cmd {
+			ChanId id;
+			double value;
+			u64 tQueued;
+			int frame;
+			Cmd() : id(-1), value(0.), tQueued(0), frame(-1) {}
+		};
+
+		QAtomicInt pleaseStop;
+		LockFreeQueue<Cmd, 1024> q;
+		QSemaphore wake;
+		/// Every post() takes the next sequence number from nPosted, and bumps nDone once its write is done -- by this
+		/// thread, or by post() itself if the queue was full.  So nDone only ever catches up with nPosted.
+		QAtomicInt nPosted, nDone;
+		QMutex doneMut; ///< taken by waitDone() around checking nDone, and by retired() to wake it, so no wakeup is lost
+		QWaitCondition doneCond;
+		mutable QMutex latMut; ///< a leaf lock, only held to add to or copy lat
+		LatencyHistogram lat;
+	};
+
+	void OutputThread::post(ChanId id, double value)
+	{
+		Cmd c;
+		c.id = id;
+		c.value = value;
+		c.tQueued = getAbsTimeNS();
+		c.frame = curFrameNum;
+		const int seq = nPosted.fetchAndAddOrdered(1) + 1;
+		if (!q.push(c)) {
+			// queue full -- wait for the writes posted before this one and write synchronously, which keeps the writes in order
+			nOverflows.ref();
+			waitDone(seq - 1);
+			doWrite(id, value, false, true, c.frame);
+			retired();
+			return;
+		}
+		wake.release();
+	}
+
+	void OutputThread::retired()
+	{
+		nDone.ref();
+		QMutexLocker l(&doneMut);
+		doneCond.wakeAll();
+	}
+
+	void OutputThread::waitDone(int n)
+	{
+		QMutexLocker l(&doneMut);
+		while (int(nDone.load() - n) < 0) doneCond.wait(&doneMut);
+	}
+
+	void OutputThread::run()
+	{
+		while (!pleaseStop.loadAcquire()) {
+			if (wake.tryAcquire(1, 100)) {
+				const int n = wake.available();
+				if (n > 0) wake.tryAcquire(n);
+			}
+			Cmd c;
+			while (q.pop(c)) {
+				doWrite(c.id, c.value, false, true, c.frame);
+				{
+					QMutexLocker l(&latMut);
+					lat.add(getAbsTimeNS() - c.tQueued);
+				}
+				retired();
+			}
+		}
+	}
+
+	static OutputThread *outThread = 0;
+
+	void StartOutputThread()
+	{
+		if (outThread) return;
+		outThread = new OutputThread;
+		outThread->start(QThread::TimeCriticalPriority);
+	}
+
+	void StopOutputThread()
+	{
+		if (!outThread) return;
+		outThread->stop();
+		delete outThread, outThread = 0;
+	}
+
+	void AsyncFlush() { if (outThread) outThread->flush(); }
+
+	void AsyncWriteDO(ChanId id, bool onoff)
+	{
+		if (outThread) outThread->post(id, onoff ? 1. : 0.);
+		else doWrite(id, onoff ? 1. : 0., false, true, curFrameNum);
+	}
+
+	void AsyncWriteAO(ChanId id, double volts)
+	{
+		if (outThread) outThread->post(id, volts);
+		else doWrite(id, volts, false, true, curFrameNum);
+	}
+
+	bool WriteDO(ChanId id, bool onoff)
+	{
+		AsyncFlush();
+		return doWrite(id, onoff ? 1. : 0., false, false, curFrameNum);
+	}
+
+	bool WriteAO(ChanId id, double volts)
+	{
+		AsyncFlush();
+		return doWrite(id, volts, false, false, curFrameNum);
+	}
+
+    bool WriteDO(const QString & devChan, bool onoff, bool closeDevice)
+    {
+		const ChanId id = ResolveDO(devChan);
+		if (id < 0) {
+			Error() << "DAQ::WriteDO: invalid DO channel `" << devChan << "'";
+			return false;
+		}
+		AsyncFlush();
+		return doWrite(id, onoff ? 1. : 0., closeDevice, false, curFrameNum);
+    }
+		
+	bool WriteAO(const QString & devChan, double volts)
+    {
+		const ChanId id = ResolveAO(devChan);
+		if (id < 0) {
+			Error() << "DAQ::WriteAO: invalid AO channel `" << devChan << "'";
+			return false;
+		}
+		return WriteAO(id, volts);
+    }
+
+	void WriteOutputStats(QTextStream & strm)
+	{
+		unsigned coalesced;
+		{
+			QMutexLocker l(&daqMut);
+			coalesced = nCoalesced;
+		}
+		strm << "daqOut_coalesced = " << coalesced << "\n"
+			 << "daqOut_overflows = " << (outThread ? outThread->nOverflows.load() : 0) << "\n";
+		if (!outThread) return;
+		const LatencyHistogram h (outThread->latency()); // a copy, the output thread keeps adding to it
+		strm << "daqOut_latency_count = " << h.count() << "\n"
+			 << "daqOut_latency_p50_us = " << h.percentile(50.)/1e3 << "\n"
+			 << "daqOut_latency_p99_us = " << h.percentile(99.)/1e3 << "\n"
+			 << "daqOut_latency_p99.9_us = " << h.percentile(99.9)/1e3 << "\n"
+			 << "daqOut_latency_max_us = " << h.max()/1e3 << "\n";
+	}
+
+	bool FrameSchedule::operator==(const FrameSchedule & o) const
+	{
+		if (nFrames != o.nFrames || repeat != o.repeat || frameRate != o.frameRate || chans.size() != o.chans.size()) return false;
+		for (int i = 0; i < chans.size(); ++i)
+			if (chans[i].id != o.chans[i].id || chans[i].values != o.chans[i].values) return false;
+		return true;
+	}
+
+	/// Called with hwMut held
+	static void StopScheduledOutput_Locked()
+	{
+		if (!schedOut.running) return;
+#ifndef FAKEDAQ
+		if (schedOut.doTask) { DAQmxStopTask(schedOut.doTask); DAQmxClearTask(schedOut.doTask); schedOut.doTask = 0; }
+		if (schedOut.aoTask) { DAQmxStopTask(schedOut.aoTask); DAQmxClearTask(schedOut.aoTask); schedOut.aoTask = 0; }
+#endif
+		QMutexLocker l(&daqMut);
+		schedOut.clocking = false;
+		for (int i = 0; i < schedOut.sched.chans.size(); ++i) {
+			OutChan & c (outChans[schedOut.sched.chans[i].id]);
+			c.scheduled = false;
+			c.haveLast = false; // the line is left at whatever the schedule last output
+		}
+		schedOut.running = false;
+		Debug() << "DAQ: scheduled output stopped";
+	}
+
+	void StopScheduledOutput()
+	{
+		QMutexLocker h(&hwMut);
+		StopScheduledOutput_Locked();
+	}
+
+	bool IsScheduledOutputRunning()
+	{
+		QMutexLocker l(&daqMut);
+		return schedOut.running;
+	}
+
+#ifndef FAKEDAQ
+	/// Indices into s.chans of the DO (isAO false) or AO channels
+	static std::vector<int> ScheduleChans(const FrameSchedule & s, bool isAO)
+	{
+		std::vector<int> idx;
+		for (int i = 0; i < s.chans.size(); ++i)
+			if (outChans[s.chans[i].id].isAO == isAO) idx.push_back(i);
+		return idx;
+	}
+
+	/// Creates and commits the buffered task for the DO (isAO false) or AO channels of the schedule, without starting it.  Returns 0 on error.
+	static TaskHandle CreateScheduleTask(const FrameSchedule & s, bool isAO, const QString & clockTerm)
+	{
+		const char *callStr = "";
+		int error = 0;
+		char errBuff[2048];
+		TaskHandle taskHandle = 0;
+		const std::vector<int> idx (ScheduleChans(s, isAO));
+		if (idx.empty()) return 0;
+		const int nF = s.nFrames, nC = int(idx.size());
+
+		DAQmxErrChk (DAQmxCreateTask ("", &taskHandle));
+		for (int i = 0; i < nC; ++i) {
+			const FrameSchedule::Chan & sc (s.chans[idx[i]]);
+			const QString & devChan (outChans[sc.id].name);
+			if (isAO) {
+				double lo = 0., hi = 0., minv, maxv;
+				for (int f = 0; f < nF; ++f) lo = MIN(lo, sc.values[f]), hi = MAX(hi, sc.values[f]);
+				PickAORange(devChan, lo, hi, minv, maxv);
+				DAQmxErrChk (DAQmxCreateAOVoltageChan(taskHandle,devChan.toUtf8().constData(),"",minv,maxv,DAQmx_Val_Volts,NULL));
+			} else
+				DAQmxErrChk (DAQmxCreateDOChan(taskHandle,devChan.toUtf8().constData(),"",DAQmx_Val_ChanPerLine));
+		}
+		// one sample per rising edge of the frame signal, regenerating the buffer every nFrames*repeat edges
+		DAQmxErrChk (DAQmxCfgSampClkTiming(taskHandle,clockTerm.toUtf8().constData(),s.frameRate,DAQmx_Val_Rising,DAQmx_Val_ContSamps,uInt64(nF*s.repeat)));
+		DAQmxErrChk (DAQmxSetWriteRegenMode(taskHandle,DAQmx_Val_AllowRegen));
+		// the slow part (reserving the lines and routing the clock) happens here rather than on the first frame
+		DAQmxErrChk (DAQmxTaskControl(taskHandle,DAQmx_Val_Task_Commit));
+		return taskHandle;
+
+	Error_Out:
+		DAQmxGetExtendedErrorInfo (errBuff, 2048);
+		if (taskHandle) DAQmxClearTask (taskHandle);
+		if (!noDaqErrPrint)
+			Error() << "DAQmx Error " << error << " in " << callStr << ": " << errBuff;
+		return 0;
+	}
+
+	/// Fills the (stopped) task's buffer starting at frame firstFrame of the schedule, and starts it.  Returns false on error.
+	static bool StartScheduleTask(TaskHandle taskHandle, const FrameSchedule & s, bool isAO, int firstFrame)
+	{
+		const char *callStr = "";
+		int error = 0;
+		char errBuff[2048];
+		const std::vector<int> idx (ScheduleChans(s, isAO));
+		const int nF = s.nFrames, nR = s.repeat, nS = nF*nR, nC = int(idx.size());
+		int32 written = 0;
+
+		DAQmxErrChk (DAQmxSetWriteRelativeTo(taskHandle,DAQmx_Val_FirstSample));
+		DAQmxErrChk (DAQmxSetWriteOffset(taskHandle,0));
+		if (isAO) {
+			std::vector<float64> buf(nS*nC);
+			for (int i = 0; i < nC; ++i)
+				for (int k = 0; k < nS; ++k) buf[i*nS + k] = s.chans[idx[i]].values[(firstFrame + k/nR) % nF];
+			DAQmxErrChk (DAQmxWriteAnalogF64(taskHandle,nS,0,DAQ_TIMEOUT,DAQmx_Val_GroupByChannel,&buf[0],&written,NULL));
+		} else {
+			std::vector<uInt8> buf(nS*nC);
+			for (int i = 0; i < nC; ++i)
+				for (int k = 0; k < nS; ++k) buf[i*nS + k] = s.chans[idx[i]].values[(firstFrame + k/nR) % nF] != 0. ? 1 : 0;
+			DAQmxErrChk (DAQmxWriteDigitalLines(taskHandle,nS,0,DAQ_TIMEOUT,DAQmx_Val_GroupByChannel,&buf[0],&written,NULL));
+		}
+		DAQmxErrChk (DAQmxStartTask(taskHandle));
+		return true;
+
+	Error_Out:
+		DAQmxGetExtendedErrorInfo (errBuff, 2048);
+		DAQmxStopTask (taskHandle);
+		if (!noDaqErrPrint)
+			Error() << "DAQmx Error " << error << " in " << callStr << ": " << errBuff;
+		return false;
+	}
+#endif
+
+	bool SetupScheduledOutput(const FrameSchedule & s, const QString & clockTerm)
+	{
+		AsyncFlush();
+		QMutexLocker h(&hwMut); // schedOut.sched and the tasks only change with both locks held, so either is enough to read them
+		{
+			QMutexLocker l(&daqMut);
+			if (schedOut.running && schedOut.sched == s && schedOut.clockTerm == clockTerm) return true;
+		}
+		StopScheduledOutput_Locked();
+		if (s.nFrames <= 0 || s.repeat <= 0 || !s.chans.size()) {
+			Error() << "DAQ: empty output schedule";
+			return false;
+		}
+		bool haveDO = false, haveAO = false;
+		const int nChans = NumChans();
+		for (int i = 0; i < s.chans.size(); ++i) {
+			const FrameSchedule::Chan & sc (s.chans[i]);
+			if (sc.id < 0 || sc.id >= nChans || sc.values.size() != s.nFrames) {
+				Error() << "DAQ: output schedule channel " << i << " is invalid or does not have " << s.nFrames << " values";
+				return false;
+			}
+			OutChan & c (outChans[sc.id]);
+			(c.isAO ? haveAO : haveDO) = true;
+#ifndef FAKEDAQ
+			ClearTask(c.dtd); // the line can only belong to one task
+#endif
+		}
+		const bool mock = IsMockBackend();
+		{
+			QMutexLocker l(&daqMut);
+			schedOut.sched = s;
+			schedOut.clockTerm = clockTerm;
+			schedOut.clocking = false;
+		}
+#ifndef FAKEDAQ
+		if (!mock) {
+			if (haveDO && !(schedOut.doTask = CreateScheduleTask(s, false, clockTerm))) return false;
+			if (haveAO && !(schedOut.aoTask = CreateScheduleTask(s, true, clockTerm))) {
+				if (schedOut.doTask) { DAQmxClearTask(schedOut.doTask); schedOut.doTask = 0; }
+				return false;
+			}
+		}
+#else
+		(void)haveDO; (void)haveAO;
+		if (!mock) Debug() << "DAQ: scheduled output is emulated in FakeDAQ";
+#endif
+		QMutexLocker l(&daqMut);
+		for (int i = 0; i < s.chans.size(); ++i) outChans[s.chans[i].id].scheduled = true;
+		schedOut.running = true;
+		Debug() << "DAQ: scheduled output of " << s.chans.size() << " channels x " << s.nFrames << " frames, clocked by " << clockTerm;
+		return true;
+	}
+
+	void RunScheduledOutput(unsigned frameNum)
+	{
+		if (schedOut.clocking) return;
+		QMutexLocker h(&hwMut);
+		if (!schedOut.running || schedOut.clocking) return;
+		const int first = int(frameNum % unsigned(schedOut.sched.nFrames));
+#ifndef FAKEDAQ
+		if ((schedOut.doTask && !StartScheduleTask(schedOut.doTask, schedOut.sched, false, first))
+			|| (schedOut.aoTask && !StartScheduleTask(schedOut.aoTask, schedOut.sched, true, first))) {
+			Error() << "DAQ: could not start scheduled output, stopping it";
+			StopScheduledOutput_Locked();
+			return;
+		}
+#endif
+		QMutexLocker l(&daqMut);
+		schedOut.clocking = true;
+		Debug() << "DAQ: scheduled output clocking from frame " << frameNum << " (sample " << first << ")";
+	}
+
+	void HoldScheduledOutput()
+	{
+		QMutexLocker h(&hwMut);
+		if (!schedOut.clocking) return;
+#ifndef FAKEDAQ
+		if (schedOut.doTask) DAQmxStopTask(schedOut.doTask);
+		if (schedOut.aoTask) DAQmxStopTask(schedOut.aoTask);
+#endif
+		QMutexLocker l(&daqMut);
+		schedOut.clocking = false;
+	}
+
+	void ScheduledOutputTick(unsigned frameNum)
+	{
+		QMutexLocker l(&daqMut);
+		if (!schedOut.running || !schedOut.clocking || !mockOn) return;
+		const FrameSchedule & s (schedOut.sched);
+		const int sample = int(frameNum % unsigned(s.nFrames));
+		const double t = getTime();
+		for (int i = 0; i < s.chans.size(); ++i) {
+			MockWrite w;
+			w.t = t;
+			w.chan = s.chans[i].id;
+			w.isAO = outChans[w.chan].isAO;
+			w.value = s.chans[i].values[sample];
+			w.sample = sample;
+			w.frame = int(frameNum);
+			mockWrites.push_back(w);
+		}
+	}
+
+	void SetFrameNum(int frameNum) { curFrameNum = frameNum; }
+
+	void SetMockBackend(bool on)
+	{
+		AsyncFlush();
+		const int n = NumChans();
+		QMutexLocker l(&daqMut);
+		mockOn = on;
+		for (int i = 0; i < n; ++i) outChans[i].haveLast = false;
+	}
+
+	bool IsMockBackend() { QMutexLocker l(&daqMut); return mockOn; }
+
+	std::vector<MockWrite> MockTakeWrites()
+	{
+		AsyncFlush();
+		QMutexLocker l(&daqMut);
+		std::vector<MockWrite> ret;
+		ret.swap(mockWrites);
+		return ret;
+	}
+
+	bool MockSaveCSV(const QString & fn)
+	{
+		const std::vector<MockWrite> writes (MockTakeWrites());
+		QFile f(fn);
+		const bool isNew = !f.exists() || !f.size();
+		if (!f.open(QIODevice::WriteOnly|QIODevice::Append|QIODevice::Text)) {
+			Error() << "Could not open mock DAQ output file " << fn << " for writing.";
+			return false;
+		}
+		QTextStream ts(&f);
+		ts.setRealNumberNotation(QTextStream::FixedNotation);
+		ts.setRealNumberPrecision(6);
+		if (isNew) ts << "time_s,channel,type,value,sample,frame\n";
+		for (std::vector<MockWrite>::const_iterator it = writes.begin(); it != writes.end(); ++it)
+			ts << it->t << "," << ChanName(it->chan) << "," << (it->isAO ? "AO" : "DO") << "," << it->value << "," << it->sample << "," << it->frame << "\n";
+		ts.flush();
+		Log() << "Saved " << writes.size() << " mock DAQ writes to " << fn;
+		return true;
+	}
+
 
 
     TermConfig StringToTermConfig(const QString & txt) 
@@ -637,6 +1153,27 @@ extern "C" {
 		if (func) return func(taskHandle);
 		return DAQmxErrorRequiredDependencyNotFound;
 	}
+
+	int32 __CFUNC  DAQmxStartTask (TaskHandle taskHandle) {
+		static int32 (__CFUNC  *func) (TaskHandle) = 0;
+		DAQ::tryLoadFunc(func, "DAQmxStartTask");
+		if (func) return func(taskHandle);
+		return DAQmxErrorRequiredDependencyNotFound;
+	}
+
+	int32 __CFUNC DAQmxCfgSampClkTiming (TaskHandle taskHandle, const char source[], float64 rate, int32 activeEdge, int32 sampleMode, uInt64 sampsPerChan) {
+		static int32 (__CFUNC *func) (TaskHandle, const char *, float64, int32, int32, uInt64) = 0;
+		DAQ::tryLoadFunc(func, "DAQmxCfgSampClkTiming");
+		if (func) return func(taskHandle, source, rate, activeEdge, sampleMode, sampsPerChan);
+		return DAQmxErrorRequiredDependencyNotFound;
+	}
+
+	int32 __CFUNC DAQmxWriteDigitalLines (TaskHandle taskHandle, int32 numSampsPerChan, bool32 autoStart, float64 timeout, bool32 dataLayout, const uInt8 writeArray[], int32 *sampsPerChanWritten, bool32 *reserved) {
+		static int32 (__CFUNC *func) (TaskHandle, int32, bool32, float64, bool32, const uInt8 *, int32 *, bool32 *) = 0;
+		DAQ::tryLoadFunc(func, "DAQmxWriteDigitalLines");
+		if (func) return func(taskHandle, numSampsPerChan, autoStart, timeout, dataLayout, writeArray, sampsPerChanWritten, reserved);
+		return DAQmxErrorRequiredDependencyNotFound;
+	}
 	
 	int32 __CFUNC DAQmxCreateDOChan (TaskHandle taskHandle, const char lines[], const char nameToAssignToLines[], int32 lineGrouping) {
 		static int32 (__CFUNC *func)(TaskHandle, const char *, const char *, int32 lineGrouping) = 0;
@@ -11,6 +11,7 @@
 #include <QStringList>
 #include <QVector>
 #include <QPair>
+#include <QTextStream>
 #ifdef HAVE_NIDAQmx
 #include "NI/NIDAQmx.h"
 #endif
@@ -80,7 +81,93 @@ namespace DAQ
 	
 	bool WriteAO(const QString & devChanName, double volts);
 	
-	void ResetDAQ(); ///< Call this to re-initialize the DAQ subsystem.  Typically before a plugin starts.  Currently just closes all open AO handles.
+	void ResetDAQ(); ///< Call this to re-initialize the DAQ subsystem.  Typically before a plugin starts.  Flushes pending async writes and closes all open AO/DO handles.
+
+    //-------- Pre-resolved channels and the async output thread -------------
+
+    /// Integer handle for an output channel, so that per-frame writes don't look up channel name strings.  Negative means invalid/none.
+    typedef int ChanId;
+
+    /// Returns the ChanId for a DO channel name such as "Dev1/port0/line0", registering it if it's new.  Returns -1 for an empty name or "off".  Call at plugin init, not per frame.
+    ChanId ResolveDO(const QString & devChan);
+    /// Returns the ChanId for an AO channel name such as "Dev1/ao0", registering it if it's new.  Returns -1 for an empty name or "off".
+    ChanId ResolveAO(const QString & devChan);
+    /// Returns the channel name for a ChanId
+    QString ChanName(ChanId id);
+
+    /// Synchronous writes by ChanId.  These first wait for any queued async writes to complete, so ordering is preserved.
+    bool WriteDO(ChanId id, bool hi_lo);
+    bool WriteAO(ChanId id, double volts);
+
+    /// Queues a timestamped write for the output thread and returns immediately.  Writes of the value a channel already has are coalesced away.  Falls back to a synchronous write if the output thread isn't running.  Safe to call from any thread.
+    void AsyncWriteDO(ChanId id, bool hi_lo);
+    void AsyncWriteAO(ChanId id, double volts);
+    /// Blocks until all async writes queued so far have been done
+    void AsyncFlush();
+
+    void StartOutputThread(); ///< called by StimApp at startup
+    void StopOutputThread(); ///< flushes and stops the output thread, called by StimApp at exit
+
+    /// Writes the async output queue-to-hardware latency percentiles, as key = value lines, for the GETSTATS command
+    void WriteOutputStats(QTextStream & strm);
+
+    //-------- Hardware-timed output -------------
+
+    /// The per-frame DO/AO values for one loop cycle, declared by a plugin up front (see StimPlugin::outputSchedule())
+    struct FrameSchedule {
+        struct Chan {
+            ChanId id; ///< from ResolveDO() or ResolveAO()
+            QVector<double> values; ///< one per frame, volts for AO, 0 or 1 for DO
+            Chan() : id(-1) {}
+        };
+        int nFrames; ///< length of the cycle, which repeats until StopScheduledOutput().  Frame f outputs values[f % nFrames].
+        int repeat; ///< clock edges per frame (the plugin's Nblinks), each frame's values are held for this many edges
+        double frameRate; ///< expected frame rate in Hz, the maximum rate of the sample clock
+        QVector<Chan> chans;
+        FrameSchedule() : nFrames(0), repeat(1), frameRate(120.) {}
+        bool operator==(const FrameSchedule & o) const;
+    };
+
+    /** Sets up the schedule on buffered tasks (one for the DO, one for the AO
+        channels) whose sample clock is the frame signal wired to clockTerm, for
+        example the vsync or frame-track photodiode signal on "/Dev1/PFI0".
+        Nothing is output until RunScheduledOutput(), after which each rising
+        edge outputs the next frame's values, so output timing no longer depends
+        on the render thread.  Software writes to the scheduled channels are
+        ignored from now on.  If the same schedule is already set up it is left
+        as it is.  Returns false on error, in which case nothing is scheduled. */
+    bool SetupScheduledOutput(const FrameSchedule & s, const QString & clockTerm);
+    /// Starts clocking out the schedule such that the next edge outputs frame frameNum, unless it's already being clocked.  Called by the plugin right before a frame is swapped in.
+    void RunScheduledOutput(unsigned frameNum);
+    /// Stops clocking (the lines keep their values) until the next RunScheduledOutput(), so that frames which don't advance frameNum, eg while paused, don't advance the schedule.
+    void HoldScheduledOutput();
+    void StopScheduledOutput(); ///< also done by ResetDAQ()
+    bool IsScheduledOutputRunning(); ///< true if set up, whether it's being clocked or held
+    /// Called by GLWindow after the swap, once per displayed frame frameNum.  Only does anything for the mock backend, where it stands in for the sample clock and records the frame's samples.
+    void ScheduledOutputTick(unsigned frameNum);
+
+    //-------- Mock backend -------------
+
+    /// One recorded output write.  t is Util::getTime() at the time the write would have hit the hardware.
+    struct MockWrite {
+        double t;
+        ChanId chan;
+        bool isAO;
+        double value; ///< volts for AO, 0 or 1 for DO
+        int sample; ///< index into the FrameSchedule for hardware-timed output, -1 for software writes
+        int frame; ///< the plugin frame this write belongs to, see SetFrameNum(), -1 if none
+        MockWrite() : t(0.), chan(-1), isAO(false), value(0.), sample(-1), frame(-1) {}
+    };
+
+    /// When on, no NI calls are made for DO/AO writes.  Instead every write that would have been done is recorded with a timestamp, for testing output timing without hardware.
+    void SetMockBackend(bool on);
+    bool IsMockBackend();
+    /// Returns and clears the writes recorded so far by the mock backend
+    std::vector<MockWrite> MockTakeWrites();
+    /// Appends the recorded writes to a CSV file (time_s,channel,type,value,sample,frame) and clears them.  Returns false on error.
+    bool MockSaveCSV(const QString & fileName);
+    /// Called by GLWindow before drawing plugin frame frameNum: writes queued from now on are recorded as belonging to it.  -1 for none.
+    void SetFrameNum(int frameNum);
 	
     /// returns true iff the device supports AI simultaneous sampling
     bool     SupportsAISimultaneousSampling(const QString & devname);
@@ -7,8 +7,30 @@
  *
  */
 #include "FastMovieFormat.h"
+#include "FastMovieThreads.h"
 #include <stdlib.h>
 #include <errno.h>
+#include <deque>
+#include <map>
+
+#if defined(_WIN32) || defined(WIN32)
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#else
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+#if defined(__SSE4_2__)
+#  include <nmmintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define FM_HAVE_SSE2
+#endif
 
 #ifdef NO_QT
 #include <zlib.h>
@@ -60,7 +82,7 @@ static __int64 fseeko (FILE * f, __int64 offset, int origin) { return _lseeki64(
  WRITE/OUTPUT FUNCTIONS
  -----------------------------------------------------------------------------*/
 /// returns NULL on error, creates a new fmv file for output on success and returns ptr to context
-FM_Context * FM_Create(const char *filename)
+FM_Context * FM_Create(const char *filename, unsigned bufferBytes, unsigned checkpointFrames)
 {
 	FILE *f = fopen(filename, "w+b");
 	if (!f) return 0;
@@ -69,6 +91,11 @@ FM_Context * FM_Create(const char *filename)
 	c->isOutput = true;
 	c->imgOffsets.clear();
 	c->imgOffsets.reserve(16);
+	c->checkpointFrames = checkpointFrames;
+	if (bufferBytes) {
+		c->writeBuf.resize(bufferBytes);
+		setvbuf(f, &c->writeBuf[0], _IOFBF, bufferBytes);
+	}
 	
 	FM_Header h;
 	memset(&h, 0, sizeof(h));
@@ -76,35 +103,67 @@ FM_Context * FM_Create(const char *filename)
 	if ( fwrite(&h, sizeof(h), 1, c->file) != 1 ) {
 		delete c;
 		c = 0;
-	}
+	} else
+		c->writePos = sizeof(h);
 	return c;
 }
-/// returns true on success
-bool         FM_AddFrame(FM_Context *c, const void *pixels, 
-						 unsigned width, unsigned height, 
-						 unsigned compressionLevel,
-						 unsigned depth, FM_Fmt fmt, 
-						 bool comp, unsigned duration_ms)
+
+/// (re)writes the header of an output file and goes back to the end.  indexRecordOffset 0 means not finalized
+static bool WriteHeader(FM_Context *c, uint64_t indexRecordOffset)
+{
+	FM_Header h;
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, FM_MAGIC_STR, strlen(FM_MAGIC_STR));
+	h.nFrames = uint32_t(c->imgOffsets.size());
+	h.width = c->width;
+	h.height = c->height;
+	h.indexRecordOffset = indexRecordOffset;
+	if (indexRecordOffset && c->crcs.size() == c->imgOffsets.size()) h.flags |= FM_HAS_CRC32C;
+	const bool ok = !fseeko(c->file, 0, SEEK_SET) 
+		            && fwrite(&h, sizeof(h), 1, c->file) == 1
+		            && !fseeko(c->file, c->writePos, SEEK_SET);
+	return ok;
+}
+
+/// flush + header update, without waiting for the encoder (which may be the caller)
+static bool Checkpoint(FM_Context *c)
+{
+	c->framesSinceCheckpoint = 0;
+	// flush the frames first, so the header never claims frames that aren't on disk yet
+	return !fflush(c->file) && WriteHeader(c, 0) && !fflush(c->file);
+}
+
+bool         FM_Checkpoint(FM_Context *c)
+{
+	if (!c || !c->file || !c->isOutput) return false;
+	if (c->enc && !FM_FlushEncoder(c)) return false;
+	return Checkpoint(c);
+}
+
+/// a frame on its way to the file: its descriptor and its (possibly compressed) pixels
+struct FM_Frame
 {
-	if (!c || !c->file || !c->isOutput || !width || !height || !depth) return false;
-	
-	//off_t savedOff = ftello(c->file);
-	fseeko(c->file, 0, SEEK_END);
-	int64_t imgoffset = ftello(c->file);
-	if (c->imgOffsets.capacity() == c->imgOffsets.size()) {
-		c->imgOffsets.reserve(c->imgOffsets.capacity()*2);
-	}
-	c->imgOffsets.push_back(static_cast<uint64_t>(imgoffset));
-	
 	FM_ImageDescriptor desc;
-	memset(&desc, 0, sizeof(desc));
-	desc.magic = FM_IMAGE_DESCRIPTOR_MAGIC;
-	desc.width = width;
-	desc.height = height;
-	desc.comp = comp ? 1 : 0;
-	desc.duration = duration_ms;
-	desc.fmt = fmt;
-	
+	const void *data;
+	uint32_t crc; ///< of desc + data
+	unsigned pixelSize, tileWidth, tileHeight; ///< tile size only for FM_ZLib_Tiled_Comp
+	std::vector<uint8_t> tiled; ///< the tile table and tiles, for FM_ZLib_Tiled_Comp
+#ifdef NO_QT
+	void *compressed;
+	FM_Frame() : data(0), crc(0), pixelSize(0), tileWidth(0), tileHeight(0), compressed(0) { memset(&desc, 0, sizeof(desc)); }
+	~FM_Frame() { if (compressed) free(compressed); }
+#else
+	QByteArray compressed;
+	FM_Frame() : data(0), crc(0), pixelSize(0), tileWidth(0), tileHeight(0) { memset(&desc, 0, sizeof(desc)); }
+#endif
+};
+
+/// fills in f.desc and returns the size of the uncompressed pixels, or 0 if the frame is invalid
+static unsigned PrepareFrame(FM_Frame & f, unsigned width, unsigned height, unsigned depth,
+							 FM_Fmt fmt, bool comp, unsigned duration_ms, 
+							 unsigned tileWidth = 0, unsigned tileHeight = 0)
+{
+	if (!width || !height) return 0;
 	int pixsz = 1;
 	switch (depth) {
 		case 32: ++pixsz; 
@@ -113,61 +172,311 @@ bool         FM_AddFrame(FM_Context *c, const void *pixels,
 		case 8:
 			break;
 		default:
-			//fseeko(c->file, savedOff, SEEK_SET);
-			return false;
+			return 0;
 	}
-	
-#ifndef NO_QT
-	QByteArray d;
-#endif
-	void *data = (void *)pixels;
-	unsigned datasz = width*height*pixsz;
-	if (comp) {
-		data = 0;
+	f.desc.magic = FM_IMAGE_DESCRIPTOR_MAGIC;
+	f.desc.width = width;
+	f.desc.height = height;
+	f.desc.comp = comp ? FM_ZLib_Comp : FM_No_Comp;
+	f.desc.duration = duration_ms;
+	f.desc.fmt = fmt;
+	f.pixelSize = pixsz;
+	if (comp && tileWidth && tileHeight && (width > tileWidth || height > tileHeight)) {
+		f.desc.comp = FM_ZLib_Tiled_Comp;
+		f.tileWidth = tileWidth;
+		f.tileHeight = tileHeight;
+	}
+	return width*height*pixsz;
+}
+
+/// zlib compresses n bytes the way qCompress() does (size prefix and all) and appends them to out
+static bool CompressAppend(const void *in, unsigned n, unsigned compressionLevel, std::vector<uint8_t> & out)
+{
 #ifdef NO_QT
-		zCompress(pixels, datasz, compressionLevel, &data, &datasz);
+	void *z = 0;
+	unsigned zlen = 0;
+	zCompress(in, n, compressionLevel, &z, &zlen);
+	if (!z) return false;
+	out.insert(out.end(), (const uint8_t *)z, (const uint8_t *)z + zlen);
+	free(z);
 #else
-		d = qCompress((uchar *)pixels, datasz, compressionLevel);
-		data = (void *)d.constData();
-		if (!data) {
-			return false;
+	const QByteArray z = qCompress((const uchar *)in, int(n), int(compressionLevel));
+	if (z.isEmpty()) return false;
+	out.insert(out.end(), (const uint8_t *)z.constData(), (const uint8_t *)z.constData() + z.size());
+#endif
+	return true;
+}
+
+/// builds f.tiled: the FM_TileTable, the tile offsets, then each tile compressed on its own
+static bool EncodeTiles(FM_Frame & f, const uint8_t *pixels, unsigned compressionLevel)
+{
+	const unsigned w = f.desc.width, h = f.desc.height, tw = f.tileWidth, th = f.tileHeight, bpp = f.pixelSize;
+	const unsigned nx = (w + tw - 1) / tw, ny = (h + th - 1) / th, n = nx*ny;
+	FM_TileTable t;
+	t.magic = FM_TILE_TABLE_MAGIC;
+	t.tileWidth = tw;
+	t.tileHeight = th;
+	t.bytesPerPixel = bpp;
+	t.nTiles = n;
+	std::vector<uint32_t> offs(n+1, 0);
+	const size_t tableBytes = sizeof(t) + offs.size()*sizeof(uint32_t);
+	std::vector<uint8_t> & out = f.tiled;
+	out.assign(tableBytes, 0);
+	std::vector<uint8_t> tile;
+	for (unsigned ty = 0, i = 0; ty < ny; ++ty) {
+		for (unsigned tx = 0; tx < nx; ++tx, ++i) {
+			const unsigned x0 = tx*tw, y0 = ty*th, 
+			               cw = w - x0 < tw ? w - x0 : tw, ch = h - y0 < th ? h - y0 : th;
+			tile.resize(size_t(cw)*ch*bpp);
+			for (unsigned y = 0; y < ch; ++y)
+				memcpy(&tile[size_t(y)*cw*bpp], pixels + (size_t(y0+y)*w + x0)*bpp, size_t(cw)*bpp);
+			if (!CompressAppend(&tile[0], unsigned(tile.size()), compressionLevel, out)) return false;
+			if (out.size() - tableBytes > 0xffffffffUL) return false;
+			offs[i+1] = uint32_t(out.size() - tableBytes);
 		}
-		datasz = d.size();
+	}
+	memcpy(&out[0], &t, sizeof(t));
+	memcpy(&out[sizeof(t)], &offs[0], offs.size()*sizeof(uint32_t));
+	return true;
+}
+
+/// points f.data at the pixels to write, compressing them first if f.desc.comp.  Returns false on error
+static bool EncodeFrame(FM_Frame & f, const void *pixels, unsigned datasz, unsigned compressionLevel)
+{
+	f.data = pixels;
+	if (f.desc.comp == FM_ZLib_Tiled_Comp) {
+		if (!EncodeTiles(f, (const uint8_t *)pixels, compressionLevel)) return false;
+		f.data = &f.tiled[0];
+		datasz = unsigned(f.tiled.size());
+	} else if (f.desc.comp) {
+		f.data = 0;
+#ifdef NO_QT
+		zCompress(pixels, datasz, compressionLevel, &f.compressed, &datasz);
+		f.data = f.compressed;
+#else
+		f.compressed = qCompress((const uchar *)pixels, datasz, compressionLevel);
+		f.data = (const void *)f.compressed.constData();
+		datasz = f.compressed.size();
 #endif
-		
+		if (!f.data) return false;
 	}
-	bool ret = false;
-	desc.length = datasz;
-	if ( data 
-		 && fwrite(&desc, sizeof(desc), 1, c->file) == 1 
-		 && (!datasz || fwrite(data, datasz, 1, c->file) == 1) ) {
-		// update header .. tell it how many images we have
-		fseeko(c->file, 0, SEEK_SET);
-		if (c->width < width || c->height < height) {
-			c->width = width;
-			c->height = height;
+	f.desc.length = datasz;
+	f.crc = FM_CRC32C(FM_CRC32C(0, &f.desc, sizeof(f.desc)), f.data, datasz);
+	return true;
+}
+
+/// writes an encoded frame at the end of the file
+static bool AppendFrame(FM_Context *c, const FM_Frame & f)
+{
+	const unsigned datasz = f.desc.length;
+	if ( fwrite(&f.desc, sizeof(f.desc), 1, c->file) == 1 
+		 && (!datasz || fwrite(f.data, datasz, 1, c->file) == 1) ) {
+		// the header is only brought up to date at checkpoints and in FM_Close()
+		c->imgOffsets.push_back(c->writePos);
+		c->crcs.push_back(f.crc);
+		c->writePos += sizeof(f.desc) + datasz;
+		if (c->width < f.desc.width || c->height < f.desc.height) {
+			c->width = f.desc.width;
+			c->height = f.desc.height;
 		}		
-		FM_Header h;
-		if ( fread(&h, sizeof(h), 1, c->file) == 1 ) {
-            h.nFrames = uint32_t(c->imgOffsets.size());
-			h.width = c->width;
-			h.height = c->height;
-			fseeko(c->file, 0, SEEK_SET);
-			fwrite(&h, sizeof(h), 1, c->file);
-		}
-		ret = true;
+		if (c->checkpointFrames && ++c->framesSinceCheckpoint >= c->checkpointFrames)
+			return Checkpoint(c);
+		return true;
 	}
+	// a short write leaves a partial frame at the end, start over from the last good frame
+	fseeko(c->file, c->writePos, SEEK_SET);
+	return false;
+}
+
+/// returns true on success
+bool         FM_AddFrame(FM_Context *c, const void *pixels, 
+						 unsigned width, unsigned height, 
+						 unsigned compressionLevel,
+						 unsigned depth, FM_Fmt fmt, 
+						 bool comp, unsigned duration_ms)
+{
+	if (!c || !c->file || !c->isOutput || !pixels) return false;
+	if (c->enc) 
+		return FM_SubmitFrame(c, pixels, width, height, compressionLevel, depth, fmt, comp, duration_ms);
 	
-#ifdef NO_QT
-	if (comp) {
-		free(data);
-		data = 0;
-	}
-#endif
+	FM_Frame f;
+	const unsigned datasz = PrepareFrame(f, width, height, depth, fmt, comp, duration_ms, c->tileWidth, c->tileHeight);
+	return datasz 
+	       && EncodeFrame(f, pixels, datasz, compressionLevel) 
+	       && AppendFrame(c, f);
+}
+
+bool         FM_SetTileSize(FM_Context *c, unsigned tileWidth, unsigned tileHeight)
+{
+	if (!c || !c->isOutput || !tileWidth != !tileHeight) return false;
+	// frames already submitted to the encoder keep the tile size they were submitted with
+	c->tileWidth = tileWidth;
+	c->tileHeight = tileHeight;
+	return true;
+}
+
+/*-----------------------------------------------------------------------------
+ MULTITHREADED ENCODER
+ -----------------------------------------------------------------------------*/
+/** Worker threads pop jobs off the queue and compress them, the sequencer
+    thread picks finished jobs out of the done map strictly in submission 
+    order and appends them.  inFlight counts the bytes held by all jobs not
+    yet written (raw pixels until compressed, then the compressed size). */
+struct FM_Encoder
+{
+	struct Job {
+		uint64_t seq;
+		FM_Frame frame;
+		std::vector<char> pixels;
+		unsigned compressionLevel;
+		size_t cost; ///< what this job currently counts against the budget
+		bool ok;
+	};
 	
-	//fseeko(c->file, savedOff, SEEK_SET);
+	FM_Context *c;
+	FM_Mutex mut;
+	FM_Cond workCond, doneCond, roomCond;
+	std::deque<Job *> queue;
+	std::map<uint64_t, Job *> done;
+	uint64_t nSubmitted, nWritten;
+	size_t inFlight, budget;
+	bool quit, failed;
+	std::vector<FM_Thread *> workers;
+	FM_Thread *sequencer;
 	
-	return ret;
+	static void workerThread(void *arg);
+	static void sequencerThread(void *arg);
+};
+
+void FM_Encoder::workerThread(void *arg)
+{
+	FM_Encoder *e = (FM_Encoder *)arg;
+	for (;;) {
+		e->mut.lock();
+		while (!e->quit && e->queue.empty()) e->workCond.wait(e->mut);
+		if (e->queue.empty()) { e->mut.unlock(); return; } // quit
+		Job *j = e->queue.front();
+		e->queue.pop_front();
+		e->mut.unlock();
+		
+		j->ok = EncodeFrame(j->frame, &j->pixels[0], unsigned(j->pixels.size()), j->compressionLevel);
+		size_t newCost = j->cost;
+		if (j->frame.desc.comp) {
+			// the raw pixels aren't needed anymore, only the compressed ones
+			std::vector<char>().swap(j->pixels);
+			newCost = j->ok ? j->frame.desc.length : 0;
+		}
+		
+		e->mut.lock();
+		e->inFlight = e->inFlight - j->cost + newCost;
+		j->cost = newCost;
+		e->done[j->seq] = j;
+		e->doneCond.wakeOne();
+		e->roomCond.wakeAll();
+		e->mut.unlock();
+	}
+}
+
+void FM_Encoder::sequencerThread(void *arg)
+{
+	FM_Encoder *e = (FM_Encoder *)arg;
+	e->mut.lock();
+	for (;;) {
+		std::map<uint64_t, Job *>::iterator it;
+		while ( (it = e->done.find(e->nWritten)) == e->done.end() ) {
+			if (e->quit && e->nWritten == e->nSubmitted) { e->mut.unlock(); return; }
+			e->doneCond.wait(e->mut);
+		}
+		Job *j = it->second;
+		e->done.erase(it);
+		const bool skip = e->failed;
+		e->mut.unlock();
+		
+		// once a frame failed, later ones are dropped so the file never has a gap in it
+		const bool ok = !skip && j->ok && AppendFrame(e->c, j->frame);
+		
+		e->mut.lock();
+		if (!ok) e->failed = true;
+		e->inFlight -= j->cost;
+		++e->nWritten;
+		e->roomCond.wakeAll();
+		delete j;
+	}
+}
+
+bool         FM_StartEncoder(FM_Context *c, unsigned nThreads, unsigned maxInFlightMB)
+{
+	if (!c || !c->file || !c->isOutput) return false;
+	if (c->enc) return true;
+	if (!nThreads) nThreads = FM_NumCPUs();
+	FM_Encoder *e = new FM_Encoder;
+	e->c = c;
+	e->nSubmitted = e->nWritten = 0;
+	e->inFlight = 0;
+	e->budget = size_t(maxInFlightMB ? maxInFlightMB : 1) * 1024 * 1024;
+	e->quit = e->failed = false;
+	for (unsigned i = 0; i < nThreads; ++i)
+		e->workers.push_back(new FM_Thread(FM_Encoder::workerThread, e));
+	e->sequencer = new FM_Thread(FM_Encoder::sequencerThread, e);
+	c->enc = e;
+	return true;
+}
+
+bool         FM_SubmitFrame(FM_Context *c, const void *pixels, 
+							unsigned width, unsigned height, 
+							unsigned compressionLevel,
+							unsigned depth, FM_Fmt fmt, 
+							bool comp, unsigned duration_ms)
+{
+	if (!c || !c->enc) return FM_AddFrame(c, pixels, width, height, compressionLevel, depth, fmt, comp, duration_ms);
+	if (!pixels) return false;
+	FM_Encoder *e = c->enc;
+	FM_Encoder::Job *j = new FM_Encoder::Job;
+	const unsigned datasz = PrepareFrame(j->frame, width, height, depth, fmt, comp, duration_ms, c->tileWidth, c->tileHeight);
+	if (!datasz) { delete j; return false; }
+	j->compressionLevel = compressionLevel;
+	j->ok = false;
+	j->cost = datasz;
+	
+	FM_Locker l(e->mut);
+	// a single frame bigger than the whole budget still goes through, on its own
+	while (!e->failed && e->inFlight && e->inFlight + datasz > e->budget) e->roomCond.wait(e->mut);
+	if (e->failed) { delete j; return false; }
+	e->mut.unlock(); // copying the pixels doesn't need the lock
+	j->pixels.assign((const char *)pixels, (const char *)pixels + datasz);
+	e->mut.lock();
+	j->seq = e->nSubmitted++;
+	e->inFlight += j->cost;
+	e->queue.push_back(j);
+	e->workCond.wakeOne();
+	return true;
+}
+
+bool         FM_FlushEncoder(FM_Context *c)
+{
+	if (!c || !c->enc) return c != 0;
+	FM_Encoder *e = c->enc;
+	FM_Locker l(e->mut);
+	while (e->nWritten < e->nSubmitted) e->roomCond.wait(e->mut);
+	return !e->failed;
+}
+
+/// writes out everything still pending and stops all the encoder's threads
+static bool StopEncoder(FM_Context *c)
+{
+	FM_Encoder *e = c->enc;
+	if (!e) return true;
+	const bool ok = FM_FlushEncoder(c);
+	e->mut.lock();
+	e->quit = true;
+	e->workCond.wakeAll();
+	e->doneCond.wakeAll();
+	e->mut.unlock();
+	for (size_t i = 0; i < e->workers.size(); ++i) delete e->workers[i]; // joins
+	delete e->sequencer;
+	c->enc = 0;
+	delete e;
+	return ok;
 }
 
 static bool Reindex(FM_Context *c, unsigned nframes, void *arg = 0, FM_ProgressFn prog = 0, std::string *errmsg = 0)
@@ -252,6 +561,7 @@ FM_Context * FM_Open(const char *filename, std::string *errmsg, bool rebuildInde
 	c->imgOffsets.reserve(h.nFrames);
 	c->width = h.width;
 	c->height = h.height;
+	c->indexRecordOffset = h.indexRecordOffset;
     
     { // figure out file size
         off_t savedOff = ftello(f);
@@ -305,6 +615,11 @@ FM_Context * FM_Open(const char *filename, std::string *errmsg, bool rebuildInde
 			delete c;
 			return 0;
 		}
+		if ( (h.flags & FM_HAS_CRC32C) && h.nFrames && ir.checksumsLength == h.nFrames*sizeof(uint32_t) ) {
+			c->crcs.resize(h.nFrames);
+			// missing checksums don't make the frames unreadable, just unverifiable
+			if ( fread(&c->crcs[0], sizeof(uint32_t), h.nFrames, f) != h.nFrames ) c->crcs.clear();
+		}
 	}
 	return c;
 }
@@ -323,6 +638,127 @@ bool         FM_IsFMV(const char *filename)
 	return ret;
 }
 
+namespace {
+	/// a tiled frame's FM_TileTable and tile offsets, checked against its descriptor
+	struct TileLayout
+	{
+		FM_TileTable t;
+		unsigned width, height, nx, ny;
+		uint64_t dataLength; ///< of the tiles, following the offsets
+		std::vector<uint32_t> offs;
+		
+		/// validates the table, and makes room for the offsets, which the caller reads in next
+		bool init(const FM_ImageDescriptor & d, const FM_TileTable & table) {
+			t = table;
+			width = d.width, height = d.height;
+			if (t.magic != FM_TILE_TABLE_MAGIC || !t.tileWidth || !t.tileHeight 
+				|| !t.bytesPerPixel || t.bytesPerPixel > 4 || !width || !height) return false;
+			nx = (width + t.tileWidth - 1) / t.tileWidth;
+			ny = (height + t.tileHeight - 1) / t.tileHeight;
+			if (uint64_t(nx)*ny != t.nTiles || tableBytes() > d.length) return false;
+			dataLength = d.length - tableBytes();
+			offs.resize(t.nTiles+1);
+			return true;
+		}
+		uint64_t tableBytes() const { return sizeof(t) + (uint64_t(t.nTiles)+1)*sizeof(uint32_t); }
+		/// call after the offsets are read
+		bool offsetsOk() const {
+			if (offs[0]) return false;
+			for (unsigned i = 0; i < t.nTiles; ++i) if (offs[i+1] < offs[i]) return false;
+			return offs[t.nTiles] <= dataLength;
+		}
+		/// the tiles that intersect the rectangle x,y,w,h are tx0..tx1 x ty0..ty1, inclusive
+		void tileRange(unsigned x, unsigned y, unsigned w, unsigned h, unsigned & tx0, unsigned & ty0, unsigned & tx1, unsigned & ty1) const {
+			tx0 = x / t.tileWidth, tx1 = (x + w - 1) / t.tileWidth;
+			ty0 = y / t.tileHeight, ty1 = (y + h - 1) / t.tileHeight;
+		}
+	};
+	
+	/** Decompresses the tiles that intersect x,y,w,h into out, w*h pixels with 
+	    no row padding.  The tiles to do are dealt out to the threads in turn. */
+	struct TileJob
+	{
+		const TileLayout *l;
+		const uint8_t *data; ///< the tile data from offset base on
+		uint32_t base;
+		unsigned x, y, w, h;
+		uint8_t *out;
+		std::vector<unsigned> tiles;
+		unsigned stride;
+		
+		struct Part { TileJob *job; unsigned first; bool ok; };
+		
+		bool decode(unsigned i, std::vector<uint8_t> & buf) const {
+			const unsigned tw = l->t.tileWidth, th = l->t.tileHeight, bpp = l->t.bytesPerPixel;
+			const unsigned x0 = (i % l->nx)*tw, y0 = (i / l->nx)*th,
+			               cw = l->width - x0 < tw ? l->width - x0 : tw, ch = l->height - y0 < th ? l->height - y0 : th;
+			const unsigned len = cw*ch*bpp, n = l->offs[i+1] - l->offs[i];
+			const uint8_t *src = data + (l->offs[i] - base);
+#ifdef NO_QT
+			if (n <= 4 || ((uint32_t(src[0]) << 24) | (src[1] << 16) | (src[2] << 8) | src[3]) != len) return false;
+			if (buf.size() < len) buf.resize(len);
+			unsigned long dl = len;
+			if (::uncompress(&buf[0], &dl, src+4, n-4) != Z_OK || dl != len) return false;
+			const uint8_t *pix = &buf[0];
+#else
+			(void)buf;
+			const QByteArray u = qUncompress(src, int(n));
+			if (unsigned(u.size()) != len) return false;
+			const uint8_t *pix = (const uint8_t *)u.constData();
+#endif
+			// just the part inside the rectangle
+			const unsigned ix0 = x0 > x ? x0 : x, ix1 = x0 + cw < x + w ? x0 + cw : x + w,
+			               iy0 = y0 > y ? y0 : y, iy1 = y0 + ch < y + h ? y0 + ch : y + h;
+			for (unsigned yy = iy0; yy < iy1; ++yy)
+				memcpy(out + (size_t(yy - y)*w + (ix0 - x))*bpp, pix + (size_t(yy - y0)*cw + (ix0 - x0))*bpp, size_t(ix1 - ix0)*bpp);
+			return true;
+		}
+		
+		static void run(void *arg) {
+			Part *p = (Part *)arg;
+			const TileJob *j = p->job;
+			std::vector<uint8_t> buf; ///< reused for all of this thread's tiles
+			for (size_t k = p->first; p->ok && k < j->tiles.size(); k += j->stride)
+				p->ok = j->decode(j->tiles[k], buf);
+		}
+	};
+}
+
+/// decodes the tiles intersecting x,y,w,h.  data holds the tile data from byte base on, far enough for all of them
+static bool DecodeTiles(const TileLayout & l, const uint8_t *data, uint32_t base, 
+						unsigned x, unsigned y, unsigned w, unsigned h, uint8_t *out, unsigned nThreads)
+{
+	TileJob j;
+	j.l = &l; j.data = data; j.base = base;
+	j.x = x; j.y = y; j.w = w; j.h = h;
+	j.out = out;
+	unsigned tx0, ty0, tx1, ty1;
+	l.tileRange(x, y, w, h, tx0, ty0, tx1, ty1);
+	for (unsigned ty = ty0; ty <= ty1; ++ty)
+		for (unsigned tx = tx0; tx <= tx1; ++tx)
+			j.tiles.push_back(ty*l.nx + tx);
+	if (!nThreads) nThreads = FM_NumCPUs();
+	if (nThreads > j.tiles.size()) nThreads = unsigned(j.tiles.size());
+	j.stride = nThreads;
+	
+	std::vector<TileJob::Part> parts(nThreads);
+	for (unsigned k = 0; k < nThreads; ++k) {
+		TileJob::Part p = { &j, k, true };
+		parts[k] = p;
+	}
+	// the calling thread takes the first share itself
+	std::vector<FM_Thread *> threads;
+	for (unsigned k = 1; k < nThreads; ++k)
+		threads.push_back(new FM_Thread(TileJob::run, &parts[k]));
+	TileJob::run(&parts[0]);
+	bool ok = true;
+	for (unsigned k = 0; k < nThreads; ++k) {
+		if (k) delete threads[k-1]; // joins
+		ok = ok && parts[k].ok;
+	}
+	return ok;
+}
+
 /// read a frame from the .fmv file
 FM_Image * FM_ReadFrame(FM_Context *c, unsigned frame_id /* first frame is frame 0 */, std::string *errmsg, int *cfs)
 {
@@ -351,6 +787,10 @@ FM_Image * FM_ReadFrame(FM_Context *c, unsigned frame_id /* first frame is frame
 		if (errmsg) *errmsg = std::string("Frame ") + frame_idstr + ": cannot read frame descriptor or frame descriptor corrupt.";
 		delete ret; 
 		ret = 0;
+	} else if (ret->desc.comp == FM_ZLib_Tiled_Comp) {
+		const unsigned w = ret->desc.width, h = ret->desc.height;
+		delete ret;
+		ret = FM_ReadFrameRect(c, frame_id, 0, 0, w, h, 1, errmsg, cfs);
 	} else {		
 #ifdef NO_QT
 		ret->data = (uint8_t *)malloc(ret->desc.length);
@@ -407,7 +847,383 @@ FM_Image * FM_ReadFrame(FM_Context *c, unsigned frame_id /* first frame is frame
 	return ret;
 }
 
+FM_Image *   FM_ReadFrameRect(FM_Context *c, unsigned frame_id, unsigned x, unsigned y, unsigned w, unsigned h,
+							  unsigned nThreads, std::string *errmsg, int *cfs)
+{
+	char frame_idstr[32];
+	sprintf(frame_idstr, "%u", frame_id);
+	
+	if (!c || c->isOutput || frame_id >= c->imgOffsets.size()) {
+		if (errmsg) *errmsg = std::string("Frame ") + frame_idstr + ": context invalid or requested frame exceeds number of frames in file.";
+		return 0;
+	}
+	if ( fseeko(c->file, c->imgOffsets[frame_id], SEEK_SET) ) {
+		if (errmsg) *errmsg = std::string("Frame ") + frame_idstr + ": seek error.";
+		return 0;
+	}
+	FM_ImageDescriptor desc;
+	if ( fread(&desc, sizeof(desc), 1, c->file) != 1 || desc.magic != FM_IMAGE_DESCRIPTOR_MAGIC ) {
+		if (errmsg) *errmsg = std::string("Frame ") + frame_idstr + ": cannot read frame descriptor or frame descriptor corrupt.";
+		return 0;
+	}
+	if (x >= desc.width || y >= desc.height || !w || !h) {
+		if (errmsg) *errmsg = std::string("Frame ") + frame_idstr + ": requested rectangle is outside the frame.";
+		return 0;
+	}
+	if (w > desc.width - x) w = desc.width - x;
+	if (h > desc.height - y) h = desc.height - y;
+	
+	if (desc.comp != FM_ZLib_Tiled_Comp) {
+		// a single blob, all of it has to be decompressed anyway
+		FM_Image *img = FM_ReadFrame(c, frame_id, errmsg, cfs);
+		if (!img || (!x && !y && w == desc.width && h == desc.height)) return img;
+		const size_t bpp = img->desc.length / (size_t(desc.width)*desc.height);
+#ifdef NO_QT
+		uint8_t *p = img->data;
+#else
+		uint8_t *p = (uint8_t *)img->data.data();
+#endif
+		for (unsigned r = 0; r < h; ++r)
+			memmove(p + r*w*bpp, p + ((size_t(y)+r)*desc.width + x)*bpp, w*bpp);
+		img->desc.width = w;
+		img->desc.height = h;
+		img->desc.length = unsigned(w*h*bpp);
+#ifndef NO_QT
+		img->data.resize(int(img->desc.length));
+#endif
+		return img;
+	}
+	
+	if ( cfs ) {
+		int64_t nextImgOff = ((frame_id+1) < c->imgOffsets.size()) ? c->imgOffsets[frame_id+1] : c->fileLengthBytes;
+		*cfs = nextImgOff - int64_t(c->imgOffsets[frame_id]);
+	}
+	FM_TileTable t;
+	TileLayout l;
+	if ( fread(&t, sizeof(t), 1, c->file) != 1 || !l.init(desc, t)
+		 || fread(&l.offs[0], sizeof(uint32_t), l.offs.size(), c->file) != l.offs.size() || !l.offsetsOk() ) {
+		if (errmsg) *errmsg = std::string("Frame ") + frame_idstr + ": tile table corrupt. File corrupt?";
+		return 0;
+	}
+	// the tiles needed are in one span of the file, from the first to the last one
+	unsigned tx0, ty0, tx1, ty1;
+	l.tileRange(x, y, w, h, tx0, ty0, tx1, ty1);
+	const uint32_t spanStart = l.offs[ty0*l.nx + tx0], spanEnd = l.offs[ty1*l.nx + tx1 + 1];
+	std::vector<uint8_t> span(size_t(spanEnd - spanStart) + 1);
+	if ( fseeko(c->file, spanStart, SEEK_CUR) || fread(&span[0], spanEnd - spanStart, 1, c->file) != 1 ) {
+		if (errmsg) *errmsg = std::string("Frame ") + frame_idstr + ": failed to read image data.";
+		return 0;
+	}
+	
+	FM_Image *ret = new FM_Image;
+	ret->desc = desc;
+	ret->desc.width = w;
+	ret->desc.height = h;
+	ret->desc.comp = FM_No_Comp;
+	ret->desc.length = w*h*t.bytesPerPixel;
+#ifdef NO_QT
+	ret->data = (uint8_t *)malloc(ret->desc.length);
+	uint8_t *out = ret->data;
+#else
+	ret->data.resize(int(ret->desc.length));
+	uint8_t *out = ret->data.size() == int(ret->desc.length) ? (uint8_t *)ret->data.data() : 0;
+#endif
+	if (!out) {
+		if (errmsg) *errmsg = std::string("Frame ") + frame_idstr + ": out of memory for image data.";
+		delete ret;
+		return 0;
+	}
+	if (!DecodeTiles(l, &span[0], spanStart, x, y, w, h, out, nThreads)) {
+		if (errmsg) *errmsg = std::string("Frame ") + frame_idstr + ": error decompressing image data. File corrupt?";
+		delete ret;
+		return 0;
+	}
+	return ret;
+}
+
 bool FM_CheckForErrors(const char *filename, void *arg, FM_ProgressFn pfun, FM_ErrorFn efun)
+{
+	return FM_Verify(filename, 0, false, arg, pfun, efun);
+}
+
+/*-----------------------------------------------------------------------------
+ VERIFICATION
+ -----------------------------------------------------------------------------*/
+namespace {
+	/// slicing-by-8 tables for the reflected Castagnoli polynomial, built at load time
+	struct CRC32CTables {
+		uint32_t t[8][256];
+		CRC32CTables() {
+			for (unsigned i = 0; i < 256; ++i) {
+				uint32_t c = i;
+				for (int k = 0; k < 8; ++k) c = (c >> 1) ^ (0x82F63B78U & (0U - (c & 1U)));
+				t[0][i] = c;
+			}
+			for (unsigned i = 0; i < 256; ++i)
+				for (int k = 1; k < 8; ++k) t[k][i] = (t[k-1][i] >> 8) ^ t[0][t[k-1][i] & 0xff];
+		}
+	};
+	const CRC32CTables crcTables;
+}
+
+uint32_t     FM_CRC32C(uint32_t crc, const void *data, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)data;
+	crc = ~crc;
+#if defined(__SSE4_2__)
+	// the crc32 instruction computes exactly this
+	for ( ; len && (size_t(p) & 7); --len) crc = _mm_crc32_u8(crc, *p++);
+#  if defined(__x86_64__)
+	uint64_t c64 = crc;
+	for ( ; len >= 8; len -= 8, p += 8) c64 = _mm_crc32_u64(c64, *(const uint64_t *)p);
+	crc = uint32_t(c64);
+#  else
+	for ( ; len >= 4; len -= 4, p += 4) crc = _mm_crc32_u32(crc, *(const uint32_t *)p);
+#  endif
+	for ( ; len; --len) crc = _mm_crc32_u8(crc, *p++);
+#else
+	const uint32_t (*t)[256] = crcTables.t;
+	for ( ; len && (size_t(p) & 7); --len) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+	for ( ; len >= 8; len -= 8, p += 8) {
+		// little endian only, like the rest of the format
+		const uint32_t lo = *(const uint32_t *)p ^ crc, hi = *(const uint32_t *)(p+4);
+		crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24]
+		    ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+	}
+	for ( ; len; --len) crc = (crc >> 8) ^ t[0][(crc ^ *p++) & 0xff];
+#endif
+	return ~crc;
+}
+
+void         FM_Transpose8(const void *src, unsigned width, unsigned height, void *dst)
+{
+	const uint8_t *s = (const uint8_t *)src;
+	uint8_t *d = (uint8_t *)dst;
+	// 16x16 blocks: 16 source rows in, 16 destination rows out, all of it in cache
+	const unsigned B = 16, bw = width - width % B, bh = height - height % B;
+#ifdef FM_HAVE_SSE2
+	for (unsigned y = 0; y < bh; y += B) {
+		for (unsigned x = 0; x < bw; x += B) {
+			__m128i r[16], t[16];
+			for (unsigned i = 0; i < B; ++i) r[i] = _mm_loadu_si128((const __m128i *)(s + size_t(y+i)*width + x));
+			// 4 rounds of interleaving row i with row i+8 is a perfect shuffle of 16 rows: the transpose
+			for (int round = 0; round < 4; ++round) {
+				for (int i = 0; i < 8; ++i) {
+					t[2*i] = _mm_unpacklo_epi8(r[i], r[i+8]);
+					t[2*i+1] = _mm_unpackhi_epi8(r[i], r[i+8]);
+				}
+				for (int i = 0; i < 16; ++i) r[i] = t[i];
+			}
+			for (unsigned i = 0; i < B; ++i) _mm_storeu_si128((__m128i *)(d + size_t(x+i)*height + y), r[i]);
+		}
+	}
+#else
+	for (unsigned y = 0; y < bh; y += B)
+		for (unsigned x = 0; x < bw; x += B)
+			for (unsigned i = 0; i < B; ++i)
+				for (unsigned j = 0; j < B; ++j)
+					d[size_t(x+j)*height + y+i] = s[size_t(y+i)*width + x+j];
+#endif
+	// the ragged right and bottom edges
+	for (unsigned y = 0; y < height; ++y)
+		for (unsigned x = (y < bh ? bw : 0); x < width; ++x)
+			d[size_t(x)*height + y] = s[size_t(y)*width + x];
+}
+
+namespace {
+	/// read-only view of a window of a file, remapped as the window moves
+	class MappedFile
+	{
+	public:
+		MappedFile() : base(0), mapOff(0), mapLen(0) {
+#if defined(_WIN32) || defined(WIN32)
+			fh = INVALID_HANDLE_VALUE; mh = 0;
+			SYSTEM_INFO si; GetSystemInfo(&si); gran = si.dwAllocationGranularity;
+#else
+			fd = -1;
+			gran = uint64_t(sysconf(_SC_PAGESIZE));
+#endif
+		}
+		~MappedFile() { unmap(); 
+#if defined(_WIN32) || defined(WIN32)
+			if (mh) CloseHandle(mh);
+			if (fh != INVALID_HANDLE_VALUE) CloseHandle(fh);
+#else
+			if (fd > -1) ::close(fd);
+#endif
+		}
+		
+		bool open(const char *filename) {
+#if defined(_WIN32) || defined(WIN32)
+			fh = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+			if (fh == INVALID_HANDLE_VALUE) return false;
+			mh = CreateFileMapping(fh, 0, PAGE_READONLY, 0, 0, 0);
+			return mh != 0;
+#else
+			fd = ::open(filename, O_RDONLY);
+			return fd > -1;
+#endif
+		}
+		
+		/// returns a pointer to the file's bytes at off, valid for at least len bytes, or 0 on error
+		const uint8_t *at(uint64_t off, uint64_t len, uint64_t windowLen) {
+			if (base && off >= mapOff && off + len <= mapOff + mapLen) return base + (off - mapOff);
+			unmap();
+			if (windowLen < len) windowLen = len;
+			const uint64_t aligned = off - (off % gran), alignedLen = windowLen + (off - aligned);
+			if (alignedLen != uint64_t(size_t(alignedLen))) return 0; // doesn't fit in the address space
+#if defined(_WIN32) || defined(WIN32)
+			void *p = MapViewOfFile(mh, FILE_MAP_READ, DWORD(aligned >> 32), DWORD(aligned & 0xffffffff), SIZE_T(alignedLen));
+			if (!p) return 0;
+#else
+			void *p = mmap(0, size_t(alignedLen), PROT_READ, MAP_SHARED, fd, off_t(aligned));
+			if (p == MAP_FAILED) return 0;
+#  ifdef MADV_SEQUENTIAL
+			madvise(p, size_t(alignedLen), MADV_SEQUENTIAL);
+#  endif
+#endif
+			base = (const uint8_t *)p;
+			mapOff = aligned;
+			mapLen = alignedLen;
+			return base + (off - aligned);
+		}
+		
+	private:
+		void unmap() {
+			if (!base) return;
+#if defined(_WIN32) || defined(WIN32)
+			UnmapViewOfFile((LPCVOID)base);
+#else
+			munmap((void *)base, size_t(mapLen));
+#endif
+			base = 0;
+		}
+		
+#if defined(_WIN32) || defined(WIN32)
+		HANDLE fh, mh;
+#else
+		int fd;
+#endif
+		const uint8_t *base;
+		uint64_t mapOff, mapLen, gran;
+	};
+	
+	unsigned BytesPerPixel(unsigned fmt)
+	{
+		switch (fmt) {
+			case FM_RGB: case FM_BGR: return 3;
+			case FM_RGBA: case FM_ARGB: return 4;
+			default: return 1;
+		}
+	}
+	
+	struct VerifyJob
+	{
+		enum { Window = 64*1024*1024 };
+		
+		std::string filename;
+		const FM_Context *c;
+		bool decode;
+		FM_Mutex mut;
+		FM_Cond cond;
+		unsigned nDone, nRunning, reportedPct;
+		bool cancel;
+		unsigned firstBad; ///< the earliest bad frame found so far, ~0U if none
+		std::string err;
+		
+		struct Range { VerifyJob *job; unsigned first, end; };
+		
+		/// returns an empty string if frame i is ok, else what's wrong with it
+		std::string check(MappedFile & mf, unsigned i, uint64_t chunkEnd)
+		{
+			char buf[160];
+			const uint64_t start = c->imgOffsets[i], 
+			               stop = i+1 < c->imgOffsets.size() ? c->imgOffsets[i+1] 
+			                      : (c->indexRecordOffset ? c->indexRecordOffset : c->fileLengthBytes);
+			if (stop < start + sizeof(FM_ImageDescriptor) || stop > c->fileLengthBytes) {
+				// same wording as FM_ReadFrame, the GUI offers a repair for these
+				snprintf(buf, sizeof(buf), "Frame %u: seek error.  Index corrupt or file truncated?", i);
+				return buf;
+			}
+			const uint8_t *p = mf.at(start, stop - start, windowFor(chunkEnd - start));
+			if (!p) { snprintf(buf, sizeof(buf), "Frame %u: cannot map the file into memory.", i); return buf; }
+			FM_ImageDescriptor desc;
+			memcpy(&desc, p, sizeof(desc));
+			if (desc.magic != FM_IMAGE_DESCRIPTOR_MAGIC) {
+				snprintf(buf, sizeof(buf), "Frame %u: cannot read frame descriptor or frame descriptor corrupt.", i);
+				return buf;
+			}
+			if (uint64_t(desc.length) + sizeof(desc) > stop - start) {
+				snprintf(buf, sizeof(buf), "Frame %u: image data runs past the end of the frame. File corrupt?", i);
+				return buf;
+			}
+			const bool haveCRC = c->crcs.size() == c->imgOffsets.size();
+			if (haveCRC && FM_CRC32C(0, p, sizeof(desc) + desc.length) != c->crcs[i]) {
+				snprintf(buf, sizeof(buf), "Frame %u: checksum mismatch, the frame data is damaged.", i);
+				return buf;
+			}
+			if (decode || !haveCRC) {
+				unsigned len = desc.length;
+				if (desc.comp == FM_ZLib_Tiled_Comp) {
+					FM_TileTable t;
+					TileLayout l;
+					bool ok = desc.length >= sizeof(t);
+					if (ok) {
+						memcpy(&t, p + sizeof(desc), sizeof(t));
+						ok = l.init(desc, t);
+					}
+					if (ok) {
+						memcpy(&l.offs[0], p + sizeof(desc) + sizeof(t), l.offs.size()*sizeof(uint32_t));
+						std::vector<uint8_t> pix(size_t(desc.width)*desc.height*t.bytesPerPixel);
+						ok = l.offsetsOk() && DecodeTiles(l, p + sizeof(desc) + l.tableBytes(), 0, 0, 0, desc.width, desc.height, &pix[0], 1);
+						len = unsigned(pix.size());
+					}
+					if (!ok) len = ~0U;
+				} else if (desc.comp) {
+#ifdef NO_QT
+					void *out = 0;
+					zUncompress(p + sizeof(desc), desc.length, &out, &len);
+					if (out) free(out); else len = ~0U;
+#else
+					const QByteArray out = qUncompress(p + sizeof(desc), int(desc.length));
+					len = out.isNull() ? ~0U : unsigned(out.size());
+#endif
+				}
+				if (len != desc.width * desc.height * BytesPerPixel(desc.fmt)) {
+					snprintf(buf, sizeof(buf), "Frame %u: error decompressing image data. File corrupt?", i);
+					return buf;
+				}
+			}
+			return std::string();
+		}
+		
+		/// map up to Window bytes at a time, but not past this thread's range
+		static uint64_t windowFor(uint64_t n) { return n < uint64_t(Window) ? n : uint64_t(Window); }
+		
+		static void run(void *arg)
+		{
+			Range *r = (Range *)arg;
+			VerifyJob *j = r->job;
+			MappedFile mf;
+			const bool opened = mf.open(j->filename.c_str());
+			const uint64_t chunkEnd = r->end < j->c->imgOffsets.size() ? j->c->imgOffsets[r->end] : j->c->fileLengthBytes;
+			for (unsigned i = r->first; i < r->end; ++i) {
+				const std::string e = opened ? j->check(mf, i, chunkEnd) : std::string("Cannot open ") + j->filename + " for reading.";
+				FM_Locker l(j->mut);
+				if (e.length() && i < j->firstBad) j->firstBad = i, j->err = e;
+				// past an earlier bad frame nothing here matters anymore
+				if (e.length() || j->cancel || i >= j->firstBad) break;
+				++j->nDone;
+				if (j->nDone * uint64_t(100) / j->c->imgOffsets.size() > j->reportedPct) j->cond.wakeAll();
+			}
+			FM_Locker l(j->mut);
+			--j->nRunning;
+			j->cond.wakeAll();
+		}
+	};
+}
+
+bool         FM_Verify(const char *filename, unsigned nThreads, bool decode, void *arg, FM_ProgressFn pfun, FM_ErrorFn efun)
 {
 	std::string errmsg("");
 	FM_Context *c = FM_Open(filename, &errmsg);
@@ -415,26 +1231,51 @@ bool FM_CheckForErrors(const char *filename, void *arg, FM_ProgressFn pfun, FM_E
 		if (efun) efun(arg, errmsg);
 		return false;
 	}
-    const unsigned n = unsigned(c->imgOffsets.size());
-	int lastpct = -1;
-	for (unsigned i = 0; i < n; ++i) {
-		FM_Image *img = FM_ReadFrame(c, i, &errmsg);
-		if (!img) {
-			if (efun) efun(arg, errmsg);
-			FM_Close(c);
-			return false;
-		}
-		delete img;
-		if (static_cast<int>(((i*100)+1) / n) > lastpct) {
-			lastpct = ((i*100)+1) / n;
-			if (pfun && !pfun(arg, lastpct)) {
-				FM_Close(c);
-				return false;
+	const unsigned n = unsigned(c->imgOffsets.size());
+	if (!nThreads) nThreads = FM_NumCPUs();
+	if (nThreads > n) nThreads = n ? n : 1;
+	
+	VerifyJob j;
+	j.filename = filename;
+	j.c = c;
+	j.decode = decode;
+	j.nDone = 0;
+	j.nRunning = nThreads;
+	j.reportedPct = 0;
+	j.cancel = false;
+	j.firstBad = ~0U;
+	std::vector<VerifyJob::Range> ranges(nThreads);
+	std::vector<FM_Thread *> threads;
+	for (unsigned t = 0; t < nThreads; ++t) {
+		VerifyJob::Range r = { &j, unsigned(uint64_t(n)*t/nThreads), unsigned(uint64_t(n)*(t+1)/nThreads) };
+		ranges[t] = r;
+		threads.push_back(new FM_Thread(VerifyJob::run, &ranges[t]));
+	}
+	
+	// progress gets reported from here, so callers see their callbacks on their own thread like always
+	j.mut.lock();
+	while (j.nRunning) {
+		j.cond.wait(j.mut);
+		const unsigned pct = n ? unsigned(j.nDone * uint64_t(100) / n) : 100;
+		if (pct > j.reportedPct && !j.cancel) {
+			j.reportedPct = pct;
+			if (pfun) {
+				j.mut.unlock();
+				const bool goOn = pfun(arg, int(pct));
+				j.mut.lock();
+				if (!goOn) j.cancel = true;
 			}
 		}
 	}
+	j.mut.unlock();
+	for (unsigned t = 0; t < nThreads; ++t) delete threads[t]; // joins
 	FM_Close(c);
-	return true;
+	
+	if (j.err.length()) {
+		if (efun) efun(arg, j.err);
+		return false;
+	}
+	return !j.cancel;
 }
 			
 /*-----------------------------------------------------------------------------
@@ -445,25 +1286,22 @@ bool FM_CheckForErrors(const char *filename, void *arg, FM_ProgressFn pfun, FM_E
 void         FM_Close(FM_Context *c)
 {
 	if (!c) return;
-	if (c->isOutput) {
-		FM_Header h;
-		fseeko(c->file, 0, SEEK_SET);
-		if ( fread(&h, sizeof(h), 1, c->file) == 1 ) {
-			// update header
-			fseeko(c->file, 0, SEEK_END);
-			h.indexRecordOffset = ftello(c->file);
-            h.nFrames = unsigned(c->imgOffsets.size());
-			fseeko(c->file, 0, SEEK_SET);
-			fwrite(&h, sizeof(h), 1, c->file);
-		}
-		// now write out the index record
-		fseeko(c->file, 0, SEEK_END);
+	StopEncoder(c);
+	if (c->isOutput && c->file) {
+		// write out the index record after the last frame, then point the header at it
+		const uint64_t indexRecordOffset = c->writePos;
 		FM_IndexRecord ir;
+		memset(&ir, 0, sizeof(ir));
 		ir.magic = FM_INDEX_RECORD_MAGIC;
 		ir.length = c->imgOffsets.size() * sizeof(uint64_t);
-		fwrite(&ir, sizeof(ir), 1, c->file);
-		if ( c->imgOffsets.size() ) 
-			fwrite(&c->imgOffsets[0], sizeof(uint64_t), c->imgOffsets.size(), c->file);
+		ir.checksumsLength = uint32_t(c->crcs.size() * sizeof(uint32_t));
+		if ( fwrite(&ir, sizeof(ir), 1, c->file) == 1 
+			 && (!c->imgOffsets.size() || fwrite(&c->imgOffsets[0], sizeof(uint64_t), c->imgOffsets.size(), c->file) == c->imgOffsets.size())
+			 && (!c->crcs.size() || fwrite(&c->crcs[0], sizeof(uint32_t), c->crcs.size(), c->file) == c->crcs.size()) ) {
+			c->writePos += sizeof(ir) + ir.length + ir.checksumsLength;
+			fflush(c->file); // index first, so a crash here never leaves a header pointing at a missing index
+			WriteHeader(c, indexRecordOffset);
+		}
 	}	
 	delete c; 
 }
@@ -518,21 +1356,24 @@ bool         FM_RebuildIndex(const char *filename, void * arg, FM_ProgressFn pro
 	if ( !h.indexRecordOffset ) {
 		fseeko(f, 0, SEEK_END);
 		h.indexRecordOffset = ftello(f);
-		fseeko(f, 0, SEEK_SET);
-		if ( fwrite(&h, sizeof(h), 1, f) != 1 ) {
-			if (errfn) errfn(arg, "Cannot re-write header!");
-			FM_Close(c);
-			return false;
-		}
 		offset = 0;
 		seektype = SEEK_END;
 	}
+	// the rebuilt index has no checksums: recomputing them from possibly damaged frames would only vouch for the damage
+	h.flags &= ~FM_HAS_CRC32C;
+	fseeko(f, 0, SEEK_SET);
+	if ( fwrite(&h, sizeof(h), 1, f) != 1 ) {
+		if (errfn) errfn(arg, "Cannot re-write header!");
+		FM_Close(c);
+		return false;
+	}
 	if ( fseeko(f, offset, seektype) ) {
 		if (errfn) errfn(arg, "Cannot seek to write index record!");
 		FM_Close(c);
 		return false;
 	}
 	FM_IndexRecord ir;
+	memset(&ir, 0, sizeof(ir));
 	ir.magic = FM_INDEX_RECORD_MAGIC;
 	ir.length = c->imgOffsets.size() * sizeof(uint64_t);
 	if ( fwrite(&ir, sizeof(ir), 1, f) != 1 ) {
@@ -599,7 +1440,7 @@ void zCompress(const void* data, unsigned nbytes, int compressionLevel,
 void zUncompress(const void *d, unsigned nbytes,
 				 void **out, unsigned *outbytes)
 {
-	const char *data = (const char *)d;
+	const unsigned char *data = (const unsigned char *)d; // unsigned, or sizes with a byte >= 0x80 get sign extended
 	if (!data || !out || !outbytes) {
 //		qWarning("qUncompress: Data is null");
 		return;
@@ -612,7 +1453,7 @@ void zUncompress(const void *d, unsigned nbytes,
 		//	qWarning("qUncompress: Input data is corrupted");
 		return;
 	}
-	unsigned long expectedSize = (data[0] << 24) | (data[1] << 16) | (data[2] <<  8) | (data[3]      );
+	unsigned long expectedSize = (static_cast<unsigned long>(data[0]) << 24) | (data[1] << 16) | (data[2] <<  8) | (data[3]      );
 	unsigned long len = expectedSize;
 	if (!len) len = 1;
 	
@@ -620,8 +1461,9 @@ void zUncompress(const void *d, unsigned nbytes,
 	
 	while(1) {
 		unsigned long alloc = len;
-		if (len  >= static_cast<unsigned long>(1 << 31)) {
+		if (len  >= (1UL << 31)) {
 			//qWarning("qUncompress: Input data is corrupted");
+			free(p);
 			return;
 		}
 		p = (unsigned char *)realloc(p, alloc);
@@ -634,7 +1476,7 @@ void zUncompress(const void *d, unsigned nbytes,
 		switch (res) {
 			case Z_OK:
 				if (len != alloc) {
-					if (len  >= (unsigned long)(1 << 31)) {
+					if (len  >= (1UL << 31)) {
 						//QByteArray does not support that huge size anyway.
 						//qWarning("qUncompress: Input data is corrupted");
 						free(p);
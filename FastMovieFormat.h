@@ -43,7 +43,7 @@ extern "C" {
 
 
 enum FM_Fmt {  FM_LUMINOSITY = 0, FM_RGB, FM_BGR, FM_RGBA, FM_ARGB };
-enum FM_Comp { FM_No_Comp = 0, FM_ZLib_Comp };
+enum FM_Comp { FM_No_Comp = 0, FM_ZLib_Comp, FM_ZLib_Tiled_Comp /* see FM_TileTable */ };
 	
 struct PACKED FM_Header {
 #define FM_MAGIC_STR "StimGLFMv2"
@@ -51,8 +51,9 @@ struct PACKED FM_Header {
 	uint32_t nFrames;   ///< the number of animation frames contained in the file
 	uint32_t width; ///< the width of the image frame, in pixels 
 	uint32_t height; ///< the height of the total image frame, in pixels
-	uint32_t reserved; ///< padding...
+	uint32_t flags; ///< FM_HAS_* bits, 0 in files made before there were any
 	uint64_t indexRecordOffset; ///< where in the file to find the index record.  if 0, then build index ourselves 
+#define FM_HAS_CRC32C 0x1 ///< the index record has a CRC32C per frame.  Older readers just ignore them
 };
 
 struct PACKED FM_ImageDescriptor {
@@ -62,18 +63,32 @@ struct PACKED FM_ImageDescriptor {
 	uint32_t height;    ///< height of image/animation, in pix
 	uint32_t bitdepth;  ///< usually 8,16,24,32, for now we only support 8
 	uint32_t fmt;       ///< for now, since we only support 8 bit, always FM_LUMINOSITY (or 0)
-	uint32_t comp;      ///< should always be FM_Zlib_Comp, for now
+	uint32_t comp;      ///< an FM_Comp, usually FM_ZLib_Comp
 	uint32_t duration;  ///< the duration of the animation frame, in ms. set to 0 for stimgl
 	uint32_t length;    ///< the length of the image data (compressed) that follows 
 };
 
+/** The data of an FM_ZLib_Tiled_Comp frame starts with this.  The frame is cut
+    into tileWidth x tileHeight tiles (smaller at the right and bottom edges),
+    each zlib compressed on its own, so part of a frame can be decoded without
+    the rest.  Readers from before tiling can't decode these frames. */
+struct PACKED FM_TileTable {
+#define FM_TILE_TABLE_MAGIC 0x711e5eed
+	uint32_t magic;
+	uint32_t tileWidth, tileHeight; ///< in pixels
+	uint32_t bytesPerPixel;
+	uint32_t nTiles; ///< left to right, then top to bottom
+	// nTiles+1 32-bit offsets follow, relative to the end of the offsets: tile i's zlib data is [offset[i], offset[i+1])
+};
+
 struct PACKED FM_IndexRecord {
 #define FM_INDEX_RECORD_MAGIC 0x12341234
 	uint32_t magic;
-	uint32_t reserved;
-	uint64_t length;
+	uint32_t checksumsLength; ///< with FM_HAS_CRC32C, the length of the checksums after the indices, else 0
+	uint64_t length; ///< the length of the indices only
 	char padding[16];
 	// indices for each frame follow..., each index is a 64-bit unsigned offset into the file for that frame
+	// then, with FM_HAS_CRC32C, a 32-bit CRC32C for each frame, over its FM_ImageDescriptor and the data following it
 };
 	
 	
@@ -97,15 +112,32 @@ struct PACKED FM_IndexRecord {
 
 #undef PACKED
 
+#define FM_DEFAULT_WRITE_BUFFER (4*1024*1024) ///< stdio buffer size for output files
+#define FM_DEFAULT_CHECKPOINT_FRAMES 256 ///< how often an output file's header is brought up to date, for crash recovery
+#define FM_DEFAULT_ENCODER_MB 256 ///< default memory budget for frames submitted to the encoder but not yet written
+#define FM_DEFAULT_TILE_SIZE 256 ///< a reasonable tile size for FM_SetTileSize(), in pixels
+
+struct FM_Encoder; ///< opaque, see FM_StartEncoder()
+
 struct FM_Context
 {
 	FILE *file;
 	std::vector<uint64_t> imgOffsets;
+	std::vector<uint32_t> crcs; ///< per-frame CRC32C, see FM_IndexRecord.  Empty for input files that have none
     uint64_t fileLengthBytes;
+	uint64_t indexRecordOffset; ///< input only, 0 if the file had no index
 	bool isOutput; 
 	unsigned width, height;
+
+	// output only
+	uint64_t writePos; ///< where the next frame goes.  Output files are only ever appended to, so no seeking per frame
+	unsigned checkpointFrames; ///< every this many frames the header gets the frame count, see FM_Checkpoint().  0 = never
+	unsigned framesSinceCheckpoint;
+	unsigned tileWidth, tileHeight; ///< compressed frames added from now on are tiled this big, 0 = not tiled.  See FM_SetTileSize()
+	std::vector<char> writeBuf; ///< the stdio buffer for the file, must outlive it
+	FM_Encoder *enc; ///< non-null while the multithreaded encoder is running, stopped by FM_Close()
 	
-	FM_Context() : file(0), isOutput(true), width(0), height(0) {}
+	FM_Context() : file(0), fileLengthBytes(0), indexRecordOffset(0), isOutput(true), width(0), height(0), writePos(0), checkpointFrames(FM_DEFAULT_CHECKPOINT_FRAMES), framesSinceCheckpoint(0), tileWidth(0), tileHeight(0), enc(0) {}
 	~FM_Context() {	if (file) fclose(file); file = 0; }
 };
 
@@ -130,14 +162,46 @@ struct FM_Image
 /*-----------------------------------------------------------------------------
   WRITE/OUTPUT FUNCTIONS
  -----------------------------------------------------------------------------*/
-/// returns NULL on error, creates a new fmv file for output on success and returns ptr to context
-FM_Context * FM_Create(const char *filename); 
-/// returns true on success
+/** returns NULL on error, creates a new fmv file for output on success and returns ptr to context.
+    Frames are streamed out through a write buffer of bufferBytes.  The header and index are only
+    written for real in FM_Close(), so until then the file is only recoverable (with 
+    FM_RebuildIndex() or FM_Open(..., rebuildIndexIfMissing=true)) up to the last checkpoint, 
+    taken every checkpointFrames frames (0 means never). */
+FM_Context * FM_Create(const char *filename, unsigned bufferBytes = FM_DEFAULT_WRITE_BUFFER,
+					   unsigned checkpointFrames = FM_DEFAULT_CHECKPOINT_FRAMES); 
+/// flushes an output file and updates its header's frame count so that a crash loses no frames written so far.  Done automatically every checkpointFrames frames.  Returns true on success.
+bool         FM_Checkpoint(FM_Context *ctx);
+/// returns true on success.  While the encoder is running this is the same as FM_SubmitFrame()
 bool         FM_AddFrame(FM_Context *ctx, const void *pixels, 
 						 unsigned width, unsigned height, unsigned compressionLevel = 1,
 						 unsigned depth = 8, FM_Fmt = FM_LUMINOSITY, 
 						 bool comp = true, unsigned duration_ms = 0);
 
+/** Compressed frames added from now on get split into tileWidth x tileHeight
+    tiles (FM_ZLib_Tiled_Comp), so that readers can decode just part of a frame
+    with FM_ReadFrameRect(), or all of it on several threads.  Frames that fit
+    in a single tile are compressed whole as usual.  0,0 turns tiling off
+    again.  Returns false on a bad context or if only one of them is 0. */
+bool         FM_SetTileSize(FM_Context *ctx, unsigned tileWidth, unsigned tileHeight);
+
+/** Starts the multithreaded encoder on an output context: from now on frames
+    are compressed by nThreads worker threads (0 = one per CPU) and a sequencer
+    thread appends them to the file in the order they were submitted.  At most
+    maxInFlightMB of frames may be submitted but not yet written; past that
+    FM_SubmitFrame() blocks.  Returns true on success, or if already running. */
+bool         FM_StartEncoder(FM_Context *ctx, unsigned nThreads = 0, unsigned maxInFlightMB = FM_DEFAULT_ENCODER_MB);
+/** Queues a frame for the encoder (or, if it isn't running, adds it right away
+    like FM_AddFrame()).  The pixels are copied, so the caller may reuse its
+    buffer as soon as this returns.  Returns false if the frame was invalid or
+    if writing a previously submitted frame failed -- in which case the file
+    ends at the last frame that was written successfully. */
+bool         FM_SubmitFrame(FM_Context *ctx, const void *pixels, 
+							unsigned width, unsigned height, unsigned compressionLevel = 1,
+							unsigned depth = 8, FM_Fmt = FM_LUMINOSITY, 
+							bool comp = true, unsigned duration_ms = 0);
+/// waits for all submitted frames to be written.  Returns false if any of them failed
+bool         FM_FlushEncoder(FM_Context *ctx);
+
 /*-----------------------------------------------------------------------------
   READ/INPUT FUNCTIONS
  -----------------------------------------------------------------------------*/
@@ -145,6 +209,13 @@ bool         FM_AddFrame(FM_Context *ctx, const void *pixels,
 FM_Context * FM_Open(const char *filename, std::string *errmsg = 0, bool rebuildIndexIfMissing = false);
 /// read a frame from the .fmv file, caller should delete returned pointer
 FM_Image *   FM_ReadFrame(FM_Context *ctx, unsigned frame_id /* first frame is frame 0 */, std::string *errmsg = 0, int *compFrameSize = 0);
+/** Like FM_ReadFrame(), but returns just the w x h rectangle of the frame at x,y 
+    (0,0 is the first pixel of the first row; the rectangle is clipped to the 
+    frame).  Of tiled frames only the tiles that intersect the rectangle are 
+    read and decompressed, spread over nThreads threads (0 = one per CPU).
+    Other frames are decompressed whole and then cropped. */
+FM_Image *   FM_ReadFrameRect(FM_Context *ctx, unsigned frame_id, unsigned x, unsigned y, unsigned w, unsigned h,
+							  unsigned nThreads = 1, std::string *errmsg = 0, int *compFrameSize = 0);
 /// returns true if the filename is openable and readable as an .fmv file!
 bool         FM_IsFMV(const char *filename);
 
@@ -159,10 +230,28 @@ typedef bool (*FM_ProgressFn)(void *, int);
     a percentage indicating scan progress from 0 to 100).  The error function
     is called with a specific message describing the error.  After the error 
     function is called, FM_CheckForErrors will return immediately with a false
-    result. */  
+    result.  Same as FM_Verify(filename, 0, false, ...). */  
 bool         FM_CheckForErrors(const char *filename, void *arg = 0, 
 							   FM_ProgressFn progfunc = 0, FM_ErrorFn errorfunc = 0);
 
+/** Parallel version of the above, which it is built on.  The frames are split
+    into nThreads (0 = one per CPU) contiguous ranges, each verified by its own
+    thread straight from a memory mapping of the file, going by the index.  
+    Frames with a CRC32C (FM_HAS_CRC32C files) get that checked, which also
+    catches bit rot in the compressed data.  Frames without one, or all frames
+    if decode is true, get decompressed too.  The callbacks are only called
+    from the calling thread, errors once, for the earliest bad frame.  The
+    progress callback returning false cancels the check. */
+bool         FM_Verify(const char *filename, unsigned nThreads = 0, bool decode = false, void *arg = 0,
+					   FM_ProgressFn progfunc = 0, FM_ErrorFn errorfunc = 0);
+
+/// CRC32C (Castagnoli) of len bytes, continuing from crc (start with 0)
+uint32_t     FM_CRC32C(uint32_t crc, const void *data, size_t len);
+
+/** Transposes height rows of width bytes (src) into width rows of height bytes (dst), which
+    must not overlap.  Turns a column-major (Matlab) 8-bit matrix into a row-major frame. */
+void         FM_Transpose8(const void *src, unsigned width, unsigned height, void *dst);
+
 /*-----------------------------------------------------------------------------
  READ/WRITE FUNCTIONS (applicable to both)
  -----------------------------------------------------------------------------*/
@@ -91,6 +91,42 @@ QSize FastMovieReader::size() const {
 	return QSize();
 }
 
+/// the QImage format frames of FM_Fmt fmt are read into, or QImage::Format_Invalid if unsupported
+static QImage::Format ImageFormat(unsigned fmt)
+{
+	switch (fmt) {
+		case FM_LUMINOSITY: return QImage::Format_Indexed8;
+		case FM_RGB: case FM_BGR: return QImage::Format_RGB888; // BGR pixels are left as they are
+		default: return QImage::Format_Invalid;
+	}
+}
+
+/// makes im a size image in the frame's own pixel format, with the frame at pos and the rest black
+static bool ToImage(const FM_Image *img, QImage & im, const QSize & size, const QPoint & pos)
+{
+	const QImage::Format f = ImageFormat(img->desc.fmt);
+	if (f == QImage::Format_Invalid) {
+		Error() << "FastMovie frame format " << img->desc.fmt << " is not supported, only luminosity, RGB and BGR are!";
+		return false;
+	}
+	const int w = int(img->desc.width), h = int(img->desc.height), bpp = f == QImage::Format_Indexed8 ? 1 : 3;
+	if (pos.x() + w > size.width() || pos.y() + h > size.height() || img->data.size() != w*h*bpp) {
+		Error() << "FastMovie returned image and expected image size mismatch!";
+		return false;
+	}
+	im = QImage(size, f);
+	if (size != QSize(w, h)) im.fill(0);
+	
+#define FAST_SCAN_LINE(bits, bpl, y) (bits + (y) * bpl)
+	
+	int bpl1 = im.bytesPerLine(), bpl2 = w*bpp;
+	uchar *bits1 = im.bits() + pos.x()*bpp, *bits2 = (uchar *)img->data.constData();
+	for (int y = 0; y < h; ++y) {
+		memcpy(FAST_SCAN_LINE(bits1, bpl1, y + pos.y()), FAST_SCAN_LINE(bits2, bpl2, y), bpl2);
+	}
+	return true;
+}
+
 bool FastMovieReader::randomAccessRead(QImage *image, int imgnum, int *compFrameSize)
 {
 	--imgnum; // internally img numbers are 0-based
@@ -98,29 +134,36 @@ bool FastMovieReader::randomAccessRead(QImage *image, int imgnum, int *compFrame
 	if (ctx) {
 		FM_Image *img = FM_ReadFrame(ctx, imgnum, 0, compFrameSize);
 		if (!img) return false;
-		if (img->desc.fmt != FM_LUMINOSITY && img->desc.bitdepth != 8) {
-			Error() << "FastMovie fmt and bitdepth are not 0 and 8, respectively!";
-			delete img;
-			return false;
-		}
-		
-#define FAST_SCAN_LINE(bits, bpl, y) (bits + (y) * bpl)
-		
-		
-		QImage im(img->desc.width, img->desc.height, QImage::Format_Indexed8);
-		if (im.byteCount() < img->data.size()) {
-			Error() << "FastMovie returned image and expected image size mismatch!";
-			delete img;
-			return false;
-		}
-		int bpl1 = im.bytesPerLine(), bpl2 = img->desc.width;
-		uchar *bits1 = im.bits(), *bits2 = (uchar *)img->data.constData();
-		for (int y = 0; y < (int)img->desc.height; ++y) {
-			memcpy(FAST_SCAN_LINE(bits1, bpl1, y), FAST_SCAN_LINE(bits2, bpl2, y), bpl2);
-		}
+		QImage im;
+		const bool ok = ToImage(img, im, QSize(img->desc.width, img->desc.height), QPoint(0, 0));
 		delete img;
-		*image = im;
-		return true;
+		if (ok) *image = im;
+		return ok;
 	}
 	return false;
 }
+
+bool FastMovieReader::randomAccessRead(QImage *image, int imgnum, int *compFrameSize, const QRect & frameRect, const QRect & decodeRect)
+{
+	--imgnum;
+	if (!image || (!ctx && !open()) || imgnum < 0 || imgnum >= (int)ctx->imgOffsets.size()) return false;
+	const QRect r = decodeRect & frameRect;
+	if (r.isEmpty()) return false;
+	FM_Image *img = FM_ReadFrameRect(ctx, imgnum, r.x(), r.y(), r.width(), r.height(), 1, 0, compFrameSize);
+	if (!img) return false;
+	QImage im;
+	const bool ok = ToImage(img, im, frameRect.size(), r.topLeft() - frameRect.topLeft());
+	delete img;
+	if (ok) *image = im;
+	return ok;
+}
+
+int FastMovieReader::frameFormat() const
+{
+	if (!ctx && !open()) return -1;
+	if (ctx->imgOffsets.empty()) return -1;
+	FM_Image *img = FM_ReadFrameRect(ctx, 0, 0, 0, 1, 1);
+	const int ret = img ? int(img->desc.fmt) : -1;
+	delete img;
+	return ret;
+}
@@ -17,6 +17,7 @@
 #include <QIODevice>
 #include <QImageReader>
 #include <QPoint>
+#include <QRect>
 
 
 class GenericMovieReader : public QImageIOHandler
@@ -44,6 +45,8 @@ public:
     bool write(const QImage &image);
 	
 	bool randomAccessRead(QImage *image, int imgnum /* first image is 1, last is imageCount() */, int *compressedFrameSize);
+	/// Reads just the frameRect part of the frame (in movie pixels, 0,0 is the top left), of which only the decodeRect part is actually decoded, the rest is left black.  Of tiled .fmv frames only the tiles needed get decompressed.
+	bool randomAccessRead(QImage *image, int imgnum, int *compressedFrameSize, const QRect & frameRect, const QRect & decodeRect);
 	
     QByteArray name() const { return fileName.toUtf8(); }
 		
@@ -57,6 +60,8 @@ public:
     int currentImageNumber() const { return -1; } // unimpl
 		
 	QSize size() const;
+	/// the FM_Fmt of the movie's frames (going by the first one), -1 on error.  Luminosity frames are read as QImage::Format_Indexed8, RGB and BGR ones as QImage::Format_RGB888
+	int frameFormat() const;
 	
 private:
 	bool open() const;
@@ -0,0 +1,145 @@
+/*
+ *  FastMovieThreads.h
+ *  StimulateOpenGL_II
+ *
+ *  Minimal mutex/condition/thread wrappers for the .fmv code.  FastMovieFormat
+ *  is also compiled without Qt (the Matlab mex, fmvtool), so with NO_QT these
+ *  sit directly on pthreads (or Win32), otherwise on QMutex/QWaitCondition/QThread.
+ *
+ */
+#ifndef FastMovieThreads_H
+#define FastMovieThreads_H
+
+#ifdef NO_QT
+#  if defined(_WIN32) || defined(WIN32)
+#    ifndef WIN32_LEAN_AND_MEAN
+#      define WIN32_LEAN_AND_MEAN
+#    endif
+#    include <windows.h>
+#    define FM_WIN32_THREADS
+#  else
+#    include <pthread.h>
+#    include <unistd.h>
+#  endif
+#else
+#  include <QMutex>
+#  include <QWaitCondition>
+#  include <QThread>
+#endif
+
+class FM_Mutex
+{
+public:
+#if defined(FM_WIN32_THREADS)
+	FM_Mutex() { InitializeCriticalSection(&m); }
+	~FM_Mutex() { DeleteCriticalSection(&m); }
+	void lock() { EnterCriticalSection(&m); }
+	void unlock() { LeaveCriticalSection(&m); }
+	CRITICAL_SECTION m;
+#elif defined(NO_QT)
+	FM_Mutex() { pthread_mutex_init(&m, 0); }
+	~FM_Mutex() { pthread_mutex_destroy(&m); }
+	void lock() { pthread_mutex_lock(&m); }
+	void unlock() { pthread_mutex_unlock(&m); }
+	pthread_mutex_t m;
+#else
+	FM_Mutex() {}
+	void lock() { m.lock(); }
+	void unlock() { m.unlock(); }
+	QMutex m;
+#endif
+private:
+	FM_Mutex(const FM_Mutex &);
+	FM_Mutex & operator=(const FM_Mutex &);
+};
+
+/// locks a FM_Mutex for the lifetime of the object
+struct FM_Locker
+{
+	FM_Mutex & m;
+	FM_Locker(FM_Mutex & mut) : m(mut) { m.lock(); }
+	~FM_Locker() { m.unlock(); }
+};
+
+class FM_Cond
+{
+public:
+#if defined(FM_WIN32_THREADS)
+	FM_Cond() { InitializeConditionVariable(&c); }
+	void wait(FM_Mutex & m) { SleepConditionVariableCS(&c, &m.m, INFINITE); }
+	void wakeOne() { WakeConditionVariable(&c); }
+	void wakeAll() { WakeAllConditionVariable(&c); }
+	CONDITION_VARIABLE c;
+#elif defined(NO_QT)
+	FM_Cond() { pthread_cond_init(&c, 0); }
+	~FM_Cond() { pthread_cond_destroy(&c); }
+	void wait(FM_Mutex & m) { pthread_cond_wait(&c, &m.m); }
+	void wakeOne() { pthread_cond_signal(&c); }
+	void wakeAll() { pthread_cond_broadcast(&c); }
+	pthread_cond_t c;
+#else
+	FM_Cond() {}
+	void wait(FM_Mutex & m) { c.wait(&m.m); }
+	void wakeOne() { c.wakeOne(); }
+	void wakeAll() { c.wakeAll(); }
+	QWaitCondition c;
+#endif
+private:
+	FM_Cond(const FM_Cond &);
+	FM_Cond & operator=(const FM_Cond &);
+};
+
+/// runs func(arg) in a new thread as soon as it's constructed, join() waits for it to finish
+class FM_Thread
+{
+public:
+	typedef void (*Func)(void *);
+private:
+	Func func;
+	void *arg;
+public:
+
+#if defined(FM_WIN32_THREADS)
+	FM_Thread(Func f, void *a) : func(f), arg(a) { h = CreateThread(0, 0, trampoline, this, 0, 0); }
+	~FM_Thread() { join(); }
+	void join() { if (h) { WaitForSingleObject(h, INFINITE); CloseHandle(h); h = 0; } }
+private:
+	static DWORD WINAPI trampoline(LPVOID p) { FM_Thread *t = (FM_Thread *)p; t->func(t->arg); return 0; }
+	HANDLE h;
+#elif defined(NO_QT)
+	FM_Thread(Func f, void *a) : func(f), arg(a), joined(false) { if (pthread_create(&t, 0, trampoline, this)) joined = true; }
+	~FM_Thread() { join(); }
+	void join() { if (!joined) { pthread_join(t, 0); joined = true; } }
+private:
+	static void *trampoline(void *p) { FM_Thread *t = (FM_Thread *)p; t->func(t->arg); return 0; }
+	pthread_t t;
+	bool joined;
+#else
+	FM_Thread(Func f, void *a) : func(f), arg(a) { thr.t = this; thr.start(); }
+	~FM_Thread() { join(); }
+	void join() { thr.wait(); }
+private:
+	struct Thr : public QThread { FM_Thread *t; void run() { t->func(t->arg); } } thr;
+#endif
+
+	FM_Thread(const FM_Thread &);
+	FM_Thread & operator=(const FM_Thread &);
+};
+
+/// the number of CPUs on this machine, for sizing thread pools
+inline unsigned FM_NumCPUs()
+{
+	int n = 1;
+#if defined(FM_WIN32_THREADS)
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	n = int(si.dwNumberOfProcessors);
+#elif defined(NO_QT)
+	n = int(sysconf(_SC_NPROCESSORS_ONLN));
+#else
+	n = QThread::idealThreadCount();
+#endif
+	return n > 0 ? unsigned(n) : 1;
+}
+
+#endif
@@ -67,6 +67,18 @@ bool Flicker::applyNewParamsAtRuntime()
 	return initFromParams();
 }
 
+bool Flicker::saveRenderAheadState(QByteArray & s) const
+{
+	s.resize(sizeof(cyccur));
+	memcpy(s.data(), &cyccur, sizeof(cyccur));
+	return true;
+}
+
+void Flicker::restoreRenderAheadState(const QByteArray & s)
+{
+	if (s.size() == sizeof(cyccur)) memcpy(&cyccur, s.constData(), sizeof(cyccur));
+}
+
 void Flicker::drawFrame()
 {
 	// Done in calling code.. glClear( GL_COLOR_BUFFER_BIT ); // sanely clear
@@ -27,6 +27,9 @@ protected:
 	void drawFrame();
 	
 	/* virtual */ bool applyNewParamsAtRuntime();
+	/* virtual */ bool canRenderAhead() const { return true; }
+	/* virtual */ bool saveRenderAheadState(QByteArray & s) const;
+	/* virtual */ void restoreRenderAheadState(const QByteArray & s);
 
 private:
 	bool validateHz() const;
@@ -0,0 +1,71 @@
+/*
+ *  FramePool.cpp
+ *  StimulateOpenGL_II
+ *
+ */
+#include "FramePool.h"
+
+void FrameBudget::setBudget(s64 bytes)
+{
+	FM_Locker l(mut);
+	bud = bytes;
+}
+
+s64 FrameBudget::budget() const
+{
+	FM_Locker l(mut);
+	return bud;
+}
+
+s64 FrameBudget::used() const
+{
+	FM_Locker l(mut);
+	return cur;
+}
+
+s64 FrameBudget::peak() const
+{
+	FM_Locker l(mut);
+	return pk;
+}
+
+void FrameBudget::resetPeak()
+{
+	FM_Locker l(mut);
+	pk = cur;
+}
+
+bool FrameBudget::reserve(s64 bytes, bool force)
+{
+	FM_Locker l(mut);
+	if (!force && cur + bytes > bud) return false;
+	cur += bytes;
+	if (cur > pk) pk = cur;
+	return true;
+}
+
+void FrameBudget::unreserve(s64 bytes)
+{
+	FM_Locker l(mut);
+	cur -= bytes;
+}
+
+void FrameBudget::settle(s64 bytes, s64 reserved)
+{
+	FM_Locker l(mut);
+	cur += bytes - reserved;
+	if (cur > pk) pk = cur;
+}
+
+#ifndef NO_QT
+PooledFrame::~PooledFrame()
+{
+	pool->unreserve(pixels.size());
+}
+
+FrameRef FramePool::adopt(const QByteArray & pixels, qint64 reserved)
+{
+	settle(pixels.size(), reserved);
+	return FrameRef(new PooledFrame(this, pixels));
+}
+#endif
@@ -0,0 +1,68 @@
+/*
+ *  FramePool.h
+ *  StimulateOpenGL_II
+ *
+ *  The decoded frames of the Movie plugin.  The reader threads, the ordered
+ *  frame queue, the image cache and the texture upload all hold FrameRef
+ *  handles to the same buffers; a buffer's bytes count against the pool's
+ *  budget once, from reserve() until its last handle goes away.
+ *
+ */
+#ifndef FramePool_H
+#define FramePool_H
+
+#include "TypeDefs.h"
+#include "FastMovieThreads.h"
+#ifndef NO_QT
+#include <QByteArray>
+#include <QSharedPointer>
+#endif
+
+/// The byte accounting of a FramePool.  It's all there is of it in NO_QT builds (tests/).
+class FrameBudget
+{
+public:
+	FrameBudget() : bud(0), cur(0), pk(0) {}
+
+	void setBudget(s64 bytes);
+	s64 budget() const;
+	s64 used() const; ///< by live frames plus reservations, in bytes
+	s64 peak() const; ///< of used() since the last resetPeak()
+	void resetPeak();
+
+	/// Sets aside bytes for a frame about to be decoded.  Fails if that would go over the budget, unless force.
+	bool reserve(s64 bytes, bool force = false);
+	void unreserve(s64 bytes);
+	/// The frame that `reserved' bytes were reserve()d for turned out to be `bytes' big
+	void settle(s64 bytes, s64 reserved);
+
+private:
+	mutable FM_Mutex mut;
+	s64 bud, cur, pk;
+};
+
+#ifndef NO_QT
+class FramePool;
+
+/// one decoded frame, tightly packed rows
+struct PooledFrame
+{
+	const QByteArray pixels;
+	~PooledFrame();
+private:
+	friend class FramePool;
+	PooledFrame(FramePool *pool, const QByteArray & pixels) : pixels(pixels), pool(pool) {}
+	FramePool *pool;
+};
+
+typedef QSharedPointer<const PooledFrame> FrameRef;
+
+class FramePool : public FrameBudget
+{
+public:
+	/// Makes the frame that `reserved' bytes were reserve()d for.  pixels may differ in size, the difference is accounted for.
+	FrameRef adopt(const QByteArray & pixels, qint64 reserved);
+};
+#endif
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ *  FrameScaler.cpp
+ *  StimulateOpenGL_II
+ *
+ *  Separable resampling: each source row is filtered horizontally into a 16 bit
+ *  intermediate (value << 7), then each destination row is a weighted sum of
+ *  intermediate rows.  Weights are 14 bit fixed point summing to exactly 1.
+ *  The vertical pass, where upscaling spends most of its time, runs 8 samples
+ *  at a time with SSE2 and is bit-identical to the scalar code.
+ *
+ */
+#include "FrameScaler.h"
+#include <math.h>
+#include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define FS_HAVE_SSE2
+#endif
+
+#define WBITS 14
+#define WONE (1 << WBITS)
+#define HSHIFT (WBITS - 7) /* intermediate values are pixel << 7, at most 32640: fits a signed short for _mm_madd_epi16 */
+#define VSHIFT (WBITS + 7)
+
+FrameScaler::FrameScaler() : sw(0), sh(0), dw(0), dh(0), bpp(1) {}
+
+/* static */
+bool FrameScaler::filterFromString(const char *s, Filter & f)
+{
+	if (!strcmp(s, "nearest")) f = Nearest;
+	else if (!strcmp(s, "bilinear")) f = Bilinear;
+	else if (!strcmp(s, "area")) f = Area;
+	else return false;
+	return true;
+}
+
+/* static */
+void FrameScaler::makeTaps(Taps & t, int src, int dst, Filter f, double shift)
+{
+	const double s = double(src) / double(dst); // source pixels per destination pixel
+	std::vector<double> ws;
+	t.first.resize(dst);
+	t.n.resize(dst);
+	std::vector<std::vector<double> > all(dst);
+	t.maxN = 1;
+	for (int d = 0; d < dst; ++d) {
+		// the source pixels destination pixel d takes from, with their (unclamped) indices
+		int lo = 0, hi = 0;
+		ws.clear();
+		if (f == Nearest) {
+			lo = hi = int(floor((d + .5 - shift) * s));
+			ws.push_back(1.);
+		} else if (f == Bilinear) {
+			const double c = (d + .5 - shift) * s - .5;
+			lo = int(floor(c));
+			hi = lo + 1;
+			ws.push_back(1. - (c - lo));
+			ws.push_back(c - lo);
+		} else { // Area: the overlap of the destination pixel's footprint with each source pixel
+			const double a = (d - shift) * s, b = (d + 1 - shift) * s;
+			lo = int(floor(a));
+			hi = int(ceil(b)) - 1;
+			if (hi < lo) hi = lo;
+			for (int i = lo; i <= hi; ++i) {
+				const double o = (b < i+1 ? b : i+1) - (a > i ? a : i);
+				ws.push_back(o > 0. ? o / s : 0.);
+			}
+		}
+		// clamp to the frame: the edge pixels get the weight of what's beyond them
+		const int clo = lo < 0 ? 0 : (lo > src-1 ? src-1 : lo), chi = hi < 0 ? 0 : (hi > src-1 ? src-1 : hi);
+		std::vector<double> & cw = all[d];
+		cw.assign(chi - clo + 1, 0.);
+		for (int i = lo; i <= hi; ++i) {
+			const int ci = i < 0 ? 0 : (i > src-1 ? src-1 : i);
+			cw[ci - clo] += ws[i - lo];
+		}
+		t.first[d] = clo;
+		t.n[d] = int(cw.size());
+		if (t.n[d] > t.maxN) t.maxN = t.n[d];
+	}
+	t.w.assign(size_t(dst) * t.maxN, 0);
+	for (int d = 0; d < dst; ++d) {
+		const std::vector<double> & cw = all[d];
+		double sum = 0.;
+		for (size_t i = 0; i < cw.size(); ++i) sum += cw[i];
+		short *w = &t.w[size_t(d) * t.maxN];
+		int isum = 0, big = 0;
+		for (int i = 0; i < t.n[d]; ++i) {
+			w[i] = short(floor(cw[i] / sum * WONE + .5));
+			isum += w[i];
+			if (w[i] > w[big]) big = i;
+		}
+		w[big] = short(w[big] + (WONE - isum)); // so they add up to exactly 1
+	}
+}
+
+void FrameScaler::setup(int srcW, int srcH, int dstW, int dstH, int bytesPerPixel, Filter f, double shiftX, double shiftY)
+{
+	sw = srcW; sh = srcH; dw = dstW; dh = dstH; bpp = bytesPerPixel;
+	makeTaps(xt, sw, dw, f, shiftX);
+	makeTaps(yt, sh, dh, f, shiftY);
+	rowUsed.assign(sh, 0);
+	for (int y = 0; y < dh; ++y)
+		for (int k = 0; k < yt.n[y]; ++k)
+			rowUsed[yt.first[y] + k] = 1;
+}
+
+void FrameScaler::horizontal(const unsigned char *srcRow, short *out) const
+{
+	if (xt.maxN <= 2) {
+		// bilinear and nearest, and area when upscaling: 2 taps (the 2nd one possibly 0)
+		for (int x = 0; x < dw; ++x) {
+			const unsigned char *p = srcRow + xt.first[x] * bpp, *p2 = xt.n[x] > 1 ? p + bpp : p;
+			const int w0 = xt.w[size_t(x) * xt.maxN], w1 = xt.maxN > 1 ? xt.w[size_t(x) * xt.maxN + 1] : 0;
+			for (int c = 0; c < bpp; ++c)
+				out[x*bpp + c] = short((w0 * p[c] + w1 * p2[c] + (1 << (HSHIFT-1))) >> HSHIFT);
+		}
+		return;
+	}
+	for (int x = 0; x < dw; ++x) {
+		const unsigned char *p = srcRow + xt.first[x] * bpp;
+		const short *w = &xt.w[size_t(x) * xt.maxN];
+		const int n = xt.n[x];
+		for (int c = 0; c < bpp; ++c) {
+			int acc = 0;
+			for (int k = 0; k < n; ++k) acc += w[k] * p[k*bpp + c];
+			out[x*bpp + c] = short((acc + (1 << (HSHIFT-1))) >> HSHIFT);
+		}
+	}
+}
+
+void FrameScaler::vertical(const short *tmp, int y, unsigned char *out) const
+{
+	const int rowLen = dw * bpp, n = yt.n[y];
+	const short *w = &yt.w[size_t(y) * yt.maxN];
+	const short *rows = tmp + size_t(yt.first[y]) * rowLen;
+	int i = 0;
+#ifdef FS_HAVE_SSE2
+	// pairs of rows interleaved, times their pair of weights: _mm_madd_epi16 does a*w0 + b*w1, exactly like the scalar loop
+	const __m128i round = _mm_set1_epi32(1 << (VSHIFT-1)), zero = _mm_setzero_si128();
+	for ( ; i + 8 <= rowLen; i += 8) {
+		__m128i lo = zero, hi = zero;
+		for (int k = 0; k < n; k += 2) {
+			const __m128i a = _mm_loadu_si128((const __m128i *)(rows + size_t(k) * rowLen + i)),
+			              b = k+1 < n ? _mm_loadu_si128((const __m128i *)(rows + size_t(k+1) * rowLen + i)) : zero;
+			const __m128i wp = _mm_set1_epi32((int(k+1 < n ? w[k+1] : 0) << 16) | (int(w[k]) & 0xffff));
+			lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wp));
+			hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wp));
+		}
+		lo = _mm_srai_epi32(_mm_add_epi32(lo, round), VSHIFT);
+		hi = _mm_srai_epi32(_mm_add_epi32(hi, round), VSHIFT);
+		_mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(_mm_packs_epi32(lo, hi), zero));
+	}
+#endif
+	for ( ; i < rowLen; ++i) {
+		int acc = 0;
+		for (int k = 0; k < n; ++k) acc += w[k] * rows[size_t(k) * rowLen + i];
+		acc = (acc + (1 << (VSHIFT-1))) >> VSHIFT;
+		out[i] = (unsigned char)(acc > 255 ? 255 : acc);
+	}
+}
+
+void FrameScaler::scale(const unsigned char *src, unsigned char *dst) const
+{
+	if (!dw || !dh) return;
+	const int rowLen = dw * bpp;
+	std::vector<short> tmp(size_t(sh) * rowLen);
+	for (int y = 0; y < sh; ++y)
+		if (rowUsed[y]) horizontal(src + size_t(y) * sw * bpp, &tmp[size_t(y) * rowLen]);
+	for (int y = 0; y < dh; ++y)
+		vertical(&tmp[0], y, dst + size_t(y) * rowLen);
+}
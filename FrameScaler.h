@@ -0,0 +1,51 @@
+/*
+ *  FrameScaler.h
+ *  StimulateOpenGL_II
+ *
+ *  Resamples 8-bit movie frames (luminance or packed RGB) on the CPU, for the
+ *  Movie plugin's `scale_mode cpu'.  Fixed point throughout, so a given frame
+ *  and setup always give the same bytes, with or without SSE2.
+ *
+ */
+#ifndef FrameScaler_H
+#define FrameScaler_H
+
+#include <vector>
+
+class FrameScaler
+{
+public:
+	enum Filter { Nearest = 0, Bilinear, Area };
+
+	FrameScaler();
+
+	/// Sets up for srcW x srcH frames of bytesPerPixel (1 or 3) bytes per pixel to become dstW x dstH.
+	/// The picture is moved right by shiftX and down by shiftY destination pixels (sub-pixel positioning), the edge pixels repeat.
+	void setup(int srcW, int srcH, int dstW, int dstH, int bytesPerPixel, Filter f, double shiftX = 0., double shiftY = 0.);
+
+	/// src and dst rows are tightly packed.  Doesn't modify the FrameScaler, so threads can share one.
+	void scale(const unsigned char *src, unsigned char *dst) const;
+
+	int dstWidth() const { return dw; }
+	int dstHeight() const { return dh; }
+	int dstBytes() const { return dw*dh*bpp; }
+
+	static bool filterFromString(const char *s, Filter & f); ///< "nearest", "bilinear" or "area"
+
+private:
+	/// for each destination column (or row): the first source one it uses, how many, and their weights (in 1/WOne)
+	struct Taps {
+		std::vector<int> first, n;
+		std::vector<short> w; ///< maxN per destination column, 0 padded
+		int maxN;
+	};
+	static void makeTaps(Taps & t, int src, int dst, Filter f, double shift);
+	void horizontal(const unsigned char *srcRow, short *out) const;
+	void vertical(const short *tmp, int y, unsigned char *out) const;
+
+	int sw, sh, dw, dh, bpp;
+	Taps xt, yt;
+	std::vector<char> rowUsed; ///< source rows that some destination row needs
+};
+
+#endif
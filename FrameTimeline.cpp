@@ -0,0 +1,183 @@
+#include "FrameTimeline.h"
+#include <QFile>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <string.h>
+
+void LatencyHistogram::reset()
+{
+	memset(counts, 0, sizeof(counts));
+	n = vmax = 0;
+}
+
+/* static */
+u64 LatencyHistogram::bucketUpperBound(unsigned b)
+{
+	if (b < unsigned(SubCount)) return b;
+	const unsigned shift = (b >> SubBits) - 1, sub = b & (SubCount-1);
+	return ((u64(SubCount + sub)) << shift) + ((u64(1) << shift) - 1);
+}
+
+u64 LatencyHistogram::percentile(double pct) const
+{
+	if (!n) return 0;
+	u64 want = u64(ceil(double(n) * pct / 100.0));
+	if (want < 1) want = 1;
+	if (want > n) want = n;
+	u64 seen = 0;
+	for (unsigned b = 0; b < unsigned(NBuckets); ++b) {
+		seen += counts[b];
+		if (seen >= want) {
+			const u64 ub = bucketUpperBound(b);
+			return ub < vmax ? ub : vmax;
+		}
+	}
+	return vmax;
+}
+
+FrameTimeline::FrameTimeline()
+	: ring(RingSize), pos(0), nRecorded(0), lastStart(0), active(false)
+{
+	memset(&ring[0], 0, sizeof(Record)*ring.size());
+}
+
+void FrameTimeline::reset()
+{
+	QMutexLocker l(&mut);
+	pos = 0;
+	nRecorded = 0;
+	lastStart = 0;
+	active = false;
+	for (int i = 0; i < N_Stats; ++i) hists[i].reset();
+}
+
+/* static */
+const char *FrameTimeline::phaseName(int p)
+{
+	static const char * const names[N_Stats] = {
+		"Start", "Draw", "FTBox", "FrameShare", "Swap", "DAQ", "AfterVSync", "Housekeeping", "Total", "Interval"
+	};
+	if (p < 0 || p >= N_Stats) return "";
+	return names[p];
+}
+
+void FrameTimeline::endFrame(int frameNum)
+{
+	if (!active) return;
+	active = false;
+	Record & r (ring[pos]);
+	r.frameNum = frameNum;
+	QMutexLocker l(&mut);
+	// each phase that happened lasted from the end of the last phase that happened before it
+	u64 prev = r.t[Start], last = prev;
+	for (int i = Start+1; i < N_Phases; ++i) {
+		if (!r.t[i]) continue;
+		hists[i].add(r.t[i] > prev ? r.t[i]-prev : 0);
+		prev = last = r.t[i];
+	}
+	hists[Total].add(last - r.t[Start]);
+	if (lastStart) hists[Interval].add(r.t[Start] > lastStart ? r.t[Start]-lastStart : 0);
+	lastStart = r.t[Start];
+	++nRecorded;
+	if (++pos >= RingSize) pos = 0;
+}
+
+void FrameTimeline::snapshot(Snapshot & s, bool withRecords) const
+{
+	s.records.clear();
+	QMutexLocker l(&mut);
+	for (int i = 0; i < N_Stats; ++i) s.hists[i] = hists[i];
+	if (!withRecords) return;
+	// oldest first, the ring is at most two contiguous runs
+	const unsigned n = frameCount() < RingSize ? frameCount() : RingSize-1,
+	               oldest = nRecorded < RingSize ? 0 : (pos+1) % RingSize,
+	               n1 = MIN(n, RingSize - oldest);
+	s.records.reserve(n);
+	s.records.insert(s.records.end(), ring.begin() + oldest, ring.begin() + oldest + n1);
+	s.records.insert(s.records.end(), ring.begin(), ring.begin() + (n - n1));
+}
+
+void FrameTimeline::writeStats(QTextStream & strm) const
+{
+	Snapshot s;
+	snapshot(s, false);
+	writeStats(s, strm);
+}
+
+/* static */
+void FrameTimeline::writeStats(const Snapshot & s, QTextStream & strm)
+{
+	for (int i = Start+1; i < N_Stats; ++i) {
+		const LatencyHistogram & h (s.hists[i]);
+		const QString pfx = QString("frameTime_") + phaseName(i);
+		strm << pfx << "_count = " << h.count() << "\n"
+			 << pfx << "_p50_us = " << h.percentile(50.)/1e3 << "\n"
+			 << pfx << "_p99_us = " << h.percentile(99.)/1e3 << "\n"
+			 << pfx << "_p99.9_us = " << h.percentile(99.9)/1e3 << "\n"
+			 << pfx << "_max_us = " << h.max()/1e3 << "\n";
+	}
+}
+
+/* static */
+bool FrameTimeline::saveChromeTrace(const Snapshot & s, const QString & fn)
+{
+	QFile f(fn);
+	if (!f.open(QIODevice::WriteOnly|QIODevice::Truncate|QIODevice::Text)) {
+		Error() << "Could not open frame timeline trace file " << fn << " for writing.";
+		return false;
+	}
+	QTextStream ts(&f);
+	ts.setRealNumberNotation(QTextStream::FixedNotation);
+	ts.setRealNumberPrecision(3);
+	const unsigned n = unsigned(s.records.size());
+	const u64 t0 = n ? s.records[0].t[Start] : 0;
+	ts << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	bool first = true;
+	for (unsigned i = 0; i < n; ++i) {
+		const Record & r (s.records[i]);
+		u64 prev = r.t[Start], last = prev;
+		for (int p = Start+1; p < N_Phases; ++p) if (r.t[p]) last = r.t[p];
+		// one enclosing event per frame, with the phases nested inside it
+		ts << (first ? "" : ",\n") << "{\"name\":\"Frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << (r.t[Start]-t0)/1e3 
+		   << ",\"dur\":" << (last-r.t[Start])/1e3 << ",\"args\":{\"frameNum\":" << r.frameNum << ",\"hwfc\":" << r.hwfc << "}}";
+		first = false;
+		for (int p = Start+1; p < N_Phases; ++p) {
+			if (!r.t[p]) continue;
+			ts << ",\n{\"name\":\"" << phaseName(p) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << (prev-t0)/1e3 
+			   << ",\"dur\":" << (r.t[p]-prev)/1e3 << "}";
+			prev = r.t[p];
+		}
+	}
+	ts << "\n]}\n";
+	ts.flush();
+	if (f.error() != QFile::NoError) {
+		Error() << "Error writing frame timeline trace file " << fn << ": " << f.errorString();
+		return false;
+	}
+	Log() << "Saved frame timing trace (" << n << " frames) to `" << fn << "'";
+	return true;
+}
+
+/* static */
+bool FrameTimeline::saveBinary(const Snapshot & s, const QString & fn)
+{
+	QFile f(fn);
+	if (!f.open(QIODevice::WriteOnly|QIODevice::Truncate)) {
+		Error() << "Could not open frame timeline binary file " << fn << " for writing.";
+		return false;
+	}
+	const unsigned n = unsigned(s.records.size());
+	BinaryHeader h;
+	memcpy(h.magic, "SGLFTL01", 8);
+	h.nPhases = N_Phases;
+	h.nRecords = n;
+	h.recordSize = sizeof(Record);
+	h.reserved = 0;
+	bool ok = f.write((const char *)&h, sizeof(h)) == qint64(sizeof(h));
+	if (ok && n) ok = f.write((const char *)&s.records[0], sizeof(Record)*n) == qint64(sizeof(Record)*n);
+	if (!ok) {
+		Error() << "Error writing frame timeline binary file " << fn << ": " << f.errorString();
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,161 @@
+#ifndef FrameTimeline_H
+#define FrameTimeline_H
+
+#include <vector>
+#include <QString>
+#include <QMutex>
+#include "TypeDefs.h"
+#include "Util.h"
+
+class QTextStream;
+
+/** \brief Log-linear latency histogram (HDR histogram style) for durations in nanoseconds.
+
+    Values below 2^SubBits ns get their own bucket, above that each power of two is
+    split into 2^SubBits buckets, so any reported value is within ~3% of the real one.
+    add() is a couple of integer ops, no allocation. */
+class LatencyHistogram
+{
+public:
+	enum { SubBits = 5, SubCount = 1<<SubBits, NBuckets = (64-SubBits+1)*SubCount };
+
+	LatencyHistogram() { reset(); }
+
+	void reset();
+	inline void add(u64 ns);
+
+	u64 count() const { return n; }
+	u64 max() const { return vmax; }
+	/// Returns the (upper bound of the bucket holding the) value at percentile pct, pct in [0,100]
+	u64 percentile(double pct) const;
+
+	static inline unsigned bucketOf(u64 ns);
+	static u64 bucketUpperBound(unsigned bucket);
+
+private:
+	u32 counts[NBuckets];
+	u64 n, vmax;
+};
+
+/** \brief Per-frame timeline of the phases of GLWindow::paintGL().
+
+    Each frame gets a slot in a preallocated ring holding the timestamp at the
+    end of each Phase (0 if the phase did not happen that frame), along with the
+    hardware frame count and plugin frame number.  At endFrame() the phase
+    durations and the frame-to-frame interval are added to LatencyHistograms,
+    which back the percentiles reported by the GETSTATS command.
+    On plugin stop the ring can be saved as a Chrome trace (chrome://tracing,
+    Perfetto) and as a raw binary log.
+
+    Recording takes no lock except once per frame in endFrame(), to add to
+    the histograms.  Other threads read the timeline through snapshot(), which
+    copies it under that lock, and then format or save the copy without
+    holding anything. */
+class FrameTimeline
+{
+public:
+	enum Phase {
+		Start = 0,    ///< paintGL() entry
+		Draw,         ///< clearing + plugin drawFrame() + hotspot/warp pass, or delay/blink/blank frame
+		FTBox,        ///< frame track box, afterFTBoxDraw(), frame dump to disk
+		FrameShare,   ///< box selector, glFlush, SpikeGL frame share readback
+		Swap,         ///< swapBuffers(), ie the vsync wait
+		DAQ,          ///< DO/AO writes after the vsync
+		AfterVSync,   ///< plugin afterVSync()
+		Housekeeping, ///< realtime param update housekeeping
+		N_Phases
+	};
+	/// histograms kept in addition to the per-phase ones
+	enum { Total = N_Phases, Interval, N_Stats };
+
+	static const char *phaseName(int phaseOrStat);
+
+	/// Ring capacity in frames (about 4.5 minutes at 120Hz)
+	static const unsigned RingSize = 32768;
+
+	struct Record {
+		u64 t[N_Phases]; ///< getAbsTimeNS() at the end of each phase, t[Start] is the frame start. 0 if the phase was skipped.
+		u32 hwfc;        ///< hardware frame count at frame start
+		s32 frameNum;    ///< plugin frame number drawn, or -1
+	};
+
+	FrameTimeline();
+
+	/// Clears the ring and histograms. Not thread-safe with respect to recording.
+	void reset();
+
+	inline void beginFrame(unsigned hwfc);
+	inline void mark(Phase p) { if (active) ring[pos].t[p] = getAbsTimeNS(); }
+	void endFrame(int frameNum);
+
+	unsigned frameCount() const { return nRecorded < RingSize ? unsigned(nRecorded) : RingSize; } ///< number of valid records in the ring
+	/// Only for the thread that records, or with recording stopped.  Other threads use snapshot().
+	const LatencyHistogram & histogram(int phaseOrStat) const { return hists[phaseOrStat]; }
+
+	struct Snapshot {
+		std::vector<Record> records; ///< oldest frame first
+		LatencyHistogram hists[N_Stats];
+	};
+	/// Copies the histograms, and the records if withRecords, consistently with respect to endFrame().  Safe from any thread.
+	/// If the ring is full the oldest record is left out, as the frame being recorded may be overwriting it.
+	void snapshot(Snapshot & s, bool withRecords = true) const;
+
+	/// Writes "frameTime_<Phase>_p50_us = x" etc lines for GETSTATS.  Safe from any thread.
+	void writeStats(QTextStream & strm) const;
+	static void writeStats(const Snapshot & s, QTextStream & strm);
+
+	/// Writes the records as Chrome trace event JSON. Returns false on error.
+	static bool saveChromeTrace(const Snapshot & s, const QString & fileName);
+	/// Writes the records as a binary log: a BinaryHeader followed by Record structs, host byte order.
+	static bool saveBinary(const Snapshot & s, const QString & fileName);
+
+	struct BinaryHeader {
+		char magic[8];  ///< "SGLFTL01"
+		u32 nPhases;    ///< N_Phases
+		u32 nRecords;
+		u32 recordSize; ///< sizeof(Record)
+		u32 reserved;
+	};
+
+private:
+	std::vector<Record> ring;
+	unsigned pos;     ///< slot of the frame being recorded
+	u64 nRecorded;
+	u64 lastStart;
+	bool active;
+	LatencyHistogram hists[N_Stats];
+	mutable QMutex mut; ///< guards hists, pos and nRecorded for snapshot()
+};
+
+inline unsigned LatencyHistogram::bucketOf(u64 v)
+{
+	if (v < u64(SubCount)) return unsigned(v);
+	unsigned msb;
+#if defined(__GNUC__) || defined(__clang__)
+	msb = 63u - unsigned(__builtin_clzll(v));
+#else
+	msb = 0;
+	for (u64 x = v; x >>= 1; ) ++msb;
+#endif
+	const unsigned shift = msb - SubBits;
+	return ((shift+1) << SubBits) + unsigned((v >> shift) & u64(SubCount-1));
+}
+
+inline void LatencyHistogram::add(u64 v)
+{
+	++counts[bucketOf(v)];
+	++n;
+	if (v > vmax) vmax = v;
+}
+
+inline void FrameTimeline::beginFrame(unsigned hwfc)
+{
+	Record & r (ring[pos]);
+	for (int i = 0; i < N_Phases; ++i) r.t[i] = 0;
+	r.hwfc = hwfc;
+	r.frameNum = -1;
+	r.t[Start] = getAbsTimeNS();
+	active = true;
+}
+
+#endif
@@ -75,6 +75,11 @@ bool FrameVariables::readAllFromLast(QVector<double> & out, int * nrows_out, int
 }
 
 void FrameVariables::push(const QVector<double> & vec) 
+{
+	pushRow(vec, -1, 0.);
+}
+
+void FrameVariables::pushRow(const QVector<double> & vec, int col, double colVal)
 {
 	if (!f.fileName().length()) return; ///< no filename specified.. means file was closed intentionally.. silently ignore
 	
@@ -120,12 +125,12 @@ void FrameVariables::push(const QVector<double> & vec)
 	if (var_precisions[0] != lastPrecision) 
 		ts.setRealNumberPrecision(lastPrecision = var_precisions[0]);
 	
-	ts << vec[0];
+	ts << (col == 0 ? colVal : vec[0]);
 	for (unsigned i = 1; i < n_fields; ++i) {
 		ts << " ";
 		if (var_precisions[i] != lastPrecision) 
 			ts.setRealNumberPrecision(lastPrecision = var_precisions[i]);
-		ts << vec[i];
+		ts << (int(i) == col ? colVal : vec[i]);
 	}
 	ts << "\n";
 	++cnt;
@@ -163,7 +168,16 @@ void FrameVariables::commitQueue()
 	for (QList<QVector<double> >::iterator it = varQueue.begin(); it != varQueue.end(); ++it) {
 		push(*it);
 	}
-	varQueue.clear();
+	varQueue.erase(varQueue.begin(), varQueue.end()); // unlike clear(), keeps the list's array
+}
+
+void FrameVariables::commitQueue(unsigned col, double colVal) 
+{
+	if (col >= n_fields) { commitQueue(); return; }
+	for (QList<QVector<double> >::const_iterator it = varQueue.constBegin(); it != varQueue.constEnd(); ++it) {
+		pushRow(*it, int(col), colVal);
+	}
+	varQueue.erase(varQueue.begin(), varQueue.end()); // unlike clear(), keeps the list's array
 }
 
 bool FrameVariables::readAllFromFile(QVector<double> & out, int * nrows_out, int * ncols_out, bool matlab) const
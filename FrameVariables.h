@@ -37,7 +37,10 @@ public:
 	// to the last column of the variables queued.
 	void enqueue(const QVector<double> & vec);
 	void enqueue(double varval0...);
-	void commitQueue();
+	void commitQueue(); ///< writes out the queued rows and empties the queue, keeping its storage for the next frame
+	/// Like commitQueue(), but with column col written as colVal in every row.  The rows themselves aren't modified, so
+	/// rows that share their storage with a plugin's own buffers don't get copied.
+	void commitQueue(unsigned col, double colVal);
 	unsigned queueCount() const { return varQueue.size(); }
 	QList<QVector<double> > & getQueue() { return varQueue; }
 	
@@ -45,6 +48,9 @@ public:
 	static bool readAllFromFile(const QString & filename, QVector<double> & out, int * nrows_out = 0, int * ncols_out = 0, bool matlab = true);
 
 	
+	/// the output file of the last plugin run that saved frame vars
+	static QString lastFileName();
+
 	/// read the last plugin that ran from file
 	static bool readAllFromLast(QVector<double> & out, int * nrows_out = 0, int * ncols_out = 0,bool matlab = true);
 	
@@ -71,6 +77,7 @@ public:
 	bool atEnd() const { return inp.curr_row >= inp.nrows; }
 
 private:
+	void pushRow(const QVector<double> & vec, int col, double colVal); ///< push(), with column col (if >= 0) replaced by colVal
 	static QStringList splitHeader(const QString & ln);
 	bool computeCols(const QString & fileName);
 	bool checkComputeCols();
@@ -86,7 +93,6 @@ private:
 	int cantOpenComplainCt;
 	bool needComputeCols;
 	static QStringList lastFileNames;
-	static QString lastFileName();
 	static void pushLastFileName(const QString & fn);
 	
 	QList<QVector<double> > varQueue;
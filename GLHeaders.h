@@ -133,6 +133,12 @@
 #ifndef GL_DYNAMIC_READ
 #define GL_DYNAMIC_READ                   0x88E9
 #endif
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER                   0x8892
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW                    0x88E0
+#endif
 #ifndef WIN64
 extern "C" {
  GLAPI void APIENTRY glDeleteFramebuffersEXT (GLsizei, const GLuint *);
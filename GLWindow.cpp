@@ -17,9 +17,32 @@
 #include <QImage>
 #include <QColor>
 #include <QOpenGLPixelTransferOptions>
+#include <QThread>
+#include <QSemaphore>
+#include <QAtomicInt>
 
 #define WINDOW_TITLE "StimulateOpenGL II - GLWindow"
 
+/// Calls GLWindow::paintGL() in a loop from a dedicated thread that owns the GL context.  The GUI thread borrows the context via GLWindow::lockRenderThread(), which parks this thread between frames.
+class RenderThread : public QThread
+{
+public:
+    RenderThread(GLWindow *win) : QThread(win), stop(0), parkRequested(0), w(win), haveContext(false) {}
+
+    QAtomicInt stop, parkRequested; ///< set by the GUI thread, polled by this one between frames
+    QSemaphore parked, resumed;
+
+    /// Called from this thread between frames.  If the GUI thread asked for the context, hand it over and wait for it to come back.
+    void checkPark();
+
+protected:
+    void run();
+
+private:
+    GLWindow *w;
+    bool haveContext;
+};
+
 /* static */ QImage GLWindow::defaultHotspotImg;
 
 GLWindow::GLWindow(unsigned w, unsigned h, bool frameless)
@@ -28,9 +51,10 @@ GLWindow::GLWindow(unsigned w, unsigned h, bool frameless)
 															Qt::MSWindowsOwnDC|
 #endif
 															(frameless ? Qt::FramelessWindowHint : (Qt::WindowFlags)0))), 
-       aMode(false), running(0), paused(false),
+       aMode(false), running(0), blinkFbo(0), blinkSerial(0), paused(false),
        lastHWFC(0), tLastFrame(0.), tLastLastFrame(0.), tLastRender(-1.), delayCtr(0), delayt0(0.),
-       delayFPS(0.), debugLogFrames(false), clearColor(0.5,0.5,0.5), fs_w(0), fs_h(0), fs_pbo_ix(0), fs_delay_ctr(1.0f), shader(0), fbo(0), hotspotTex(0), warpTex(0)
+       delayFPS(0.), debugLogFrames(false), clearColor(0.5,0.5,0.5), fshare(stimApp()->frameShareSlots(), stimApp()->frameShareSlotKB()*1024), fs_w(0), fs_h(0), fs_pbo_ix(0), fs_lastGrabBlinkImg(0), fs_sharedBlinkImg(0), fs_delay_ctr(1.0f), shader(0), fbo(0), hotspotTex(0), warpTex(0),
+       renderThread(0), renderLocked(false), renderLockScopes(0), lastFrameSwapped(false), raHead(0), raCount(0), raShown(0), raOff(false), loopRestartPending(0)
 
 {
     hasNvidia = false;
@@ -49,8 +73,11 @@ GLWindow::GLWindow(unsigned w, unsigned h, bool frameless)
 
     memset(fs_pbo, 0, sizeof fs_pbo);
 	memset(fs_bytesz, 0, sizeof fs_bytesz);
+	memset(fs_blinkImg, 0, sizeof fs_blinkImg);
+	memset(fs_grabW, 0, sizeof fs_grabW);
+	memset(fs_grabH, 0, sizeof fs_grabH);
 	if (fshare.shm) {
-		Log() << "GLWindow: " << (fshare.createdByThisInstance ? "Created" : "Attatched to pre-existing") <<  " SpikeGL 'frame share' memory segment, size: " << (double(fshare.size())/1024.0/1024.0) << "MB.";
+		Log() << "GLWindow: " << (fshare.createdByThisInstance ? "Created" : "Attatched to pre-existing") <<  " SpikeGL 'frame share' memory segment, size: " << (double(fshare.size())/1024.0/1024.0) << "MB, " << fshare.shm->nslots << " slots of " << (double(fshare.shm->slot_size)/1024.0/1024.0) << "MB.";
 		fshare.lock();
 		const bool already_running = fshare.shm->stimgl_pid;
 		fshare.unlock();
@@ -97,6 +124,7 @@ GLWindow::GLWindow(unsigned w, unsigned h, bool frameless)
 }
 
 GLWindow::~GLWindow() { 
+    stopRenderThread();
     if (running) running->stop(); 
     // be sure to remove all plugins while we are still a valid GLWindow instance, to avoid a crash bug
     while (pluginsList.count())
@@ -135,7 +163,7 @@ void GLWindow::setupShaders()
     }
 }
 
-void GLWindow::shaderApplyAndDraw()
+void GLWindow::shaderApplyAndDraw(GLuint srcTex)
 {
     if (!fbo || !shader) return;
     if (!fbo->isValid()) {
@@ -171,7 +199,7 @@ void GLWindow::shaderApplyAndDraw()
         QOpenGLContext::currentContext()->functions()->glActiveTexture(GL_TEXTURE0+hotspotUnit);
         glBindTexture(GL_TEXTURE_RECTANGLE, hotspotTex->textureId());
         QOpenGLContext::currentContext()->functions()->glActiveTexture(GL_TEXTURE0+texUnit);
-        glBindTexture(GL_TEXTURE_RECTANGLE, fbo->texture());
+        glBindTexture(GL_TEXTURE_RECTANGLE, srcTex ? srcTex : fbo->texture());
         glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         // render our vertex and coord buffers which don't change.. just the texture changes
@@ -194,6 +222,9 @@ void GLWindow::shaderApplyAndDraw()
 }
 
 void GLWindow::criticalCleanup() { 
+    stopRenderThread();
+    renderAheadFree();
+    delete blinkFbo, blinkFbo = 0;
 	if (fshare.shm) { fshare.lock(); fshare.shm->stimgl_pid = 0; fshare.unlock(); }
 	if (fs_pbo[0]) { glDeleteBuffers(N_PBOS, fs_pbo); memset(fs_pbo, 0, sizeof fs_pbo); }
 	if (clrImg_tex) glDeleteTextures(1, &clrImg_tex), clrImg_tex = clrImg_w = clrImg_h = 0; 
@@ -290,6 +321,9 @@ void GLWindow::resizeGL(int w, int h)
     setupHotspotTex();
     setupWarpTex();
 
+    renderAheadReset();
+    renderAheadFree(); // reallocated at the new size on the next plugin start
+    delete blinkFbo, blinkFbo = 0; // reallocated at the new size on the next blink
     if (fbo) delete fbo, fbo = 0;
     if (shader) {
         fbo = new QOpenGLFramebufferObject(w, h, GL_TEXTURE_RECTANGLE);
@@ -304,7 +338,7 @@ void GLWindow::setupHotspotTex()
 {
     const int w = win_width, h = win_height;
 
-    if (QGLContext::currentContext() != context()) context()->makeCurrent();
+    if (QGLContext::currentContext() != context()) makeCurrent();
 
     // scale the hotspot correction image to the new size...
     if (hotspotTex) delete hotspotTex, hotspotTex = 0;
@@ -330,7 +364,7 @@ void GLWindow::setupWarpTex()
 {
     const int w = win_width, h = win_height;
 
-    if (QGLContext::currentContext() != context()) context()->makeCurrent();
+    if (QGLContext::currentContext() != context()) makeCurrent();
 
     // scale the hotspot correction image to the new size...
     if (warpTex) delete warpTex, warpTex = 0;
@@ -452,15 +486,140 @@ static void adjustRefreshToKnownPresets(double & delayFPS) {
 }
 
 
+/// One frame of the render-ahead ring, along with the per-frame plugin state that is replayed when it is shown
+struct GLWindow::RenderAheadSlot
+{
+    QOpenGLFramebufferObject *fbo;
+    unsigned frameNum;
+    bool ftAssertions[StimPlugin::N_FTStates]; ///< what the plugin's drawFrame() asserted, for advanceFTState() at display time
+    QList<QVector<double> > fvQueue; ///< frame vars enqueued by drawFrame(), committed by afterFTBoxDraw() at display time
+    QVector<StimPlugin::PendingDAQWrite> pendingDOWrites, pendingAOWrites; ///< DO/AO writes to do right after this frame's vsync
+    QByteArray pluginState; ///< StimPlugin::saveRenderAheadState() from just before this frame was drawn
+    bool haveState, ///< pluginState is valid
+         paramsChanged; ///< the housekeeping after this frame applied new params, which rewinding can't undo
+
+    RenderAheadSlot() : fbo(0), frameNum(0), haveState(false), paramsChanged(false) { for (int i = 0; i < StimPlugin::N_FTStates; ++i) ftAssertions[i] = false; }
+    ~RenderAheadSlot() { delete fbo; }
+};
+
+void GLWindow::doPendingDAQWrites(RenderAheadSlot *s, int skipDOChan)
+{
+	QVector<StimPlugin::PendingDAQWrite> & pendingDOWrites (s ? s->pendingDOWrites : running->pendingDOWrites),
+	                                     & pendingAOWrites (s ? s->pendingAOWrites : running->pendingAOWrites);
+	for (QVector<StimPlugin::PendingDAQWrite>::const_iterator it = pendingDOWrites.begin(); it != pendingDOWrites.end(); ++it) {
+		const StimPlugin::PendingDAQWrite & w = *it;
+		if (skipDOChan >= 0 && w.chan == skipDOChan) 
+			Warning() << "Specified to setDOline " << w.devChanString << " conflicts with DO_with_vsync line! Ignoring...";
+		else DAQ::AsyncWriteDO(w.chan, !eqf(0.0, w.volts));
+	}
+	for (QVector<StimPlugin::PendingDAQWrite>::const_iterator it = pendingAOWrites.begin(); it != pendingAOWrites.end(); ++it) {
+		const StimPlugin::PendingDAQWrite & w = *it;
+		DAQ::AsyncWriteAO(w.chan, w.volts);
+	}
+	pendingDOWrites.clear(), pendingAOWrites.clear();
+}
+
+/// Stops the running plugin at the end of its loop and restarts it for the next loop (if any), drawing the delay/end state frame meanwhile.
+/// Returns true if it drew the end state blank screen.  Sets dframe for the "looped" debug output.
+bool GLWindow::loopRestart(bool & dframe)
+{
+	bool drewEndStateBlankScreen = false;
+	const unsigned timerpd = stimApp()->busy() ? 0 : 1000/MAX(stimApp()->refreshRate(),120)/2;
+	const unsigned loopCt = running->loopCt + 1, nLoops = running->nLoops;
+	StimPlugin * const p = running;
+	const bool doRestart = !nLoops || loopCt < nLoops;
+	const bool hadDelay = (delayCtr = p->delay) > 0;
+	
+	p->setSBString(QString().sprintf("Delay counter: %d", delayCtr));
+	
+	// NB: Need to draw this here as StimPlugin::stop() could potentially take FOREVER (checkerflicker!!)
+	//     So we will do it here -- put the BG frame up as quickly as possible then worry about calling stop.
+	//     We need to put the BG frame up in cases where we are stopping for good (in which case it's a gray
+	//     bg, no ft box) or in cases where there are delay frames and we are looping -- in which case we put
+	//     up the delay frame!
+	if (!doRestart || hadDelay) {
+		// force screen clear *NOW* as per Anthony's specs, so that we don't hang on last frame forever..
+		drawEndStateBlankScreenImmediately(p, !doRestart);
+		drewEndStateBlankScreen = true;
+		/**/
+		 /// XXX
+		 Debug() << "looped, drew delayframe, hwfc=" << getHWFrameCount() << ", delayCtr=" << delayCtr;
+		 dframe = true;
+		 //*/
+	}
+	--delayCtr;
+
+	const double t0 = getTime();
+	const int saved_delayCtr = delayCtr;
+	p->stop(false,false,doRestart);
+	if (doRestart) {
+		if (!renderThread) timer->stop();
+		blockPaint = true;
+		p->loopCt = loopCt;
+		p->start(true);
+		p->waitForInitialization();
+		blockPaint = false;
+		if (!renderThread) timer->start(timerpd);					
+		delayCtr = saved_delayCtr;
+		p->setSBString(QString().sprintf("Delay counter: %d", delayCtr));
+		p->loopCt = loopCt;
+		// BEGIN UGLY HACK #7812
+		if (!p->dontCloseFVarFileAcrossLoops) 
+			p->frameVars->closeAndRemoveOutput(); /// remove redundant frame var file, unless we are moving object and we are doing random trials
+		// END UGLY HACK #7812
+
+		double tRestart = getTime() - t0;
+		int frameFudge = (int)qRound( tRestart * delayFPS ); ///< this many frames have elapsed during startup, so reduce our delay Ctr by that much
+		if (frameFudge > 0 && delayCtr > 0) {
+			// force a frame so as to re-synch us to the vsync signal so that the fudge factor becomes more accurate
+			drawEndStateBlankScreenImmediately(p, false);
+			drewEndStateBlankScreen = true;
+		}
+		// now we are synched to the vsync signal, so hopefully this fudging is more accurate 
+		tRestart = getTime() - t0;
+		frameFudge = (int)qRound( tRestart * delayFPS );
+		delayCtr -= frameFudge; 
+		if (hadDelay && delayCtr < 0) {
+			Warning() << "Inter-loop restart/setup time of " << tRestart << "s took longer than delay=" << p->delay << " frames!  Increase `delay' to avoid this situation!";
+		}
+		
+		/// XXX
+		Debug() << "reinitted, tRestart=" << tRestart << ", hwfc=" << getHWFrameCount() << ", delayCtr=" << delayCtr;
+
+		/**/
+		 /// XXX
+		 dframe = true;
+		 //*/					
+	} else
+		delayCtr = 0;
+	return drewEndStateBlankScreen;
+}
+
+void GLWindow::queuedLoopRestart()
+{
+	if (!loopRestartPending.loadAcquire()) return;
+	makeCurrent(); // parks the render thread, it gets the context back once we return to the event loop
+	bool dframe = false;
+	if (running && running->initted
+		&& ((running->nFrames && running->frameNum >= running->nFrames)
+			|| (running->have_fv_input_file && running->frameVars->atEnd())))
+		loopRestart(dframe);
+	loopRestartPending.storeRelease(0);
+}
+
 // draw each frame
 void GLWindow::paintGL()
 {
 	if (blockPaint) return;
+    if (renderThread && QThread::currentThread() != renderThread) return;
+    if (renderThread && loopRestartPending.loadAcquire()) { lastFrameSwapped = false; return; } // the GUI thread is restarting the plugin's loop, see queuedLoopRestart()
+    if (!renderThread && stimApp()->isRenderThread() && !stimApp()->busy())
+        QTimer::singleShot(0, this, SLOT(startRenderThread())); // hand off the GL context once we are back in the event loop
 	
     tThisFrame = getTime();
     bool signalDIOOn = false;
 	
-    if (timer->isActive()) return; // this was a spurious paint event
+    if (!renderThread && timer->isActive()) return; // this was a spurious paint event
     unsigned timerpd = 1000/MAX(stimApp()->refreshRate(),120)/2;
     if (stimApp()->busy()) timerpd = 0;
 
@@ -473,6 +632,9 @@ void GLWindow::paintGL()
 #endif
 
     lastHWFC = getHWFrameCount();
+    raShown = 0;
+    const bool timingThisFrame = running;
+    if (timingThisFrame) timeline.beginFrame(lastHWFC);
                
     bool doBufSwap = false;
 
@@ -491,6 +653,8 @@ void GLWindow::paintGL()
 	const bool haveBlinkBuf = running && *Nblinks > 1 && *blinkCt > 0;
 	const bool saveBlinkBuf = !haveBlinkBuf && running && *Nblinks > 1 && *blinkCt == 0;
     bool drewEndStateBlankScreen = false;
+	unsigned fsBlinkImg = 0; ///< nonzero if the back buffer holds blinked frame # blinkSerial
+	int shownFrameNum = -1; ///< the plugin frame this call swaps in, -1 for delay frames, blink repeats etc
 	
     if (!paused && (!blinkCt || !(*blinkCt) || saveBlinkBuf)) {
         // NB: don't clear here, let the plugin do clearing as an optimization
@@ -503,73 +667,14 @@ void GLWindow::paintGL()
 			// if nFrames mode and frameNum >= nFrames.. loop plugin by stopping then restarting
 			if ((running->nFrames && running->frameNum >= running->nFrames)
 				|| (running->have_fv_input_file && running->frameVars->atEnd())) { /// or if reading framevar file and it ended..
-				const unsigned loopCt = running->loopCt + 1, nLoops = running->nLoops;
-				StimPlugin * const p = running;
-				const bool doRestart = !nLoops || loopCt < nLoops;
-				const bool hadDelay = (delayCtr = p->delay) > 0;
-				
-				p->customStatusBarString.sprintf("Delay counter: %d", delayCtr);
-				
-				// NB: Need to draw this here as StimPlugin::stop() could potentially take FOREVER (checkerflicker!!)
-				//     So we will do it here -- put the BG frame up as quickly as possible then worry about calling stop.
-				//     We need to put the BG frame up in cases where we are stopping for good (in which case it's a gray
-				//     bg, no ft box) or in cases where there are delay frames and we are looping -- in which case we put
-				//     up the delay frame!
-				if (!doRestart || hadDelay) {
-					// force screen clear *NOW* as per Anthony's specs, so that we don't hang on last frame forever..
-					drawEndStateBlankScreenImmediately(p, !doRestart);
-                    drewEndStateBlankScreen = true;
-					/**/
-					 /// XXX
-					 Debug() << "looped, drew delayframe, hwfc=" << getHWFrameCount() << ", delayCtr=" << delayCtr;
-					 dframe = true;
-					 //*/
+				if (renderThread) {
+					// StimPlugin::stop()/start() must run in the GUI thread, where the plugin lives: hand the restart over to it and wait
+					if (loopRestartPending.testAndSetOrdered(0, 1))
+						QMetaObject::invokeMethod(this, "queuedLoopRestart", Qt::QueuedConnection);
+					lastFrameSwapped = false;
+					return;
 				}
-				--delayCtr;
-
-				const double t0 = getTime();
-				const int saved_delayCtr = delayCtr;
-				p->stop(false,false,doRestart);
-				if (doRestart) {
-					timer->stop();
-					blockPaint = true;
-					p->loopCt = loopCt;
-					p->start(true);
-					p->waitForInitialization();
-					blockPaint = false;
-					timer->start(timerpd);					
-					delayCtr = saved_delayCtr;
-					p->customStatusBarString.sprintf("Delay counter: %d", delayCtr);
-					p->loopCt = loopCt;
-					// BEGIN UGLY HACK #7812
-					if (!p->dontCloseFVarFileAcrossLoops) 
-						p->frameVars->closeAndRemoveOutput(); /// remove redundant frame var file, unless we are moving object and we are doing random trials
-					// END UGLY HACK #7812
-
-					double tRestart = getTime() - t0;
-					int frameFudge = (int)qRound( tRestart * delayFPS ); ///< this many frames have elapsed during startup, so reduce our delay Ctr by that much
-					if (frameFudge > 0 && delayCtr > 0) {
-						// force a frame so as to re-synch us to the vsync signal so that the fudge factor becomes more accurate
-						drawEndStateBlankScreenImmediately(p, false);
-                        drewEndStateBlankScreen = true;
-					}
-					// now we are synched to the vsync signal, so hopefully this fudging is more accurate 
-					tRestart = getTime() - t0;
-					frameFudge = (int)qRound( tRestart * delayFPS );
-					delayCtr -= frameFudge; 
-					if (hadDelay && delayCtr < 0) {
-						Warning() << "Inter-loop restart/setup time of " << tRestart << "s took longer than delay=" << p->delay << " frames!  Increase `delay' to avoid this situation!";
-					}
-					
-					/// XXX
-					Debug() << "reinitted, tRestart=" << tRestart << ", hwfc=" << getHWFrameCount() << ", delayCtr=" << delayCtr;
-
-					/**/
-					 /// XXX
-					 dframe = true;
-					 //*/					
-				} else
-					delayCtr = 0;
+				drewEndStateBlankScreen = loopRestart(dframe);
 			}
 			if (running && delayCtr > 0) {
 				drawEndStateBlankScreen(running, false); ///< this draws the FT box in the end state
@@ -578,29 +683,61 @@ void GLWindow::paintGL()
 					if (delayt0 <= 0.) delayt0 = getTime();
 				}
 				--delayCtr;
-				running->customStatusBarString.sprintf("Delay counter: %d", delayCtr);
+				running->setSBString(QString().sprintf("Delay counter: %d", delayCtr));
 				doBufSwap = true;
+				timeline.mark(FrameTimeline::Draw);
 			} else if (running) { // note: code above may have stopped plugin, check if it's still running
 
-                if (fbo && !fbo->bind())
-                    Error() << "FBO bind() returned false!";
+				if (renderAheadActive() && !raCount && raOff) {
+					// the last prerendered frame was shown, from now on draw directly
+					renderAheadFree();
+				} else if (renderAheadActive()) {
+					// nothing prerendered (plugin start, or it fell behind), so render this frame now -- twice if a param update just flushed it
+					for (int i = 0; i < 2 && running && !raCount; ++i) renderAheadRenderOne();
+					if (running && raCount) renderAheadPresent();
+				}
+				
+				if (running && !raShown) {
+					if (fbo && !fbo->bind())
+						Error() << "FBO bind() returned false!";
 
-                if (!running->pluginDoesOwnClearing)
-					running->clearScreen();
+					if (!running->pluginDoesOwnClearing)
+						running->clearScreen();
 
 				
-				glEnable(GL_SCISSOR_TEST); /// < the frame happens within our scissor rect, (lmargin, etc support)
-				running->drawFrame();
-                glDisable(GL_SCISSOR_TEST);
+					glEnable(GL_SCISSOR_TEST); /// < the frame happens within our scissor rect, (lmargin, etc support)
+					DAQ::SetFrameNum(int(running->frameNum));
+					running->drawFrame();
+					glDisable(GL_SCISSOR_TEST);
 
-                if (fbo && fbo->isBound()) fbo->release();
-                shaderApplyAndDraw(); // renders the above FBO to screen, having applied the shader to it
+					if (fbo && fbo->isBound()) fbo->release();
+					shaderApplyAndDraw(); // renders the above FBO to screen, having applied the shader to it
+				}
+                timeline.mark(FrameTimeline::Draw);
 
 				if (running) { // NB: drawFrame may have called stop(), thus NULLing this pointer, so check it again
+					if (raShown) {
+						// put back the frame track assertions and frame vars the plugin made when it drew this frame
+						for (int i = 0; i < StimPlugin::N_FTStates; ++i) {
+							const bool b = running->ftAssertions[i];
+							running->ftAssertions[i] = raShown->ftAssertions[i];
+							raShown->ftAssertions[i] = b;
+						}
+						if (running->frameVars) running->frameVars->getQueue().swap(raShown->fvQueue);
+					}
 					running->advanceFTState(); // NB: this asserts FT_Start/FT_Change/FT_End flag, if need be, etc, and otherwise decides whith FT color to us.  Looks at running->nFrames, etc
 					running->drawFTBox();
 					running->afterFTBoxDraw();
+					if (raShown) {
+						// restore anything asserted/enqueued while prerendering frames after this one
+						for (int i = 0; i < StimPlugin::N_FTStates; ++i) running->ftAssertions[i] = raShown->ftAssertions[i];
+						if (running->frameVars) running->frameVars->getQueue().swap(raShown->fvQueue);
+						raShown->fvQueue.clear();
+					}
 					if (debugLogFrames) running->logBackbufferToDisk();
+					timeline.mark(FrameTimeline::FTBox);
+					shownFrameNum = int(running->frameNum);
+					running->hwTimedOutputFrame(running->frameNum); // (re)starts hardware-timed output clocking at this frame, if need be
 					++running->frameNum;
 					if (running->delay <= 0 && running->frameNum == 1)
 						signalDIOOn = true;
@@ -609,7 +746,7 @@ void GLWindow::paintGL()
 				
 			}
         }
-		if (saveBlinkBuf) copyBlinkBuf();
+		if (saveBlinkBuf && copyBlinkBuf()) fsBlinkImg = blinkSerial;
     }	
 	if (!paused && blinkCt && ++(*blinkCt) >= *Nblinks) *blinkCt = 0; 
 	if (!running) {  
@@ -623,22 +760,28 @@ void GLWindow::paintGL()
 		// if so, draw plugin bg with ftrack_end box
 		drawEndStateBlankScreen(running, false);
 		doBufSwap = true;
+		timeline.mark(FrameTimeline::Draw);
 	} else if (running && !paused && haveBlinkBuf) {
 		drawBlinkBuf();
+		fsBlinkImg = blinkSerial;
 		doBufSwap = true;
+		timeline.mark(FrameTimeline::Draw);
 	}
 
     tLastLastFrame = tLastFrame;
     tLastFrame = tThisFrame;
+    lastFrameSwapped = doBufSwap;
 
     if (doBufSwap) {// doBufSwap is normally true either if we don't have aMode or if we have a plugin and it is running and not paused
 
-		boxSelector->draw();
+		if (boxSelector->draw()) fsBlinkImg = 0; // box outline is drawn on top, so it's not a plain repeat
 
 		glFlush();
-        processFrameShare(GL_BACK);
+        processFrameShare(GL_BACK, fsBlinkImg);
+        timeline.mark(FrameTimeline::FrameShare);
 
 		swapBuffers();// should wait for vsync...   
+        timeline.mark(FrameTimeline::Swap);
 
         detectDroppedFrame();
 
@@ -656,24 +799,17 @@ void GLWindow::paintGL()
 		}
 		
 		if (running && !paused) {
-			// Do DO and AO writes immediately after the vsync..
-			QString devChan; bool did_do_vsync = false;
-			if (signalDIOOn && running->getParam("DO_with_vsync", devChan) && devChan != "off" && devChan.length())
-				DAQ::WriteDO(devChan, true), did_do_vsync=true;
+			if (shownFrameNum >= 0) DAQ::SetFrameNum(shownFrameNum);
+			// Queue DO and AO writes immediately after the vsync, the DAQ output thread does them..
+			const DAQ::ChanId vsyncChan = running->doWithVsyncChan; bool did_do_vsync = false;
+			if (signalDIOOn && vsyncChan >= 0)
+				DAQ::AsyncWriteDO(vsyncChan, true), did_do_vsync=true;
 			// do pending writes specified by params set[AD]Olines,set[AD]Ostates for this frame...
-			for (QVector<StimPlugin::PendingDAQWrite>::const_iterator it = running->pendingDOWrites.begin(); it != running->pendingDOWrites.end(); ++it) {
-				const StimPlugin::PendingDAQWrite & w = *it;
-				if (did_do_vsync && w.devChanString == devChan) 
-					Warning() << "Specified to setDOline " << w.devChanString << " conflicts with DO_with_vsync line! Ignoring...";
-				else DAQ::WriteDO(w.devChanString, !eqf(0.0, w.volts));
-			}
-			for (QVector<StimPlugin::PendingDAQWrite>::const_iterator it = running->pendingAOWrites.begin(); it != running->pendingAOWrites.end(); ++it) {
-				const StimPlugin::PendingDAQWrite & w = *it;
-				DAQ::WriteAO(w.devChanString, w.volts);
-			}
+			// (for a prerendered frame, they were saved along with it)
+			doPendingDAQWrites(raShown, did_do_vsync ? vsyncChan : -1);
 
-			running->pendingDOWrites.clear();
-			running->pendingAOWrites.clear();
+			if (running->hwTimedOutput && shownFrameNum >= 0) DAQ::ScheduledOutputTick(unsigned(shownFrameNum)); // the mock backend's stand-in for the frame clock
+			timeline.mark(FrameTimeline::DAQ);
 		}
 		
 
@@ -691,23 +827,44 @@ void GLWindow::paintGL()
 	
 	
 	
+    if (!renderThread) {
 #ifdef Q_OS_WIN
 	    //timer->start(timerpd);
 	    update();
 #else
 	    timer->start(0);
 #endif
+    }
 
-    if (running && running->initted) {
+    if (running && running->initted && renderAheadActive()) {
+		// afterVSync() and the param housekeeping already happened for each prerendered frame, right after it was drawn
+		if (!paused) {
+			renderAheadFill();
+			timeline.mark(FrameTimeline::AfterVSync);
+		} else if (!running->gotNewParams || !renderAheadFlush()) {
+			// realtime param updates while paused apply to the next frame to be prerendered, unless the ring could be flushed
+			StimPlugin * const p = running;
+			const unsigned shownFrameNum = p->frameNum;
+			p->frameNum += raCount;
+			p->doRealtimeParamUpdateHousekeeping();
+			if (running == p) p->frameNum = shownFrameNum;
+			timeline.mark(FrameTimeline::Housekeeping);
+		} else
+			timeline.mark(FrameTimeline::Housekeeping);
+    } else if (running && running->initted) {
 		if (!paused) {
 			running->cycleTimeLeft -= getTime()-tThisFrame;
 			running->afterVSync();			
+			timeline.mark(FrameTimeline::AfterVSync);
 		}
 
 		// pending param history & realtime param update support here
-		if (running)
+		if (running) {
 			running->doRealtimeParamUpdateHousekeeping();
+			timeline.mark(FrameTimeline::Housekeeping);
+		}
     }
+    if (timingThisFrame) timeline.endFrame(running ? running->getFrameNum() : -1);
     
 }
 
@@ -742,7 +899,7 @@ void GLWindow::detectDroppedFrame()
         running->putMissedFrame(static_cast<unsigned>(tDiff*1e3), int(running->frameNum-1));
 }
 
-void GLWindow::processFrameShare(GLenum which_colorbuffer)
+void GLWindow::processFrameShare(GLenum which_colorbuffer, unsigned blinkImg)
 {
     double funcStart = -1.;
 	bool doClear = false;
@@ -756,7 +913,7 @@ void GLWindow::processFrameShare(GLenum which_colorbuffer)
 			if (!fs_pbo[0] || fs_w != win_width || fs_h != win_height) {
 				if (fs_pbo[0]) glDeleteBuffers(N_PBOS, fs_pbo);
 				glGenBuffers(N_PBOS, fs_pbo);
-				fs_pbo_ix = 0;	fs_q1.clear(); fs_q2.clear();
+				fs_pbo_ix = 0;	fs_q1.clear(); fs_q2.clear(); fs_lastGrabBlinkImg = 0;
 				for (int i = 0; i < N_PBOS; ++i) {
 					glBindBuffer(GL_PIXEL_PACK_BUFFER, fs_pbo[i]);
 					glBufferData(GL_PIXEL_PACK_BUFFER, win_width*win_height*4, 0, GL_DYNAMIC_READ);
@@ -767,7 +924,15 @@ void GLWindow::processFrameShare(GLenum which_colorbuffer)
 					int ix = *it;
 					bool throwaway = ix < 0;
 					if (throwaway) ix = -ix;
+					const bool blinkRepeat = ix & FS_BlinkRepeat;
+					ix &= ~FS_BlinkRepeat;
 					--ix; // offset back..
+					if (blinkRepeat) {
+						// same image as the newest one in the ring, so just re-publish it with this frame's number and time
+						if (!throwaway && fs_sharedBlinkImg == fs_blinkImg[ix] && fshare.republish(fs_lastHWFC[ix], fs_abs_times[ix]) && excessiveDebug)
+							pushFSTSC(fs_abs_times[ix]);
+						continue;
+					}
 					double t0 = getTime();
 					// data from last frame should be ready
 					glBindBuffer(GL_PIXEL_PACK_BUFFER, fs_pbo[ix]);
@@ -775,21 +940,14 @@ void GLWindow::processFrameShare(GLenum which_colorbuffer)
 					t0 = getTime();
 					const void *fs_mem = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
 					if (excessiveDebug) Debug() << "glMapBuffer of pbo# " << ix << " took: " << (getTime()-t0)*1000. << "ms";
-					if (!throwaway && fs_mem && fshare.lock()) {
-						fshare.shm->frame_num = fs_lastHWFC[ix];
-						fshare.shm->frame_abs_time_ns = fs_abs_times[ix];
-						if (excessiveDebug) pushFSTSC(fshare.shm->frame_abs_time_ns);
-						fshare.shm->w = w;
-						fshare.shm->h = h;
-						fshare.shm->fmt = GL_BGRA;
-						static const unsigned fssds(FRAME_SHARE_SHM_DATA_SIZE);
-						fshare.shm->sz_bytes = fs_bytesz[ix] < fssds ? fs_bytesz[ix] : fssds;
-						fshare.shm->box_x = fs_rect.x/float(win_width);
-						fshare.shm->box_y = fs_rect.y/float(win_height);
-						fshare.shm->box_w = fs_rect.v3/float(win_width);
-						fshare.shm->box_h = fs_rect.v4/float(win_height);
-						memcpy((void *)fshare.shm->data, fs_mem, fshare.shm->sz_bytes);
-						fshare.unlock();
+					if (!throwaway && fs_mem) {
+						// NB: no shm lock here -- the ring slots are seqlocked, so SpikeGL can never make us wait
+						t0 = getTime();
+						fshare.publish(fs_mem, fs_grabW[ix], fs_grabH[ix], fs_lastHWFC[ix], fs_abs_times[ix],
+									   fs_rect.x/float(win_width), fs_rect.y/float(win_height), fs_rect.v3/float(win_width), fs_rect.v4/float(win_height));
+						if (excessiveDebug) Debug() << "publish of pbo# " << ix << " took: " << (getTime()-t0)*1000. << "ms";
+						if (excessiveDebug) pushFSTSC(fs_abs_times[ix]);
+						fs_sharedBlinkImg = fs_blinkImg[ix];
 					}
 					if (fs_mem) {
 						t0 = getTime();
@@ -805,35 +963,40 @@ void GLWindow::processFrameShare(GLenum which_colorbuffer)
 			fs_q1.clear();
             if (/*true*/grabThisFrame) {
 				const int ix(fs_pbo_ix % N_PBOS);
+				// a blink repeat of the last grabbed frame needs no new readback
+				const bool blinkRepeat = blinkImg && blinkImg == fs_lastGrabBlinkImg && sz == fs_bytesz[(fs_pbo_ix+N_PBOS-1) % N_PBOS];
 				fs_lastHWFC[ix] = lastHWFC;
 				fs_bytesz[ix] = sz;
+				fs_grabW[ix] = w, fs_grabH[ix] = h;
 				fs_abs_times[ix] = getAbsTimeNS();
-				glBindBuffer(GL_PIXEL_PACK_BUFFER, fs_pbo[ix]);
-				GLint bufwas;
-				glGetIntegerv(GL_READ_BUFFER, &bufwas);
-				glReadBuffer(which_colorbuffer);
-				double t0 = getTime();
-				glReadPixels(dfw?0:fs_rect.x,dfw?0:fs_rect.y,w,h,GL_BGRA,GL_UNSIGNED_BYTE,0);
-                if (excessiveDebug) Debug() << "glReadPixels of pbo#" << (ix) << " took: " << (getTime()-t0)*1000. << "ms";
-				glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
-				glReadBuffer(bufwas);
-				fs_q1.push_back(grabThisFrame ? (ix+1) : -(ix+1)); // offset up so negative takes effect
-				++fs_pbo_ix;
+				fs_blinkImg[ix] = fs_lastGrabBlinkImg = blinkImg;
+				if (blinkRepeat) {
+					fs_q1.push_back((ix+1) | FS_BlinkRepeat);
+					++fs_pbo_ix;
+				} else {
+					glBindBuffer(GL_PIXEL_PACK_BUFFER, fs_pbo[ix]);
+					GLint bufwas;
+					glGetIntegerv(GL_READ_BUFFER, &bufwas);
+					glReadBuffer(which_colorbuffer);
+					double t0 = getTime();
+					glReadPixels(dfw?0:fs_rect.x,dfw?0:fs_rect.y,w,h,GL_BGRA,GL_UNSIGNED_BYTE,0);
+					if (excessiveDebug) Debug() << "glReadPixels of pbo#" << (ix) << " took: " << (getTime()-t0)*1000. << "ms";
+					glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+					glReadBuffer(bufwas);
+					fs_q1.push_back(grabThisFrame ? (ix+1) : -(ix+1)); // offset up so negative takes effect
+					++fs_pbo_ix;
+				}
 			}
 			
 			//Debug() << "Entire fshare routine took: " << ((getTime()-t0)*1000.) << "ms";
 		} else { // !fshare.shm->enabled
 			doClear = true;
 		}
-		if (fshare.shm->do_box_select) {
-			fshare.lock();
-			fshare.shm->do_box_select = 0;
-			fshare.unlock();
+		if (fshare.takeBoxSelectRequest()) {
 			fs_rect_saved = fs_rect = boxSelector->getBox();
 			boxSelector->setEnabled(true);
 			boxSelector->setHidden(false);
-			activateWindow();
-			raise();
+			QMetaObject::invokeMethod(this, "activateAndRaise"); // may be on the render thread
 			Log() << "SpikeGL requested a 'frame-share' clipping rectangle definition...\n";
 			Log() << "Use the mouse cursor to adjust the rectangle, ENTER to accept it, or ESC to cancel."; 
 		}
@@ -850,23 +1013,229 @@ void GLWindow::processFrameShare(GLenum which_colorbuffer)
 		fs_pbo_ix = 0; // make sure to zero out the fs_pbo_ix always because we want to "get rid of" old/stale PBOs when user toggles enable/disable 
 		fs_q1.clear();
 		fs_q2.clear();		
+		fs_lastGrabBlinkImg = 0;
     }
     if (excessiveDebug && funcStart > 0.) Debug() << "processFrameShare total time: " << (getTime()-funcStart)*1000. << "ms";
 }
 
-void GLWindow::copyBlinkBuf() 
+bool GLWindow::copyBlinkBuf() 
 {
-	if (running) {
-		blinkBuf.resize(width()*height()*3);
-		running->readBackBuffer(blinkBuf, Vec2i(0,0), Vec2i(width(), height()), GL_UNSIGNED_BYTE);
+	if (!running) return false;
+	const QRect r(0, 0, win_width, win_height);
+	if (QOpenGLFramebufferObject::hasOpenGLFramebufferBlit()) {
+		// keep the frame on the GPU -- a glReadPixels() here would stall the pipeline every blinked frame
+		if (blinkFbo && blinkFbo->size() != r.size()) delete blinkFbo, blinkFbo = 0;
+		if (!blinkFbo) {
+			blinkFbo = new QOpenGLFramebufferObject(r.size());
+			if (!blinkFbo->isValid()) {
+				Warning() << "Could not create blink FBO, falling back to (slower) CPU-side blink buffer.";
+				delete blinkFbo, blinkFbo = 0;
+			}
+		}
 	}
+	if (blinkFbo) {
+		QOpenGLFramebufferObject::blitFramebuffer(blinkFbo, r, 0, r);
+	} else {
+		blinkBuf.resize(win_width*win_height*3);
+		running->readBackBuffer(blinkBuf, Vec2i(0,0), Vec2i(win_width, win_height), GL_UNSIGNED_BYTE);
+	}
+	++blinkSerial;
+	return true;
 }
 
 void GLWindow::drawBlinkBuf() 
 {
-	glDrawPixels(width(), height(), GL_RGB, GL_UNSIGNED_BYTE, (const void *)(blinkBuf.constData()));
+	if (blinkFbo) {
+		const QRect r(0, 0, win_width, win_height);
+		QOpenGLFramebufferObject::blitFramebuffer(0, r, blinkFbo, r);
+	} else if (blinkBuf.size() >= int(win_width*win_height*3))
+		glDrawPixels(win_width, win_height, GL_RGB, GL_UNSIGNED_BYTE, (const void *)(blinkBuf.constData()));
 }
  
+void GLWindow::renderAheadSetup(StimPlugin *p)
+{
+    int n = 0;
+    if (!p->getParam("renderAhead", n) || n < 0) n = 0;
+    const bool warn = n > 0 && !p->loopCt; // only warn once, not on every loop
+    if (n > 0 && !p->canRenderAhead()) {
+        if (warn) Warning() << p->name() << " with these params does not support renderAhead, ignoring it.";
+        n = 0;
+    } else if (n > 0 && p->have_fv_input_file) {
+        if (warn) Warning() << "renderAhead is not supported when playing back a frame_vars file, ignoring it.";
+        n = 0;
+    } else if (n > 0 && (!QOpenGLFramebufferObject::hasOpenGLFramebufferObjects() || (!shader && !QOpenGLFramebufferObject::hasOpenGLFramebufferBlit()))) {
+        if (warn) Warning() << "renderAhead needs FBO and framebuffer blit support from the GL driver, ignoring it.";
+        n = 0;
+    }
+    if (n > 0 && raOff) n = 0; // a realtime param update turned it off earlier in this run
+    raHead = raCount = 0;
+    if (n == raSlots.size()) return;
+    renderAheadFree();
+    if (!n) return;
+    makeCurrent();
+    for (int i = 0; i < n; ++i) {
+        RenderAheadSlot *s = new RenderAheadSlot;
+        s->fbo = new QOpenGLFramebufferObject(win_width, win_height, GL_TEXTURE_RECTANGLE);
+        raSlots.push_back(s);
+        if (!s->fbo->isValid()) {
+            Error() << "renderAhead: could not create FBO #" << i << ", disabling render-ahead.";
+            renderAheadFree();
+            break;
+        }
+    }
+    QOpenGLFramebufferObject::bindDefault();
+    if (raSlots.size())
+        Log() << "renderAhead: prerendering up to " << raSlots.size() << " frames (" << (double(win_width)*win_height*4.*raSlots.size()/(1024.*1024.)) << " MB of FBOs)";
+}
+
+void GLWindow::renderAheadFree()
+{
+    for (int i = 0; i < raSlots.size(); ++i) delete raSlots[i];
+    raSlots.clear();
+    raHead = raCount = 0;
+    raShown = 0;
+}
+
+void GLWindow::renderAheadReset()
+{
+    StimPlugin * const p = running;
+    if (p && raCount && !renderAheadRewind()) {
+        // the plugin's state is already past the prerendered frames, so play them out without drawing them:
+        // their frame vars rows and DO/AO writes happen as if they had been shown, and frameNum stays in step with the plugin
+        for ( ; raCount && running == p; raHead = (raHead + 1) % raSlots.size(), --raCount) {
+            RenderAheadSlot & s (*raSlots[raHead]);
+            for (int i = 0; i < StimPlugin::N_FTStates; ++i) p->ftAssertions[i] = s.ftAssertions[i];
+            if (p->frameVars) p->frameVars->getQueue().swap(s.fvQueue);
+            p->advanceFTState();
+            p->afterFTBoxDraw();
+            if (p->frameVars) p->frameVars->getQueue().clear();
+            s.fvQueue.clear();
+            DAQ::SetFrameNum(int(s.frameNum));
+            doPendingDAQWrites(&s, -1);
+            ++p->frameNum;
+        }
+    }
+    raHead = raCount = 0;
+    raShown = 0;
+}
+
+bool GLWindow::renderAheadRenderOne()
+{
+    StimPlugin * const p = running;
+    if (!p || raCount >= raSlots.size()) return false;
+    const unsigned shownFrameNum = p->frameNum, num = shownFrameNum + raCount;
+    if (p->nFrames && num >= p->nFrames) return false; // the loop restart in paintGL() happens at nFrames, don't render past it
+    RenderAheadSlot & s (*raSlots[(raHead + raCount) % raSlots.size()]);
+    const double t0 = getTime();
+
+    p->frameNum = num;
+    s.haveState = p->saveRenderAheadState(s.pluginState);
+    s.paramsChanged = false;
+    // DO/AO writes queued by the housekeeping after the previous frame belong to this frame
+    s.pendingDOWrites.clear(); s.pendingDOWrites.swap(p->pendingDOWrites);
+    s.pendingAOWrites.clear(); s.pendingAOWrites.swap(p->pendingAOWrites);
+
+    if (!s.fbo->bind()) {
+        Error() << "renderAhead: FBO bind() returned false, disabling render-ahead.";
+        p->frameNum = shownFrameNum;
+        p->pendingDOWrites.swap(s.pendingDOWrites); p->pendingAOWrites.swap(s.pendingAOWrites);
+        renderAheadFree();
+        return false;
+    }
+    p->useBGColor();
+    if (!p->pluginDoesOwnClearing)
+        p->clearScreen();
+    glEnable(GL_SCISSOR_TEST);
+    DAQ::SetFrameNum(int(num));
+    p->drawFrame();
+    glDisable(GL_SCISSOR_TEST);
+    s.fbo->release();
+    if (running != p) return false; // drawFrame() stopped the plugin
+
+    for (int i = 0; i < StimPlugin::N_FTStates; ++i)
+        s.ftAssertions[i] = p->ftAssertions[i], p->ftAssertions[i] = false;
+    s.fvQueue.clear();
+    if (p->frameVars) s.fvQueue.swap(p->frameVars->getQueue());
+    s.frameNum = num;
+    ++raCount;
+
+    // same as what paintGL() does after the vsync for a frame drawn directly
+    p->frameNum = num + 1;
+    p->cycleTimeLeft = 1.0/getHWRefreshRate() - (getTime() - t0);
+    p->afterVSync();
+    if (running != p) return false;
+    if (p->gotNewParams && renderAheadFlush()) return running == p; // the ring is empty again, refill it with the new params
+    const unsigned nHist = p->pendingParamsHistorySize();
+    const bool newParams = p->gotNewParams;
+    p->doRealtimeParamUpdateHousekeeping();
+    if (running != p) return false;
+    s.paramsChanged = newParams || nHist != p->pendingParamsHistorySize();
+    p->frameNum = shownFrameNum;
+    return true;
+}
+
+bool GLWindow::renderAheadRewind()
+{
+    StimPlugin * const p = running;
+    if (!p || !raCount) return false;
+    RenderAheadSlot & oldest (*raSlots[raHead]);
+    bool canRewind = oldest.haveState;
+    for (int i = 0; canRewind && i < raCount; ++i)
+        canRewind = !raSlots[(raHead + i) % raSlots.size()]->paramsChanged;
+    if (!canRewind) return false;
+    p->restoreRenderAheadState(oldest.pluginState);
+    // the DO/AO writes queued before the oldest frame still belong to it, everything else gets redone
+    p->pendingDOWrites.clear(); p->pendingDOWrites.swap(oldest.pendingDOWrites);
+    p->pendingAOWrites.clear(); p->pendingAOWrites.swap(oldest.pendingAOWrites);
+    for (int i = 0; i < raSlots.size(); ++i) {
+        RenderAheadSlot & s (*raSlots[i]);
+        s.fvQueue.clear(); s.pendingDOWrites.clear(); s.pendingAOWrites.clear();
+    }
+    for (int i = 0; i < StimPlugin::N_FTStates; ++i) p->ftAssertions[i] = false;
+    if (p->frameVars) p->frameVars->getQueue().clear();
+    p->frameNum = oldest.frameNum;
+    raCount = 0;
+    return true;
+}
+
+bool GLWindow::renderAheadFlush()
+{
+    StimPlugin * const p = running;
+    if (!p || !raCount) return false;
+    if (!renderAheadRewind()) {
+        // let the prerendered frames play out, with the update applied after them, then draw directly
+        if (!raOff)
+            Warning() << "renderAhead: " << p->name() << " can't discard its prerendered frames, so this param update takes effect " << raCount << " frames late and renderAhead is off for the rest of the run.";
+        raOff = true;
+        return false;
+    }
+    p->doRealtimeParamUpdateHousekeeping();
+    return true;
+}
+
+void GLWindow::renderAheadFill()
+{
+    const double tEnd = getTime() + 0.5/double(MAX(stimApp()->refreshRate(), 1U));
+    while (running && !raOff && raCount < raSlots.size() && renderAheadRenderOne() && getTime() < tEnd)
+        ;
+}
+
+void GLWindow::renderAheadPresent()
+{
+    RenderAheadSlot & s (*raSlots[raHead]);
+    if (s.frameNum != running->frameNum)
+        Error() << "INTERNAL: renderAhead frame " << s.frameNum << " presented as frame " << running->frameNum;
+    if (shader && fbo) {
+        shaderApplyAndDraw(s.fbo->texture());
+    } else {
+        const QRect r(0, 0, win_width, win_height);
+        QOpenGLFramebufferObject::blitFramebuffer(0, r, s.fbo, r);
+    }
+    raHead = (raHead + 1) % raSlots.size();
+    --raCount;
+    raShown = &s;
+}
+
 void GLWindow::pluginCreated(StimPlugin *p)
 {
     if (pluginsList.indexOf(p) < 0) {
@@ -884,12 +1253,14 @@ void GLWindow::pluginStarted(StimPlugin *p)
 {
     if (running) { running->stop(); }
     running = p;
+    if (!p->loopCt) raOff = false; // a loop restart is still the same run
 	hw_refresh = getHWRefreshRate();
     Log() << p->name() << " started";
 }
 
 void GLWindow::pluginDidFinishInit(StimPlugin *p) {
 	delayCtr = p->delay;
+	renderAheadSetup(p);
 }
 
 void GLWindow::pluginStopped(StimPlugin *p)
@@ -901,11 +1272,18 @@ void GLWindow::pluginStopped(StimPlugin *p)
 		if (!p->softCleanup) {
 			delayFPS = delayt0 = 0.;	
 		}
+        // frames prerendered but never shown are dropped along with their frame vars and DAQ writes, the run is over
+        raHead = raCount = 0;
+        raShown = 0;
+        if (!p->softCleanup) {
+            makeCurrent();
+            renderAheadFree();
+        }
         running = 0;
         paused = false;
 		hw_refresh = getHWRefreshRate();
         Log() << p->name() << " stopped.";
-        setWindowTitle(WINDOW_TITLE);
+        QMetaObject::invokeMethod(this, "setWindowTitle", Q_ARG(QString, QString(WINDOW_TITLE))); // may be on the render thread
     }
 }
 
@@ -960,6 +1338,7 @@ void GLWindow::initPlugins()
 // overrides QWidget methoed -- catch keypresses
 void GLWindow::keyPressEvent(QKeyEvent *event)
 {
+    RenderLock rl(this);
     makeCurrent(); // just in case they do opengl commands in their plugin
     if (running && running->processKey(event->key())) {
         event->accept();
@@ -1034,9 +1413,12 @@ void GLWindow::keyPressEvent(QKeyEvent *event)
 
 void GLWindow::pauseUnpause()
 {
+    RenderLock rl(this);
     if (!running) return;
     paused = !paused;
     Log() << (paused ? "Paused" : "Unpaused");
+    // paused frames don't advance frameNum, so they must not clock the hardware-timed output either.  It resumes on the next frame shown.
+    if (paused && running->hwTimedOutput) DAQ::HoldScheduledOutput();
     if (!paused && !running->frameNum && running->needNotifyStart
             && ((stimApp()->spikeGLNotifyParams.nloopsNotifyPerIter || running->loopCt == 0)) ) {
         if (stimApp()->spikeGLNotifyParams.enabled)
@@ -1079,3 +1461,126 @@ void GLWindow::pushFSTSC(quint64 tsc)
 }
 
 
+
+void RenderThread::checkPark()
+{
+    if (!parkRequested.loadAcquire()) return;
+    w->QGLWidget::doneCurrent();
+    w->context()->moveToThread(w->thread());
+    haveContext = false;
+    parkRequested.storeRelease(0);
+    parked.release();
+    resumed.acquire();
+    if (!stop.loadAcquire()) {
+        w->QGLWidget::makeCurrent();
+        haveContext = true;
+    }
+}
+
+void RenderThread::run()
+{
+    Debug() << "Render thread started.";
+    w->QGLWidget::makeCurrent();
+    haveContext = true;
+    while (!stop.loadAcquire()) {
+        checkPark();
+        if (stop.loadAcquire()) break;
+        w->paintGL();
+        if (!w->lastFrameSwapped) yieldCurrentThread(); // paused or not running: no vsync wait, so don't hog the cpu
+    }
+    if (haveContext) {
+        w->QGLWidget::doneCurrent();
+        w->context()->moveToThread(w->thread());
+        haveContext = false;
+    }
+    Debug() << "Render thread exiting.";
+}
+
+void GLWindow::startRenderThread()
+{
+    if (renderThread || !stimApp()->isRenderThread()) return;
+    timer->stop();
+    renderThread = new RenderThread(this);
+    QGLWidget::doneCurrent();
+    context()->moveToThread(renderThread);
+    renderThread->start(QThread::TimeCriticalPriority);
+    Log() << "Rendering from a dedicated render thread.";
+}
+
+void GLWindow::stopRenderThread()
+{
+    if (!renderThread) return;
+    if (!renderLocked) {
+        renderThread->parkRequested.storeRelease(1);
+        renderThread->parked.acquire();
+    }
+    renderThread->stop.storeRelease(1);
+    renderThread->resumed.release();
+    renderThread->wait();
+    delete renderThread, renderThread = 0;
+    renderLocked = false;
+    QGLWidget::makeCurrent();
+    timer->start(0);
+    Log() << "Rendering from the GUI thread.";
+}
+
+void GLWindow::lockRenderThread()
+{
+    if (!renderThread || renderLocked || QThread::currentThread() != thread()) return;
+    renderThread->parkRequested.storeRelease(1);
+    renderThread->parked.acquire();
+    renderLocked = true;
+    QTimer::singleShot(0, this, SLOT(unlockRenderThread()));
+}
+
+void GLWindow::unlockRenderThread()
+{
+    if (!renderThread || !renderLocked) return;
+    if (renderLockScopes > 0) {
+        // a RenderLock is still alive further up the stack, we got here via a nested event loop (eg a dialog)
+        QTimer::singleShot(10, this, SLOT(unlockRenderThread()));
+        return;
+    }
+    QGLWidget::doneCurrent();
+    context()->moveToThread(renderThread);
+    renderLocked = false;
+    renderThread->resumed.release();
+}
+
+void GLWindow::renderThreadCheckPark()
+{
+    if (renderThread && QThread::currentThread() == renderThread)
+        renderThread->checkPark();
+}
+
+void GLWindow::makeCurrent()
+{
+    lockRenderThread();
+    QGLWidget::makeCurrent();
+}
+
+void GLWindow::glDraw()
+{
+    if (renderThread) return;
+    QGLWidget::glDraw();
+}
+
+void GLWindow::activateAndRaise()
+{
+    activateWindow();
+    raise();
+}
+
+GLWindow::RenderLock::RenderLock(GLWindow *win)
+    : w(win && win->renderThread && QThread::currentThread() == win->thread() ? win : 0)
+{
+    if (w) {
+        w->lockRenderThread();
+        ++w->renderLockScopes;
+    }
+}
+
+GLWindow::RenderLock::~RenderLock()
+{
+    if (w) --w->renderLockScopes;
+}
@@ -3,10 +3,13 @@
 
 #include <QGLWidget>
 #include <QList>
+#include <QVector>
 #include <QImage>
+#include <QAtomicInt>
 #include "Util.h"
 #include "StimGL_SpikeGL_Integration.h"
 #include "GLBoxSelector.h"
+#include "FrameTimeline.h"
 
 class StimPlugin;
 class QTimer;
@@ -14,6 +17,7 @@ class StimApp;
 class QOpenGLShaderProgram;
 class QOpenGLFramebufferObject;
 class QOpenGLTexture;
+class RenderThread;
 
 /**
    \brief The main Open GL display window.
@@ -25,6 +29,28 @@ class QOpenGLTexture;
    runningPlugin(), isPaused() and plugins() methods.
 
    This class also handles all keyboard hotkeys (see keyPressEvent())
+
+   Frames are normally drawn from the GUI thread, driven by a QTimer.  If
+   StimApp::isRenderThread() is set, paintGL() instead runs in a loop in a
+   dedicated high-priority RenderThread that owns the GL context, so that 
+   console/status bar/dialog work in the GUI thread can't delay a frame.
+   GUI-thread code that touches GL or the running plugin must then hold a
+   RenderLock (makeCurrent() takes one implicitly).
+
+   Note that the GUI thread does not post messages to the render thread: 
+   plugins, params and the console were all written to be called directly 
+   from the GUI thread, so instead a RenderLock parks the render thread at
+   its next frame boundary and borrows the GL context.  The render thread 
+   only ever waits on the GUI thread between frames -- for a lock, or for a
+   plugin loop restart, which it hands over with a queued call since the 
+   plugins live in the GUI thread.
+
+   Plugins that are deterministic from their params (see 
+   StimPlugin::canRenderAhead()) may be run with the renderAhead param, in 
+   which case their frames are drawn up to that many frames in advance into
+   a ring of FBOs and blitted to the back buffer at display time.  The frame
+   track box, blinks and DO/AO writes are still done at display time, using 
+   the per-frame plugin state saved with each prerendered frame.
 */
    
 class GLWindow : public QGLWidget
@@ -70,6 +96,29 @@ public:
      void setWarp(const QImage &img); ///< this image has a special format where pixels are ar,gb -> x,y location (scaled to img width/height) to grab the source pixel
      void clearWarp();
 
+     /// Number of frames currently prerendered ahead of the displayed frame, see StimPlugin::canRenderAhead()
+     unsigned renderAheadCount() const { return unsigned(raCount); }
+
+     /// Per-frame phase timings of paintGL() for the current plugin run, see GETSTATS
+     FrameTimeline & frameTimeline() { return timeline; }
+     const FrameTimeline & frameTimeline() const { return timeline; }
+
+     /// Overrides QGLWidget. If the render thread is active and this is called from the GUI thread, parks the render thread and borrows the GL context until control returns to the GUI event loop.
+     void makeCurrent();
+
+     /** \brief Scoped lock for GUI-thread code that touches GL or running-plugin state.
+
+         If the render thread is active, parks it at its next frame boundary and 
+         moves the GL context to the GUI thread.  The context is given back once 
+         all RenderLocks are gone and control returns to the GUI event loop.  
+         A no-op if there is no render thread or if not called from the GUI thread. */
+     struct RenderLock {
+         RenderLock(GLWindow *w);
+         ~RenderLock();
+     private:
+         GLWindow *w;
+     };
+
 public slots:
     /// Toggles the paused/unpaused state of the plugin execution engine.
     void pauseUnpause();
@@ -102,6 +151,9 @@ protected:
          the plugin's drawFrame() function is not called. */
      void paintGL();
 
+     /// Overrides QGLWidget -- a NOOP if the render thread is active, since it draws continuously
+     void glDraw();
+
      /// override close events -- prevent window from being closed!
      void closeEvent(QCloseEvent *event);
 
@@ -114,14 +166,35 @@ protected:
 	/// overrides QWidget -- catch the refresh rate in case the window moved to a new monitor..
 	void moveEvent(QMoveEvent *event);
 
+private slots:
+    void startRenderThread();
+    void unlockRenderThread();
+    void activateAndRaise();
+    void queuedLoopRestart(); ///< loopRestart() on behalf of the render thread, which waits for it in paintGL()
+
 private:
+    friend class RenderThread;
+    RenderThread *renderThread; ///< non-NULL if rendering happens in a dedicated thread
+    bool renderLocked; ///< true if the GUI thread borrowed the GL context from the render thread
+    int renderLockScopes; ///< number of active RenderLock instances
+    bool lastFrameSwapped; ///< true if the last paintGL() call swapped buffers
+    void lockRenderThread();
+    void stopRenderThread();
+    void renderThreadCheckPark(); ///< call when the render thread waits on the GUI thread, so that lockRenderThread() can't deadlock
+    QAtomicInt loopRestartPending; ///< nonzero while the render thread waits for queuedLoopRestart()
+    bool loopRestart(bool & dframe);
+
+	FrameTimeline timeline;
+
 	bool blockPaint;
 	StimPlugin *running;
 	QList<StimPlugin *> pluginsList;
 	QTimer *timer;
-	QByteArray blinkBuf;
+	QByteArray blinkBuf; ///< CPU-side copy of the blinked frame, only used if the GL driver can't blit framebuffers
+	QOpenGLFramebufferObject *blinkFbo; ///< the blinked frame (as swapped, with FT box), repeated with a blit on the Nblinks-1 following frames
+	unsigned blinkSerial; ///< incremented each time a new frame is saved for blinking, lets processFrameShare() recognize repeats
 
-	void copyBlinkBuf();
+	bool copyBlinkBuf();
 	void drawBlinkBuf();
 
 	void initPlugins(); 
@@ -139,11 +212,14 @@ private:
 	bool debugLogFrames;
 	Util::Vec3 clearColor;
 	
-	void processFrameShare(GLenum which_colorbuffer = GL_FRONT);
+	/// blinkImg is nonzero if the color buffer holds blinked frame blinkSerial, in which case a repeat of an already grabbed image is shared without reading it back again
+	void processFrameShare(GLenum which_colorbuffer = GL_FRONT, unsigned blinkImg = 0);
 	
 	StimGL_SpikeGL_Integration::FrameShare fshare;
 	static const int N_PBOS = 2; ///< number of frameshare PBOs to use
-	GLuint fs_w, fs_h, fs_pbo[N_PBOS], fs_pbo_ix, fs_lastHWFC[N_PBOS], fs_bytesz[N_PBOS];
+	static const int FS_BlinkRepeat = 0x1000; ///< or'd into fs_q1/fs_q2 entries that repeat the previous grab rather than having their own readback
+	GLuint fs_w, fs_h, fs_pbo[N_PBOS], fs_pbo_ix, fs_lastHWFC[N_PBOS], fs_bytesz[N_PBOS], fs_grabW[N_PBOS], fs_grabH[N_PBOS];
+	unsigned fs_blinkImg[N_PBOS], fs_lastGrabBlinkImg, fs_sharedBlinkImg; ///< blink image # of each grab, of the last grab and of what's in shm (0 = not a blinked frame)
 	quint64 fs_abs_times[N_PBOS];
 	float fs_delay_ctr;
 	QList<quint64> fs_frame_tscs;
@@ -165,13 +241,30 @@ private:
     QImage hotspotImg, warpImg;
 
     void setupShaders();
-    void shaderApplyAndDraw();
+    void shaderApplyAndDraw(GLuint srcTex = 0); ///< srcTex defaults to the texture of fbo
     void setupHotspotTex();
     void setupWarpTex();
 
     bool hasNvidia, shaderNeedsSize;
 
     void detectDroppedFrame();
+
+    struct RenderAheadSlot;
+    QVector<RenderAheadSlot *> raSlots; ///< ring of prerendered frames, empty unless the running plugin uses renderAhead
+    int raHead, raCount; ///< index of the oldest prerendered frame in raSlots, and the number of prerendered frames. The next frame to prerender is running->frameNum + raCount
+    RenderAheadSlot *raShown; ///< the slot shown by this paintGL() call, if any -- its DAQ writes happen after the swap
+    bool raOff; ///< set when a realtime param update couldn't be applied by rewinding the ring: render-ahead is off for the rest of the run
+
+    bool renderAheadActive() const { return running && !raSlots.isEmpty(); }
+    void renderAheadSetup(StimPlugin *p); ///< (re)allocates the ring for p's renderAhead param, called on plugin start
+    void renderAheadFree();
+    void renderAheadReset(); ///< empties the ring on a resize: rewinds the plugin to the next frame to be shown if it can, otherwise does the prerendered frames' frame vars and DAQ writes without showing them
+    bool renderAheadRewind(); ///< restores the plugin's state from before the oldest prerendered frame and discards the ring, if it can
+    bool renderAheadFlush(); ///< on a realtime param update: rewinds the plugin to the next frame to be shown and discards the ring, if it can
+    bool renderAheadRenderOne(); ///< prerenders the next frame into the ring, followed by its afterVSync() and param housekeeping
+    void renderAheadFill(); ///< prerenders frames until the ring is full or half the refresh period is spent
+    void renderAheadPresent(); ///< draws the oldest prerendered frame to the back buffer and pops it, setting raShown
+    void doPendingDAQWrites(RenderAheadSlot *s, int skipDOChan); ///< queues and clears the DO/AO writes for the frame just shown (s's, or the running plugin's if s is NULL), skipping DO writes to skipDOChan if >= 0
 };
 
 #endif
@@ -0,0 +1,94 @@
+#ifndef LockFreeQueue_H
+#define LockFreeQueue_H
+
+#ifndef NO_QT
+#  include <QAtomicInt>
+#else
+#  ifdef _MSC_VER
+#    include <intrin.h>
+#  endif
+/// the bits of QAtomicInt that LockFreeQueue uses, for NO_QT builds (tests/)
+class QAtomicInt
+{
+public:
+    QAtomicInt(int v = 0) : v(v) {}
+#  ifdef _MSC_VER
+    int load() const { return v; }
+    int loadAcquire() const { return v; } // MSVC volatile reads acquire
+    void store(int x) { v = x; }
+    void storeRelease(int x) { v = x; } // and volatile writes release
+    bool testAndSetRelaxed(int expected, int x) { return _InterlockedCompareExchange(&v, x, expected) == expected; }
+private:
+    volatile long v;
+#  else
+    int load() const { return __atomic_load_n(&v, __ATOMIC_RELAXED); }
+    int loadAcquire() const { return __atomic_load_n(&v, __ATOMIC_ACQUIRE); }
+    void store(int x) { __atomic_store_n(&v, x, __ATOMIC_RELAXED); }
+    void storeRelease(int x) { __atomic_store_n(&v, x, __ATOMIC_RELEASE); }
+    bool testAndSetRelaxed(int expected, int x) { return __atomic_compare_exchange_n(&v, &expected, x, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED); }
+private:
+    int v;
+#  endif
+};
+#endif
+
+/** \brief Bounded lock-free multi-producer queue (Dmitry Vyukov's design).
+
+    push() may be called from any number of threads at once, pop() from one
+    consumer at a time.  Neither ever blocks or allocates: push() returns false
+    when the queue is full.  N must be a power of 2. */
+template <typename T, unsigned N>
+class LockFreeQueue
+{
+public:
+    LockFreeQueue() : cells(new Cell[N]), enqPos(0), deqPos(0)
+    {
+        for (unsigned i = 0; i < N; ++i) cells[i].seq.store(int(i));
+    }
+    ~LockFreeQueue() { delete [] cells; }
+
+    bool push(const T & t)
+    {
+        Cell *c;
+        int pos = enqPos.load();
+        for (;;) {
+            c = &cells[unsigned(pos) % N];
+            const int dif = int(unsigned(c->seq.loadAcquire()) - unsigned(pos));
+            if (!dif) {
+                if (enqPos.testAndSetRelaxed(pos, pos+1)) break; // claimed this cell
+                pos = enqPos.load();
+            } else if (dif < 0)
+                return false; // full
+            else
+                pos = enqPos.load(); // another producer got this cell first
+        }
+        c->data = t;
+        c->seq.storeRelease(pos+1); // publish it to the consumer
+        return true;
+    }
+
+    bool pop(T & t)
+    {
+        Cell & c (cells[deqPos % N]);
+        if (int(unsigned(c.seq.loadAcquire()) - (deqPos+1)) < 0) return false; // empty
+        t = c.data;
+        c.data = T(); // don't hang on to resources until the cell is reused
+        c.seq.storeRelease(int(deqPos + N)); // hand the cell back to the producers
+        ++deqPos;
+        return true;
+    }
+
+private:
+    LockFreeQueue(const LockFreeQueue &);
+    LockFreeQueue & operator=(const LockFreeQueue &);
+
+    struct Cell {
+        QAtomicInt seq;
+        T data;
+    };
+    Cell *cells;
+    QAtomicInt enqPos;
+    unsigned deqPos;
+};
+
+#endif
@@ -9,6 +9,19 @@
 %                slower maximal compression. Default is 9, or the value 
 %                specified in the FastMovieWriter constructer 
 %                (see FastMovieWriter function reference).
+%
+%    myobj = AddFrame(myobj, frames, compressionLevel, layout)
+%
+%                frames may also be an M x N x K array of K frames, which
+%                are all added in one call.  This is much faster than
+%                calling AddFrame K times.  Frames are compressed and
+%                written in the background, Finalize waits for that to
+%                finish.  The optional layout argument says how M x N
+%                maps to the movie: 'wh' (the default) makes M the width,
+%                so images have to be transposed (frame') first; 'hw'
+%                takes frames as Matlab displays them, M rows of N pixels,
+%                and transposes them in C++, which is a lot faster than
+%                transposing in Matlab.
 function g = AddFrame(varargin)
    if (nargin < 2),
        error('AddFrame takes at least two arguments!');
@@ -16,11 +29,15 @@ function g = AddFrame(varargin)
    g = varargin{1};
    frame = varargin{2};
    clevel = g.clevel;
-   if (nargin > 2),
+   if (nargin > 2 && ~isempty(varargin{3})),
        clevel = varargin{3};
    end;
    if (~isnumeric(frame)),
        error('Second argument to addFrame must be numeric array!');
    end;
-   FastMovieWriterMex('addFrame', g.handle, frame, clevel);
+   if (nargin > 3),
+       FastMovieWriterMex('addFrame', g.handle, frame, clevel, varargin{4});
+   else
+       FastMovieWriterMex('addFrame', g.handle, frame, clevel);
+   end;
 end
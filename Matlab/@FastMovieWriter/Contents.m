@@ -42,6 +42,19 @@
 %                specified in the FastMovieWriter constructer 
 %                (see FastMovieWriter function reference).
 %
+%    myobj = AddFrame(myobj, frames, compressionLevel, layout)
+%
+%                frames may also be an M x N x K array of K frames, which
+%                are all added in one call.  This is much faster than
+%                calling AddFrame K times.  Frames are compressed and
+%                written in the background, Finalize waits for that to
+%                finish.  The optional layout argument says how M x N
+%                maps to the movie: 'wh' (the default) makes M the width,
+%                so images have to be transposed (frame') first; 'hw'
+%                takes frames as Matlab displays them, M rows of N pixels,
+%                and transposes them in C++, which is a lot faster than
+%                transposing in Matlab.
+%
 %
 %   myobj = Finalize(myobj)
 %
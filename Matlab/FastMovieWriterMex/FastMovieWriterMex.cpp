@@ -6,6 +6,7 @@
 #include <stdio.h>
 
 #include <map>
+#include <vector>
 #ifndef NO_QT
 #define NO_QT
 #endif
@@ -20,6 +21,7 @@ struct Context {
 	int w, h;
 	int frameCt;
 	std::string fileName;
+	std::vector<uint8_t> convBuf, transBuf; ///< addFrame's scratch, kept between calls
 	
 	Context() : ctx(0), w(0), h(0), frameCt(0) {}
 	~Context() {
@@ -27,6 +29,10 @@ struct Context {
 	}
 	void endAnimCloseFile() {
 		if (ctx) { 
+			if (!FM_FlushEncoder(ctx)) {
+				frameCt = int(ctx->imgOffsets.size());
+				mexWarnMsgTxt("Error writing frames to the output file (disk full?), the movie is truncated.");
+			}
 			if (w && h) {
 				mexPrintf("%d x %d FastMovie, %d frames, written to %s\n", w, h, frameCt, fileName.c_str());
 			}
@@ -110,6 +116,8 @@ void createNewContext(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]
 		mxFree(fnStr);
 		c->ctx = FM_Create(c->fileName.c_str());
 		err = errno;
+		// frames get compressed on all cores, addFrame only waits if too many are in flight
+		if (c->ctx) FM_StartEncoder(c->ctx);
 	} else {
 		mexErrMsgTxt("Please pass in a filename (string) for the output file."); 
 	}
@@ -123,14 +131,48 @@ void createNewContext(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]
 	RETURN(h);
 }
 
+/// one frame of an mxArray of class T to 8 bits, same scaling as always: doubles and singles are 0..1, int8 is offset by 128
+template<typename T> static void ToUint8(const T *in, size_t n, double scale, int offset, uint8_t *out)
+{
+	for (size_t i = 0; i < n; ++i) {
+		const double color = in[i] * scale + offset; // clamped as a double, so that big uint32s don't overflow an int
+		out[i] = color <= 0. ? 0 : (color >= 255. ? 255 : (uint8_t)color);
+	}
+}
+
+static bool ConvertFrame(int clsid, const void *m, size_t n, uint8_t *out)
+{
+	switch(clsid) {
+		case mxCHAR_CLASS:
+		case mxINT8_CLASS: ToUint8((const signed char *)m, n, 1., 128, out); break;
+		case mxINT16_CLASS: ToUint8((const short *)m, n, 1., 0, out); break;
+		case mxUINT16_CLASS: ToUint8((const unsigned short *)m, n, 1., 0, out); break;
+		case mxUINT32_CLASS: ToUint8((const unsigned int *)m, n, 1., 0, out); break;
+		case mxINT32_CLASS: ToUint8((const int *)m, n, 1., 0, out); break;
+		case mxDOUBLE_CLASS: ToUint8((const double *)m, n, 255., 0, out); break;
+		case mxSINGLE_CLASS: ToUint8((const float *)m, n, 255., 0, out); break;
+		default: return false;
+	}
+	return true;
+}
+
+/** addFrame(handle, frames, compressionLevel[, layout])
+    frames is M x N, or M x N x K for K frames at once.  Each frame goes to the
+    encoder, which compresses and writes in the background; finalize waits for it.
+    layout 'wh' (the default) takes M as the width, as this always did, which means
+    Matlab code has to pass images transposed.  'hw' takes frames the way Matlab
+    shows them (M rows of N pixels) and transposes them here instead. */
 void addFrame(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 {
-	if (nrhs != 3) mexErrMsgTxt("Three arguments required: handle, matrix, compression level.");
+	if (nrhs != 3 && nrhs != 4) mexErrMsgTxt("Three or four arguments required: handle, matrix, compression level[, layout].");
 	Context *c = GetContext(nrhs, prhs);
 	if (!c->ctx) {
 		mexErrMsgTxt("Cannot add frame -- invalid object state.  Either the output file was closed or was never opened or some other error occurred.");
 	}
-	int sx = mxGetM(prhs[1]), sy = mxGetN(prhs[1]);
+	const mwSize ndims = mxGetNumberOfDimensions(prhs[1]);
+	if (ndims > 3) mexErrMsgTxt("Passed-in matrix must be M x N (one frame) or M x N x K (K frames)!");
+	const mwSize *dims = mxGetDimensions(prhs[1]);
+	const int M = int(dims[0]), N = int(dims[1]), K = ndims > 2 ? int(dims[2]) : 1;
 	int clevel = 1;
 	
 	if ( !mxIsDouble(prhs[2]) || mxGetM(prhs[2]) != 1 || mxGetN(prhs[2]) != 1)
@@ -140,8 +182,23 @@ void addFrame(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 
 	if (clevel < 0) clevel = 0;
 	if (clevel > 9) clevel = 9;
+
+	bool transpose = false;
+	if (nrhs > 3) {
+		char *layout = mxIsChar(prhs[3]) ? mxArrayToString(prhs[3]) : 0;
+		const bool hw = layout && !strcmpi(layout, "hw"), wh = layout && !strcmpi(layout, "wh");
+		if (layout) mxFree(layout);
+		if (!hw && !wh) mexErrMsgTxt("Layout must be 'wh' (M x N matrix is width x height) or 'hw' (height x width, as Matlab displays images).");
+		transpose = hw;
+	}
+	// the size of the frames written
+	const int sx = transpose ? N : M, sy = transpose ? M : N;
 	
-	//mexPrintf("DBG: %d x %d matrix...\n", sx, sy);
+	//mexPrintf("DBG: %d x %d x %d matrix...\n", M, N, K);
+
+	if (sx <= 0 || sy <= 0 || K <= 0) {
+		mexErrMsgTxt("Passed-in matrix cannot be empty!");
+	}
 
 	if (c->w && c->h) {
 	  if (sx != c->w || sy != c->h) {
@@ -151,56 +208,35 @@ void addFrame(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[])
 	c->w = sx;
 	c->h = sy;
 	
-
-	if (sx <= 0 || sy <= 0) {
-		mexErrMsgTxt("Passed-in matrix cannot be empty!");
-	}
-	
-	uint8_t *imgbuf = new uint8_t [sx*sy];
-	
-	void *m = mxGetData(prhs[1]);
+	const uint8_t *m = (const uint8_t *)mxGetData(prhs[1]);
 	if (!m) {
-		delete [] imgbuf;
 		mexErrMsgTxt("Passed-in matrix is not valid!");
 	}
 	const int clsid = mxGetClassID(prhs[1]);
+	const size_t npix = size_t(sx) * sy, elemBytes = mxGetElementSize(prhs[1]);
 	
-	if (clsid == mxUINT8_CLASS) {
-		// optimized processing of pixels if the format is correct -- just do a memcpy!
-		memcpy(imgbuf, m, sx*sy);
-	} else {	
-		for (int x = 0; x < sx; ++x) {
-			for (int y = 0; y < sy; ++y) {
-				int color = 0;
-				
-				switch(clsid) {
-					case mxCHAR_CLASS:
-					case mxINT8_CLASS: color = static_cast<int>(((signed char *)m)[y*sx + x]) + 128; break;
-					case mxUINT8_CLASS: color = ((unsigned char *)m)[y*sx + x]; break;
-					case mxINT16_CLASS: color = ((short *)m)[y*sx + x]; break;
-					case mxUINT16_CLASS: color = ((unsigned short *)m)[y*sx + x]; break;
-					case mxUINT32_CLASS: color = ((unsigned int *)m)[y*sx + x]; break;
-					case mxINT32_CLASS: color = ((int *)m)[y*sx + x]; break;
-					case mxDOUBLE_CLASS: color = ((double *)m)[y*sx + x] * 255.; break;
-					case mxSINGLE_CLASS: color = ((float *)m)[y*sx + x] * 255.; break;
-					default:
-						delete [] imgbuf;
-						mexErrMsgTxt("Argument 2 must be a matrix of numeric type.");
-				}
-				if (color < 0) color = 0;
-				if (color > 255) color = 255;
-				(imgbuf + (y*sx))[x] = (uint8_t)color;
-			}
+	if (clsid != mxUINT8_CLASS) c->convBuf.resize(npix);
+	if (transpose) c->transBuf.resize(npix);
+
+	for (int k = 0; k < K; ++k) {
+		const uint8_t *frame = m + size_t(k) * npix * elemBytes;
+		const void *pixels = frame; // uint8 in the right layout goes straight to the encoder, which takes its own copy
+		if (clsid != mxUINT8_CLASS) {
+			if (!ConvertFrame(clsid, frame, npix, &c->convBuf[0]))
+				mexErrMsgTxt("Argument 2 must be a matrix of numeric type.");
+			pixels = &c->convBuf[0];
 		}
+		if (transpose) {
+			// column-major M x N in memory is N rows of M bytes
+			FM_Transpose8(pixels, M, N, &c->transBuf[0]);
+			pixels = &c->transBuf[0];
+		}
+		if (!FM_SubmitFrame(c->ctx, pixels, sx, sy, clevel)) {
+			mexErrMsgTxt("Failed in call to FM_SubmitFrame() -- error writing to the output file?");
+		}
+		++c->frameCt;
 	}
-
-	if (!FM_AddFrame(c->ctx, imgbuf, sx, sy, clevel)) {
-		delete [] imgbuf;
-		mexErrMsgTxt("Failed in call to FM_AddFrame().");
-	}
-	delete [] imgbuf;
-	++c->frameCt;
-	RETURN(1);
+	RETURN(K);
 }
 
 
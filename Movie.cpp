@@ -9,41 +9,39 @@
 #include <QScopedPointer>
 #include <QProgressDialog>
 #include "FastMovieFormat.h"
+#include "FrameScaler.h"
 #include <QMessageBox>
 #include <QFileInfo>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <math.h>
 
 #define FRAME_QUEUE_SIZE 100
 #define IMAGE_CACHE_SIZE 100*1024*1024 /* 100MB image cache! */
 
-static void dummySleep(int ms) 
-{
-	QWaitCondition sleep;
-	QMutex bs;
-	bs.lock();
-	sleep.wait(&bs, ms); 
-	bs.unlock();
-}
-
 class ReaderThread : public QThread
 {
 public:
-	ReaderThread(Movie *m, int threadid) : QThread(m), reader(0), m(m), threadid(threadid) {}
+	ReaderThread(Movie *m, int threadid) : QThread(m), reader(0), readerClip(-1), m(m), threadid(threadid) {}
 	~ReaderThread() { delete reader; reader = 0; }
-	
+
 	volatile bool stop;
-	
+
 	GenericMovieReader *reader;
+	int readerClip; ///< the clip reader is open on
 	QFile iodevice;
-	
+
 protected:
 	void run();
 private:
+	bool openReader(int clip);
 	Movie *m;
 	int threadid;
 };
 
 Movie::Movie()
-    : StimPlugin("Movie"), imgct(0), framect(0), loopsleft(0), loopforever(true), xoff(0), yoff(0)
+    : StimPlugin("Movie"), schedClip(0), schedImg(0), framect(0), loopsleft(0), loopforever(true), haveRoi(false), fit(FitNone), scaleMode(ScaleNone), scaleX(1.), scaleY(1.), offsetX(0.), offsetY(0.), scaleFilter(FrameScaler::Bilinear), syncReader(0), syncReaderClip(-1), shader(0)
 {
 	int nThreads = int(getNProcessors()) /*- 2*/;
 	if (nThreads < 2) nThreads = 2;
@@ -54,8 +52,8 @@ Movie::Movie()
 	Connect(stimApp(), SIGNAL(gotCheckFMV(const QString &)), this, SLOT(checkFMV(const QString &)));
 }
 
-bool Movie::initFromParams(bool skipfboinit)
-{	
+bool Movie::initFromParams(bool skiptexinit)
+{
 	QMutexLocker locker(&readFramesMutex);
 
 	inAfterVSync = false;
@@ -63,16 +61,42 @@ bool Movie::initFromParams(bool skipfboinit)
 	drewAFrame = false;
 	nSubFrames = ((int)fps_mode)+1;
 	imgCache.clear();
-	imgCache.setMaxCost(IMAGE_CACHE_SIZE);
+	cfsMap.clear();
     cfsMin = INT_MAX; cfsMax = INT_MIN; cfsAvg = 0; cfsNAvg = 0;
-	
-	if ( !getParam("file", file) ) {
-		Error() << "`file' parameter missing!";
+	clearClips();
+
+	QString file, playlist;
+	if (getParam("playlist", playlist) && !playlist.trimmed().isEmpty()) {
+		// comma separated, so that file names can have spaces in them
+		const QVector<QString> files = parseCSVStrings(playlist.trimmed(), QRegExp("\\s*,\\s*"));
+		QVector<double> lps, gaps;
+		getParam("playlist_loops", lps);
+		getParam("playlist_gaps", gaps);
+		for (int i = 0; i < files.size(); ++i) {
+			Clip c;
+			c.file = files[i];
+			// items with no value of their own get the last one given
+			if (lps.size()) c.loops = int(lps[i < lps.size() ? i : lps.size()-1]);
+			if (gaps.size()) c.gap = int(gaps[i < gaps.size() ? i : gaps.size()-1]);
+			if (c.loops < 1 || c.gap < 0) {
+				Error() << "`playlist_loops' must be >= 1 and `playlist_gaps' >= 0 (item " << (i+1) << ", " << c.file << ")";
+				return false;
+			}
+			clips.push_back(c);
+		}
+	} else if ( getParam("file", file) ) {
+		Clip c;
+		c.file = file;
+		clips.push_back(c);
+	} else {
+		Error() << "`file' (or `playlist') parameter missing!";
 		return false;
 	}
-	if ( !QFile::exists(file) ) {
-		Error() << "movie file `" << file << "' not found!";
-		return false;
+	for (int i = 0; i < clips.size(); ++i) {
+		if ( !QFile::exists(clips[i].file) ) {
+			Error() << "movie file `" << clips[i].file << "' not found!";
+			return false;
+		}
 	}
 	{
 		QString dummy;
@@ -81,23 +105,168 @@ bool Movie::initFromParams(bool skipfboinit)
 			return false;
 		}
 	}
-	
+
 	loopsleft = 0;
 	getParam("loops", *const_cast<int *>(&loopsleft));
 	loopforever = (loopsleft < 1);
-    
-	QFile f (file);
+
+	haveRoi = false;
+	{
+		QVector<double> r;
+		if (getParam("roi", r)) {
+			if (r.size() != 4 || r[2] < 1. || r[3] < 1.) {
+				Error() << "`roi' parameter must be 4 numbers: x,y,width,height (in movie pixels, 0,0 being the top left)";
+				return false;
+			}
+			roiParam = QRect(int(r[0]), int(r[1]), int(r[2]), int(r[3]));
+			haveRoi = true;
+		}
+	}
+	cropOrigin = cropSize = Vec2iZero;
+
+	scaleX = scaleY = 1.;
+	offsetX = offsetY = 0.;
+	fit = FitNone;
+	{
+		QVector<double> v;
+		if (getParam("scale", v) && v.size()) {
+			scaleX = v[0];
+			scaleY = v.size() > 1 ? v[1] : v[0];
+			if (scaleX <= 0. || scaleY <= 0.) {
+				Error() << "`scale' must be > 0 (one number, or x,y)";
+				return false;
+			}
+		}
+		if (getParam("offset", v)) {
+			if (v.size() != 2) {
+				Error() << "`offset' parameter must be 2 numbers: x,y (in window pixels, fractions allowed)";
+				return false;
+			}
+			offsetX = v[0];
+			offsetY = v[1];
+		}
+		QString f, mode = "gl", filt = "bilinear";
+		if (getParam("fit", f)) {
+			f = f.trimmed().toLower();
+			if (f == "letterbox") fit = FitLetterbox;
+			else if (f == "stretch") fit = FitStretch;
+			else if (f != "none") {
+				Error() << "`fit' must be one of: none, letterbox, stretch";
+				return false;
+			}
+		}
+		getParam("scale_mode", mode);
+		getParam("scale_filter", filt);
+		mode = mode.trimmed().toLower();
+		FrameScaler::Filter sf;
+		if (!FrameScaler::filterFromString(filt.trimmed().toLower().toUtf8().constData(), sf)) {
+			Error() << "`scale_filter' must be one of: nearest, bilinear, area";
+			return false;
+		}
+		if (mode != "gl" && mode != "cpu") {
+			Error() << "`scale_mode' must be gl or cpu";
+			return false;
+		}
+		scaleFilter = sf;
+		const bool scaling = fit != FitNone || scaleX != 1. || scaleY != 1. || offsetX != 0. || offsetY != 0.;
+		scaleMode = !scaling ? ScaleNone : (mode == "cpu" ? ScaleCPU : ScaleGL);
+		if (scaleMode == ScaleGL && sf == FrameScaler::Area)
+			Warning() << "`scale_filter area' needs `scale_mode cpu', GL scaling will be bilinear";
+	}
+
+	// the first clip is opened here, to catch errors before starting.  The reader threads open the rest as they get to them
+	{
+		QString err;
+		if (!openClip(clips[0], err)) {
+			Error() << err;
+			return false;
+		}
+		clips[0].state = Clip::Ready;
+	}
+
+	poppedframect = framect = schedImg = schedClip = 0;
+	delete syncReader;
+	syncReader = 0;
+	movieEnded = false;
+	type = GL_UNSIGNED_BYTE;
+
+	// one budget for all decoded frames: queued, cached or being uploaded.  By default what the
+	// frame queue and the image cache used to get between them
+	const unsigned long long memsize = getHWPhysMem();
+	const unsigned long long framesize = static_cast<unsigned long long>(clips[0].outSz.width()) * clips[0].outSz.height() * clips[0].bytesPerPixel;
+	double memMB = 0.;
+	getParam("movie_mem_mb", memMB);
+	unsigned long long budget = memMB > 0. ? static_cast<unsigned long long>(memMB * 1024. * 1024.)
+	                                       : IMAGE_CACHE_SIZE + FRAME_QUEUE_SIZE * framesize;
+	if (budget > memsize / 2ULL) {
+		Warning() << "Movie memory budget is too big for physical memory; shrinking to 1/2 of RAM!";
+		budget = memsize / 2ULL;
+	}
+	if (budget < framesize)
+		Warning() << "`movie_mem_mb' is less than one frame, frames will be read one at a time";
+	pool.setBudget(static_cast<qint64>(budget));
+	pool.resetPeak();
+	imgCache.setMaxCost(static_cast<int>(qMin(budget / 1024ULL, static_cast<unsigned long long>(INT_MAX))));
+	Debug() << "MemSize: " << memsize << ", movie memory budget: " << budget;
+
+	int fqsize = static_cast<int>(qMin(budget / framesize, static_cast<unsigned long long>(FRAME_QUEUE_SIZE)));
+	if (fqsize < 10) fqsize = 10; // the pool's budget is what really limits read-ahead
+
+	for (QList<QThread *>::iterator it = threads.begin(); it != threads.end(); ++it) {
+		ReaderThread *rt = dynamic_cast<ReaderThread *>(*it);
+		if (rt) {
+			// readers get (re)opened on the clip of the frame they're reading, see ReaderThread::openReader()
+			delete rt->reader;
+			rt->reader = 0;
+			rt->readerClip = -1;
+		} else {
+			Error() << "INTERNAL PLUGIN ERROR -- reader thread is not of type ReaderThread!";
+			return false;
+		}
+		(*it)->start();
+	}
+	readFrames.clear();
+	partialFrames.clear();
+	sem.release(fqsize);
+
+	if (!skiptexinit && !initTextures()) {
+		Error() << "Movie plugin could not create its textures.  Aborting plugin!";
+		return false;
+	}
+
+	// unlock mutex to allow threads to proceed
+	locker.unlock();
+
+	if (!skiptexinit) {
+		for (int k = 0; k < nSubFrames; ++k) {
+			if (!preloadNextTex()) {
+				Error() << "Failed to preload the first frame to a texture -- aborting plugin!";
+				return false;
+			}
+		}
+	}
+
+	Log() << "Movie plugin started using " << threads.count() << " reader threads and " << MOVIE_NUM_TEX << " textures, playing " << clips.size() << " clip(s).";
+
+	return true;
+}
+
+/// Opens and indexes c.file and works out how it's played.  Can be slow (GIFs get scanned), so it
+/// runs without readFramesMutex -- on a reader thread, for all but the first clip.
+bool Movie::openClip(Clip & c, QString & err) const
+{
+	QFile f (c.file);
 	f.open(QIODevice::ReadOnly);
 	if (!f.isOpen()) {
-		Error() << "movie file error, cannot open: " << file;
+		err = "movie file error, cannot open: " + c.file;
 		return false;
-		
+
 	}
 	GenericMovieReader *rdr = 0;
 	GifReader *gr = 0;
 	FastMovieReader *fmr = 0;
-	if (FastMovieReader::canRead(file)) {
-		fmr = new FastMovieReader(file);
+	if (FastMovieReader::canRead(c.file)) {
+		fmr = new FastMovieReader(c.file);
 		if (!fmr->canRead()) {
 			delete fmr; fmr = 0;
 		}
@@ -112,112 +281,149 @@ bool Movie::initFromParams(bool skipfboinit)
 	QScopedPointer<GenericMovieReader> scopedPtr(rdr);
 
 	if (!rdr->canRead() ) {
-		Error() << "movie file error: cannot read input file";
+		err = "movie file error: cannot read input file " + c.file;
 		return false;
 	}
 
 	if (rdr->imageCount() < 2) {
-		Error() << "movie file not an animation!  Use an animated GIF and/or FastMovie file with at least 2 frames!" ;
-		return false;        		
+		err = "movie file not an animation!  Use an animated GIF and/or FastMovie file with at least 2 frames!";
+		return false;
 	}
-	
+
 	if (gr && !gr->isAnimatedGifNonOptimized()) { // scan file..
-		Error() << "Input movie is an optimized GIF. (This plugin only supports non-optimized GIFs for fast reading.)  Use the @GifWriter Matlab class to generate non-optimized GIFs for input to this plugin!";
+		err = "Input movie is an optimized GIF. (This plugin only supports non-optimized GIFs for fast reading.)  Use the @GifWriter Matlab class to generate non-optimized GIFs for input to this plugin!";
 		return false;
 	}
-	
-	unsigned long long memsize = getHWPhysMem();
-	if (static_cast<unsigned long long>(imgCache.maxCost()) > memsize/2ULL) {
-		Warning() << "Image cache size is too big for physical memory; shrinking to 1/2 of RAM!";
-		imgCache.setMaxCost(static_cast<int>(memsize / 2ULL));
-	}
-	Debug() << "MemSize: " << memsize << ", image cache size: " << imgCache.maxCost();
-	poppedframect = framect = imgct = 0;
-	sz = rdr->size();
-	animationNumFrames = rdr->imageCount();
-	movieEnded = false;
 
-	int fqsize = FRAME_QUEUE_SIZE;
-	
-	if (static_cast<unsigned long long>(fqsize * sz.width() * sz.height()) > memsize / 2ULL) {
-		Warning() << "Image queue size is too big for physical memory; shrinking to 1/2 of RAM!";
-		fqsize = static_cast<int>(memsize/2ULL)/(sz.width() * sz.height());
-	}
-	if (fqsize < 10) fqsize = 10;
-	
-	
-	ifmt = GL_RGB;
-	fmt = GL_LUMINANCE;
-	type = GL_UNSIGNED_BYTE;
-	
-	if (lmargin) xoff = lmargin;
-	else xoff = (width() - sz.width()) / 2;
-	if (bmargin) yoff = bmargin;
-	else yoff = (height() - sz.height()) / 2;
-	if (xoff < 0) xoff = 0;
-	if (yoff < 0) yoff = 0;
-
-	for (QList<QThread *>::iterator it = threads.begin(); it != threads.end(); ++it) {
-		ReaderThread *rt = dynamic_cast<ReaderThread *>(*it);
-		if (rt) {
-			delete rt->reader;
-			if (dynamic_cast<GifReader *>(rdr)) {
-				GifReader *gg = new GifReader;
-				rt->reader = gg;
-				rt->iodevice.close();
-				rt->iodevice.setFileName(file);
-				rt->iodevice.open(QIODevice::ReadOnly);
-				gg->setDevice(&rt->iodevice);
-				gg->copyImageLengthsAndOffsets(*gr); // copy cached values from existing reader..
-			} else {
-				FastMovieReader *f = new FastMovieReader(file);
-				f->canRead(); // scan...
-				rt->reader = f;
-			}
-		} else {
-			Error() << "INTERNAL PLUGIN ERROR -- reader thread is not of type ReaderThread!";
+	c.roi = QRect(QPoint(0, 0), rdr->size());
+	if (haveRoi) {
+		c.roi &= roiParam;
+		if (c.roi.isEmpty()) {
+			err = QString("`roi' is entirely outside of the %1x%2 movie frame of %3!").arg(rdr->size().width()).arg(rdr->size().height()).arg(c.file);
 			return false;
 		}
-		(*it)->start();
+		if (c.roi != roiParam)
+			Warning() << "`roi' clipped to the movie frame of " << c.file << ": " << c.roi.x() << "," << c.roi.y() << "," << c.roi.width() << "," << c.roi.height();
 	}
-	rdr = 0;
-	gr = 0;
-	fmr = 0;
-	readFrames.clear();
-	sem.release(fqsize);
-	
-	if (!skipfboinit) {
-		bool usefbo = initFBOs();
-		// Re-enable rendering to the window
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);	
-		if (!usefbo) {
-			Error() << "Movie plugin requires FBO support from the OpenGL subsystem.  Please install good OpenGL drivers that support FBO!  Aborting plugin!";
+	c.sz = c.roi.size();
+	c.isFMV = !!fmr;
+	c.nFrames = rdr->imageCount();
+	switch (fmr ? fmr->frameFormat() : int(FM_LUMINOSITY)) { // GIF frames are read as 8 bit palette indices and played as luminance
+		case FM_LUMINOSITY: c.ifmt = GL_LUMINANCE8; c.fmt = GL_LUMINANCE; c.bytesPerPixel = 1; break;
+		case FM_RGB: c.ifmt = GL_RGB8; c.fmt = GL_RGB; c.bytesPerPixel = 3; break;
+		case FM_BGR: c.ifmt = GL_RGB8; c.fmt = GL_BGR; c.bytesPerPixel = 3; break;
+		default:
+			err = "movie file error: only luminosity, RGB and BGR .fmv frames can be played";
 			return false;
-		}
 	}
+	if (c.bytesPerPixel > 1 && fps_mode != FPS_Single) {
+		err = "color movies can only be played with fps_mode single (in the dual and triple modes each frame becomes one color channel)";
+		return false;
+	}
+	placeClip(c);
+	c.gif = 0;
+	if (gr) {
+		// kept just for its frame offsets, see ReaderThread::openReader()
+		gr->setDevice(0);
+		c.gif = gr;
+		scopedPtr.take();
+	}
+	return true;
+}
 
-	// unlock mutex to allow threads to proceed
-	locker.unlock();
+/// opens a clip for prefetching, on the reader thread that scheduleFrame() picked to do it
+void Movie::prepareClip(int i)
+{
+	Clip c;
+	readFramesMutex.lock();
+	c = clips[i];
+	readFramesMutex.unlock();
 
-	if (!skipfboinit) {
-		for (int k = 0; k < nSubFrames; ++k) {
-			if (!preloadNextTexToFBO()) {
-				Error() << "Failed to preload the first frame to the FBO -- aborting plugin!";
-				return false;
+	QString err;
+	const double t0 = getTime();
+	const bool ok = openClip(c, err);
+
+	QMutexLocker l(&readFramesMutex);
+	if (ok) {
+		c.state = Clip::Ready;
+		clips[i] = c;
+		Debug() << "Movie: opened playlist item " << (i+1) << " (" << c.file << ") in " << ((getTime()-t0)*1e3) << " msec";
+	} else {
+		clips[i].state = Clip::Bad;
+		Error() << "Movie: skipping playlist item " << (i+1) << ": " << err;
+	}
+}
+
+void Movie::clearClips()
+{
+	for (int i = 0; i < clips.size(); ++i) {
+		delete clips[i].gif;
+		delete clips[i].scaler;
+	}
+	clips.clear();
+}
+
+/// Hands a reader thread the next frame to read, readFramesMutex must be held.  Returns false if the clip
+/// due next isn't open yet, in which case j.openClip says if it's the calling thread that should open it.
+bool Movie::scheduleFrame(ReaderJob & j)
+{
+	j.ended = false;
+	j.framenum = j.clip = j.imgnum = j.openClip = j.prefetchClip = -1;
+	while (!movieEnded) {
+		Clip & c = clips[schedClip];
+		if (c.state == Clip::Bad) {
+			nextClip();
+			continue;
+		}
+		if (c.state != Clip::Ready) {
+			if (c.state == Clip::Unopened) {
+				c.state = Clip::Opening;
+				j.openClip = schedClip;
+			}
+			return false;
+		}
+		const int nPlayed = c.nFrames * c.loops;
+		if (schedImg >= nPlayed + c.gap) {
+			nextClip();
+			continue;
+		}
+		j.clip = schedClip;
+		j.imgnum = schedImg < nPlayed ? schedImg % c.nFrames : -1;
+		j.framenum = framect++;
+		j.decodeRect = decodeRectFor(c);
+		if (!schedImg) {
+			// starting this clip: get the next one ready while it plays
+			Clip & n = clips[(schedClip+1) % clips.size()];
+			if (n.state == Clip::Unopened) {
+				n.state = Clip::Opening;
+				j.prefetchClip = (schedClip+1) % clips.size();
 			}
 		}
+		++schedImg;
+		return true;
 	}
+	j.ended = true;
+	return true;
+}
 
-	Log() << "Movie plugin started using " << threads.count() << " threads to blend frames " << MOVIE_NUM_FBO << " FBO backbuffers.";
-
-	return true;	
+/// on to the next clip of the playlist, readFramesMutex must be held
+void Movie::nextClip()
+{
+	schedImg = 0;
+	if (++schedClip < clips.size()) return;
+	schedClip = 0;
+	if (!loopforever && --loopsleft <= 0)
+		movieEnded = true;
 }
 
 bool Movie::init()
 {
+	frameVars->setVariableNames(QString("frameNum subFrameNum clip imgNum ftrackBoxState(0=ON,1=off,2=change,3=start,4=end,-1=undefined)").split(" "));
+	frameVars->setVariableDefaults(QVector<double>() << 0. << 0. << 0. << 0. << -1.);
+
 	if (!initFromParams()) return false;
 
-	return true;    
+	return true;
 }
 
 void Movie::stop(bool doSave, bool use_gui, bool softStop)
@@ -236,26 +442,37 @@ void Movie::afterVSync(bool isSimulated)
 	inAfterVSync = true;
 	bool preloadOk = true;
 	for (int k = 0; preloadOk && k < nSubFrames; ++k) {
-		preloadOk = preloadNextTexToFBO();
+		preloadOk = preloadNextTex();
 		if ( !preloadOk && !pendingStop) {
-			Error() << "Failed to preload a frame to the FBO -- aborting plugin!";
+			Error() << "Failed to preload a frame to a texture -- aborting plugin!";
 			stop();
 		}
 	}
 	StimPlugin::afterVSync(isSimulated);
-	inAfterVSync = false;	
+	inAfterVSync = false;
 	drewAFrame = false;
 }
 
-QByteArray Movie::popOneFrame()
+/* reimplemented from super */
+void Movie::afterFTBoxDraw()
+{
+	if (!frameVars || !frameVars->queueCount()) return;
+	for (QList<QVector<double> >::iterator it = frameVars->getQueue().begin();  it != frameVars->getQueue().end(); ++it)
+	{
+		QVector<double> & b(*it);
+		if (b.size() >= 5) b[b.size()-1] = double(currentFTState);
+	}
+	frameVars->commitQueue();
+}
+
+bool Movie::popOneFrame(QueuedFrame & frame)
 {
-	QByteArray frame;
 	int failct = 0;
-	bool endedExit = false;
-	while (frame.isNull() && failct < 1000) {
+	bool endedExit = false, gotFrame = false, reread = false;
+	while (!gotFrame && failct < 1000) {
 		readFramesMutex.lock();
 		if (readFrames.size() == 0 && movieEnded) {
-			Log() << "Movie file " << file << " ended.";
+			Log() << "Movie " << (clips.size() > 1 ? QString("playlist") : "file " + clips.at(0).file) << " ended.  Peak decoded frame memory: " << (pool.peak() >> 20) << " MB of " << (pool.budget() >> 20) << " MB";
 			endedExit = true;
 			readFramesMutex.unlock();
 			break;
@@ -265,15 +482,24 @@ QByteArray Movie::popOneFrame()
 			++failct;
 		} else {
 			frame = readFrames.begin().value();
+			gotFrame = true;
 			readFrames.erase(readFrames.begin());
+			if (!partialFrames.isEmpty()) {
+				QMap<int,PartialFrame>::iterator pf = partialFrames.find(poppedframect);
+				if (pf != partialFrames.end()) {
+					// read ahead during a cropped getFrameDump(), and more of it is needed now
+					if (!pf.value().decoded.contains(decodeRectFor(clips.at(frame.clip)))) reread = true;
+					partialFrames.erase(pf);
+				}
+			}
 			++poppedframect;
 			sem.release(1);
 		}
-        int cfs = cfsMap[poppedframect%(animationNumFrames?animationNumFrames:1)];
+        const int cfs = gotFrame ? frame.cfs : 0;
         if (cfs > 0) {
             if (cfsMin > cfs) cfsMin = cfs;
             if (cfsMax < cfs) cfsMax = cfs;
-            
+
             { // compute avg
                 long long a = static_cast<int64_t>(cfsAvg) * static_cast<int64_t>(cfsNAvg);
                 if (cfsNAvg >= 30) {
@@ -286,30 +512,186 @@ QByteArray Movie::popOneFrame()
             }
         }
 
-        customStatusBarString.sprintf("Compr. fsize min/max/avg: %d/%d/%d",cfsMin,cfsMax,cfsAvg);
+        QString sb = QString().sprintf("Compr. fsize min/max/avg: %d/%d/%d",cfsMin,cfsMax,cfsAvg);
+        if (gotFrame && clips.size() > 1) sb += QString(" - clip %1/%2").arg(frame.clip+1).arg(clips.size());
+        sb += QString(" - mem %1/%2 MB").arg(pool.used() >> 20).arg(pool.budget() >> 20);
+        setSBString(sb);
 		readFramesMutex.unlock();
 	}
 	if (endedExit) {
 		stop();
-		return QByteArray();
+		return false;
 	}
-	if (failct >= 1000 && frame.isNull()) {
+	if (failct >= 1000 && !gotFrame) {
 		Error() << "INTERNAL ERROR IN MOVIE PLUGIN: could not grab a frame from the queue.  FIXME!";
 		stop();
-		return QByteArray();
+		return false;
 	}
-	return frame;
+	if (reread && !rereadFrame(frame)) {
+		Error() << "Movie plugin could not re-read frame " << frame.imgnum << " of " << clips.at(frame.clip).file;
+		stop();
+		return false;
+	}
+	return true;
 }
-	
+
+/// img's pixels without the QImage row padding, which is how frames are queued, cached and uploaded (GL_UNPACK_ALIGNMENT is 1)
+static QByteArray PackedPixels(const QImage & img)
+{
+	const int rowBytes = img.width() * (img.depth() / 8);
+	if (rowBytes == img.bytesPerLine()) return QByteArray(reinterpret_cast<const char *>(img.constBits()), img.byteCount());
+	QByteArray ret(rowBytes * img.height(), Qt::Uninitialized);
+	for (int y = 0; y < img.height(); ++y)
+		memcpy(ret.data() + y*rowBytes, img.constScanLine(y), rowBytes);
+	return ret;
+}
+
+/// what gets queued for a frame read into img: its packed pixels, put through the clip's scaler if it has one
+static QByteArray FramePixels(const QImage & img, const FrameScaler *scaler)
+{
+	QByteArray px = PackedPixels(img);
+	if (!scaler) return px;
+	QByteArray ret(scaler->dstBytes(), Qt::Uninitialized);
+	scaler->scale(reinterpret_cast<const unsigned char *>(px.constData()), reinterpret_cast<unsigned char *>(ret.data()));
+	return ret;
+}
+
+/// reads the frame again right here on the GUI thread, with the current decode rect
+bool Movie::rereadFrame(QueuedFrame & frame)
+{
+	const Clip & c = clips.at(frame.clip);
+	if (!syncReader || syncReaderClip != frame.clip) {
+		delete syncReader;
+		syncReader = new FastMovieReader(c.file);
+		syncReaderClip = frame.clip;
+	}
+	QImage img;
+	QRect r;
+	{
+		QMutexLocker l(&readFramesMutex);
+		r = decodeRectFor(c);
+	}
+	if (!syncReader->randomAccessRead(&img, frame.imgnum+1, 0, c.roi, r)) return false;
+	// it's due now, so it gets its memory regardless of the budget
+	const qint64 need = qint64(c.outSz.width()) * c.outSz.height() * c.bytesPerPixel;
+	pool.reserve(need, true);
+	frame.buf = pool.adopt(FramePixels(img, c.scaler), need);
+	return true;
+}
+
+/// Waits until the pool has bytes for frame framenum (or stop is set, then returns false), dropping least recently
+/// used cached frames to make room.  The frame due next always gets its memory, so a small budget slows reading
+/// down but can't stall it.
+bool Movie::reserveFrameMem(int framenum, qint64 bytes, const volatile bool & stop)
+{
+	QMutexLocker l(&readFramesMutex);
+	while (!stop) {
+		if (pool.reserve(bytes, framenum <= poppedframect)) return true;
+		if (imgCache.totalCost() > 0) {
+			// shrinking maxCost makes QCache evict from the least recently used end; frames that are also
+			// queued or uploading stay alive (and counted) until those are done with them
+			const int maxCost = imgCache.maxCost(), kb = int(bytes / 1024) + 1;
+			imgCache.setMaxCost(imgCache.totalCost() > kb ? imgCache.totalCost() - kb : 0);
+			imgCache.setMaxCost(maxCost);
+			if (pool.reserve(bytes)) return true;
+		}
+		// the rest is held by the queue, which the display drains
+		QWaitCondition sleep;
+		sleep.wait(&readFramesMutex, 1);   // 1 ms
+	}
+	return false;
+}
+
+/// Works out where clip c is drawn in the window, and sets up its scaler for ScaleCPU
+void Movie::placeClip(Clip & c) const
+{
+	const double w = c.sz.width(), h = c.sz.height();
+	c.outSz = c.sz;
+	c.scaler = 0;
+	if (scaleMode == ScaleNone) {
+		// 1:1, clamped to the window
+		int xoff, yoff;
+		if (lmargin) xoff = lmargin;
+		else xoff = (width() - c.sz.width()) / 2;
+		if (bmargin) yoff = bmargin;
+		else yoff = (height() - c.sz.height()) / 2;
+		if (xoff < 0) xoff = 0;
+		if (yoff < 0) yoff = 0;
+		c.dstX = xoff;
+		c.dstY = yoff;
+		c.dstW = (c.sz.width() <= (int)width() ? c.sz.width() : width());
+		c.dstH = (c.sz.height() <= (int)height() ? c.sz.height() : height());
+		return;
+	}
+	double dw = w * scaleX, dh = h * scaleY;
+	if (fit == FitLetterbox) {
+		const double s = qMin(width() / w, height() / h);
+		dw = w * s;
+		dh = h * s;
+	} else if (fit == FitStretch) {
+		dw = width();
+		dh = height();
+	}
+	c.dstX = (lmargin ? double(lmargin) : (width() - dw) / 2.) + offsetX;
+	c.dstY = (bmargin ? double(bmargin) : (height() - dh) / 2.) + offsetY;
+	c.dstW = dw;
+	c.dstH = dh;
+	if (scaleMode == ScaleCPU) {
+		// drawn 1:1 at whole pixels, the fractions of dstX,dstY go into the resampling (window y is up, frame rows go down)
+		const double ix = floor(c.dstX), iy = floor(c.dstY);
+		c.outSz = QSize(qMax(1, int(floor(dw + .5))), qMax(1, int(floor(dh + .5))));
+		c.scaler = new FrameScaler;
+		c.scaler->setup(c.sz.width(), c.sz.height(), c.outSz.width(), c.outSz.height(), c.bytesPerPixel,
+		                FrameScaler::Filter(scaleFilter), c.dstX - ix, iy - c.dstY);
+		c.dstX = ix;
+		c.dstY = iy;
+		c.dstW = c.outSz.width();
+		c.dstH = c.outSz.height();
+	}
+}
+
+/// the part of c.roi the reader threads decode: all of it, except during a cropped getFrameDump() of an .fmv.  readFramesMutex must be held
+QRect Movie::decodeRectFor(const Clip & c) const
+{
+	if (!c.isFMV || cropSize.w <= 0 || cropSize.h <= 0) return c.roi;
+	// window -> movie pixels, the inverse of placeClip(): roi is drawn upside down, into dstW x dstH at dstX,dstY
+	const Vec2i & o = cropOrigin, & cs = cropSize;
+	const int w = c.sz.width(), h = c.sz.height();
+	const double sx = w / c.dstW, sy = h / c.dstH;
+	const int x0 = int(floor((o.x - c.dstX) * sx)), x1 = int(ceil((o.x + cs.w - c.dstX) * sx)),
+	          y0 = h - int(ceil((o.y + cs.h - c.dstY) * sy)), y1 = h - int(floor((o.y - c.dstY) * sy));
+	// a pixel of slack all around for GL_NEAREST's rounding, more for what the scaling filters reach
+	const int m = scaleMode == ScaleNone ? 1 : 2 + int(ceil(qMax(sx, sy)));
+	QRect r = QRect(QPoint(x0 - m, y0 - m), QPoint(x1 + m - 1, y1 + m - 1)).translated(c.roi.topLeft()) & c.roi;
+	if (r.isEmpty()) r = QRect(c.roi.topLeft(), QSize(1, 1)); // the crop misses the movie entirely
+	return r;
+}
+
+/* virtual */
+void Movie::setFrameDumpCrop(const Vec2i & o, const Vec2i & cs)
+{
+	QMutexLocker l(&readFramesMutex);
+	cropOrigin = o;
+	cropSize = cs;
+	if (cs.w > 0 && cs.h > 0 && clips.size() && clips.at(schedClip).isFMV) {
+		const QRect r = decodeRectFor(clips.at(schedClip));
+		Debug() << "Movie: frame dump only decodes " << r.x() << "," << r.y() << "," << r.width() << "," << r.height() << " of each frame";
+	}
+}
+
 void Movie::drawFrame()
-{   
+{
 	if (pendingStop) {
 		pendingStop = false;
 		stop();
 		return;
 	}
-	
-	drawFrameUsingFBOTexture();
+
+	drawFrameUsingTextures();
+	for (int k = 0; k < nSubFrames; ++k) {
+		const TexSlot & s = texSlots[(unsigned(texctr)-(nSubFrames-k)) % MOVIE_NUM_TEX];
+		frameVars->enqueue(double(frameNum), double(k), double(s.clip), double(s.imgnum), -1.);
+	}
 	drewAFrame = true;
 }
 
@@ -321,12 +703,14 @@ void Movie::stopAllThreads()
 			t->stop = true;
 		}
 	}
-	dummySleep(250);
-	while (sem.tryAcquire(1,1)) {} // completely 0 out the semaphore	
+	// they may be in the middle of opening a clip, which uses clips[]
+	for (QList<QThread *>::iterator it = threads.begin(); it != threads.end(); ++it)
+		(*it)->wait();
+	while (sem.tryAcquire(1,1)) {} // completely 0 out the semaphore
 }
 
 /* virtual */
-bool Movie::applyNewParamsAtRuntime() 
+bool Movie::applyNewParamsAtRuntime()
 {
 	stopAllThreads();
 	return initFromParams(true);
@@ -336,311 +720,363 @@ void Movie::cleanup()
 {
 	stopAllThreads();
 	readFrames.clear();
+	partialFrames.clear();
     cfsMap.clear();
 	imgCache.clear();
-	cleanupFBOs();
+	clearClips();
+	delete syncReader;
+	syncReader = 0;
+	cleanupTextures();
 	StimPlugin::cleanup();
 }
 
-bool Movie::initFBOs()
+bool Movie::initTextures()
 {
-	memset(fbos, 0, sizeof(fbos));
 	memset(texs, 0, sizeof(texs));
-	fboctr = nSubFrames;
-	
-	if ( !glCheckFBStatus() ) {
-		Error() << "`FBO' mode is selected but the implementation doesn't support framebuffer objects.";
-		return false;
-	}
-	
+	texctr = nSubFrames;
+
 	glGetError(); // clear error flag
-	Log() << "`FBO' mode enabled, generating " << MOVIE_NUM_FBO << " FBO textures  (please wait)..";
+	Log() << "Generating " << MOVIE_NUM_TEX << " movie textures  (please wait)..";
 	Status() << "Generating texture cache ...";
-	
+
 	stimApp()->console()->update(); // ensure message is printed
 	stimApp()->processEvents(QEventLoop::ExcludeUserInputEvents); // ensure message is printed
 	const double t0 = getTime();
-	
-	glGenFramebuffersEXT(MOVIE_NUM_FBO, fbos);
-	if ( !glCheckFBStatus() ) {
-		Error() << "Error after glGenFramebuffersEXT call.";
-		return false;
-	}
+
 	int err;
-	if ((err=glGetError())) {
-		Error() << "GL Error: " << glGetErrorString(err) << " after call to glGenFramebuffersEXT";
-		return false;
-	}
-	glGenTextures(MOVIE_NUM_FBO, texs);
+	glGenTextures(MOVIE_NUM_TEX, texs);
 	if ((err=glGetError())) {
 		Error() << "GL Error: " << glGetErrorString(err) << " after call to glGenTextures";
 		return false;
 	}
-	// initialize the off-screen VRAM-based textures
-	for (int i = 0; i < MOVIE_NUM_FBO; ++i) {
+	// initialize the off-screen VRAM-based textures, in the frames' own format (1 byte per pixel for luminance movies)
+	const Clip & c = clips.at(0);
+	for (int i = 0; i < MOVIE_NUM_TEX; ++i) {
 		glBindTexture(GL_TEXTURE_RECTANGLE_ARB, texs[i]);
 		if ((err=glGetError())) {
 			Error() << "GL Error: " << glGetErrorString(err) << " after call to glBindTexture";
 			return false;
 		}
-		//glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, GL_RGBA, w, h, 0, GL_BGRA, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
-		// optimization to use less RAM
-		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, ifmt, sz.width(), sz.height(), 0, fmt, type, NULL);
+		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, c.ifmt, c.outSz.width(), c.outSz.height(), 0, c.fmt, type, NULL);
 		if ((err=glGetError())) {
 			Error() << "GL Error: " << glGetErrorString(err) << " after call to glTexImage2D";
 			return false;
 		}
 		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
 		glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		
+		texSlots[i].sz = c.outSz;
+		texSlots[i].ifmt = c.ifmt;
+		texSlots[i].fmt = c.fmt;
+		texSlots[i].filter = GL_NEAREST;
+		texSlots[i].clip = 0;
+		texSlots[i].imgnum = -1;
 	}
-	// setup framebuffers-to-texture association
-	for (int i = 0; i < MOVIE_NUM_FBO; ++i) {
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbos[i]);
-		if ((err=glGetError())) {
-			Error() << "GL Error: " << glGetErrorString(err) << " after call to glBindFramebufferEXT";
-			return false;
-		}
-		glFramebufferTexture2DEXT(GL_FRAMEBUFFER_EXT,
-								  GL_COLOR_ATTACHMENT0_EXT,
-								  GL_TEXTURE_RECTANGLE_ARB, texs[i], 0);
-		
-		if ((err=glGetError())) {
-			Error() << "GL Error: " << glGetErrorString(err) << " after call to glFramebufferTexture2DEXT";
-			return false;
-		}
-		if ( !glCheckFBStatus() ) {
-			Error() << "`FBO' error associating fbo/tex #" << i;
-			// Re-enable rendering to the window
-			glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-			return false;
-		}
-		
-	}
-	
-	if ( !glCheckFBStatus() ) {
-		Error() << "`FBO' error after initialization.";
-		// Re-enable rendering to the window
-		glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
-		return false;
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+
+	delete shader;
+	shader = new QOpenGLShaderProgram;
+	if (!shader->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/Shaders/movie_shader_120.frag") || !shader->link()) {
+		Warning() << "Movie shader link error, falling back to one pass per subframe: " << shader->log();
+		delete shader, shader = 0;
+	} else {
+		shNSub = shader->uniformLocation("nSubFrames");
+		shLum = shader->uniformLocation("luminance");
+		shChan[0] = shader->uniformLocation("chan0");
+		shChan[1] = shader->uniformLocation("chan1");
+		shChan[2] = shader->uniformLocation("chan2");
+		shader->bind();
+		shader->setUniformValue("sub0", GLint(0));
+		shader->setUniformValue("sub1", GLint(1));
+		shader->setUniformValue("sub2", GLint(2));
+		shader->release();
 	}
-		
-	const int w = sz.width(), h = sz.height();
-	const int W = (sz.width() <= (int)width() ? sz.width() : width()),
-	          H = (sz.height() <= (int)height() ? sz.height() : height());
-	
-	GLint v[] = {
-		xoff, yoff,
-		xoff + W, yoff,
-		xoff + W, yoff + H,
-		xoff, yoff + H
-	};
-	
-	GLint t[] = {
-		0, h-1,
-		w-1, h-1,
-		w-1, 0,
-		0, 0,
-	};
-	/* 
-	GLint v[] = {
-		xoff, yoff,
-		xoff, yoff + H,
-		xoff + W, yoff + H,
-		xoff + W, yoff,
-	};
-	GLint t[] = {
-		0, 0,
-		0, h,
-		w, h, 
-		w, 0,
-	};*/
-	
-	memcpy(vertices, v, sizeof(vertices));
-	memcpy(texCoords, t, sizeof(texCoords));
-	
-	Log() << "FBO init completed in " << (getTime()-t0) << " seconds.";
-	return true;	
+
+	Log() << "Texture init completed in " << (getTime()-t0) << " seconds.";
+	return true;
 }
 
-bool Movie::preloadNextTexToFBO()
+bool Movie::preloadNextTex()
 {
-	double t0 = getTime(), elapsed;
-	
-	const int i = unsigned(fboctr++) % MOVIE_NUM_FBO;
-	
-	// enable rendering to the FBO
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, fbos[i]);
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, texs[i]);
-	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glPushAttrib(GL_VIEWPORT_BIT|GL_COLOR_BUFFER_BIT);
-	glDrawBuffer(GL_COLOR_ATTACHMENT0_EXT); // just to be explicit about which attachment we are drawing to in the FBO
-	glViewport(0, 0, width(), height());
-	// draw to off-screen texture i
-	QByteArray frame = popOneFrame();
-	//t0 = getTime();
-	if (!frame.isNull()) {
-		glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, ifmt, sz.width(), sz.height(), 0, fmt, type, frame.constData());
+	const int i = unsigned(texctr++) % MOVIE_NUM_TEX;
+
+	QueuedFrame frame;
+	if (!popOneFrame(frame)) return false;
+
+	const Clip & c = clips.at(frame.clip);
+	TexSlot & s = texSlots[i];
+	s.clip = frame.clip;
+	s.imgnum = frame.buf ? frame.imgnum : -1;
+	s.fmt = c.fmt;
+
+	const int w = c.outSz.width(), h = c.outSz.height();
+	const GLfloat v[] = {
+		GLfloat(c.dstX), GLfloat(c.dstY),
+		GLfloat(c.dstX + c.dstW), GLfloat(c.dstY),
+		GLfloat(c.dstX + c.dstW), GLfloat(c.dstY + c.dstH),
+		GLfloat(c.dstX), GLfloat(c.dstY + c.dstH)
+	};
+	// unscaled keeps the historical w-1,h-1 texel mapping, scaled quads span the whole texture so filtering lines up
+	const GLfloat e = scaleMode == ScaleNone ? 1.f : 0.f;
+	const GLfloat t[] = {
+		0.f, h-e,
+		w-e, h-e,
+		w-e, 0.f,
+		0.f, 0.f,
+	};
+	memcpy(s.vertices, v, sizeof(s.vertices));
+	memcpy(s.texCoords, t, sizeof(s.texCoords));
+	s.filter = scaleMode == ScaleGL && scaleFilter != FrameScaler::Nearest ? GL_LINEAR : GL_NEAREST;
+
+	if (frame.buf) {
+		// straight into texture i, rows are tightly packed (see PackedPixels())
+		glBindTexture(GL_TEXTURE_RECTANGLE_ARB, texs[i]);
+		if (s.sz == c.outSz && s.ifmt == c.ifmt) {
+			// same size and format as what's in it, so no reallocation
+			glTexSubImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, 0, 0, w, h, c.fmt, type, frame.buf->pixels.constData());
+		} else {
+			glTexImage2D(GL_TEXTURE_RECTANGLE_ARB, 0, c.ifmt, w, h, 0, c.fmt, type, frame.buf->pixels.constData());
+			s.sz = c.outSz;
+			s.ifmt = c.ifmt;
+		}
 		glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
 		// at this point we have a texture with frame i living in VRAM
-		// generate a mipmap for quality? nah -- mipmaps not supprted anyway for GL_TEXTURE_RECTANGLE_ARB path
-		//glBindTexture(GL_TEXTURE_RECTANGLE_ARB, texs[i]);
-		//glGenerateMipmapEXT(GL_TEXTURE_RECTANGLE_ARB);
-	} else {
-        //Debug() << "preloadFBO fbo#"<<i<<" got null frame";
-    }
-	glPopAttrib();
-	// Re-enable rendering to the window
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);	
-	
-	elapsed = getTime() - t0;
-	//Debug() << "preloadFBO fbo#" << i << " took " << (elapsed*1e3) << " msec";
-	//qDebug("preloadNextTexToFBO %g ms", elapsed*1000.0);
+	}
 
-	return !frame.isNull();
+	return true;
 }
 
-void Movie::cleanupFBOs()
+void Movie::cleanupTextures()
 {
-	glDeleteFramebuffersEXT(MOVIE_NUM_FBO, fbos); // it's weird.. you have to detach the texture from the FBO first, before deleting the texture itself
-	glDeleteTextures(MOVIE_NUM_FBO, texs);
-	memset(fbos, 0, sizeof(fbos));
+	glDeleteTextures(MOVIE_NUM_TEX, texs);
 	memset(texs, 0, sizeof(texs));
-	// Make sure rendering to the window is on, just in case
-	glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
+	delete shader, shader = 0;
 }
 
-void Movie::drawFrameUsingFBOTexture()
+void Movie::drawFrameUsingTextures()
 {
-	double t0 = getTime(), elapsed;
-	
 	glDisable(GL_SCISSOR_TEST);
-	
+
 	glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
 	glEnable(GL_TEXTURE_RECTANGLE_ARB);
-	
+
 	// render our vertex and coord buffers which don't change.. just the texture changes
 	glEnableClientState(GL_VERTEX_ARRAY);
 	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-	
+
 	GLint saved_cmask[4];
 	glGetIntegerv(GL_COLOR_WRITEMASK, saved_cmask);
-	
+
+	int slot[3];
+	bool onePass = !!shader;
 	for (int k = 0; k < nSubFrames; ++k) {
-		const int texnum = (unsigned(fboctr)-(nSubFrames-k)) % MOVIE_NUM_FBO;
-		glBindTexture(GL_TEXTURE_RECTANGLE_ARB, texs[texnum]);
-		if (!k) {													 
-			glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-			glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-		}
-		if (fps_mode) {
-			switch (color_order[k]) {
-				case 'r': glColorMask(GL_TRUE, GL_FALSE, GL_FALSE, GL_FALSE); break;
-				case 'g': glColorMask(GL_FALSE, GL_TRUE, GL_FALSE, GL_FALSE); break;
-				case 'b': glColorMask(GL_FALSE, GL_FALSE, GL_TRUE, GL_FALSE); break;
-			}
+		slot[k] = (unsigned(texctr)-(nSubFrames-k)) % MOVIE_NUM_TEX;
+		// gap frames aren't drawn, and subframes from clips of different sizes need their own quads
+		if (texSlots[slot[k]].imgnum < 0 || (k && (memcmp(texSlots[slot[k]].vertices, texSlots[slot[0]].vertices, sizeof(texSlots[0].vertices))
+		                                           || texSlots[slot[k]].sz != texSlots[slot[0]].sz || texSlots[slot[k]].filter != texSlots[slot[0]].filter)))
+			onePass = false;
+	}
+
+	if (onePass) {
+		// subframe k on texture unit k, the shader puts it in color channel color_order[k]
+		QOpenGLFunctions *f = QOpenGLContext::currentContext()->functions();
+		GLfloat chans[3][3];
+		GLboolean cmask[3] = { GL_FALSE, GL_FALSE, GL_FALSE };
+		memset(chans, 0, sizeof(chans));
+		for (int k = 0; k < nSubFrames; ++k) {
+			f->glActiveTexture(GL_TEXTURE0 + k);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB, texs[slot[k]]);
+			glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, texSlots[slot[k]].filter);
+			glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, texSlots[slot[k]].filter);
+			const int c = color_order[k] == 'r' ? 0 : (color_order[k] == 'g' ? 1 : 2);
+			chans[k][c] = 1.f;
+			cmask[c] = GL_TRUE;
 		}
-		
-		glTexCoordPointer(2, GL_INT, 0, texCoords);
-		glVertexPointer(2, GL_INT, 0, vertices);
+		// channels no subframe goes to are left alone, same as the glColorMask() passes below
+		if (fps_mode) glColorMask(cmask[0], cmask[1], cmask[2], GL_FALSE);
+		shader->bind();
+		shader->setUniformValue(shNSub, GLint(nSubFrames));
+		shader->setUniformValue(shLum, GLint(texSlots[slot[0]].fmt == GL_LUMINANCE));
+		for (int k = 0; k < 3; ++k)
+			shader->setUniformValue(shChan[k], chans[k][0], chans[k][1], chans[k][2]);
+		glTexCoordPointer(2, GL_FLOAT, 0, texSlots[slot[0]].texCoords);
+		glVertexPointer(2, GL_FLOAT, 0, texSlots[slot[0]].vertices);
 		glDrawArrays(GL_QUADS, 0, 4);
+		shader->release();
+		for (int k = nSubFrames-1; k >= 0; --k) {
+			f->glActiveTexture(GL_TEXTURE0 + k);
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+		}
+	} else {
+		for (int k = 0; k < nSubFrames; ++k) {
+			const TexSlot & s = texSlots[slot[k]];
+			if (s.imgnum < 0) continue;
+			glBindTexture(GL_TEXTURE_RECTANGLE_ARB, texs[slot[k]]);
+			glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MIN_FILTER, s.filter);
+			glTexParameteri(GL_TEXTURE_RECTANGLE_ARB, GL_TEXTURE_MAG_FILTER, s.filter);
+			if (fps_mode) {
+				switch (color_order[k]) {
+					case 'r': glColorMask(GL_TRUE, GL_FALSE, GL_FALSE, GL_FALSE); break;
+					case 'g': glColorMask(GL_FALSE, GL_TRUE, GL_FALSE, GL_FALSE); break;
+					case 'b': glColorMask(GL_FALSE, GL_FALSE, GL_TRUE, GL_FALSE); break;
+				}
+			}
+			glTexCoordPointer(2, GL_FLOAT, 0, s.texCoords);
+			glVertexPointer(2, GL_FLOAT, 0, s.vertices);
+			glDrawArrays(GL_QUADS, 0, 4);
+		}
 	}
 	glColorMask(saved_cmask[0], saved_cmask[1], saved_cmask[2], saved_cmask[3]);
 	glDisableClientState(GL_VERTEX_ARRAY);
 	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
-	
-	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);	
-	glDisable(GL_TEXTURE_RECTANGLE_ARB);	
-	
-	elapsed = getTime()-t0;
-	
-	//qDebug("drawFrameUsingFBOTexture %g ms", elapsed*1000.0);
+
+	glBindTexture(GL_TEXTURE_RECTANGLE_ARB, 0);
+	glDisable(GL_TEXTURE_RECTANGLE_ARB);
 }
 
-void ReaderThread::run() 
+/// points reader at the clip's file, if it isn't already
+bool ReaderThread::openReader(int clip)
+{
+	if (reader && readerClip == clip) return true;
+	delete reader;
+	reader = 0;
+	readerClip = -1;
+
+	// the clip is Ready, so these don't change under us
+	const QString file = m->clips.at(clip).file;
+	const GifReader *gif = m->clips.at(clip).gif;
+	if (gif) {
+		GifReader *gg = new GifReader;
+		iodevice.close();
+		iodevice.setFileName(file);
+		iodevice.open(QIODevice::ReadOnly);
+		gg->setDevice(&iodevice);
+		gg->copyImageLengthsAndOffsets(*gif); // copy cached values from the clip's scan..
+		reader = gg;
+	} else {
+		FastMovieReader *f = new FastMovieReader(file);
+		if (!f->canRead()) { // scan...
+			Error() << "Movie reader thread " << threadid << " could not open " << file;
+			delete f;
+			return false;
+		}
+		reader = f;
+	}
+	readerClip = clip;
+	return true;
+}
+
+void ReaderThread::run()
 {
 	stop = false;
-	
+
 	Debug() << "reader thread " << threadid << " started.";
-	
-	QImage img(m->sz.width(), m->sz.height(), QImage::Format_RGB32);
-	
+
+	QImage img; // the readers make it Indexed8 or RGB888 (color .fmv), roi sized
+	bool haveSlot = false; // of the frame queue
+
 	while (!stop) {
-		if (m->sem.tryAcquire(1,250)) {
-			int framenum;
-					
-		
+		if (haveSlot || m->sem.tryAcquire(1,250)) {
+			haveSlot = true;
+
 			double t0;
-			
+
 			t0 = getTime();
-			
+
+			Movie::ReaderJob j;
 			m->readFramesMutex.lock();
-			if (m->imgct >= m->animationNumFrames) {
-				if (m->loopforever || --m->loopsleft > 0)
-					m->imgct = 0;
-				else
-					m->movieEnded = true;
+			const bool scheduled = m->scheduleFrame(j);
+			const Movie::ImgKey key(j.clip, j.imgnum);
+			FrameRef cachedImg;
+			int cachedCfs = 0;
+			if (scheduled && !j.ended && j.imgnum > -1 && m->imgCache.contains(key)) {
+				cachedImg = *(m->imgCache.object(key));
+				cachedCfs = m->cfsMap.value(key);
 			}
-			int imgct = m->imgct++;		
-			framenum = m->framect++;
-			bool movieEnded = m->movieEnded;
-			QByteArray cachedImg;
-			if (m->imgCache.contains(imgct))
-				cachedImg = *(m->imgCache.object(imgct));
-            
+			const Movie::Clip clip = scheduled && !j.ended ? m->clips.at(j.clip) : Movie::Clip();
 			m->readFramesMutex.unlock();
 
-            //Debug() << "reader " << threadid << " framect=" << framenum << " imgct=" << imgct;
+			if (!scheduled) {
+				// the clip that's next isn't open yet: open it, or wait for whoever is
+				if (j.openClip > -1) m->prepareClip(j.openClip);
+				else msleep(1);
+				continue;
+			}
+			haveSlot = false;
+
+            //Debug() << "reader " << threadid << " framect=" << j.framenum << " clip=" << j.clip << " imgnum=" << j.imgnum;
 
-			if (movieEnded) {
+			if (j.ended) {
 				stop = true;
 				break;
 			}
-			
-			if (!cachedImg.isNull()) {
-				
+
+			Movie::QueuedFrame qf;
+			qf.clip = j.clip;
+			qf.imgnum = j.imgnum;
+
+			if (j.imgnum < 0) {
+				// gap between clips, nothing to read
 				m->readFramesMutex.lock();
-				m->readFrames[framenum] = cachedImg;
+				m->readFrames[j.framenum] = qf;
 				m->readFramesMutex.unlock();
 
-                //Debug() << "reader " << threadid << " " << imgct << " was cached";
+			} else if (cachedImg) {
 
-			} else {
+				qf.buf = cachedImg;
+				qf.cfs = cachedCfs;
+				m->readFramesMutex.lock();
+				m->readFrames[j.framenum] = qf;
+				m->readFramesMutex.unlock();
+
+                //Debug() << "reader " << threadid << " " << j.imgnum << " was cached";
+
+			} else if (openReader(j.clip)) {
 				// img not in cache, so read it from the disk file and enqueue it, and also cache it
+				const qint64 need = qint64(clip.outSz.width()) * clip.outSz.height() * clip.bytesPerPixel;
+				if (!m->reserveFrameMem(j.framenum, need, stop)) break;
                 bool readok = false;
-                
-				
+
+
                 int cfs = 0;
-                
+
 				// jump the reader to current image
-				readok=reader->randomAccessRead(&img, imgct+1, &cfs);
-				
+				FastMovieReader *fmr = dynamic_cast<FastMovieReader *>(reader);
+				if (fmr)
+					readok = fmr->randomAccessRead(&img, j.imgnum+1, &cfs, clip.roi, j.decodeRect);
+				else if ((readok = reader->randomAccessRead(&img, j.imgnum+1, &cfs)) && clip.roi != QRect(QPoint(0, 0), img.size()))
+					img = img.copy(clip.roi);
+				const bool partial = j.decodeRect != clip.roi;
+
 				// next, copy bits to our queue...
 				if (readok) {
-					QByteArray *pixels = new QByteArray; // it's ok, the imgCache below will own and auto-delete this object when it goes out-of-cache..
-					pixels->resize(img.byteCount());
-					
-					unsigned char *p = reinterpret_cast<unsigned char *>(pixels->data());
-					
-					memcpy(p, img.bits(), pixels->size());
-					
+					// the one copy of this frame: the queue, the cache and the upload all hold it through handles
+					qf.buf = m->pool.adopt(FramePixels(img, clip.scaler), need);
+					qf.cfs = cfs;
+
 					m->readFramesMutex.lock();
-                    m->cfsMap[imgct] = cfs;
-					m->readFrames[framenum] = *pixels; // shallow copy..
-					m->imgCache.insert(imgct, pixels, pixels->size()); // img cache owns object, will delete when emptying..
+                    m->cfsMap[key] = cfs;
+					m->readFrames[j.framenum] = qf;
+					if (partial) {
+						// only good enough for the getFrameDump() that asked for it, so it doesn't get cached
+						Movie::PartialFrame pf = { j.imgnum, j.decodeRect };
+						m->partialFrames[j.framenum] = pf;
+					} else
+						m->imgCache.insert(key, new FrameRef(qf.buf), int(qf.buf->pixels.size() / 1024) + 1); // img cache owns the handle, the frame lives on while the queue has it
 					m->readFramesMutex.unlock();
 
-				}
-				
+				} else
+					m->pool.unreserve(need);
+
 			}
-			//Debug () << "reader " << threadid << " " << imgct << " read in " << ((getTime()-t0)*1000.) << " msec";
-			//qDebug("thread %d, frame %d imgnr %d took %g msec to read from %s", (int)threadid, (int)framenum, imgct, ((getTime()-t0)*1000.),				   cachedImg.isNull() ? "file" : "cache");
 
+			if (j.prefetchClip > -1) m->prepareClip(j.prefetchClip);
+			//Debug () << "reader " << threadid << " " << j.imgnum << " read in " << ((getTime()-t0)*1000.) << " msec";
+			(void)t0;
 		}
 	}
 	delete reader;
 	reader = 0;
+	readerClip = -1;
 	Debug() << "reader thread " << threadid << " stopped.";
 
 }
@@ -11,16 +11,33 @@
 #include <QVector>
 #include <QList>
 #include "Util.h"
+#include "FramePool.h"
 #include <QCache>
+#include <QRect>
+#include <QPair>
 
 class GLWindow;
 class ReaderThread;
 class QProgressDialog;
 class FMVChecker;
+class FastMovieReader;
+class GifReader;
+class FrameScaler;
+class QOpenGLShaderProgram;
 
 /** \brief A plugin that plays a movie as the stim.  
 
-    For now, only 8-bit GIF animation movies are supported.
+    Plays non-optimized 8-bit GIF animations and .fmv files.  Frames are kept
+    and uploaded in their native pixel format: one byte per pixel luminance
+    (GIFs and grayscale .fmv) or packed RGB/BGR (color .fmv, fps_mode single only).
+
+    Plays either a single `file' or a `playlist' of them, gaplessly: upcoming
+    clips are opened and read ahead by the reader threads while the current one
+    plays, and the textures are only reallocated when the frame size changes.
+
+    Frames can be scaled (`scale', `fit') and positioned to a fraction of a
+    pixel (`offset'), either by GL when drawing or, for output that is the same
+    on every machine, by a FrameScaler in the reader threads (`scale_mode').
  
     For a full description of this plugin's parameters, it is recommended you see the \subpage plugin_params "Plugin Parameter Documentation"  for more details.
 */ 
@@ -42,8 +59,10 @@ protected:
     bool init(); ///< from StimPlugin
 	/* virtual */ bool applyNewParamsAtRuntime();
 	/* virtual */ void afterVSync(bool isSimulated = false);
+	/* virtual */ void afterFTBoxDraw();
 
 	/* virtual */ void cleanup();
+	/* virtual */ void setFrameDumpCrop(const Vec2i & cropOrigin, const Vec2i & cropSize);
 
 private slots:
 	void checkFMV(const QString & fmvfile);
@@ -52,22 +71,74 @@ private slots:
 	void fmvChkCanceled(FMVChecker *);
 	
 private:
-	bool initFromParams(bool skipfboinit = false);
+	/// one movie of the playlist (or just `file')
+	struct Clip {
+		QString file;
+		int loops, gap; ///< per pass through the playlist: times it is played, then blank frames after it
+		enum State { Unopened = 0, Opening, Ready, Bad } state; ///< guarded by readFramesMutex.  The fields below are only valid once Ready
+		bool isFMV;
+		int nFrames;
+		QRect roi; ///< the part of the movie frame that is played, in movie pixels with 0,0 at the top left.  The `roi' param, or the whole frame
+		QSize sz; ///< of roi, which is what gets played
+		int bytesPerPixel; ///< of its decoded frames, whose rows are not padded: 1 for luminance, 3 for RGB/BGR
+		GLint ifmt, fmt;
+		GifReader *gif; ///< the scanned GIF whose frame offsets the reader threads copy, NULL for .fmv
+		double dstX, dstY, dstW, dstH; ///< where in the window roi is drawn (lower left corner and size), see placeClip()
+		QSize outSz; ///< of its frames as queued and uploaded: sz, or what the scaler makes of it
+		FrameScaler *scaler; ///< for ScaleCPU, shared by the reader threads
+		Clip() : loops(1), gap(0), state(Unopened), isFMV(false), nFrames(0), bytesPerPixel(1), ifmt(0), fmt(0), gif(0), dstX(0.), dstY(0.), dstW(0.), dstH(0.), scaler(0) {}
+	};
+	/// a frame read by a reader thread, waiting to be uploaded
+	struct QueuedFrame {
+		FrameRef buf; ///< null for the blank frames of a clip's gap
+		int clip, imgnum, cfs; ///< imgnum is 0-based, -1 for gap frames
+		QueuedFrame() : clip(0), imgnum(-1), cfs(0) {}
+	};
+	/// what scheduleFrame() tells a reader thread to do
+	struct ReaderJob {
+		bool ended;
+		int framenum, clip, imgnum; ///< imgnum -1 is a gap frame
+		QRect decodeRect;
+		int openClip, prefetchClip; ///< clips the thread should open, the one it is waiting on and the one after the clip it just started
+	};
+	typedef QPair<int,int> ImgKey; ///< clip, imgnum
+
+	bool initFromParams(bool skiptexinit = false);
 	void stopAllThreads();
-	QByteArray popOneFrame();
-	void drawFrameUsingFBOTexture();
-
-    QString file;
-	int animationNumFrames;
-	QSize sz;
-	volatile int imgct, framect, loopsleft;
+	void clearClips();
+	bool openClip(Clip & c, QString & err) const;
+	void prepareClip(int clip);
+	bool scheduleFrame(ReaderJob & j);
+	void nextClip();
+	void placeClip(Clip & c) const;
+	QRect decodeRectFor(const Clip & c) const;
+	bool popOneFrame(QueuedFrame & frame);
+	bool rereadFrame(QueuedFrame & frame);
+	bool reserveFrameMem(int framenum, qint64 bytes, const volatile bool & stop);
+	void drawFrameUsingTextures();
+
+	QVector<Clip> clips;
+	volatile int schedClip, schedImg, framect, loopsleft; ///< where the reader threads are at: the clip, and position in its loops*nFrames frames + gap blank frames
 	bool loopforever;
+	bool haveRoi;
+	QRect roiParam; ///< the `roi' param, applied to every clip
+	enum Fit { FitNone = 0, FitLetterbox, FitStretch } fit;
+	enum ScaleMode { ScaleNone = 0, ScaleGL, ScaleCPU } scaleMode; ///< ScaleNone is the original 1:1 drawing, used when there's no scaling or offset asked for
+	double scaleX, scaleY, offsetX, offsetY;
+	int scaleFilter; ///< a FrameScaler::Filter
+	Vec2i cropOrigin, cropSize; ///< of the getFrameDump() in progress (in window pixels), which only needs part of each .fmv frame decoded
 	
 	int poppedframect;
 	
+	FramePool pool; ///< every decoded frame, wherever it is held, counts against the `movie_mem_mb' budget.  Outlives readFrames and imgCache
 	QMutex readFramesMutex;
-	QMap<int,QByteArray> readFrames;
-    QMap<int,int> cfsMap;
+	QMap<int,QueuedFrame> readFrames;
+	QMap<ImgKey,int> cfsMap;
+	/// frames in readFrames that only had part of the roi decoded, keyed by frame number like readFrames
+	struct PartialFrame { int imgnum; QRect decoded; };
+	QMap<int,PartialFrame> partialFrames;
+	FastMovieReader *syncReader; ///< re-reads partial frames in full when they turn out to be needed after all, see popOneFrame()
+	int syncReaderClip;
     
     
     // stats -- compressed frame size min, max, avg
@@ -77,20 +148,30 @@ private:
 	QSemaphore sem;
 	
 	bool inAfterVSync, pendingStop, drewAFrame;
-    int xoff, yoff;
 	volatile bool movieEnded;
 	
-	bool initFBOs();
-	void cleanupFBOs();
-	bool preloadNextTexToFBO();
-
-#define MOVIE_NUM_FBO 6
-	GLuint fbos[MOVIE_NUM_FBO], texs[MOVIE_NUM_FBO];
-	unsigned char fboctr;
-	GLint ifmt, fmt, type, vertices[8], texCoords[8];
+	bool initTextures();
+	void cleanupTextures();
+	bool preloadNextTex();
+
+#define MOVIE_NUM_TEX 6
+	GLuint texs[MOVIE_NUM_TEX];
+	/// what is in each of texs
+	struct TexSlot {
+		QSize sz; GLint ifmt; ///< the storage allocated, reused by frames of the same size and format
+		GLint fmt;
+		int clip, imgnum; ///< of the frame in it, imgnum -1 for gap frames, which leave the texture untouched and aren't drawn
+		GLfloat vertices[8], texCoords[8];
+		GLint filter; ///< GL_NEAREST, or GL_LINEAR when GL does bilinear scaling
+	} texSlots[MOVIE_NUM_TEX];
+	unsigned char texctr;
+	GLint type;
 	int nSubFrames;
 
-	QCache<int,QByteArray> imgCache;
+	QOpenGLShaderProgram *shader; ///< draws all the subframes in one pass, NULL if it didn't link (then it's one pass per subframe)
+	int shNSub, shLum, shChan[3]; ///< its uniform locations
+
+	QCache<ImgKey,FrameRef> imgCache; ///< cost is in KB, so that budgets over 2GB fit an int
 };
 
 
@@ -1,5 +1,6 @@
 #include "MovingGrating.h"
 #include "DAQ.h"
+#include <string.h>
 
 #define TEXWIDTH 2048
 
@@ -64,6 +65,7 @@ bool MovingGrating::initFromParams()
             return false;
         }
     }
+    tframesDOChan = DAQ::ResolveDO(tframesDO);
 
 	if ( !getParam("min_color", min_color)) min_color = 0.0;
 	if ( !getParam("max_color", max_color)) max_color = 1.;
@@ -126,13 +128,49 @@ static inline bool my_feqf(const float f1, const float f2) {
     return fabsf(f1-f2) < epsilon;
 }
 
+/* virtual */
+bool MovingGrating::outputSchedule(DAQ::FrameSchedule & s) const
+{
+    if (!tframesDO.length() || tframes <= 0 || tframesDOChan < 0) return false;
+    // same as the software path in drawFrame(): high on the first frame of every tframes, low on the rest
+    DAQ::FrameSchedule::Chan c;
+    c.id = tframesDOChan;
+    c.values.fill(0., tframes);
+    c.values[0] = 1.;
+    s.nFrames = tframes;
+    s.chans.push_back(c);
+    return true;
+}
+
+namespace {
+	struct GratingState { double phase; float angle, spatial_freq; };
+}
+
+bool MovingGrating::saveRenderAheadState(QByteArray & s) const
+{
+	GratingState st;
+	memset(&st, 0, sizeof(st));
+	st.phase = phase, st.angle = angle, st.spatial_freq = spatial_freq;
+	s.resize(sizeof(st));
+	memcpy(s.data(), &st, sizeof(st));
+	return true;
+}
+
+void MovingGrating::restoreRenderAheadState(const QByteArray & s)
+{
+	GratingState st;
+	if (s.size() != sizeof(st)) return;
+	memcpy(&st, s.constData(), sizeof(st));
+	phase = st.phase, angle = st.angle, spatial_freq = st.spatial_freq;
+}
+
 void MovingGrating::drawFrame()
 {
-    if (tframesDO.length() && tframes > 0) {
+    if (tframesDO.length() && tframes > 0 && !hwTimedOutput) {
         if (!(frameNum%tframes))
-            DAQ::WriteDO(tframesDO, true);  // set tframesDO line high every tframes, if using tframes
+            DAQ::AsyncWriteDO(tframesDOChan, true);  // set tframesDO line high every tframes, if using tframes
         else if (frameNum && !((frameNum-1)%(tframes)))
-            DAQ::WriteDO(tframesDO, false); // set tframesDO line low the frame after tframes, if using tframes
+            DAQ::AsyncWriteDO(tframesDOChan, false); // set tframesDO line low the frame after tframes, if using tframes
     }
 
     const int nIters = int(fps_mode)+1;
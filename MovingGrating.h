@@ -25,6 +25,7 @@ class MovingGrating : public StimPlugin
 	float dangle; ///< delta-angle.  every tframes modify the angle by this amount
 	int tframes;
     QString tframesDO;
+    int tframesDOChan; ///< DAQ::ChanId of tframesDO, resolved in init()
 
 	float min_color,max_color; ///< actual intensities used scaled to this range. This param should be clamped between [0,1]
 	
@@ -42,6 +43,10 @@ protected:
     bool init();
 	/* virtual */ bool applyNewParamsAtRuntime();
 	/* virtual */ void afterFTBoxDraw(); 
+	/* virtual */ bool canRenderAhead() const { return !tframesDO.length() || hwTimedOutput; } ///< tframesDO is written from drawFrame(), unless it's hardware-timed
+	/* virtual */ bool outputSchedule(DAQ::FrameSchedule & s) const; ///< the tframesDO pulse train
+	/* virtual */ bool saveRenderAheadState(QByteArray & s) const; ///< phase, angle and spatial_freq
+	/* virtual */ void restoreRenderAheadState(const QByteArray & s);
 
 private:
 	bool initFromParams();
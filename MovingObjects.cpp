@@ -3,6 +3,15 @@
 #include "GLHeaders.h"
 #include "DAQ.h"
 #include <math.h>
+#include <deque>
+#include <QThread>
+#include <QSemaphore>
+#include <QMutex>
+#include <QAtomicInt>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define MO_HAVE_SSE2
+#endif
 
 #define DEFAULT_TYPE BoxType
 #define DEFAULT_LEN 8
@@ -31,13 +40,14 @@
 
 
 MovingObjects::MovingObjects()
-    : StimPlugin("MovingObjects"), savedrng(false)
+    : StimPlugin("MovingObjects"), savedrng(false), batchRender(false), batch(0), precomputeFrames(0), simulator(0), canvasW(0), canvasH(0), frameAllocs(0), maxFrameAllocs(0)
 {
 	pluginDoesOwnClearing = true;
 }
 
 MovingObjects::~MovingObjects()
 {
+	delete simulator, simulator = 0;
 }
 
 QString MovingObjects::objTypeStrs[] = { "box", "ellipsoid", "sphere", NULL };
@@ -320,6 +330,16 @@ void MovingObjects::initRealtimeChangeableParams()
 	if (!getParam("debugAABB", debugAABB))
 		debugAABB = false;
 	
+	if (!getParam("batchRender", batchRender))
+		batchRender = false;
+	
+	if (!getParam("precomputeFrames", precomputeFrames) || precomputeFrames < 0)
+		precomputeFrames = 0;
+	if (precomputeFrames && have_fv_input_file) {
+		Warning() << "precomputeFrames=" << precomputeFrames << " ignored when reading a frame var file";
+		precomputeFrames = 0;
+	}
+	
 	if (!have_fv_input_file && int(nFrames) != tframes * numSizes * numSpeeds) {
 		int oldnFrames = nFrames;
 		nFrames = tframes * numSpeeds * numSizes;
@@ -329,6 +349,7 @@ void MovingObjects::initRealtimeChangeableParams()
 
 bool MovingObjects::init()
 {
+	canvasW = width(), canvasH = height();
 	
 	initCameraDistance();
 	
@@ -362,6 +383,7 @@ bool MovingObjects::init()
        	objs.push_back(!i ? ObjData() : objs.front()); // get defaults from first object
 		ObjData & o = objs.back();
 		o.objNum = i;
+		o.paramSuffix = i > 0 ? QString::number(i+1) : QString();
 			
 		if (!initObjectFromParams(o, csfv)) {
 			if (i > 0)
@@ -410,6 +432,7 @@ bool MovingObjects::init()
             return false;
         }
     }
+    tframesDOChan = DAQ::ResolveDO(tframesDO);
 
 	if (!getParam("ft_change_frame_cycle", ftChangeEvery) && !getParam("ftrack_change_frame_cycle",ftChangeEvery) 
 		&& !getParam("ftrack_change_cycle",ftChangeEvery) && !getParam("ftrack_change",ftChangeEvery)) 
@@ -524,6 +547,9 @@ bool MovingObjects::init()
 	// NB: the below is a performance optimization for Shapes such as Ellipse and Rectangle which create 1 display list per 
 	// object -- the below ensures that the shared static display list is compiled after init is done so that we don't have to compile one later
 	// while the plugin is running
+	bool gradShader;
+	if (!getParam("gradShader", gradShader)) gradShader = true;
+	Shapes::GradientShape::setUseShader(gradShader);
 	Shapes::InitStaticDisplayLists();
 	
 	if (!softCleanup) glGetIntegerv(GL_SHADE_MODEL, &savedShadeModel);
@@ -573,29 +599,7 @@ void MovingObjects::initObj(ObjData & o) {
 		Shapes::Sphere *sph = 0;
 		o.shape = sph = new Shapes::Sphere(o.len_vec[0].x);
 		for (int i = 0; i < (int)o.len_vec.size(); ++i) o.len_vec[i].y = o.len_vec[i].x; ///< enforce lengths in x/y equal for spheres
-		sph->lightIsFixedInSpace = lightIsFixedInSpace;
-		for (int i = 0; i < 3; ++i)	sph->lightPosition[i] = lightPos[i]*2.0;
-		sph->lightPosition[3] = lightIsDirectional ? 0.0f : 1.0f;
-		for (int i = 0; i < 3; ++i) {
-			sph->lightAmbient[i] = lightAmbient;
-			sph->lightSpecular[i] = lightSpecular;
-			sph->lightDiffuse[i] = lightDiffuse;
-			sph->ambient[i] = o.ambient;
-			sph->diffuse[i] = o.diffuse;
-			sph->emission[i] = o.emission;
-			sph->specular[i] = o.specular;
-		}
-		sph->lightAttenuations[0] = lightConstantAttenuation;
-		sph->lightAttenuations[1] = lightLinearAttenuation;
-		sph->lightAttenuations[2] = lightQuadraticAttenuation;
-		sph->shininess = o.shininess*128.0;
-		sph->lightAmbient[3] = 1.;
-		sph->lightSpecular[3] = 1.;
-		sph->lightDiffuse[3] = 1.;
-		sph->ambient[3] = 1.0;
-		sph->diffuse[3] = 1.0;
-		sph->emission[3] = 1.0;
-		sph->specular[3] = 1.0;
+		setupSphereLighting(sph, o);
 		o.color = 1.; // hard-code white color for spheres
 		o.spin = 0.;
 		o.phi_o = 0.; // no spin or phi for spheres...
@@ -605,10 +609,38 @@ void MovingObjects::initObj(ObjData & o) {
 	Shapes::GradientShape *gs = 0;
 	if ((gs = dynamic_cast<Shapes::GradientShape *>(o.shape)))
 		gs->setGradient(o.grad_type,o.grad_freq,o.grad_angle,o.grad_offset,o.grad_min,o.grad_max);
+	o.shape->mo = this; // distance() and canvasPosition() use it, also on the simulation thread
 	o.shape->position = o.pos_o;
 	o.shape->noMatrixAttribPush = true; ///< performance hack	
 }
 
+void MovingObjects::setupSphereLighting(Shapes::Sphere *sph, const ObjData & o) const
+{
+	sph->lightIsFixedInSpace = lightIsFixedInSpace;
+	for (int i = 0; i < 3; ++i)	sph->lightPosition[i] = lightPos[i]*2.0;
+	sph->lightPosition[3] = lightIsDirectional ? 0.0f : 1.0f;
+	for (int i = 0; i < 3; ++i) {
+		sph->lightAmbient[i] = lightAmbient;
+		sph->lightSpecular[i] = lightSpecular;
+		sph->lightDiffuse[i] = lightDiffuse;
+		sph->ambient[i] = o.ambient;
+		sph->diffuse[i] = o.diffuse;
+		sph->emission[i] = o.emission;
+		sph->specular[i] = o.specular;
+	}
+	sph->lightAttenuations[0] = lightConstantAttenuation;
+	sph->lightAttenuations[1] = lightLinearAttenuation;
+	sph->lightAttenuations[2] = lightQuadraticAttenuation;
+	sph->shininess = o.shininess*128.0;
+	sph->lightAmbient[3] = 1.;
+	sph->lightSpecular[3] = 1.;
+	sph->lightDiffuse[3] = 1.;
+	sph->ambient[3] = 1.0;
+	sph->diffuse[3] = 1.0;
+	sph->emission[3] = 1.0;
+	sph->specular[3] = 1.0;
+}
+
 void MovingObjects::initObjs() {
 	int i = 0;
 	for (QList<ObjData>::iterator it = objs.begin(); it != objs.end(); ++it, ++i) {
@@ -636,10 +668,15 @@ void MovingObjects::cleanupObjs() {
 
 void MovingObjects::cleanup()
 {
+	flushPrecomputed(); // rewinds the RNG and objects to the last frame drawn
 	if ((savedrng = softCleanup)) {
 		saved_ran1state = ran1Gen.currentSeed();		
 	}
     cleanupObjs();
+	objs2Render.clear();
+	shapeArena.clear();
+	maxFrameAllocs = 0;
+	delete batch, batch = 0;
 	if (!softCleanup) {
 		Shapes::CleanupStaticDisplayLists();
 		glShadeModel(savedShadeModel);
@@ -652,10 +689,12 @@ bool MovingObjects::processKey(int key)
     switch ( key ) {
     case 'm':
     case 'M':
+		flushPrecomputed();
         moveFlag = !moveFlag;
         return true;
 	case 'j':
 	case 'J':
+		flushPrecomputed();
 		jitterlocal = !jitterlocal;
 		return true;
     }
@@ -783,11 +822,11 @@ void MovingObjects::preReadFrameVarsForWholeFrame()
 		}	
 }
 
-void MovingObjects::postWriteFrameVarsForWholeFrame()
+void MovingObjects::postWriteFrameVarsForWholeFrame(const QVector<QVector<QVector<double> > > & fvs)
 {
-	for (int i = 0; i < numObj; ++i) {
-		for (int k = 0; k < nSubFrames; ++k) {
-			const QVector<double> & fv (fvs_block[i][k]);
+	for (int i = 0; i < numObj && i < fvs.size(); ++i) {
+		for (int k = 0; k < nSubFrames && k < fvs[i].size(); ++k) {
+			const QVector<double> & fv (fvs[i][k]);
 			if (unsigned(fv.size()) != frameVars->nFields()) {
 				Error() << "INTERNAL PLUGIN ERROR: FrameVar file configured for different number of fields than are being written!";
 				stop();
@@ -805,31 +844,73 @@ static inline void SETUP_STEPWISE_VEL_DIR_HELPER(Vec2 & stepwise_vel_dir, double
     else stepwise_vel_dir = Vec2(xxx,yyy).normalized();
 }
 
+/* virtual */
+bool MovingObjects::outputSchedule(DAQ::FrameSchedule & s) const
+{
+    if (!tframesDO.length() || tframes <= 0 || tframesDOChan < 0) return false;
+    // same as the software path in doFrameDraw(): high on the first frame of every tframes, low on the rest
+    DAQ::FrameSchedule::Chan c;
+    c.id = tframesDOChan;
+    c.values.fill(0., tframes);
+    c.values[0] = 1.;
+    s.nFrames = tframes;
+    s.chans.push_back(c);
+    return true;
+}
+
 void MovingObjects::doFrameDraw()
 {	
-	if (have_fv_input_file) 
-		preReadFrameVarsForWholeFrame();
-
-    if (tframesDO.length() && tframes > 0) {
+    if (tframesDO.length() && tframes > 0 && !hwTimedOutput) {
         if (!(frameNum%tframes))
-            DAQ::WriteDO(tframesDO, true);  // set tframesDO line high every tframes, if using tframes
+            DAQ::AsyncWriteDO(tframesDOChan, true);  // set tframesDO line high every tframes, if using tframes
         else if (frameNum && !((frameNum-1)%(tframes)))
-            DAQ::WriteDO(tframesDO, false); // set tframesDO line low the frame after tframes, if using tframes
+            DAQ::AsyncWriteDO(tframesDOChan, false); // set tframesDO line low the frame after tframes, if using tframes
     }
 
-	QMap <double, Obj2Render> objs2Render; ///< objects will be rendered in this order, this is ordered in reverse depth order
+	if (width() != canvasW || height() != canvasH) {
+		// frames simulated ahead used the old size
+		flushPrecomputed();
+		canvasW = width(), canvasH = height();
+	}
+
+	if (precomputeFrames > 0) {
+		FrameState *fs = takePrecomputedFrame();
+		renderFrame(*fs);
+		delete fs;
+		return;
+	}
+	
+	if (simulateFrame(frameNum, syncFrame))
+		renderFrame(syncFrame);
+	syncFrame.fvs.clear(); // drop our reference to fvs_block's rows, so that the next simulateFrame() writes them in place
+}
+
+bool MovingObjects::simulateFrame(unsigned fnum, FrameState & out)
+{
+	if (have_fv_input_file) 
+		preReadFrameVarsForWholeFrame();
+	
+	out.fnum = fnum;
+	out.nAllocs = 0;
+	out.items.clear();
+	if (out.items.capacity() < size_t(objs.size()*nSubFrames)) 
+		out.items.reserve(objs.size()*nSubFrames), ++out.nAllocs;
+	
+	motion.resize(objs.size());
+	// update position after delay period
+	const bool doPositionUpdate = (int(fnum)%tframes /*- delay*/) >= 0;
 	
 	for (int k=0; k < nSubFrames; k++) {
 		
-		for (QList<ObjData>::iterator it = objs.begin(); it != objs.end(); ++it) {
+		// Pass 1: jitter, trial (re)initialization, stepwise velocity and edge handling, per object.
+		// NB: this consumes random numbers so it must always be done strictly in object order!
+		int i = 0;
+		for (QList<ObjData>::iterator it = objs.begin(); it != objs.end(); ++it, ++i) {
 #    define SETUP_STEPWISE_VEL_DIR(xxx,yyy) SETUP_STEPWISE_VEL_DIR_HELPER(o.stepwise_vel_dir,xxx,yyy)
 			ObjData & o = *it;
-			int objName = o.objNum + 1;
-			QString suf = objName > 1 ? QString::number(objName) : "";
-			if (!o.shape) continue; // should never happen..
-			Rect aabb = o.shape->AABB();
-			double objLen, objLen_min;
-			float  & objcolor (o.color);
+			if (!(motion.valid[i] = (o.shape != 0))) continue; // should never happen..
+			Rect & aabb (motion.aabb[i] = o.shape->AABB());
+			double & objLen (motion.objLen[i]), & objLen_min (motion.objLenMin[i]);
 
 			{ // Create a scope for the below references...				
 				double & x  (o.shape->position.x),					 
@@ -869,7 +950,7 @@ void MovingObjects::doFrameDraw()
 					
 										
 					// initialize position iff k==0 and frameNum is a multiple of tframes
-					if ( !k && !(frameNum%tframes)) {
+					if ( !k && !(fnum%tframes)) {
 						if (++o.vel_vec_i >= o.vel_vec.size()) {
 							o.vel_vec_i = 0;
 							++o.len_vec_i;
@@ -885,8 +966,8 @@ void MovingObjects::doFrameDraw()
 						objLen_min = o.len_vec[o.len_vec_i].y;
 						
 						// save current r1immediate, r2immediate
-						//params[QString("r1_immediate")+suf] = QString::number(objLen);
-						//params[QString("r2_immediate")+suf] = QString::number(objLen_min);
+						//params[QString("r1_immediate")+o.paramSuffix] = QString::number(objLen);
+						//params[QString("r2_immediate")+o.paramSuffix] = QString::number(objLen_min);
 						
 						// apply new length by adjusting object scale
 						o.shape->scale.x = objLen / objLen_o;
@@ -1004,39 +1085,57 @@ void MovingObjects::doFrameDraw()
 					// increment only once for every 'tFrame' notion of a frame, which is a graphics card frame.  Caused confusion before when I didn't do it like this (see emails with tjwardill 1/11/2016)
 					if (unsigned(++o.stepwise_vel_vec_i) >= unsigned(o.stepwise_vel_vec.size())) 
 						o.stepwise_vel_vec_i = 0;
+				} // END if moveFlag
+			} // end alias reference scope
+			
+			// gather this object's kinematic state for the position update pass below
+			motion.x[i] = o.shape->position.x;
+			motion.y[i] = o.shape->position.y;
+			motion.z[i] = o.shape->position.z;
+			motion.vx[i] = o.v.x;
+			motion.vy[i] = o.v.y;
+			motion.vz[i] = o.v.z;
+			motion.jx[i] = o.jitterx;
+			motion.jy[i] = o.jittery;
+			motion.jz[i] = o.jitterz;
+			motion.hw[i] = aabb.size.w/2;
+			motion.hh[i] = aabb.size.h/2;
+		} // end obj loop
+		
+		// Pass 2: update all object positions applying velocity vector o.v (plus jitter), for all objects at once
+		if (moveFlag && doPositionUpdate) {
+			const MotionBounds b = { canvasW*.5, canvasH*.5, cameraDistance, min_x_pix, max_x_pix, min_y_pix, max_y_pix, zBoundsNear, zBoundsFar, wrapEdge };
+			integrateMotion(motion, i, b);
+		}
+		
+		// Pass 3: write back positions, gradient animation, frame var input/output, and enqueue for render
+		i = 0;
+		for (QList<ObjData>::iterator it = objs.begin(); it != objs.end(); ++it, ++i) {
+			ObjData & o = *it;
+			if (!motion.valid[i]) continue;
+			Rect & aabb (motion.aabb[i]);
+			double & objLen (motion.objLen[i]), & objLen_min (motion.objLenMin[i]);
+			float  & objcolor (o.color);
 
-					
-					
-					// update object position applying velocity vector o.v
-					{
-						Vec2 c = Shapes::Shape::canvasPosition(Vec3(x+vx+jitterx,y+vy+jittery,z+vz+jitterz));
-						// update position after delay period
-						// if jitter pushes us outside of motion box then do not jitter this frame
-						if ((int(frameNum)%tframes /*- delay*/) >= 0) { 
-							if (!wrapEdge && ((c.x + aabb.size.w/2 > max_x_pix) 
-											  ||  (c.x - aabb.size.w/2 < min_x_pix)))
-								x += vx;
-							else 
-								x += vx + jitterx;
-							if (!wrapEdge && ((c.y + aabb.size.h/2 > max_y_pix) 
-											  || (c.y - aabb.size.h/2 < min_y_pix))) 
-								y += vy;
-							else 
-								y += vy + jittery;
-							
-							if (!wrapEdge && (z+vz+jitterz > zBoundsFar
-											  || z+vz+jitterz < zBoundsNear)) 
-								z += vz;
-							else 
-								z += vz + jitterz;
-
-							// also apply spin
-							objPhi += o.spin;
-
-							aabb = o.shape->AABB();
-							o.lastPos = o.shape->position; // save last pos
+			{ // Create a scope for the below references...				
+				double & x  (o.shape->position.x),					 
+					   & y  (o.shape->position.y),	
+					   & z  (o.shape->position.z);
+				
+				double  & objLen_o (o.len_vec[0].x), & objLen_min_o (o.len_vec[0].y);
+				double  & objPhi (o.shape->angle); 
 
-						}
+				if (moveFlag) {
+					if (doPositionUpdate) {
+						x = motion.x[i];
+						y = motion.y[i];
+						z = motion.z[i];
+						
+						// also apply spin
+						objPhi += o.spin;
+						
+						aabb = o.shape->AABB();
+						o.lastPos = o.shape->position; // save last pos
 					}
 					
 					// update grating position/spin (note, this is slightly costly performance-wise)
@@ -1066,7 +1165,7 @@ void MovingObjects::doFrameDraw()
                             o.grad_angle += float(dT) * o.grad_spin;
                             while (o.grad_angle < (float)-2.*M_PI) o.grad_angle += float(2.*M_PI);
                             while (o.grad_angle > (float)2.*M_PI) o.grad_angle -= float(2.*M_PI);
-							gshape->setGradient(o.grad_type, o.grad_freq, o.grad_angle, o.grad_offset, o.grad_min, o.grad_max);
+							gshape->setGradient(o.grad_type, o.grad_freq, o.grad_angle, o.grad_offset, o.grad_min, o.grad_max, false); // o.shape is never drawn, only its copies, so skip the GL setup here
 						}
 						
 						// safely update stepwise gradient param indices						
@@ -1077,10 +1176,10 @@ void MovingObjects::doFrameDraw()
 					}
 					
 					// save current velocities, phi
-					//params[QString("objVelx_immediate")+suf] = QString::number(vx);
-					//params[QString("objVely_immediate")+suf] = QString::number(vy);
-					//params[QString("objVelz_immediate")+suf] = QString::number(vz);
-					//params[QString("objPhi_immediate")+suf] = QString::number(objPhi);
+					//params[QString("objVelx_immediate")+o.paramSuffix] = QString::number(vx);
+					//params[QString("objVely_immediate")+o.paramSuffix] = QString::number(vy);
+					//params[QString("objVelz_immediate")+o.paramSuffix] = QString::number(vz);
+					//params[QString("objPhi_immediate")+o.paramSuffix] = QString::number(objPhi);
 										
 					
 				} // END if moveFlag
@@ -1090,27 +1189,27 @@ void MovingObjects::doFrameDraw()
 						
 					const QVector<double> & fv (fvs_block[o.objNum][k]); 
 										
-					if (fv.size() < NUM_FRAME_VARS && frameNum) {
+					if (fv.size() < NUM_FRAME_VARS && fnum) {
 						// at end of file?
 						Warning() << name() << "'s frame_var file ended input, stopping plugin.";
 						have_fv_input_file = false;
 						stop();
-						return;
+						return false;
 					} 
-					if (fv.size() < NUM_FRAME_VARS || fv[FV_frameNum] != frameNum) {
-						Error() << "Error reading frame " << frameNum << " from frameVar file! Datafile frame num differs from current frame number!  Do all the fps_mode and numObj parameters of the frameVar file match the current fps mode and numObjs?";	
+					if (fv.size() < NUM_FRAME_VARS || fv[FV_frameNum] != fnum) {
+						Error() << "Error reading frame " << fnum << " from frameVar file! Datafile frame num differs from current frame number!  Do all the fps_mode and numObj parameters of the frameVar file match the current fps mode and numObjs?";	
 						stop();
-						return;
+						return false;
 					}
 					if (fv[FV_objNum] != o.objNum) {
 						Error() << "Error reading object " << o.objNum << " from frameVar file! Datafile object num differs from current object number!  Do all the fps_mode and numObj parameters of the frameVar file match the current fps mode and numObjs?";	
 						stop();
-						return;						
+						return false;						
 					}
 					if (fv[FV_subFrameNum] != k) {
 						Error() << "Error reading subframe " << k << " from frameVar file! Datafile subframe num differs from current subframe numer!  Do all the fps_mode and numObj parameters of the frameVar file match the current fps mode and numObjs?";	
 						stop();
-						return;												
+						return false;												
 					}
 					
 
@@ -1147,7 +1246,7 @@ void MovingObjects::doFrameDraw()
 					if (!is3D && !eqf(z, 0.)) is3D = true;
 					
 						
-					if (!k && !frameNum) {
+					if (!k && !fnum) {
 						// do some required initialization if on frame 0 for this object to make sure r1, r2 and  obj type jive
 						o.phi_o = objPhi;
 						o.pos_o = Vec3(x,y,z);
@@ -1181,23 +1280,28 @@ void MovingObjects::doFrameDraw()
 			} // end alias reference scope
 			
 			// enqueue draw stim if after delay period, or if have fv file
-			if (have_fv_input_file || (int(frameNum)%tframes) >= 0) {
-				/// enqueue object to be rendered in depth order
-				Obj2Render o2r(o, k, aabb);
-				shapes2del.push_back(o2r.shapeCopy = newShape(o.type));
-				o2r.shapeCopy->copyProperties(o.shape);				
-				objs2Render.insertMulti(-o.shape->position.z, o2r);
+			if (have_fv_input_file || (int(fnum)%tframes) >= 0) {
+				/// enqueue object to be rendered (renderFrame() sorts them by depth)
+				RenderItem ri;
+				ri.type = o.type;
+				ri.objNum = o.objNum;
+				ri.k = k;
+				ri.debugLvl = o.debugLvl;
+				ri.color = objcolor;
+				ri.shape.save(o.shape);
+				ri.aabb = aabb;
+				out.items.push_back(ri);
 				
 				if (!have_fv_input_file /**< doing output.. */) {
-					double fnum = frameNum;
+					double fvnum = fnum;
 
 					// in rndtrial mode, save 1 big file with fnum being a derived value.  HACK!
-					if (rndtrial && loopCt && nFrames) fnum = frameNum + loopCt*nFrames;
+					if (rndtrial && loopCt && nFrames) fvnum = fnum + loopCt*nFrames;
 
 					// nb: push() needs to take all doubles as args!
 					QVector<double> & fv (fvs_block[o.objNum][k]);
 					fv.resize(N_FVCols);
-					fv[FV_frameNum] = fnum;
+					fv[FV_frameNum] = fvnum;
 					fv[FV_objNum] = o.objNum;
 					fv[FV_subFrameNum] = k;
 					fv[FV_objType] = o.type;
@@ -1216,14 +1320,48 @@ void MovingObjects::doFrameDraw()
 				
 	} // end K loop
 	
+	if (!have_fv_input_file)
+		out.fvs = fvs_block;
+	return true;
+}
+
+void MovingObjects::renderFrame(FrameState & fs)
+{
+	unsigned nAllocs = fs.nAllocs;
+	// if precomputing, objs belongs to the simulation thread, so read sphere material params from the frame's own snapshot of them
+	const QList<ObjData> & objData (fs.ckpt.objs.size() ? fs.ckpt.objs : objs);
+	
+	shapeArena.reset();
+	objs2Render.clear();
+	if (objs2Render.capacity() < fs.items.size()) 
+		objs2Render.reserve(fs.items.size()), ++nAllocs;
+	// NB: items are added in reverse so that after the (stable) sort, objects at the same depth are drawn last-enqueued-first, as they always were
+	for (std::vector<RenderItem>::const_reverse_iterator it = fs.items.rbegin(); it != fs.items.rend(); ++it) {
+		const RenderItem & ri (*it);
+		Obj2Render o2r;
+		o2r.obj = &ri;
+		o2r.shapeCopy = shapeArena.get(ri.type, nAllocs);
+		o2r.shapeCopy->mo = this;
+		o2r.depth = -ri.shape.position.z;
+		ri.shape.apply(o2r.shapeCopy, true);
+		if (ri.type == SphereType && ri.objNum < objData.size())
+			setupSphereLighting(static_cast<Shapes::Sphere *>(o2r.shapeCopy), objData.at(ri.objNum));
+		objs2Render.push_back(o2r);
+	}
+	sortObjs2Render(nAllocs);
+	
 	// now, render all objects for this entire frame in depth-first order, ascending.
-	int i = 0;
-	for (QMap<double,Obj2Render>::iterator it = objs2Render.begin(); it != objs2Render.end(); ++it, ++i) {
-		drawObject(i, *it);
-	} 
+	if (batchRender) {
+		drawObjectsBatched(objs2Render);
+	} else {
+		int i = 0;
+		for (std::vector<Obj2Render>::iterator it = objs2Render.begin(); it != objs2Render.end(); ++it, ++i) {
+			drawObject(i, *it);
+		} 
+	}
 	
 	// shapes2del guards against possible dangling alias/references...
-	for (QList<Shapes::Shape *>::iterator it = shapes2del.begin(); it != shapes2del.end(); ++it)
+	for (std::vector<Shapes::Shape *>::iterator it = shapes2del.begin(); it != shapes2del.end(); ++it)
 		delete *it;
 	shapes2del.clear();
 	
@@ -1231,25 +1369,135 @@ void MovingObjects::doFrameDraw()
 	// rendering order in this plugin, so we save them above as we render, and then write them out 
 	//  in subframe order, grouped by object number
 	// .. we do them in blocks for all the objects and subframes for this frame
-	// the inverse of this (read a frame's worth of vars and reorder it) is at the beginning of this function
+	// the inverse of this (read a frame's worth of vars and reorder it) is at the beginning of simulateFrame()
 	if (!have_fv_input_file)
-		postWriteFrameVarsForWholeFrame();	
+		postWriteFrameVarsForWholeFrame(fs.fvs);	
+	
+	frameAllocs = nAllocs;
+	if (frameAllocs > maxFrameAllocs) maxFrameAllocs = frameAllocs;
+	if (frameNum > 0 && !(frameNum%45))
+		setSBString(QString().sprintf("Heap allocs last frame: %u max: %u", frameAllocs, maxFrameAllocs));
 }
 
-void MovingObjects::drawObject(const int i, Obj2Render & o2r)
+/// Bottom-up merge sort (stable), using objs2RenderTmp as scratch space so the heap is only touched if the number of objects grew
+void MovingObjects::sortObjs2Render(unsigned & nAllocs)
+{
+	std::vector<Obj2Render> & v (objs2Render);
+	const int n = int(v.size());
+	int i;
+	for (i = 1; i < n && !(v[i].depth < v[i-1].depth); ++i)
+		; // already in order? (always the case in 2D mode, where everything is at the same depth)
+	if (i >= n) return;
+	if (objs2RenderTmp.capacity() < v.size()) ++nAllocs;
+	objs2RenderTmp.resize(v.size());
+	Obj2Render *src = &v[0], *dst = &objs2RenderTmp[0];
+	for (int w = 1; w < n; w *= 2) {
+		for (int lo = 0; lo < n; lo += 2*w) {
+			const int mid = MIN(lo+w, n), hi = MIN(lo+2*w, n);
+			int a = lo, b = mid, o = lo;
+			while (a < mid && b < hi) dst[o++] = src[b].depth < src[a].depth ? src[b++] : src[a++];
+			while (a < mid) dst[o++] = src[a++];
+			while (b < hi) dst[o++] = src[b++];
+		}
+		Obj2Render *tmp = src; src = dst; dst = tmp;
+	}
+	if (src != &v[0]) v.swap(objs2RenderTmp);
+}
+
+Shapes::Shape *MovingObjects::ShapeArena::get(ObjType t, unsigned & nAllocs)
+{
+	if (unsigned(t) >= unsigned(N_ObjTypes)) t = BoxType;
+	std::vector<Shapes::Shape *> & v (shapes[t]);
+	if (used[t] >= v.size()) {
+		if (v.size() == v.capacity()) ++nAllocs;
+		v.push_back(newShape(t));
+		++nAllocs;
+	}
+	return v[used[t]++];
+}
+
+void MovingObjects::ShapeArena::clear()
+{
+	for (int i = 0; i < (int)N_ObjTypes; ++i) {
+		for (std::vector<Shapes::Shape *>::iterator it = shapes[i].begin(); it != shapes[i].end(); ++it)
+			delete *it;
+		shapes[i].clear();
+	}
+	reset();
+}
+
+void MovingObjects::MotionSoA::resize(int n)
+{
+	std::vector<double> * const v[] = { &x, &y, &z, &vx, &vy, &vz, &jx, &jy, &jz, &hw, &hh, &objLen, &objLenMin };
+	for (unsigned j = 0; j < sizeof(v)/sizeof(*v); ++j)
+		if (int(v[j]->size()) != n) v[j]->resize(n);
+	if (int(aabb.size()) != n) aabb.resize(n);
+	if (int(valid.size()) != n) valid.resize(n);
+}
+
+/// Position update for objects [0,n) in motion, equivalent to applying, per object:
+///   c = Shape::canvasPosition(pos + v + jitter); pos += v, or pos += v + jitter if the jittered position stays inside the motion box.
+/// The SSE2 path does the same IEEE double operations in the same order as the scalar path, so results are bit-identical.
+/* static */
+void MovingObjects::integrateMotion(MotionSoA & m, int n, const MotionBounds & b)
+{
+	const double midx = b.midx, midy = b.midy, cam = b.cameraDistance,
+	             min_x_pix = b.min_x_pix, max_x_pix = b.max_x_pix, min_y_pix = b.min_y_pix, max_y_pix = b.max_y_pix,
+	             zBoundsNear = b.zBoundsNear, zBoundsFar = b.zBoundsFar;
+	const bool wrapEdge = b.wrapEdge;
+	int i = 0;
+#ifdef MO_HAVE_SSE2
+	if (!eqf(cam, 0.)) {
+		const __m128d vmidx = _mm_set1_pd(midx), vmidy = _mm_set1_pd(midy), vcam = _mm_set1_pd(cam),
+		              one = _mm_set1_pd(1.0), eps = _mm_set1_pd(EPSILON), tiny = _mm_set1_pd(1e-9), sign = _mm_set1_pd(-0.0),
+		              xmin = _mm_set1_pd(min_x_pix), xmax = _mm_set1_pd(max_x_pix), ymin = _mm_set1_pd(min_y_pix), ymax = _mm_set1_pd(max_y_pix),
+		              znear = _mm_set1_pd(zBoundsNear), zfar = _mm_set1_pd(zBoundsFar), 
+		              noJitterEnabled = wrapEdge ? _mm_setzero_pd() : _mm_cmpeq_pd(one, one);
+		for ( ; i+2 <= n; i += 2) {
+			const __m128d x = _mm_loadu_pd(&m.x[i]), y = _mm_loadu_pd(&m.y[i]), z = _mm_loadu_pd(&m.z[i]),
+			              vx = _mm_loadu_pd(&m.vx[i]), vy = _mm_loadu_pd(&m.vy[i]), vz = _mm_loadu_pd(&m.vz[i]),
+			              jx = _mm_loadu_pd(&m.jx[i]), jy = _mm_loadu_pd(&m.jy[i]), jz = _mm_loadu_pd(&m.jz[i]),
+			              hw = _mm_loadu_pd(&m.hw[i]), hh = _mm_loadu_pd(&m.hh[i]);
+			const __m128d pz = _mm_add_pd(_mm_add_pd(z, vz), jz);
+			__m128d d = _mm_add_pd(_mm_div_pd(pz, vcam), one);
+			const __m128d dzero = _mm_cmplt_pd(_mm_andnot_pd(sign, d), eps);
+			d = _mm_or_pd(_mm_and_pd(dzero, tiny), _mm_andnot_pd(dzero, d));
+			const __m128d cx = _mm_add_pd(_mm_div_pd(_mm_sub_pd(_mm_add_pd(_mm_add_pd(x, vx), jx), vmidx), d), vmidx),
+			              cy = _mm_add_pd(_mm_div_pd(_mm_sub_pd(_mm_add_pd(_mm_add_pd(y, vy), jy), vmidy), d), vmidy);
+			// lanes where jitter would push us outside of the motion box get no jitter this frame
+			const __m128d nx = _mm_and_pd(noJitterEnabled, _mm_or_pd(_mm_cmpgt_pd(_mm_add_pd(cx, hw), xmax), _mm_cmplt_pd(_mm_sub_pd(cx, hw), xmin))),
+			              ny = _mm_and_pd(noJitterEnabled, _mm_or_pd(_mm_cmpgt_pd(_mm_add_pd(cy, hh), ymax), _mm_cmplt_pd(_mm_sub_pd(cy, hh), ymin))),
+			              nz = _mm_and_pd(noJitterEnabled, _mm_or_pd(_mm_cmpgt_pd(pz, zfar), _mm_cmplt_pd(pz, znear)));
+			_mm_storeu_pd(&m.x[i], _mm_add_pd(x, _mm_or_pd(_mm_and_pd(nx, vx), _mm_andnot_pd(nx, _mm_add_pd(vx, jx)))));
+			_mm_storeu_pd(&m.y[i], _mm_add_pd(y, _mm_or_pd(_mm_and_pd(ny, vy), _mm_andnot_pd(ny, _mm_add_pd(vy, jy)))));
+			_mm_storeu_pd(&m.z[i], _mm_add_pd(z, _mm_or_pd(_mm_and_pd(nz, vz), _mm_andnot_pd(nz, _mm_add_pd(vz, jz)))));
+		}
+	}
+#endif
+	for ( ; i < n; ++i) {
+		const double pz = m.z[i]+m.vz[i]+m.jz[i];
+		double d = eqf(cam, 0.) ? 0. : pz/cam + 1.0;
+		if (eqf(d, 0.0)) d = 1e-9;
+		const double cx = (m.x[i]+m.vx[i]+m.jx[i] - midx)/d + midx,
+		             cy = (m.y[i]+m.vy[i]+m.jy[i] - midy)/d + midy;
+		// if jitter pushes us outside of motion box then do not jitter this frame
+		if (!wrapEdge && ((cx + m.hw[i] > max_x_pix) || (cx - m.hw[i] < min_x_pix)))
+			m.x[i] += m.vx[i];
+		else
+			m.x[i] += m.vx[i] + m.jx[i];
+		if (!wrapEdge && ((cy + m.hh[i] > max_y_pix) || (cy - m.hh[i] < min_y_pix)))
+			m.y[i] += m.vy[i];
+		else
+			m.y[i] += m.vy[i] + m.jy[i];
+		if (!wrapEdge && (pz > zBoundsFar || pz < zBoundsNear))
+			m.z[i] += m.vz[i];
+		else
+			m.z[i] += m.vz[i] + m.jz[i];
+	}
+}
+
+bool MovingObjects::setupSubframeColor(Shapes::Shape *s, float objcolor, int k)
 {
-	(void)i;
-	const Rect & aabb (o2r.aabb);
-	Shapes::Shape *s = o2r.shapeCopy;
-	const ObjData & o (o2r.obj);
-	const int k (o2r.k);
-	double t0;
-		
-	if (o.debugLvl >= 2)
-		t0 = getTime();
-	
-	const float & objcolor (o.color);
-	
 	float r,g,b;
 	bool fpsTrick = false;
 	
@@ -1265,6 +1513,22 @@ void MovingObjects::drawObject(const int i, Obj2Render & o2r)
 		b = g = r = objcolor;
 	
 	s->color = Vec3(r, g, b);
+	return fpsTrick;
+}
+
+void MovingObjects::drawObject(const int i, Obj2Render & o2r)
+{
+	(void)i;
+	const RenderItem & o (*o2r.obj);
+	const Rect & aabb (o.aabb);
+	Shapes::Shape *s = o2r.shapeCopy;
+	const int k (o.k);
+	double t0;
+		
+	if (o.debugLvl >= 2)
+		t0 = getTime();
+	
+	const bool fpsTrick = setupSubframeColor(s, o.color, k);
 			
 	if (o.type == SphereType) {
 		glShadeModel(GL_SMOOTH);
@@ -1284,18 +1548,59 @@ void MovingObjects::drawObject(const int i, Obj2Render & o2r)
 	}
 	
 	///DEBUG HACK FOR AABB VERIFICATION					
-	if (debugAABB && k==0) {
-		const Rect & r (aabb);
-		glColor3f(0.,1.,0); 
-		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-		glBegin(GL_QUADS);
-		glVertex2f(r.origin.x,r.origin.y);
-		glVertex2f(r.origin.x+r.size.w,r.origin.y);
-		glVertex2f(r.origin.x+r.size.w,r.origin.y+r.size.h);
-		glVertex2f(r.origin.x,r.origin.y+r.size.h);	
-		glEnd();
-		glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
-	}	
+	if (debugAABB && k==0) 
+		drawDebugAABB(aabb);
+}
+
+void MovingObjects::drawDebugAABB(const Rect & r)
+{
+	glColor3f(0.,1.,0); 
+	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	glBegin(GL_QUADS);
+	glVertex2f(r.origin.x,r.origin.y);
+	glVertex2f(r.origin.x+r.size.w,r.origin.y);
+	glVertex2f(r.origin.x+r.size.w,r.origin.y+r.size.h);
+	glVertex2f(r.origin.x,r.origin.y+r.size.h);	
+	glEnd();
+	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+}
+
+void MovingObjects::drawObjectsBatched(std::vector<Obj2Render> & objs2Render)
+{
+	if (!batch) batch = new Shapes::Batch;
+	
+	// Consecutive (in depth order) objects of the same subframe get merged into one batch.
+	// A subframe change (different color mask in dual/triple fps mode) ends the current batch.
+	int curK = -1;
+	bool fpsTrick = false;
+	int i = 0;
+	glShadeModel(savedShadeModel);
+	for (std::vector<Obj2Render>::iterator it = objs2Render.begin(); it != objs2Render.end(); ++it, ++i) {
+		Obj2Render & o2r (*it);
+		const int k = o2r.obj->k;
+		if (k != curK) {
+			batch->flush();
+			curK = k;
+		}
+		// NB: sets the color mask for this subframe, which is the same for all objects in the batch
+		fpsTrick = setupSubframeColor(o2r.shapeCopy, o2r.obj->color, k);
+		if (!batch->add(o2r.shapeCopy)) {
+			// should never happen: every shape type is batchable
+			batch->flush();
+			drawObject(i, o2r);
+			glShadeModel(savedShadeModel);
+			curK = -1;
+		} else if (debugAABB && k == 0) {
+			// as in drawObject(), each outline goes right on top of its object and under the ones after it
+			batch->flush();
+			if (fpsTrick) glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			drawDebugAABB(o2r.obj->aabb);
+		}
+	}
+	batch->flush();
+	if (fpsTrick)
+		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glClear(GL_DEPTH_BUFFER_BIT);
 }
 
 void MovingObjects::wrapObject(ObjData & o, Rect & aabb) const {
@@ -1389,7 +1694,7 @@ void MovingObjects::ensureObjectIsInBounds(ObjData & o) const
 		REDO_AABB();
 		
 		// FUDGE: objects that are out-of-bounds get fudged in-bounds here...
-		Vec2 cpos = Shapes::Shape::canvasPosition(fpos);
+		Vec2 cpos = Shapes::Shape::canvasPosition(this, fpos);
 	/*	const double objLen (o.shape->scale.x * o.len_vec[0].x), objLen_min (o.shape->scale.y * o.len_vec[0].y); 
 		const double hw = objLen/2., hh = objLen_min/2.;
 		if (cpos.x-hw < min_x_pix) cpos.x = min_x_pix+hw, modified = true;
@@ -1449,45 +1754,45 @@ void MovingObjects::initBoundingNormals()
 	Vec3 a,b,t;
 	Vec3 p1, p2, p3;
 	// left edge
-	p1 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix, min_y_pix), 0.0); 
-	p2 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix, min_y_pix+1), 0.0);
-	p3 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix, min_y_pix+1), 1.0);
+	p1 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix, min_y_pix), 0.0); 
+	p2 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix, min_y_pix+1), 0.0);
+	p3 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix, min_y_pix+1), 1.0);
 	a = (p2-p1).normalized();
 	b = (p3-p1).normalized();
 	frustumNormals[0] = t = a.cross(b).normalized();
 	// right edge
-	p1 = Shapes::Shape::cposToRealPos(Vec2(max_x_pix, min_y_pix), 0.0); 
-	p2 = Shapes::Shape::cposToRealPos(Vec2(max_x_pix, min_y_pix), 1.0);
-	p3 = Shapes::Shape::cposToRealPos(Vec2(max_x_pix, min_y_pix+1), 1.0);
+	p1 = Shapes::Shape::cposToRealPos(this, Vec2(max_x_pix, min_y_pix), 0.0); 
+	p2 = Shapes::Shape::cposToRealPos(this, Vec2(max_x_pix, min_y_pix), 1.0);
+	p3 = Shapes::Shape::cposToRealPos(this, Vec2(max_x_pix, min_y_pix+1), 1.0);
 	a = (p2-p1).normalized();
 	b = (p3-p1).normalized();
 	frustumNormals[1] = t = a.cross(b).normalized();
 	// bottom edge
-	p1 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix, min_y_pix), 0.0); 
-	p2 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix, min_y_pix), 1.0);
-	p3 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix+1, min_y_pix), 1.0);
+	p1 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix, min_y_pix), 0.0); 
+	p2 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix, min_y_pix), 1.0);
+	p3 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix+1, min_y_pix), 1.0);
 	a = (p2-p1).normalized();
 	b = (p3-p1).normalized();
 	frustumNormals[2] = t = a.cross(b).normalized();
 	// top edge
-	p1 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix, max_y_pix), 0.0); 
-	p2 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix+1, max_y_pix), 0.0);
-	p3 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix+1, max_y_pix), 1.0);
+	p1 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix, max_y_pix), 0.0); 
+	p2 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix+1, max_y_pix), 0.0);
+	p3 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix+1, max_y_pix), 1.0);
 	a = (p2-p1).normalized();
 	b = (p3-p1).normalized();
 	frustumNormals[3] = t = a.cross(b).normalized();
 	// near edge
 	const double z=distanceToZ(.5); 
-	p1 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix, min_y_pix), z); 
-	p2 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix+1, min_y_pix), z);
-	p3 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix+1, min_y_pix+1), z);
+	p1 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix, min_y_pix), z); 
+	p2 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix+1, min_y_pix), z);
+	p3 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix+1, min_y_pix+1), z);
 	a = (p2-p1).normalized();
 	b = (p3-p1).normalized();
 	frustumNormals[4] = t = a.cross(b).normalized();
 	// far edge
-	p1 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix, min_y_pix), zBoundsFar); 
-	p2 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix, min_y_pix+1), zBoundsFar);
-	p3 = Shapes::Shape::cposToRealPos(Vec2(min_x_pix+1, min_y_pix+1), zBoundsFar);
+	p1 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix, min_y_pix), zBoundsFar); 
+	p2 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix, min_y_pix+1), zBoundsFar);
+	p3 = Shapes::Shape::cposToRealPos(this, Vec2(min_x_pix+1, min_y_pix+1), zBoundsFar);
 	a = (p2-p1).normalized();
 	b = (p3-p1).normalized();
 	frustumNormals[5] = t = a.cross(b).normalized();
@@ -1515,10 +1820,168 @@ double MovingObjects::zToDistance(double z) const
 	return z/cameraDistance + 1.0;
 }
 
+#ifndef Q_OS_WIN
+#pragma mark Precomputed trajectory support
+#endif
+
+/**
+   \brief Thread that runs the MovingObjects simulation ahead of drawing.
+
+   Used if precomputeFrames > 0.  Calls MovingObjects::simulateFrame() for 
+   successive frames, keeping at most precomputeFrames of them queued.  The 
+   main thread consumes them in MovingObjects::takePrecomputedFrame().  
+   While this thread exists it owns the simulation state (objs, ran1Gen, etc),
+   so the main thread must delete it (see MovingObjects::flushPrecomputed()) 
+   before touching any of that. */
+class TrajectorySimulator : public QThread
+{
+public:
+	TrajectorySimulator(MovingObjects & mo, unsigned startFrame, int nAhead);
+	~TrajectorySimulator(); ///< stops the thread and deletes any frames not yet taken
+	
+	/// Blocks until the next frame is available.  Caller must delete it.
+	MovingObjects::FrameState *takeOne();
+	
+protected:
+	/// The simulation thread function
+	void run();
+private:
+	MovingObjects & mo;
+	QSemaphore freeSlots, ///< Main thread releases 1 resource per frame taken
+	           haveMore; ///< Simulation thread releases 1 resource per frame created
+	std::deque<MovingObjects::FrameState *> frames;
+	QMutex mut; ///< Mutex for frames queue
+	unsigned nextFrame;
+	QAtomicInt stop; ///< set by the destructor, run() checks it before and after each wait for a free slot
+};
+
+TrajectorySimulator::TrajectorySimulator(MovingObjects & mo, unsigned startFrame, int nAhead)
+	: QThread(&mo), mo(mo), freeSlots(nAhead), haveMore(0), nextFrame(startFrame), stop(0)
+{
+}
+
+TrajectorySimulator::~TrajectorySimulator()
+{
+	stop.storeRelease(1);
+	freeSlots.release(1);
+	wait();
+	mut.lock();
+	for (std::deque<MovingObjects::FrameState *>::iterator it = frames.begin(); it != frames.end(); ++it)
+		delete *it;
+	frames.clear();
+	mut.unlock();
+}
+
+MovingObjects::FrameState *TrajectorySimulator::takeOne()
+{
+	haveMore.acquire();
+	MovingObjects::FrameState *f;
+	mut.lock();
+	f = frames.front();
+	frames.pop_front();
+	mut.unlock();
+	freeSlots.release();
+	return f;
+}
+
+void TrajectorySimulator::run()
+{
+	while (!stop.loadAcquire()) {
+		freeSlots.acquire();
+		if (stop.loadAcquire()) return;
+		
+		MovingObjects::FrameState *f = new MovingObjects::FrameState;
+		mo.simulateFrame(nextFrame++, *f);
+		mo.saveCheckpoint(f->ckpt);
+		mut.lock();
+		frames.push_back(f);
+		mut.unlock();
+		haveMore.release();
+	}
+}
+
+MovingObjects::FrameState *MovingObjects::takePrecomputedFrame()
+{
+	if (!simulator) {
+		saveCheckpoint(lastDrawnCkpt);
+		simulator = new TrajectorySimulator(*this, frameNum, precomputeFrames);
+		simulator->start();
+	}
+	FrameState *fs = simulator->takeOne();
+	if (fs->fnum != frameNum) {
+		// frame counter got out of step with the simulation (should not normally happen), resimulate from here
+		Debug() << "Precomputed frame " << fs->fnum << " != frameNum " << frameNum << ", resimulating";
+		delete fs;
+		flushPrecomputed();
+		return takePrecomputedFrame();
+	}
+	lastDrawnCkpt = fs->ckpt;
+	return fs;
+}
+
+void MovingObjects::flushPrecomputed()
+{
+	if (!simulator) return;
+	delete simulator, simulator = 0;
+	restoreCheckpoint(lastDrawnCkpt);
+	lastDrawnCkpt = SimCheckpoint();
+}
+
+void MovingObjects::saveCheckpoint(SimCheckpoint & c) const
+{
+	c.objs = objs;
+	c.shapes.resize(objs.size());
+	for (int i = 0; i < objs.size(); ++i)
+		if (objs[i].shape) c.shapes[i].save(objs[i].shape);
+	c.rng = ran1Gen;
+}
+
+void MovingObjects::restoreCheckpoint(const SimCheckpoint & c)
+{
+	if (c.objs.size() != objs.size()) return; // should never happen
+	for (int i = 0; i < objs.size(); ++i) {
+		ObjData & o = objs[i];
+		Shapes::Shape * const s = o.shape; // the checkpoint's shape pointer is the same as ours, but be paranoid
+		o = c.objs[i];
+		o.shape = s;
+		if (s) c.shapes[i].apply(s, false);
+	}
+	ran1Gen = c.rng;
+}
+
+void MovingObjects::ShapeState::save(const Shapes::Shape *s)
+{
+	position = s->position;
+	scale = s->scale;
+	lengths = s->lengths();
+	angle = s->angle;
+	const Shapes::GradientShape *g = dynamic_cast<const Shapes::GradientShape *>(s);
+	if (g) g->getGradient(grad_type, grad_freq, grad_angle, grad_offset, grad_min, grad_max);
+	else grad_type = Shapes::GradientShape::None, grad_freq = 1.f, grad_angle = grad_offset = grad_min = 0.f, grad_max = 1.f;
+}
+
+void MovingObjects::ShapeState::apply(Shapes::Shape *s, bool setupGradient) const
+{
+	s->position = position;
+	s->scale = scale;
+	s->setLengths(lengths.x, lengths.y);
+	s->angle = angle;
+	s->noMatrixAttribPush = true; ///< performance hack	
+	Shapes::GradientShape *g = dynamic_cast<Shapes::GradientShape *>(s);
+	if (g) g->setGradient(grad_type, grad_freq, grad_angle, grad_offset, grad_min, grad_max, setupGradient);
+}
+
 #ifndef Q_OS_WIN
 #pragma mark Realtime param update support functions here
 #endif
 
+bool MovingObjects::applyNewParamsAtRuntime_Base()
+{
+	// the simulation may be running ahead with the old params, so rewind it to the frame the new ones apply to
+	flushPrecomputed();
+	return StimPlugin::applyNewParamsAtRuntime_Base();
+}
+
 bool MovingObjects::applyNewParamsAtRuntime()
 {
 	ChangedParamMap m = paramsThatChanged();
@@ -1539,11 +2002,8 @@ bool MovingObjects::applyNewParamsAtRuntime()
 	for (int i = 0; i < numObj; ++i) {
 		ObjData & o = objs[i];
 		ObjType savedType = o.type;
-		QString suf = "";
-		if (i) {
-			suf = QString::number(i+1);
-			paramSuffixPush(suf);
-		}
+		const QString & suf (o.paramSuffix);
+		if (i) paramSuffixPush(suf);
 		QString key;
 
 		ConfigSuppressesFrameVar csfv_dummy;
@@ -1647,11 +2107,7 @@ bool MovingObjects::applyNewParamsAtRuntime()
 void MovingObjects::afterFTBoxDraw()
 {
 	if (!frameVars || !frameVars->queueCount()) return;
-	for (QList<QVector<double> >::iterator it = frameVars->getQueue().begin();  it != frameVars->getQueue().end(); ++it)
-	{
-		QVector<double> & b(*it);
-		if (b.size() > int(FV_FTrackState)) b[FV_FTrackState] = double(currentFTState);
-	}
-	frameVars->commitQueue();
+	// NB: the queued rows share their storage with fvs_block, so don't write to them -- that would copy every row, every frame
+	frameVars->commitQueue(FV_FTrackState, double(currentFTState));
 }
 
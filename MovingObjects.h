@@ -2,7 +2,11 @@
 #define MovingObjects_H
 #include "StimPlugin.h"
 #include <QList>
+#include <vector>
 #include "Shapes.h"
+#include "RNG.h"
+
+class TrajectorySimulator;
 
 /** \brief A plugin that draws K moving objects targets.  Targets may be square boxes or 
            ellipses (or circles).
@@ -16,18 +20,43 @@
 class MovingObjects : public StimPlugin
 {
     friend class GLWindow;
+    friend class TrajectorySimulator;
     MovingObjects();
 public:
     virtual ~MovingObjects();
 
+	/// Structure-of-arrays motion state for all objects, filled in per subframe by simulateFrame() so the position update can run over all objects at once (vectorized)
+	struct MotionSoA {
+		std::vector<double> x, y, z,    ///< position
+		                    vx, vy, vz, ///< working velocity (ObjData::v)
+		                    jx, jy, jz, ///< jitter for this subframe
+		                    hw, hh,     ///< half width/height of the object's AABB
+		                    objLen, objLenMin;
+		std::vector<Rect> aabb;
+		std::vector<char> valid; ///< false if the object had no shape and is to be skipped
+		void resize(int n);
+	};
+	/// The canvas and motion box, as the position update sees them
+	struct MotionBounds {
+		double midx, midy;     ///< canvas center
+		double cameraDistance; ///< see zToDistance()
+		double min_x_pix, max_x_pix, min_y_pix, max_y_pix, zBoundsNear, zBoundsFar;
+		bool wrapEdge;
+	};
+	/// Applies velocity+jitter to positions of objects [0,n) in m.  Depends on nothing else, so SelfTest can check it against the object-by-object computation.
+	static void integrateMotion(MotionSoA & m, int n, const MotionBounds & b);
+
 protected:
     bool init(); ///< reimplemented from super
     void cleanup(); ///< reimplemented from super
     void drawFrame(); ///< reimplemented
     bool processKey(int key); ///< remiplemented
 	/* virtual */ bool applyNewParamsAtRuntime(); ///< reimplemented from super
+	/* virtual */ bool applyNewParamsAtRuntime_Base(); ///< reimplemented from super -- flushes precomputed frames before any params change
     /*virtual */ void afterVSync(bool isSimulated = false);
 	/*virtual */ void afterFTBoxDraw(); 
+	/*virtual */ bool canRenderAhead() const { return !tframesDO.length() || hwTimedOutput; } ///< tframesDO is written from drawFrame(), unless it's hardware-timed
+	/*virtual */ bool outputSchedule(DAQ::FrameSchedule & s) const; ///< the tframesDO pulse train
 
 private:
     void initObjs();
@@ -37,7 +66,7 @@ private:
 	Rect canvasAABB;
 
 	enum ObjType { 
-		BoxType=0, EllipseType, SphereType
+		BoxType=0, EllipseType, SphereType, N_ObjTypes
 	};
 	
 	static QString objTypeStrs[];
@@ -70,6 +99,7 @@ private:
 		int stepwise_grad_temp_vec_i, stepwise_grad_spat_vec_i;
 		
 		int debugLvl;		
+		QString paramSuffix; ///< "" for the first object, else its number, as appended to its param names.  Set once in initObjs().
 				
 		ObjData(); // init all to 0
 		void initDefaults();	
@@ -98,20 +128,88 @@ private:
 		}		
 	};
 
-	struct Obj2Render ///< used internally in doFrameDraw()
+	/// The per-frame state of a shape that the simulation modifies.  Plain data, so that it can be handed between threads.
+	struct ShapeState {
+		Vec3 position;
+		Vec2 scale, lengths;
+		double angle;
+		Shapes::GradientShape::GradType grad_type;
+		float grad_freq, grad_angle, grad_offset, grad_min, grad_max; ///< only meaningful for GradientShapes
+		void save(const Shapes::Shape *s);
+		/// If setupGradient is false, no GL calls are made
+		void apply(Shapes::Shape *s, bool setupGradient) const;
+	};
+	
+	/// What gets drawn for 1 object in 1 subframe.  Produced by simulateFrame(), consumed by renderFrame().
+	struct RenderItem {
+		ObjType type;
+		int objNum, k, debugLvl;
+		float color;
+		ShapeState shape;
+		Rect aabb;
+	};
+	
+	/// Everything needed to restore the simulation to a particular frame boundary
+	struct SimCheckpoint {
+		QList<ObjData> objs;
+		QVector<ShapeState> shapes;
+		RNG rng;
+	};
+	
+	/// The result of simulating 1 frame: what to draw plus the framevar rows to write
+	struct FrameState {
+		unsigned fnum;
+		unsigned nAllocs; ///< number of heap allocations simulateFrame() needed for this frame
+		std::vector<RenderItem> items;
+		QVector<QVector<QVector<double> > > fvs; ///< same layout as fvs_block
+		SimCheckpoint ckpt; ///< simulation state after this frame, only filled in by the precompute thread
+	};
+
+	struct Obj2Render ///< used internally in renderFrame()
 	{
-		const ObjData & obj;
-		const int k; /**< subframe number */
+		const RenderItem *obj; ///< also has the subframe number and AABB
 		Shapes::Shape *shapeCopy;
-		Rect aabb;
-		Obj2Render(const ObjData & obj, int k, const Rect & aabb) : obj(obj), k(k), shapeCopy(0), aabb(aabb) {}
+		double depth; ///< sort key
 	};
 	friend struct Obj2Render;
+	
+	/// Recycles the copies of the shapes that get drawn each frame, so drawing doesn't normally hit the heap
+	struct ShapeArena {
+		std::vector<Shapes::Shape *> shapes[N_ObjTypes];
+		unsigned used[N_ObjTypes];
+		ShapeArena() { reset(); }
+		~ShapeArena() { clear(); }
+		/// Returns an unused shape of type t, creating it (and incrementing nAllocs) if there are none left
+		Shapes::Shape *get(ObjType t, unsigned & nAllocs);
+		void reset() { for (int i = 0; i < (int)N_ObjTypes; ++i) used[i] = 0; } ///< makes all shapes available again, call once per frame
+		void clear(); ///< deletes all shapes
+	};
+	friend struct ShapeArena;
+	
+	/// Runs the motion simulation for frame fnum, putting the results in out.  Touches no GL state unless reading from a frame var file. Returns false if the plugin was stopped.
+	bool simulateFrame(unsigned fnum, FrameState & out);
+	/// Draws the objects in fs in depth order and writes out its framevars
+	void renderFrame(FrameState & fs);
+	
+	void saveCheckpoint(SimCheckpoint & c) const;
+	void restoreCheckpoint(const SimCheckpoint & c);
+	/// Returns the precomputed state for the current frameNum, starting the precompute thread if needed. Caller must delete it.
+	FrameState *takePrecomputedFrame();
+	/// Stops the precompute thread (if any), discards frames it computed ahead, and rewinds the simulation to the last frame drawn
+	void flushPrecomputed();
 
 	void drawObject(const int i, ///< rednered obj Num 
 					Obj2Render & o2r);
+	/// Alternate to calling drawObject() for each object -- merges consecutive objects into Shapes::Batch draws. Used if batchRender=true.
+	void drawObjectsBatched(std::vector<Obj2Render> & objs2Render);
+	/// Stable sort of objs2Render by depth, ascending
+	void sortObjs2Render(unsigned & nAllocs);
+	/// Sets s->color (and the glColorMask for dual/triple fps mode) for subframe k. Returns true if the color mask was modified.
+	bool setupSubframeColor(Shapes::Shape *s, float objcolor, int k);
+	void drawDebugAABB(const Rect & r);
 
 	void initObj(ObjData & o);
+	void setupSphereLighting(Shapes::Sphere *sph, const ObjData & o) const;
 	void reinitObj(ObjData & o, ObjType newType);
 	static Shapes::Shape * newShape(ObjType t);
 	static ObjType parseObjectType(const QString & stringFromParamFile);
@@ -124,10 +222,16 @@ private:
 	void applyRandomPositionForRndTrial_1_2_5(ObjData & o, bool = false);
 
 	void preReadFrameVarsForWholeFrame();
-	void postWriteFrameVarsForWholeFrame();
+	void postWriteFrameVarsForWholeFrame(const QVector<QVector<QVector<double> > > & fvs);
+	
+	MotionSoA motion; ///< see simulateFrame()
 		
 	QList<ObjData> objs;
-	QList<Shapes::Shape *> shapes2del;
+	std::vector<Shapes::Shape *> shapes2del; ///< shapes replaced by reinitObj(), deleted after the frame is drawn
+	std::vector<Obj2Render> objs2Render, objs2RenderTmp; ///< render list and sort scratch space, reused every frame
+	ShapeArena shapeArena;
+	FrameState syncFrame; ///< reused every frame if not precomputing
+	unsigned frameAllocs, maxFrameAllocs; ///< heap allocations made by the simulation and drawing, for the last frame and the max for any frame
 	QVector<QVector<QVector<double> > >  fvs_block; ///< framevar data buffer -- indexed by [objnum][subframenum][fvarnum]
 
 	int numObj;
@@ -139,6 +243,7 @@ private:
 	
 	int rndtrial;
     int tframes; QString tframesDO;
+    int tframesDOChan; ///< DAQ::ChanId of tframesDO, resolved in init()
 	int rseed;
 	int jittermag;	
 	bool jitterlocal;
@@ -153,9 +258,15 @@ private:
 	double min_x_pix,max_x_pix,min_y_pix,max_y_pix;
 	
 	bool debugAABB; ///< comes from param file -- if true draw a green box around each shape's AABB to debug AABB
+	bool batchRender; ///< comes from param file -- if true, objects are drawn merged via Shapes::Batch
+	Shapes::Batch *batch; ///< lazily created if batchRender is true
+	int precomputeFrames; ///< comes from param file -- if >0, the simulation runs this many frames ahead of drawing in a TrajectorySimulator thread
+	TrajectorySimulator *simulator; ///< lazily created in takePrecomputedFrame()
+	SimCheckpoint lastDrawnCkpt; ///< simulation state as of the last frame drawn, flushPrecomputed() rewinds to this
 	GLint savedShadeModel;
 	
 	double cameraDistance, majorPixelWidth;
+	unsigned canvasW, canvasH; ///< copy of width()/height() taken in init() and on resize, for the TrajectorySimulator thread, which must not touch the GLWindow
 	unsigned didScaledZWarning;
 	double zBoundsNear, zBoundsFar; ///< when objects hit this Z, they bounce back
 	bool is3D; ///< this flag controls if we jitter in Z, if rndtrial produces random Z values, and a bunch of other things
@@ -187,6 +298,8 @@ private:
 public:
 	double distanceToZ(double distance) const;
 	double zToDistance(double z) const;
+	unsigned canvasWidth() const { return canvasW; } ///< width() as of init() or the last resize, safe from the simulation thread
+	unsigned canvasHeight() const { return canvasH; } ///< likewise for height()
 };
 
 #endif
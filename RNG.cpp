@@ -8,6 +8,32 @@ RNG::RNG(int sd, Type t) : t(t)
     reseed(sd);
 }
 
+RNG::RNG(const RNG & o) : iv(0)
+{
+    *this = o;
+}
+
+RNG & RNG::operator=(const RNG & o)
+{
+    static const int NTAB = 32; // size of the ran1() shuffle table, see ran1f()
+    if (this == &o) return *this;
+    originalSeed = o.originalSeed;
+    s = o.s;
+    ct = o.ct;
+    t = o.t;
+    gset = o.gset;
+    iset = o.iset;
+    iy = o.iy;
+    if (o.iv) {
+        if (!iv) iv = new int[NTAB];
+        for (int i = 0; i < NTAB; ++i) iv[i] = o.iv[i];
+    } else {
+        delete [] iv;
+        iv = 0;
+    }
+    return *this;
+}
+
 RNG::~RNG()
 {
     delete [] iv; // may be NULL if Ran0
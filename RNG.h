@@ -37,8 +37,11 @@ public:
     };
 
     RNG(int seed = 1, Type = Ran0);
+    RNG(const RNG &); ///< copies the complete generator state, so that the copy generates the same sequence as the original
     ~RNG();
 
+    RNG & operator=(const RNG &);
+
     /// Identify what type of generator this is.
     Type type() const { return t; }
 
@@ -110,3 +110,19 @@ void Sawtooth::drawFrame()
 {
 	return initFromParams();
 }
+
+/* virtual */ bool Sawtooth::saveRenderAheadState(QByteArray & s) const
+{
+	const int st[2] = { cyccur, loopct };
+	s.resize(sizeof(st));
+	memcpy(s.data(), st, sizeof(st));
+	return true;
+}
+
+/* virtual */ void Sawtooth::restoreRenderAheadState(const QByteArray & s)
+{
+	int st[2];
+	if (s.size() != sizeof(st)) return;
+	memcpy(st, s.constData(), sizeof(st));
+	cyccur = st[0], loopct = st[1];
+}
@@ -24,6 +24,9 @@ protected:
 	void drawFrame();
 
 	/* virtual */ bool applyNewParamsAtRuntime();
+	/* virtual */ bool canRenderAhead() const { return Nloops < 0; } ///< otherwise drawFrame() would stop us before the prerendered frames were shown
+	/* virtual */ bool saveRenderAheadState(QByteArray & s) const;
+	/* virtual */ void restoreRenderAheadState(const QByteArray & s);
 	
 private:
 	bool initFromParams();
@@ -0,0 +1,650 @@
+#include "SelfTest.h"
+#include "StimApp.h"
+#include "GLWindow.h"
+#include "StimPlugin.h"
+#include "DAQ.h"
+#include "FrameVariables.h"
+#include "MovingObjects.h"
+#include "Shapes.h"
+#include "StimGL_SpikeGL_Integration.h"
+#include "Util.h"
+#include "RNG.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QEventLoop>
+#include <QFile>
+#include <QHostAddress>
+#include <QMap>
+#include <QOpenGLFramebufferObject>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QTextStream>
+#include <QThread>
+#include <QVector>
+#include <vector>
+#include <iostream>
+
+namespace {
+	typedef bool (*TestFunc)(QString & err);
+
+	/// Per-frame level of DO line chan over frames [0,nFrames) from the mock DAQ writes.  A write holds until the next one.  nWrites gets the number of writes to chan.
+	QVector<int> doLevels(const std::vector<DAQ::MockWrite> & writes, DAQ::ChanId chan, unsigned nFrames, unsigned & nWrites)
+	{
+		QVector<int> lv(int(nFrames), -1);
+		nWrites = 0;
+		for (std::vector<DAQ::MockWrite>::const_iterator it = writes.begin(); it != writes.end(); ++it) {
+			if (it->chan != chan) continue;
+			++nWrites;
+			if (it->frame >= 0 && unsigned(it->frame) < nFrames) lv[it->frame] = it->value != 0. ? 1 : 0;
+		}
+		for (int f = 0; f < lv.size(); ++f)
+			if (lv[f] < 0) lv[f] = f ? lv[f-1] : 0;
+		return lv;
+	}
+
+	/* MovingGrating's tframesDO, software-timed and then hardware-timed (the mock
+	   backend stands in for the sample clock), with tframes changed mid-run by
+	   the param history.  The line must be the same on every frame. */
+	bool testHWTimedOutput(QString & err)
+	{
+		const QString line("Dev1/port0/line0");
+		const unsigned nF = 60, changeAt = 30;
+		const bool wasMock = DAQ::IsMockBackend();
+		DAQ::SetMockBackend(true);
+		QVector<int> lv[2];
+		unsigned nWrites[2] = { 0, 0 };
+		bool ok = true;
+		for (int hw = 0; ok && hw < 2; ++hw) {
+			StimParams p0, p1;
+			p0["nFrames"] = nF;
+			p0["nLoops"] = 1;
+			p0["delay"] = 0;
+			p0["tframes"] = 10;
+			p0["tframesDO"] = line;
+			p0["hw_timed_output"] = hw;
+			p1 = p0;
+			p1["tframes"] = 7;
+			QMap<unsigned, StimParams> pf;
+			pf[0] = p0;
+			pf[changeAt] = p1;
+			DAQ::MockTakeWrites();
+			ok = SelfTest::runPlugin("MovingGrating", pf, 30., err);
+			if (ok) lv[hw] = doLevels(DAQ::MockTakeWrites(), DAQ::ResolveDO(line), nF, nWrites[hw]);
+		}
+		DAQ::SetMockBackend(wasMock);
+		if (!ok) return false;
+		if (nWrites[1] != nF) {
+			err = QString("expected one hardware-timed sample per frame (%1), got %2").arg(nF).arg(nWrites[1]);
+			return false;
+		}
+		for (unsigned f = 0; f < nF; ++f)
+			if (lv[0][f] != lv[1][f]) {
+				err = QString("frame %1: software-timed tframesDO is %2, hardware-timed is %3").arg(f).arg(lv[0][f]).arg(lv[1][f]);
+				return false;
+			}
+		if (!lv[1][35] || lv[1][40]) {
+			err = "tframes=7 did not take effect at frame 30";
+			return false;
+		}
+		return true;
+	}
+
+	/// Posts n alternating writes to its own DO line, as fast as it can
+	class DOPoster : public QThread
+	{
+	public:
+		DOPoster(DAQ::ChanId chan, int n) : chan(chan), n(n) {}
+	protected:
+		void run() { for (int i = 0; i < n; ++i) DAQ::AsyncWriteDO(chan, !(i & 1)); }
+	private:
+		DAQ::ChanId chan;
+		int n;
+	};
+
+	/* Several threads flood the async output queue (1024 deep) with writes no
+	   coalescing can drop, so some of them go through the queue-full path.
+	   Flushing must still return, with every write done in order per line.
+	   Then the writes are saved with MockSaveCSV() and read back. */
+	bool testMockOutput(QString & err)
+	{
+		enum { nThreads = 4, nPerThread = 5000 };
+		const bool wasMock = DAQ::IsMockBackend();
+		DAQ::SetMockBackend(true);
+		DAQ::MockTakeWrites();
+		DAQ::ChanId chans[nThreads];
+		DOPoster *posters[nThreads];
+		for (int i = 0; i < nThreads; ++i) {
+			chans[i] = DAQ::ResolveDO(QString("Dev1/port1/line%1").arg(i));
+			DAQ::WriteDO(chans[i], false); // so the first posted write (high) isn't coalesced away either
+			posters[i] = new DOPoster(chans[i], nPerThread);
+		}
+		const DAQ::ChanId ao = DAQ::ResolveAO("Dev1/ao1");
+		DAQ::MockTakeWrites();
+		for (int i = 0; i < nThreads; ++i) posters[i]->start();
+		for (int i = 0; i < nThreads; ++i) posters[i]->wait(), delete posters[i];
+		DAQ::AsyncWriteAO(ao, 1.25);
+		DAQ::AsyncWriteAO(ao, -2.5);
+		std::vector<DAQ::MockWrite> writes (DAQ::MockTakeWrites()); // flushes
+		DAQ::SetMockBackend(wasMock);
+
+		int n[nThreads] = { 0 };
+		for (std::vector<DAQ::MockWrite>::const_iterator it = writes.begin(); it != writes.end(); ++it)
+			for (int i = 0; i < nThreads; ++i)
+				if (it->chan == chans[i]) {
+					if (it->value != double(!(n[i] & 1))) {
+						err = QString("line %1: write #%2 is out of order").arg(i).arg(n[i]);
+						return false;
+					}
+					++n[i];
+				}
+		for (int i = 0; i < nThreads; ++i)
+			if (n[i] != nPerThread) {
+				err = QString("line %1: %2 of %3 writes done").arg(i).arg(n[i]).arg(int(nPerThread));
+				return false;
+			}
+
+		// put the AO writes and a few DO ones back and save them as CSV
+		std::vector<DAQ::MockWrite> saved;
+		for (std::vector<DAQ::MockWrite>::const_iterator it = writes.begin(); it != writes.end(); ++it)
+			if (it->chan == ao || (it->chan == chans[0] && saved.size() < 4)) saved.push_back(*it);
+		const QString fn (QDir::temp().filePath(QString("stimgl_selftest_%1.csv").arg(QCoreApplication::applicationPid())));
+		QFile::remove(fn);
+		DAQ::SetMockBackend(true);
+		DAQ::MockTakeWrites();
+		for (size_t i = 0; i < saved.size(); ++i) {
+			if (saved[i].isAO) DAQ::WriteAO(saved[i].chan, saved[i].value);
+			else DAQ::WriteDO(saved[i].chan, saved[i].value != 0.);
+		}
+		const bool savedOk = DAQ::MockSaveCSV(fn);
+		DAQ::SetMockBackend(wasMock);
+		QFile f(fn);
+		if (!savedOk || !f.open(QIODevice::ReadOnly|QIODevice::Text)) {
+			err = QString("could not save or read back ") + fn;
+			return false;
+		}
+		const QStringList lines (QTextStream(&f).readAll().split("\n", QString::SkipEmptyParts));
+		f.close();
+		QFile::remove(fn);
+		if (lines.size() != int(saved.size()) + 1 || lines[0] != "time_s,channel,type,value,sample,frame") {
+			err = QString("CSV has %1 lines (expected %2), header `%3'").arg(lines.size()).arg(saved.size()+1).arg(lines.value(0));
+			return false;
+		}
+		double tPrev = 0.;
+		for (size_t i = 0; i < saved.size(); ++i) {
+			const QStringList c (lines[int(i)+1].split(","));
+			const double t = c.value(0).toDouble();
+			if (c.size() != 6 || c[1] != DAQ::ChanName(saved[i].chan) || c[2] != (saved[i].isAO ? "AO" : "DO")
+				|| c[3].toDouble() != saved[i].value || c[4] != "-1" || t < tPrev) {
+				err = QString("CSV line %1 is `%2'").arg(i+2).arg(lines[int(i)+1]);
+				return false;
+			}
+			tPrev = t;
+		}
+		return true;
+	}
+
+	/// The position update the way MovingObjects did it before integrateMotion(): object by object, through the
+	/// canvas position of the jittered position (Shape::canvasPosition() with MovingObjects::zToDistance()).
+	void integrateMotionPerObject(MovingObjects::MotionSoA & m, int n, const MovingObjects::MotionBounds & b)
+	{
+		for (int i = 0; i < n; ++i) {
+			double & x (m.x[i]), & y (m.y[i]), & z (m.z[i]);
+			const double vx = m.vx[i], vy = m.vy[i], vz = m.vz[i], jitterx = m.jx[i], jittery = m.jy[i], jitterz = m.jz[i];
+			const Vec3 p (x+vx+jitterx,y+vy+jittery,z+vz+jitterz);
+			double d = eqf(b.cameraDistance,0.) ? 0. : p.z/b.cameraDistance + 1.0;
+			if (eqf(d,0.0)) d=1e-9;
+			const Vec2 mid (b.midx, b.midy), c (Vec2(p.x-mid.x, p.y-mid.y)/d + mid);
+			// if jitter pushes us outside of motion box then do not jitter this frame
+			if (!b.wrapEdge && ((c.x + m.hw[i] > b.max_x_pix) 
+							  ||  (c.x - m.hw[i] < b.min_x_pix)))
+				x += vx;
+			else 
+				x += vx + jitterx;
+			if (!b.wrapEdge && ((c.y + m.hh[i] > b.max_y_pix) 
+							  || (c.y - m.hh[i] < b.min_y_pix))) 
+				y += vy;
+			else 
+				y += vy + jittery;
+			
+			if (!b.wrapEdge && (z+vz+jitterz > b.zBoundsFar
+							  || z+vz+jitterz < b.zBoundsNear)) 
+				z += vz;
+			else 
+				z += vz + jitterz;
+		}
+	}
+
+	/* MovingObjects::integrateMotion() against integrateMotionPerObject() on
+	   random objects straddling the edges of the motion box, so that jitter is
+	   both taken and dropped, for 1..9 objects so the SSE2 kernel also runs its
+	   scalar tail, with and without wrapEdge, and with a zero camera distance.
+	   The positions must be the same bit for bit. */
+	bool testSoAMotion(QString & err)
+	{
+		const MovingObjects::MotionBounds bounds[] = {
+			{ 400., 300., 1000., 0., 800., 0., 600., -200., 500., false },
+			{ 400., 300., 1000., 0., 800., 0., 600., -200., 500., true },
+			{ 320., 240., 0., 10., 630., 10., 470., -1., 1., false },
+			{ 960., 540., 50., 100., 1800., 50., 1000., -30., 200., false },
+		};
+		RNG rng(12345, RNG::Ran1);
+		for (unsigned k = 0; k < sizeof(bounds)/sizeof(*bounds); ++k) {
+			const MovingObjects::MotionBounds & b (bounds[k]);
+			for (int trial = 0; trial < 2000; ++trial) {
+				const int n = 1 + trial % 9;
+				MovingObjects::MotionSoA m[2];
+				m[0].resize(n);
+				for (int i = 0; i < n; ++i) {
+					m[0].hw[i] = 1. + rng.next()*60., m[0].hh[i] = 1. + rng.next()*60.;
+					const double ex = rng.next() < .5 ? b.min_x_pix + m[0].hw[i] : b.max_x_pix - m[0].hw[i],
+					             ey = rng.next() < .5 ? b.min_y_pix + m[0].hh[i] : b.max_y_pix - m[0].hh[i],
+					             ez = rng.next() < .5 ? b.zBoundsNear : b.zBoundsFar;
+					m[0].x[i] = rng.next() < .3 ? b.min_x_pix + rng.next()*(b.max_x_pix-b.min_x_pix) : ex + (rng.next()-.5)*20.;
+					m[0].y[i] = rng.next() < .3 ? b.min_y_pix + rng.next()*(b.max_y_pix-b.min_y_pix) : ey + (rng.next()-.5)*20.;
+					m[0].z[i] = rng.next() < .3 ? b.zBoundsNear + rng.next()*(b.zBoundsFar-b.zBoundsNear) : ez + (rng.next()-.5)*20.;
+					m[0].vx[i] = (rng.next()-.5)*20., m[0].vy[i] = (rng.next()-.5)*20., m[0].vz[i] = (rng.next()-.5)*4.;
+					m[0].jx[i] = (rng.next()-.5)*10., m[0].jy[i] = (rng.next()-.5)*10., m[0].jz[i] = (rng.next()-.5)*10.;
+				}
+				m[1] = m[0];
+				MovingObjects::integrateMotion(m[0], n, b);
+				integrateMotionPerObject(m[1], n, b);
+				for (int i = 0; i < n; ++i)
+					if (m[0].x[i] != m[1].x[i] || m[0].y[i] != m[1].y[i] || m[0].z[i] != m[1].z[i]) {
+						err = QString("bounds %1, trial %2, object %3 of %4: (%5,%6,%7) != (%8,%9,%10)").arg(k).arg(trial).arg(i).arg(n)
+							.arg(m[0].x[i], 0, 'g', 17).arg(m[0].y[i], 0, 'g', 17).arg(m[0].z[i], 0, 'g', 17)
+							.arg(m[1].x[i], 0, 'g', 17).arg(m[1].y[i], 0, 'g', 17).arg(m[1].z[i], 0, 'g', 17);
+						return false;
+					}
+			}
+		}
+		return true;
+	}
+
+	/// Draws r, with its bottom left corner at the origin, into a new w x h fbo and reads back the red channel of the middle row into row
+	/// A w x h fbo with a depth buffer and GLWindow's projection, to draw shapes into and read back
+	struct TestCanvas {
+		QOpenGLFramebufferObject fbo;
+		const int w, h;
+
+		TestCanvas(int w, int h) : fbo(w, h, QOpenGLFramebufferObject::Depth), w(w), h(h) {}
+
+		bool begin(QString & err) {
+			if (!fbo.isValid() || !fbo.bind()) {
+				err = "cannot create a framebuffer object";
+				return false;
+			}
+			glPushAttrib(GL_ALL_ATTRIB_BITS);
+			glViewport(0, 0, w, h);
+			glMatrixMode(GL_PROJECTION);
+			glPushMatrix();
+			glLoadIdentity();
+			glOrtho(0., w, 0., h, -1e6, 1e6);
+			glMatrixMode(GL_MODELVIEW);
+			glPushMatrix();
+			glLoadIdentity();
+			glDisable(GL_DEPTH_TEST);
+			glDisable(GL_BLEND);
+			glDisable(GL_LIGHTING);
+			glDisable(GL_DITHER);
+			glClearColor(0.f, 0.f, 0.f, 1.f);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			return true;
+		}
+		/// reads back rows [y0, y0+nRows) as RGBA
+		void end(std::vector<unsigned char> & rgba, int y0, int nRows) {
+			rgba.resize(w*nRows*4);
+			glPixelStorei(GL_PACK_ALIGNMENT, 1);
+			glReadPixels(0, y0, w, nRows, GL_RGBA, GL_UNSIGNED_BYTE, &rgba[0]);
+			glMatrixMode(GL_MODELVIEW);
+			glPopMatrix();
+			glMatrixMode(GL_PROJECTION);
+			glPopMatrix();
+			glPopAttrib();
+			fbo.release();
+		}
+	};
+
+	bool drawGradientRow(Shapes::Rectangle & r, int w, int h, std::vector<unsigned char> & row, QString & err)
+	{
+		TestCanvas c(w, h);
+		if (!c.begin(err)) return false;
+		r.position = Vec3(w*.5, h*.5, 0.);
+		r.draw();
+		std::vector<unsigned char> rgba;
+		c.end(rgba, h/2, 1);
+		row.resize(w);
+		for (int x = 0; x < w; ++x) row[x] = rgba[x*4];
+		return true;
+	}
+
+	/* A box covering a 512x8 fbo with each gradient type, drawn with the
+	   gradient shader and with the gradient textures.  Every pixel of the
+	   middle row must be within 1 of gradientValue() at the gradient
+	   coordinate of its center, for both.  freq 2 over 512 pixels puts the
+	   pixel centers in the middle of the 256 texels, so neither path is
+	   at a texel boundary. */
+	bool testGradientShader(QString & err)
+	{
+		const int W = 512, H = 8;
+		const float freq = 2.f, offset = .25f, gmin = .1f, gmax = .9f;
+		stimApp()->glWin()->makeCurrent();
+		const bool hadShader = Shapes::GradientShape::usingShader();
+		bool ok = true;
+		for (int shader = 1; ok && shader >= 0; --shader) {
+			if (!Shapes::GradientShape::setUseShader(shader) && shader) {
+				err = "the gradient shader could not be built";
+				ok = false;
+				break;
+			}
+			for (int t = Shapes::GradientShape::Cos; ok && t < Shapes::GradientShape::N_GradTypes; ++t) {
+				const Shapes::GradientShape::GradType gt = Shapes::GradientShape::GradType(t);
+				std::vector<unsigned char> row;
+				{
+					Shapes::Rectangle r(W, H);
+					r.setGradient(gt, freq, 0.f, offset, gmin, gmax);
+					ok = drawGradientRow(r, W, H, row, err);
+				}
+				for (int x = 0; ok && x < W; ++x) {
+					const float want = Shapes::GradientShape::gradientValue(gt, freq*(x+.5f)/W + offset, gmin, gmax) * 255.f;
+					if (fabsf(row[x] - want) > 1.f) {
+						err = QString("%1 gradient type %2, pixel %3 is %4, expected %5")
+							.arg(shader ? "shader" : "texture").arg(t).arg(x).arg(int(row[x])).arg(want);
+						ok = false;
+					}
+				}
+			}
+		}
+		Shapes::GradientShape::setUseShader(hadShader);
+		return ok;
+	}
+
+	/* Two overlapping spheres, one colored and lit by a positional light,
+	   drawn the batchRender=false way (GL lighting, depth test, depth clear
+	   after each) and through a Shapes::Batch (lit on the CPU, front
+	   triangles only).  The two images must agree to within 2 per channel. */
+	bool testSphereBatch(QString & err)
+	{
+		const int W = 256, H = 256;
+		stimApp()->glWin()->makeCurrent();
+		Shapes::Sphere s1(180.), s2(120.);
+		s1.position = Vec3(110.3, 120.7, 0.);
+		s2.position = Vec3(170., 140., 0.);
+		s2.color = Vec3(.6, .3, .9);
+		s2.lightPosition[0] = 60.f, s2.lightPosition[1] = 200.f, s2.lightPosition[2] = 150.f, s2.lightPosition[3] = 1.f;
+		s2.lightAttenuations[1] = .001f;
+		std::vector<unsigned char> img[2];
+		for (int batched = 0; batched < 2; ++batched) {
+			TestCanvas c(W, H);
+			if (!c.begin(err)) return false;
+			glShadeModel(GL_FLAT);
+			if (batched) {
+				Shapes::Batch b;
+				b.add(&s1);
+				b.add(&s2);
+				b.flush();
+			} else {
+				glShadeModel(GL_SMOOTH);
+				s1.draw();
+				glClear(GL_DEPTH_BUFFER_BIT);
+				s2.draw();
+			}
+			c.end(img[batched], 0, H);
+		}
+		for (int i = 0; i < W*H*4; ++i) {
+			if (i % 4 == 3) continue;
+			if (abs(int(img[0][i]) - int(img[1][i])) > 2) {
+				err = QString("pixel %1,%2 channel %3 is %4 batched, %5 unbatched")
+					.arg((i/4) % W).arg(i/4/W).arg(i % 4).arg(int(img[1][i])).arg(int(img[0][i]));
+				return false;
+			}
+		}
+		return true;
+	}
+
+	/// Stands in for SpikeGL's NotifyServer, speaking the protocol from the event loop, with poll()
+	struct NotifyStandIn {
+		QTcpServer srv;
+		const bool keepAlive; ///< says KEEPALIVE in the greeting, else closes the connection after each notification
+		int nAbort; ///< drops the connection instead of sending OK, for this many notifications
+		int nConns, nMsgs;
+		QStringList seqs; ///< the SEQ line that came before each notification, or empty
+		QVector<double> tMsgs;
+		QList<QTcpSocket *> socks;
+		QString seq;
+
+		NotifyStandIn(bool keepAlive, int nAbort = 0) : keepAlive(keepAlive), nAbort(nAbort), nConns(0), nMsgs(0) { srv.listen(QHostAddress::LocalHost, 0); }
+		~NotifyStandIn() { qDeleteAll(socks); }
+
+		void poll() {
+			QCoreApplication::processEvents(QEventLoop::AllEvents, 5);
+			while (srv.hasPendingConnections()) {
+				QTcpSocket *s = srv.nextPendingConnection();
+				socks.push_back(s);
+				++nConns;
+				s->write(keepAlive ? "HELLO I'M SPIKEGL KEEPALIVE\n" : "HELLO I'M SPIKEGL\n");
+			}
+			for (int i = 0; i < socks.size(); ++i) {
+				QTcpSocket *s = socks[i];
+				while (s->state() == QAbstractSocket::ConnectedState && s->canReadLine()) {
+					const QString line (QString(s->readLine()).trimmed());
+					if (line.startsWith("SEQ")) seq = line;
+					else if (line.startsWith("END PLUGIN PARAMS")) {
+						++nMsgs;
+						seqs.push_back(seq), seq.clear();
+						tMsgs.push_back(getTime());
+						if (nAbort > 0) --nAbort, s->abort();
+						else {
+							s->write("OK\n");
+							if (!keepAlive) s->disconnectFromHost();
+						}
+					}
+				}
+			}
+		}
+
+		/// polls until n has delivered or given up on nMsgs notifications, or timeoutSecs pass
+		bool pumpUntil(StimGL_SpikeGL_Integration::Notifier & n, unsigned nMsgs, double timeoutSecs) {
+			const double tEnd = getTime() + timeoutSecs;
+			for (;;) {
+				poll();
+				const StimGL_SpikeGL_Integration::Notifier::Stats st (n.stats());
+				if (st.delivered + st.failed >= nMsgs) return true;
+				if (getTime() > tEnd) return false;
+			}
+		}
+	};
+
+	/* The background SpikeGL notifier against a stand-in server: one
+	   connection for everything if the server says KEEPALIVE, one per
+	   notification if it doesn't, retries with backoff when the connection
+	   drops before the OK (with the same sequence number each time), and drops
+	   at MaxQueued.  Then the real NotifyServer must acknowledge a repeated
+	   sequence number without emitting it again. */
+	bool testNotifier(QString & err)
+	{
+		using StimGL_SpikeGL_Integration::Notifier;
+		QMap<QString, QVariant> prms;
+		prms["selftest"] = 1;
+		const int tout = 5000;
+
+		for (int keepAlive = 1; keepAlive >= 0; --keepAlive) {
+			NotifyStandIn si(keepAlive);
+			Notifier n;
+			n.start();
+			for (int i = 0; i < 3; ++i) n.post(Notifier::Start, "SelfTest", prms, "127.0.0.1", si.srv.serverPort(), tout);
+			if (!si.pumpUntil(n, 3, 10.) || n.stats().delivered != 3 || si.nMsgs != 3) {
+				err = QString("KEEPALIVE=%1: %2 of 3 notifications delivered").arg(keepAlive).arg(n.stats().delivered);
+				return false;
+			}
+			if (si.nConns != (keepAlive ? 1 : 3)) {
+				err = QString("KEEPALIVE=%1: 3 notifications took %2 connections").arg(keepAlive).arg(si.nConns);
+				return false;
+			}
+			if (keepAlive ? (si.seqs[0].isEmpty() || si.seqs[0] == si.seqs[1] || si.seqs[1] == si.seqs[2]) : !si.seqs.join("").isEmpty()) {
+				err = QString("KEEPALIVE=%1: bad SEQ lines `%2'").arg(keepAlive).arg(si.seqs.join("', `"));
+				return false;
+			}
+		}
+
+		{
+			NotifyStandIn si(true, 2);
+			Notifier n;
+			n.start();
+			n.post(Notifier::End, "SelfTest", prms, "127.0.0.1", si.srv.serverPort(), tout);
+			if (!si.pumpUntil(n, 1, 10.) || n.stats().delivered != 1 || si.nMsgs != 3 || si.nConns != 3) {
+				err = QString("retry: delivered %1 after %2 tries on %3 connections, expected 1 after 3 on 3").arg(n.stats().delivered).arg(si.nMsgs).arg(si.nConns);
+				return false;
+			}
+			if (si.seqs[0].isEmpty() || si.seqs[1] != si.seqs[0] || si.seqs[2] != si.seqs[0]) {
+				err = QString("retry: the retries were sent as `%1'").arg(si.seqs.join("', `"));
+				return false;
+			}
+			const double minBackoff = (Notifier::BackoffMinMS + 2*Notifier::BackoffMinMS) / 1e3;
+			if (si.tMsgs[2] - si.tMsgs[0] < minBackoff*0.9) {
+				err = QString("retry: 3 tries took %1 ms, backoff is at least %2 ms").arg((si.tMsgs[2]-si.tMsgs[0])*1e3).arg(minBackoff*1e3);
+				return false;
+			}
+		}
+
+		{
+			// the stand-in isn't polled while posting, so the first notification waits on the greeting and nothing is delivered yet
+			NotifyStandIn si(true);
+			Notifier n;
+			n.start();
+			const int nOver = 10;
+			for (int i = 0; i < Notifier::MaxQueued + nOver; ++i)
+				n.post(Notifier::Params, "SelfTest", prms, "127.0.0.1", si.srv.serverPort(), tout);
+			if (n.stats().dropped != unsigned(nOver)) {
+				err = QString("overflow: %1 notifications dropped, expected %2").arg(n.stats().dropped).arg(nOver);
+				return false;
+			}
+			if (!si.pumpUntil(n, Notifier::MaxQueued, 30.) || n.stats().delivered != unsigned(Notifier::MaxQueued)) {
+				err = QString("overflow: %1 of %2 queued notifications delivered").arg(n.stats().delivered).arg(int(Notifier::MaxQueued));
+				return false;
+			}
+		}
+
+		// a repeat of a sequence number is acknowledged but not emitted
+		quint16 port;
+		{
+			QTcpServer tmp;
+			tmp.listen(QHostAddress::LocalHost, 0);
+			port = tmp.serverPort();
+		}
+		StimGL_SpikeGL_Integration::NotifyServer ns(0);
+		SignalCounter emitted;
+		QObject::connect(&ns, SIGNAL(gotPluginStartNotification(const QString &, const QMap<QString, QVariant> &)), &emitted, SLOT(count()));
+		if (!ns.beginListening("127.0.0.1", port, tout)) {
+			err = QString("NotifyServer could not listen on port %1").arg(port);
+			return false;
+		}
+		const QString msg ("PLUGIN START SelfTest\nPLUGIN PARAMS\nselftest = 1\nEND PLUGIN PARAMS\n");
+		QTcpSocket c;
+		c.connectToHost("127.0.0.1", port);
+		c.write((QString("SEQ selftest 1\n") + msg + "SEQ selftest 1\n" + msg + "SEQ selftest 2\n" + msg).toUtf8());
+		QStringList replies;
+		for (const double tEnd = getTime() + 10.; replies.size() < 4 && getTime() < tEnd; ) {
+			QCoreApplication::processEvents(QEventLoop::AllEvents, 5);
+			while (c.canReadLine()) replies.push_back(QString(c.readLine()).trimmed());
+		}
+		if (replies.size() != 4 || replies.filter("OK").size() != 3 || emitted.n != 2) {
+			err = QString("NotifyServer: replies `%1', %2 notifications emitted, expected a greeting, 3 OKs and 2").arg(replies.join("', `")).arg(emitted.n);
+			return false;
+		}
+		return true;
+	}
+
+	const struct {
+		const char *name;
+		TestFunc func;
+	} allTests[] = {
+		{ "daq_hw_timed_output", testHWTimedOutput },
+		{ "daq_mock_output", testMockOutput },
+		{ "movingobjects_soa_motion", testSoAMotion },
+		{ "gradient_shader", testGradientShader },
+		{ "sphere_batch", testSphereBatch },
+		{ "spikegl_notifier", testNotifier },
+	};
+	const int nTests = int(sizeof(allTests)/sizeof(*allTests));
+}
+
+/* static */
+bool SelfTest::parseArgs(const QStringList & args, QStringList & tests)
+{
+	int i = args.indexOf("--selftest");
+	if (i < 0) return false;
+	tests.clear();
+	for (++i; i < args.size() && !args[i].startsWith("--"); ++i)
+		tests.push_back(args[i]);
+	return true;
+}
+
+/* static */
+QStringList SelfTest::testNames()
+{
+	QStringList ret;
+	for (int i = 0; i < nTests; ++i) ret.push_back(allTests[i].name);
+	return ret;
+}
+
+SelfTest::SelfTest(const QStringList & t, QObject *parent)
+	: QObject(parent), tests(t)
+{
+}
+
+/* static */
+bool SelfTest::runPlugin(const QString & pluginName, const QMap<unsigned, StimParams> & paramsAtFrame, double timeoutSecs, QString & err)
+{
+	GLWindow *w = stimApp()->glWin();
+	StimPlugin *p = w->pluginFind(pluginName);
+	if (!p) {
+		err = QString("plugin '") + pluginName + "' not found";
+		return false;
+	}
+	QMap<unsigned, StimParams> hist;
+	for (QMap<unsigned, StimParams>::const_iterator it = paramsAtFrame.begin(); it != paramsAtFrame.end(); ++it) {
+		StimParams & prms (hist[it.key()]);
+		stimApp()->setParamsFromGlobalDefaults(prms);
+		for (StimParams::const_iterator pit = it.value().begin(); pit != it.value().end(); ++pit)
+			prms[pit.key()] = pit.value();
+	}
+	p->setParams(hist.value(0));
+	if (hist.size() > 1 && !p->enqueueParamsForPendingParamsHistory(hist)) {
+		err = "could not set the param history";
+		return false;
+	}
+	if (!p->start(true)) {
+		p->stop();
+		err = QString("plugin '") + pluginName + "' failed to start";
+		return false;
+	}
+	const double tEnd = getTime() + timeoutSecs;
+	while (w->runningPlugin() == p) {
+		if (getTime() > tEnd) {
+			p->stop();
+			err = QString("plugin '") + pluginName + "' did not finish within " + QString::number(timeoutSecs) + " s";
+			return false;
+		}
+		QCoreApplication::processEvents(QEventLoop::AllEvents, 5);
+	}
+	return true;
+}
+
+void SelfTest::start()
+{
+	if (tests.isEmpty()) tests = testNames();
+	int nFailed = 0;
+	for (int t = 0; t < tests.size(); ++t) {
+		int i = 0;
+		while (i < nTests && tests[t] != allTests[i].name) ++i;
+		QString err;
+		const double t0 = getTime();
+		const bool ok = i < nTests ? allTests[i].func(err) : (err = "no such test", false);
+		if (!ok) ++nFailed;
+		std::cout << (ok ? "PASS " : "FAIL ") << tests[t].toUtf8().constData() << " (" << int((getTime()-t0)*1e3) << " ms)";
+		if (!ok) std::cout << ": " << err.toUtf8().constData();
+		std::cout << std::endl;
+	}
+	std::cout << (tests.size() - nFailed) << "/" << tests.size() << " tests passed" << std::endl;
+	stimApp()->exit(nFailed ? 1 : 0);
+}
@@ -0,0 +1,59 @@
+#ifndef SelfTest_H
+#define SelfTest_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QMap>
+#include "StimParams.h"
+
+/** \brief The headless --selftest mode.
+
+    Started by StimApp when the program is run as:
+
+      StimulateOpenGL_II --selftest [testname ...]
+
+    Runs the named tests (all of them if none are named), printing one
+    PASS/FAIL line per test, and quits with exit status 0 if they all passed,
+    1 otherwise.  Like --benchmark it skips the console window, TCP server and
+    refresh rate calibration and turns vsync off, and it needs a GL context,
+    so on a machine without a display run it under xvfb-run.  `make check'
+    runs it.
+
+    These are the tests that need the app: the DAQ output path with the mock
+    backend, plugins run for a number of frames, etc.  The Qt-free parts are
+    tested by tests/ instead, which needs no display. */
+class SelfTest : public QObject
+{
+	Q_OBJECT
+public:
+	/// Returns true if args contain --selftest, in which case tests is filled in with the test names following it
+	static bool parseArgs(const QStringList & args, QStringList & tests);
+	static QStringList testNames();
+
+	SelfTest(const QStringList & tests, QObject *parent = 0);
+
+	/// Runs pluginName until it stops by itself (use nFrames and nLoops), or timeoutSecs passes.  Returns false on error or timeout.
+	/// paramsAtFrame[0] are the params it starts with, on top of the global defaults.  Any others are replayed at those frames, as param history.
+	static bool runPlugin(const QString & pluginName, const QMap<unsigned, StimParams> & paramsAtFrame, double timeoutSecs, QString & err);
+
+public slots:
+	/// Runs the tests and quits the app.  Called from the event loop once the GLWindow is up.
+	void start();
+
+private:
+	QStringList tests;
+};
+
+/// Counts the signals connected to its count() slot, for tests
+class SignalCounter : public QObject
+{
+	Q_OBJECT
+public:
+	SignalCounter() : n(0) {}
+	int n;
+public slots:
+	void count() { ++n; }
+};
+
+#endif
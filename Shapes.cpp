@@ -9,17 +9,19 @@
 #include "Shapes.h"
 #include "GLHeaders.h"
 #include <memory>
+#include <cstddef>
 #include "MovingObjects.h"
 #include <math.h>
 #include "Util.h"
 #include <QHash>
+#include <QOpenGLShaderProgram>
 
 static const bool myExcessiveDebug(false);
 
 namespace Shapes {
 	
 Shape::Shape() 
-	: position(Vec3Zero), scale(Vec2Unit), color(Vec3Gray), angle(0.), noMatrixAttribPush(false)
+	: position(Vec3Zero), scale(Vec2Unit), color(Vec3Gray), angle(0.), noMatrixAttribPush(false), mo(0)
 {}
 
 Shape::~Shape() 
@@ -54,6 +56,7 @@ void Shape::copyProperties(const Shape *o)
 	color = o->color;
 	angle = o->angle;
 	noMatrixAttribPush = o->noMatrixAttribPush;
+	mo = o->mo;
 }
 
 	
@@ -61,9 +64,13 @@ void Shape::copyProperties(const Shape *o)
 /* static */ int GradientShape::tcache_ct(0);
 /* static */ GradientShape::DLCache *GradientShape::dcache; /// maps dl_grad display lists to counters.. implementing shared display lists
 /* static */ int GradientShape::dcache_ct(0);
+/* static */ QOpenGLShaderProgram *GradientShape::gshader(0);
+/* static */ int GradientShape::gshader_type(-1), GradientShape::gshader_min(-1), GradientShape::gshader_max(-1), GradientShape::gshader_xform(-1);
+/* static */ GLuint Rectangle::unitDl(0);
+/* static */ GLuint Ellipse::unitDl(0);
 
 	
-GradientShape::GradientShape() : gtex(0), grad_type(None), grad_freq(1.f), grad_angle(0.f), grad_offset(0.f), grad_min(0.f), grad_max(1.f), dl(0)
+GradientShape::GradientShape() : gtex(0), grad_type(None), grad_freq(1.f), grad_angle(0.f), grad_offset(0.f), grad_min(0.f), grad_max(1.f), dl(0), shaderBound(false)
 {
 	if (!tcache) tcache = new TexCache, tcache_ct = 0;
 	if (!dcache) dcache = new DLCache, dcache_ct = 0;
@@ -100,7 +107,7 @@ void GradientShape::copyProperties(const Shape *from)
 	}
 }
 
-void GradientShape::setGradient(GradType t, float freq, float angle, float offset, float min, float max)
+void GradientShape::setGradient(GradType t, float freq, float angle, float offset, float min, float max, bool setupNow)
 {
 	grad_freq = freq;
 	grad_angle = angle;
@@ -111,13 +118,32 @@ void GradientShape::setGradient(GradType t, float freq, float angle, float offse
 	if (max < 0.f) max = 0.f; if (max > 1.f) max = 1.f;
 	grad_min = min;
 	grad_max = max;
+	if (!setupNow) return;
 	GLuint olddl = dl;
 	setupDl();
 	dcache->release(olddl);
 }
 
+void GradientShape::getGradient(GradType & t, float & freq, float & angle, float & offset, float & min, float & max) const
+{
+	t = grad_type;
+	freq = grad_freq;
+	angle = grad_angle;
+	offset = grad_offset;
+	min = grad_min;
+	max = grad_max;
+}
+
 void GradientShape::setupDl()
 {
+	if (gshader) {
+		// gradient shader mode: the gradient comes from uniforms set in drawBegin(), so no per-parameter texture or display list
+		// (any old dl is released by the caller)
+		tcache->release(gtex);
+		gtex = 0;
+		dl = 0;
+		return;
+	}
 	const GLuint old_gtex = gtex;
 	gtex = tcache->getAndRetain(grad_type, grad_min, grad_max);
 	if (!typeId()) {
@@ -141,6 +167,12 @@ void GradientShape::drawBegin()
 {
 	Shape::drawBegin();
 	if (gtex) glEnable(GL_TEXTURE_1D);
+	else if (gshader && grad_type != None) {
+		const float ca = cosf(grad_angle), sa = sinf(grad_angle);
+		const GLfloat xform[4] = { 0.f, grad_freq*ca, grad_freq*sa, grad_offset + grad_freq*gradientBase(ca, sa) };
+		bindShader(grad_type, grad_min, grad_max, xform);
+		shaderBound = true;
+	}
 	// continued in subclass
 }
 	
@@ -149,9 +181,94 @@ void GradientShape::drawEnd()
 {
 	// continues from subclass..
 	if (gtex) glDisable(GL_TEXTURE_1D);
+	if (shaderBound) releaseShader(), shaderBound = false;
 	Shape::drawEnd();
 }
 
+/* static */
+float GradientShape::gradientFunction(GradType t, float x, float min, float max)
+{
+	float f;
+	switch (t) {
+		case Squ:
+			f = x < 0.5f ? 0.0f : 1.0f;
+			break;
+		case Saw: {
+			static const float swfact = (1.0f/0.95f);
+			f = x*swfact;
+			if (f >= 1.0f) {
+				f = 1.0f-((f-1.0f)/(swfact-1.0f));
+			}
+		}
+			break;
+		case Tri:
+			f = x*2.0f;
+			if (f > 1.0) f = 1.0f-(f-1.0f);
+			break;
+		case Sin:
+			f = (sinf(x*(2.0*M_PI))+1.0)/2.0;
+			break;
+		case None:
+			return 1.f; // no gradient, shape color is unmodulated
+		case Cos:
+		default:
+			f = (cosf(x*(2.0*M_PI))+1.0)/2.0;
+			break;
+	}
+	if (f < 0.f) f = 0.f;
+	if (f > 1.f) f = 1.f;			
+	return f*(max-min) + min;
+}
+
+/* static */
+float GradientShape::gradientValue(GradType t, float s, float min, float max)
+{
+	static const int TEXWIDTH = 256; // same as TexCache::createTex()
+	// GL_REPEAT + GL_NEAREST: wrap to [0,1) and pick the texel s falls in
+	int i = int((s - floorf(s)) * TEXWIDTH);
+	if (i < 0) i = 0;
+	if (i > TEXWIDTH-1) i = TEXWIDTH-1;
+	return gradientFunction(t, GLfloat(i)/GLfloat(TEXWIDTH-1), min, max);
+}
+
+/* static */
+bool GradientShape::setUseShader(bool on)
+{
+	delete gshader, gshader = 0;
+	if (!on) return true;
+	gshader = new QOpenGLShaderProgram;
+	const bool okvert = gshader->addShaderFromSourceFile(QOpenGLShader::Vertex, ":/Shaders/gradient_shader_120.vert");
+	const bool okfrag = gshader->addShaderFromSourceFile(QOpenGLShader::Fragment, ":/Shaders/gradient_shader_120.frag");
+	if (!okvert || !okfrag || !gshader->link()) {
+		Warning() << "Gradient shader link error, falling back to gradient textures: " << gshader->log();
+		delete gshader, gshader = 0;
+		return false;
+	}
+	gshader_type = gshader->uniformLocation("grad_type");
+	gshader_min = gshader->uniformLocation("grad_min");
+	gshader_max = gshader->uniformLocation("grad_max");
+	gshader_xform = gshader->uniformLocation("grad_xform");
+	Debug() << "Using gradient shader for shapes.";
+	return true;
+}
+
+/* static */
+void GradientShape::bindShader(GradType t, float min, float max, const GLfloat xform[4])
+{
+	if (!gshader) return;
+	gshader->bind();
+	gshader->setUniformValue(gshader_type, GLint(t));
+	gshader->setUniformValue(gshader_min, GLfloat(min));
+	gshader->setUniformValue(gshader_max, GLfloat(max));
+	gshader->setUniformValue(gshader_xform, xform[0], xform[1], xform[2], xform[3]);
+}
+
+/* static */
+void GradientShape::releaseShader()
+{
+	if (gshader) gshader->release();
+}
+
 unsigned GradientShape::DLCache::count(GLuint dl) const { 
 	RefctMap::const_iterator it = refs.find(dl);
 	if (it != refs.end()) return it.value();
@@ -320,41 +437,10 @@ GLuint GradientShape::TexCache::createTex(GradType t, float min, float max)
 	static const int TEXWIDTH = 256;
 	GLuint tex = 0;
 	glGenTextures(1, &tex);
-	GLfloat pix[TEXWIDTH], f;
+	GLfloat pix[TEXWIDTH];
 	for (int i = 0; tex && i < TEXWIDTH; ++i) {
 		const GLfloat x(GLfloat(i)/GLfloat(TEXWIDTH-1)); // we do it this way so we can get 0.0 and 1.0 in our x domain..
-		switch (t) {
-			case Squ:
-				f = x < 0.5f ? 0.0f : 1.0f;
-				break;
-			case Saw: {
-				static const float swfact = (1.0f/0.95f);
-				f = x*swfact;
-				if (f >= 1.0f) {
-					f = 1.0f-((f-1.0f)/(swfact-1.0f));
-				}
-			}
-				break;
-			case Tri:
-				f = x*2.0f;
-				if (f > 1.0) f = 1.0f-(f-1.0f);
-				break;
-			case Sin:
-				f = (sinf(x*(2.0*M_PI))+1.0)/2.0;
-				break;
-			case None:
-				glDeleteTextures(1, &tex);
-				tex = 0;
-				break;
-			case Cos:
-			default:
-				f = (cosf(x*(2.0*M_PI))+1.0)/2.0;
-				break;
-		}
-		if (f < 0.f) f = 0.f;
-		if (f > 1.f) f = 1.f;			
-		f = f*(max-min) + min;
-		pix[i] = f;
+		pix[i] = gradientFunction(t, x, min, max);
 	}
 	glBindTexture(GL_TEXTURE_1D, tex);
 	glTexImage1D(GL_TEXTURE_1D, 0, GL_LUMINANCE, TEXWIDTH, 0, GL_LUMINANCE, GL_FLOAT, pix);
@@ -403,59 +489,44 @@ void Sphere::copyProperties(const Shape *o)
 	}
 }
 	
-static MovingObjects * movingObjects()
-{
-	MovingObjects *p = (MovingObjects *)stimApp()->glWin()->runningPlugin();
-	if (!p || !dynamic_cast<MovingObjects *>((StimPlugin *)p)) {
-		p = (MovingObjects *)stimApp()->glWin()->pluginFind("movingobjects");
-		if (p) p = dynamic_cast<MovingObjects *>(p);
-	}
-	if (!p) Error() << "INTERNAL ERROR -- Cannot find MovingObjects plugin!";	
-	return p;
-}
-
 double Shape::distance() const {
-	MovingObjects *p = movingObjects();
-	if (p) return p->zToDistance(position.z);
-	return 0.;
+	if (mo) return mo->zToDistance(position.z);
+	return 1.; // not part of a scene: the default Z-plane
 }
 
 void Shape::setDistance(double d) {
 	double z = 0.;
-	MovingObjects *p = movingObjects();
-	if (p) z = p->distanceToZ(d);
+	if (mo) z = mo->distanceToZ(d);
 	position.z = z;
 }
 
-Vec2 Shape::canvasPosition() const { return canvasPosition(position); }
+Vec2 Shape::canvasPosition() const { return canvasPosition(mo, position); }
 
 void Shape::setCanvasPosition(const Vec2 & v) {
-	position = cposToRealPos(v, position.z);
+	position = cposToRealPos(mo, v, position.z);
 }
 	
 /*static*/
-Vec2 Shape::canvasPosition(const Vec3 & position)
+Vec2 Shape::canvasPosition(const MovingObjects *m, const Vec3 & position)
 {
-	MovingObjects *m = movingObjects();
-	Vec2 mid (m->width()*.5, m->height()*.5);
-	double d = 0.0;
-	if (m) d = m->zToDistance(position.z);
+	if (!m) return Vec2(position.x, position.y);
+	Vec2 mid (m->canvasWidth()*.5, m->canvasHeight()*.5);
+	double d = m->zToDistance(position.z);
 	if (eqf(d,0.0)) d=1e-9;
 	Vec2 p(position.x-mid.x, position.y-mid.y);
 	return p/d + mid;
 }
 
 /* static */
-Vec3 Shape::cposToRealPos(const Vec2 & cpos, double z)
+Vec3 Shape::cposToRealPos(const MovingObjects *m, const Vec2 & cpos, double z)
 {
 	// cpos = (pos-mid)/d + mid
 	// cpos - mid = (pos-mid)/d
 	// (cpos - mid)*d = pos-mid
 	// (cpos - mid)*d + mid = pos
-	MovingObjects *m = movingObjects();
-	Vec2 mid (m->width()*.5, m->height()*.5);
-	double d = 0.0;
-	if (m) d = m->zToDistance(z);
+	if (!m) return Vec3(cpos.x, cpos.y, z);
+	Vec2 mid (m->canvasWidth()*.5, m->canvasHeight()*.5);
+	const double d = m->zToDistance(z);
 	const Vec2 rpos2d ((cpos-mid)*d + mid);
 	return Vec3 (rpos2d.x, rpos2d.y, z);
 }
@@ -499,11 +570,56 @@ void Ellipse::draw() {
 	scale.x *= xdiameter;
 	scale.y *= ydiameter;
 	drawBegin();
-	glCallList(dl);
+	if (gshader) {
+		if (!unitDl) {
+			// plain unit circle, the gradient shader computes the gradient from the vertex positions
+			static const double incr = DEG2RAD(360.0) / numVertices;
+			double radian = 0.;
+			unitDl = glGenLists(1);
+			glNewList(unitDl, GL_COMPILE);
+			glBegin(GL_POLYGON);
+			for (unsigned i = 0; i < numVertices; ++i, radian += incr)
+				glVertex2d(cos(radian)/2., sin(radian)/2.);
+			glEnd();
+			glEndList();
+		}
+		glCallList(unitDl);
+	} else
+		glCallList(dl);
 	drawEnd();
 	scale = scale_saved;
 }
 
+namespace {
+	/// unit circle lookup table shared by Ellipse::appendToBatch(), same vertices as Ellipse::defineDl()
+	struct EllipseTable {
+		double c[NUM_VERTICES_FOR_ELLIPSOIDS], s[NUM_VERTICES_FOR_ELLIPSOIDS];
+		EllipseTable() {
+			const double incr = DEG2RAD(360.0) / NUM_VERTICES_FOR_ELLIPSOIDS;
+			double radian = 0.;
+			for (int i = 0; i < NUM_VERTICES_FOR_ELLIPSOIDS; ++i, radian += incr)
+				c[i] = cos(radian), s[i] = sin(radian);
+		}
+	};
+}
+
+bool Ellipse::appendToBatch(Batch & b) const
+{
+	static const EllipseTable tab;
+	const bool hasGrad = gtex || (gshader && grad_type != None);
+	b.beginShape(this, Vec2(scale.x*xdiameter, scale.y*ydiameter), gtex, gshader ? grad_type : None, grad_min, grad_max);
+	const double ca = cos(grad_angle), sa = sin(grad_angle);
+	for (unsigned i = 0; i < numVertices; ++i) {
+		GLfloat t = 0.f;
+		// NB: cos(radian-grad_angle) == cos(radian)*cos(grad_angle) + sin(radian)*sin(grad_angle)
+		if (hasGrad) t = grad_offset + (grad_freq * ((1.0+tab.c[i]*ca+tab.s[i]*sa)/2.0));
+		b.vertex(tab.c[i]/2., tab.s[i]/2., t);
+		// triangulate the GL_POLYGON as a fan about vertex 0, same as the driver does
+		if (i >= 2) b.triangle(0, i-1, i);
+	}
+	return true;
+}
+
 Rect Ellipse::AABB() const { 
 	const double d = distance() > 0.0 ? distance() : 0.000000001;
 	const double r_max (xdiameter/d);
@@ -565,12 +681,42 @@ void Rectangle::draw() {
 	scale.x *= width;
 	scale.y *= height;
 	drawBegin();
-	glCallList(dl);
+	if (gshader) {
+		if (!unitDl) {
+			// plain unit square, the gradient shader computes the gradient from the vertex positions
+			unitDl = glGenLists(1);
+			glNewList(unitDl, GL_COMPILE);
+			glBegin(GL_QUADS);
+			glVertex2d(-.5, -.5);
+			glVertex2d(.5, -.5);
+			glVertex2d(.5, .5);
+			glVertex2d(-.5, .5);
+			glEnd();
+			glEndList();
+		}
+		glCallList(unitDl);
+	} else
+		glCallList(dl);
 	drawEnd();
 	scale = scale_saved;
 }
 
 
+bool Rectangle::appendToBatch(Batch & b) const
+{
+	static const double cx[4] = { -.5, .5, .5, -.5 }, cy[4] = { -.5, -.5, .5, .5 };
+	const bool hasGrad = gtex || (gshader && grad_type != None);
+	b.beginShape(this, Vec2(scale.x*width, scale.y*height), gtex, gshader ? grad_type : None, grad_min, grad_max);
+	GLuint v[4];
+	for (int i = 0; i < 4; ++i) {
+		GLfloat t = 0.f;
+		if (hasGrad) t = (grad_freq * Vec2f(cx[i]+.5f, cy[i]+.5f).rotated(grad_angle).x) + grad_offset;
+		v[i] = b.vertex(cx[i], cy[i], t);
+	}
+	b.triangle(v[0], v[1], v[2]);
+	b.triangle(v[0], v[2], v[3]);
+	return true;
+}
 
 Rect Rectangle::AABB() const {
 	double d0 = distance();
@@ -629,6 +775,9 @@ static void DLCleanup(GLuint & dl) {
 	
 void CleanupStaticDisplayLists() {
 	DLCleanup(Sphere::dl);
+	DLCleanup(Rectangle::unitDl);
+	DLCleanup(Ellipse::unitDl);
+	delete GradientShape::gshader, GradientShape::gshader = 0;
 	gluDeleteQuadric(Sphere::quadric), Sphere::quadric = 0;
 }
 
@@ -679,11 +828,8 @@ Sphere::Sphere(double diam)
 	color = 1.0;
 }
 
-void Sphere::draw()
+void Sphere::coloredLighting(GLfloat lAmb[4], GLfloat lDif[4], GLfloat lSpec[4], GLfloat spec[4], GLfloat amb[4], GLfloat dif[4], GLfloat emis[4]) const
 {
-	double d = distance();
-	if (d < 0.0) d = 1e-9;
-	GLfloat lAmb[4], lDif[4], lSpec[4], spec[4], amb[4], dif[4], emis[4];
 	for (int i = 0; i < 4; ++i) {
 		GLfloat c = 1.f;
 		switch(i) {
@@ -699,6 +845,22 @@ void Sphere::draw()
 		dif[i] = diffuse[i]*c;
 		emis[i] = emission[i]*c;
 	}
+}
+
+void Sphere::fixedLightPosition(GLfloat l[4]) const
+{
+	std::memcpy(l, lightPosition, sizeof(lightPosition));
+	l[0] -= position.x;
+	l[1] -= position.y;
+	l[2] += position.z;
+}
+
+void Sphere::draw()
+{
+	double d = distance();
+	if (d < 0.0) d = 1e-9;
+	GLfloat lAmb[4], lDif[4], lSpec[4], spec[4], amb[4], dif[4], emis[4];
+	coloredLighting(lAmb, lDif, lSpec, spec, amb, dif, emis);
 	GLint depthEnabled = 0, depthFunc = 0;
 	glGetIntegerv(GL_DEPTH_TEST, &depthEnabled);
 	glGetIntegerv(GL_DEPTH_FUNC, &depthFunc);
@@ -713,10 +875,7 @@ void Sphere::draw()
 		glPushMatrix();
 		glLoadIdentity();
 		GLfloat *l = lightPosition_xf;
-		std::memcpy(l, lightPosition, sizeof(lightPosition_xf));
-		l[0] -= position.x;
-		l[1] -= position.y;
-		l[2] += position.z;
+		fixedLightPosition(l);
 		glLightfv(GL_LIGHT0, GL_POSITION, l);
 		glLightf(GL_LIGHT0, GL_CONSTANT_ATTENUATION, lightAttenuations[0]);
 		glLightf(GL_LIGHT0, GL_LINEAR_ATTENUATION, lightAttenuations[1]);
@@ -758,6 +917,84 @@ void Sphere::draw()
 		glDisable(GL_DEPTH_TEST);		
 }
 
+namespace {
+	/// unit sphere shared by Sphere::appendToBatch(), on the same slices x stacks lattice as the gluSphere() in Sphere::draw().
+	/// Only the triangles facing +z are kept: under our glOrtho projection they are what the depth test leaves of a lone sphere.
+	struct SphereTable {
+		std::vector<Vec3> v; ///< the vertices of those triangles, which are also their normals
+		std::vector<GLuint> tris;
+		static Vec3 point(int j, int i) {
+			const double rho = M_PI*j/NUM_VERTICES_FOR_SPHEROIDS, theta = 2.*M_PI*i/NUM_VERTICES_FOR_SPHEROIDS;
+			return Vec3(sin(theta)*sin(rho), cos(theta)*sin(rho), cos(rho));
+		}
+		SphereTable() {
+			const int n = NUM_VERTICES_FOR_SPHEROIDS;
+			std::vector<int> ix((n+1)*(n+1), -1);
+			for (int j = 0; j < n; ++j)
+				for (int i = 0; i < n; ++i) {
+					const int q[4][2] = { { j, i }, { j+1, i }, { j+1, i+1 }, { j, i+1 } };
+					const int t[2][3] = { { 0, 1, 3 }, { 3, 1, 2 } };
+					for (int k = 0; k < 2; ++k) {
+						const Vec3 a (point(q[t[k][0]][0], q[t[k][0]][1])), b (point(q[t[k][1]][0], q[t[k][1]][1])), c (point(q[t[k][2]][0], q[t[k][2]][1]));
+						const Vec3 e1 (b-a), e2 (c-a), m (a+b+c);
+						const Vec3 nrm (e1.y*e2.z-e1.z*e2.y, e1.z*e2.x-e1.x*e2.z, e1.x*e2.y-e1.y*e2.x);
+						// the outward face normal has to point at the viewer (degenerate triangles at the poles have none)
+						const double outward = nrm.x*m.x + nrm.y*m.y + nrm.z*m.z;
+						if (!(outward > 0. ? nrm.z > 0. : (outward < 0. && nrm.z < 0.))) continue;
+						for (int l = 0; l < 3; ++l) {
+							int & vi (ix[q[t[k][l]][0]*(n+1) + q[t[k][l]][1]]);
+							if (vi < 0) vi = int(v.size()), v.push_back(point(q[t[k][l]][0], q[t[k][l]][1]));
+							tris.push_back(GLuint(vi));
+						}
+					}
+				}
+		}
+	};
+}
+
+bool Sphere::appendToBatch(Batch & b) const
+{
+	static const SphereTable tab;
+	double d = distance();
+	if (d < 0.0) d = 1e-9;
+	const double r = scale.x * diameter / d / 2.0;
+	GLfloat lAmb[4], lDif[4], lSpec[4], spec[4], amb[4], dif[4], emis[4], l[4];
+	coloredLighting(lAmb, lDif, lSpec, spec, amb, dif, emis);
+	// NB: draw() gives GL the unfixed light position with the identity modelview MovingObjects draws with
+	if (lightIsFixedInSpace) fixedLightPosition(l);
+	else std::memcpy(l, lightPosition, sizeof(l));
+	const Vec2 cpos (canvasPosition());
+	b.beginLitShape(this, r);
+	// GL_LIGHT0 evaluated as fixed-function GL does per vertex, with the default light model (.2 global ambient, viewer at infinity) and no spotlight
+	Vec3 L (l[0], l[1], l[2]);
+	if (l[3] == 0.f) L = L * (1./sqrt(L.x*L.x + L.y*L.y + L.z*L.z));
+	for (std::vector<Vec3>::const_iterator it = tab.v.begin(); it != tab.v.end(); ++it) {
+		const Vec3 & n (*it);
+		Vec3 vp (L);
+		double att = 1.;
+		if (l[3] != 0.f) {
+			vp = L*(1./l[3]) - Vec3(cpos.x + r*n.x, cpos.y + r*n.y, r*n.z);
+			const double dist = sqrt(vp.x*vp.x + vp.y*vp.y + vp.z*vp.z);
+			vp = vp * (1./dist);
+			att = 1./(lightAttenuations[0] + lightAttenuations[1]*dist + lightAttenuations[2]*dist*dist);
+		}
+		const double nl = n.x*vp.x + n.y*vp.y + n.z*vp.z;
+		Vec3 h (vp.x, vp.y, vp.z + 1.);
+		h = h * (1./sqrt(h.x*h.x + h.y*h.y + h.z*h.z));
+		const double nh = n.x*h.x + n.y*h.y + n.z*h.z;
+		const double sf = nl > 0. ? pow(MAX(nh, 0.), double(shininess)) : 0.;
+		GLfloat rgb[3];
+		for (int c = 0; c < 3; ++c) {
+			const double val = emis[c] + amb[c]*.2 + att*(amb[c]*lAmb[c] + MAX(nl, 0.)*dif[c]*lDif[c] + sf*spec[c]*lSpec[c]);
+			rgb[c] = GLfloat(val < 0. ? 0. : (val > 1. ? 1. : val));
+		}
+		b.vertex(n.x, n.y, rgb);
+	}
+	for (size_t i = 0; i + 2 < tab.tris.size(); i += 3)
+		b.triangle(tab.tris[i], tab.tris[i+1], tab.tris[i+2]);
+	return true;
+}
+
 Rect Sphere::AABB() const {
 	const double d = distance() > 0.0 ? distance() : 0.000000001;
 	Vec2 cpos(canvasPosition());
@@ -769,6 +1006,103 @@ Rect Sphere::AABB() const {
 }
 	
 
+Batch::Batch()
+	: tex(0), vbo(0), gtype(GradientShape::None), gmin(0.f), gmax(0.f), smooth(false), nShapes(0), nDrawCalls(0), base(0), tx(0.), ty(0.), m00(1.), m01(0.), m10(0.), m11(1.), cr(0.f), cg(0.f), cb(0.f)
+{
+	verts.reserve(4096);
+	idxs.reserve(8192);
+}
+
+Batch::~Batch()
+{
+	if (vbo) glDeleteBuffers(1, &vbo), vbo = 0;
+}
+
+void Batch::beginShape(const Shape *s, const Vec2 & scaleXY, GLuint t, GradientShape::GradType gt, GLfloat gmn, GLfloat gmx)
+{
+	// a change of gradient texture (or shader gradient) ends the current run
+	if (nShapes && (t != tex || gt != gtype || gmn != gmin || gmx != gmax || smooth)) flush();
+	tex = t;
+	gtype = gt, gmin = gmn, gmax = gmx;
+	smooth = false;
+	base = GLuint(verts.size());
+	++nShapes;
+	
+	// same transform as Shape::drawBegin(): translate * rotate * scale
+	const double d0 = s->distance(), d = d0 > 0.0 ? d0 : 0.000000000001;
+	const Vec2 cpos (s->canvasPosition());
+	const double sx = scaleXY.x/d, sy = scaleXY.y/d;
+	double c = 1., sn = 0.;
+	if (!eqf(s->angle, 0.)) c = cos(DEG2RAD(s->angle)), sn = sin(DEG2RAD(s->angle));
+	tx = cpos.x, ty = cpos.y;
+	m00 = c*sx, m01 = -sn*sy;
+	m10 = sn*sx, m11 = c*sy;
+	cr = s->color.r, cg = s->color.g, cb = s->color.b;
+}
+
+void Batch::beginLitShape(const Shape *s, double radius)
+{
+	if (nShapes && !smooth) flush();
+	tex = 0;
+	gtype = GradientShape::None, gmin = gmax = 0.f;
+	smooth = true;
+	base = GLuint(verts.size());
+	++nShapes;
+	const Vec2 cpos (s->canvasPosition());
+	tx = cpos.x, ty = cpos.y;
+	m00 = radius, m01 = 0.;
+	m10 = 0., m11 = radius;
+	cr = s->color.r, cg = s->color.g, cb = s->color.b;
+}
+
+void Batch::flush()
+{
+	if (!nShapes) return;
+	if (!vbo) glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, GLsizei(verts.size()*sizeof(Vertex)), &verts[0], GL_STREAM_DRAW);
+	glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+	if (smooth) {
+		glPushAttrib(GL_LIGHTING_BIT);
+		glShadeModel(GL_SMOOTH);
+	}
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	glVertexPointer(2, GL_FLOAT, sizeof(Vertex), (const GLvoid *)offsetof(Vertex, x));
+	glColorPointer(3, GL_FLOAT, sizeof(Vertex), (const GLvoid *)offsetof(Vertex, r));
+	if (tex) {
+		glEnable(GL_TEXTURE_1D);
+		glTexEnvf(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
+		glBindTexture(GL_TEXTURE_1D, tex);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(1, GL_FLOAT, sizeof(Vertex), (const GLvoid *)offsetof(Vertex, s));
+	} else if (gtype != GradientShape::None) {
+		// the texcoord already holds the gradient coordinate
+		static const GLfloat xform[4] = { 1.f, 0.f, 0.f, 0.f };
+		GradientShape::bindShader(gtype, gmin, gmax, xform);
+		glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+		glTexCoordPointer(1, GL_FLOAT, sizeof(Vertex), (const GLvoid *)offsetof(Vertex, s));
+	}
+	glDrawElements(GL_TRIANGLES, GLsizei(idxs.size()), GL_UNSIGNED_INT, &idxs[0]);
+	if (tex) {
+		glBindTexture(GL_TEXTURE_1D, 0);
+		glDisable(GL_TEXTURE_1D);
+	} else if (gtype != GradientShape::None)
+		GradientShape::releaseShader();
+	if (smooth) glPopAttrib();
+	glPopClientAttrib();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	++nDrawCalls;
+	if (myExcessiveDebug) Debug() << "Batch::flush() drew " << nShapes << " shapes (" << verts.size() << " vertices) tex=" << tex;
+	verts.clear();
+	idxs.clear();
+	nShapes = 0;
+	base = 0;
+}
+
 } // end namespace Shapes
 
 bool Rect::intersects(const Rect & r) const {
@@ -33,10 +33,15 @@ struct Rect {
 	inline double top() const { return origin.y + size.h; }
 };
 
+class QOpenGLShaderProgram;
+class MovingObjects;
+
 /** this namespace is needed because stupid Windows headers pollute the global namespace with
 	'Ellipse' and 'Rectangle' already! */
 namespace Shapes { 
 
+class Batch;
+
 class Shape {
 public:
 	Vec3 position;  ///< basically, position, or the center of the AABB of the shape (shapes are anchored at center basically)
@@ -44,6 +49,7 @@ public:
 	Vec3 color;     ///< defaults to gray
 	double angle; ///< the angle of rotation about the Z axis, in degrees
 	bool noMatrixAttribPush; ///< defaults to false, if true, don't do the glPushAttrib()/glPushMatrix calls as a performance hack
+	MovingObjects *mo; ///< the plugin that owns this shape, for its canvas size and Z-to-distance mapping.  Set by MovingObjects when it creates the shape.  If NULL the shape is at distance 1 and its canvas position is its position
 public:
 	Shape();
 	virtual ~Shape();
@@ -53,11 +59,12 @@ public:
 	virtual Rect AABB() const = 0; ///< must reimplement in subclasses to return the axis-aligned-bounding-box (with scale, rotation, and position applied!)
 	
 	virtual void setLengths(double l1, double l2) = 0;
+	virtual Vec2 lengths() const = 0; ///< the inverse of setLengths()
 	
 	Vec2 bottomLeft() const { return AABB().origin; }
 	
-	static Vec2 canvasPosition(const Vec3 & real_position); ///< returns the canvas position given a real pos
-	static Vec3 cposToRealPos(const Vec2 & canvas_position, double z);
+	static Vec2 canvasPosition(const MovingObjects *m, const Vec3 & real_position); ///< returns the canvas position given a real pos (which is the same if m is NULL)
+	static Vec3 cposToRealPos(const MovingObjects *m, const Vec2 & canvas_position, double z);
 	Vec2 canvasPosition() const; ///< returns the position of the object on the canvas after the object's Z position (distance) calculation is applied
 	void setCanvasPosition(const Vec2 &);
 	double distance() const; /**< the default distance, 1, means the object is on the 
@@ -70,6 +77,9 @@ public:
 	
 	virtual void copyProperties(const Shape *from);
 	
+	/// Append this shape's geometry to a Batch for merged drawing. Returns false if this shape type is not batchable (eg Sphere), in which case the caller should draw() it normally.
+	virtual bool appendToBatch(Batch &) const { return false; }
+	
 protected:
 	virtual void drawBegin();
 	virtual void drawEnd();
@@ -86,12 +96,28 @@ public:
 	
 	/*virtual*/ void copyProperties(const Shape *from);
 
-	void setGradient(GradType t, float freq, float angle, float offset, float min, float max);
+	/// If setupNow is false, only the parameters are stored and no GL calls are made (the display list is left as-is). Safe to call from a non-GL thread in that case.
+	void setGradient(GradType t, float freq, float angle, float offset, float min, float max, bool setupNow = true);
+	void getGradient(GradType & t, float & freq, float & angle, float & offset, float & min, float & max) const;
 
 	virtual int typeId() const = 0;
 	
 	static void doCacheGC() { if (dcache) dcache->doAutoCleanup(); }
 	
+	/// Gradient profile for type t at x in [0,1] (one period), scaled to [min,max].  The gradient textures are filled in from this.
+	static float gradientFunction(GradType t, float x, float min, float max);
+	/** CPU reference for a drawn gradient: the value at gradient coordinate s (wrapping every 1.0), 
+	    sampled the same way as the 256-texel GL_NEAREST/GL_REPEAT gradient textures.  The gradient 
+	    shader computes exactly this, so it can be used to generate golden images for either path. */
+	static float gradientValue(GradType t, float s, float min, float max);
+	
+	/// If on, gradients are computed in a fragment shader from per-shape uniforms instead of from cached 1D textures and per-parameter display lists.  Returns false if the shader could not be built, in which case textures are used.  Call with the GL context current, before creating any shapes.
+	static bool setUseShader(bool on);
+	static bool usingShader() { return gshader != 0; }
+	/// Binds the gradient shader for gradient type t (which must not be None). The gradient coordinate is s = xform[0]*texcoord + xform[1]*vertex.x + xform[2]*vertex.y + xform[3]
+	static void bindShader(GradType t, float min, float max, const GLfloat xform[4]);
+	static void releaseShader();
+	
 protected:
 
 	GLuint gtex;
@@ -105,8 +131,14 @@ protected:
 			
 	GLuint dl; ///< if non-zero, child class should use this display list instead of the static one associated with the class
 
+	static QOpenGLShaderProgram *gshader; ///< non-NULL if using the gradient shader
+	static int gshader_type, gshader_min, gshader_max, gshader_xform; ///< uniform locations
+	bool shaderBound; ///< true between drawBegin() and drawEnd() if we bound gshader
+
 	void setupDl();
 	virtual void defineDl() = 0;
+	/// Gradient coordinate (before freq and offset are applied) at the center of the unit shape, for a gradient angle with cosine ca and sine sa. Used by the gradient shader.
+	virtual float gradientBase(float ca, float sa) const = 0;
 	// child classes should call these if they reimplement them!!
 	virtual void drawBegin();
 	virtual void drawEnd();
@@ -167,6 +199,8 @@ private:
 	
 	static DLCache *dcache;
 	static int dcache_ct;	
+	
+	friend void CleanupStaticDisplayLists();
 };
 	
 class Rectangle : public GradientShape {
@@ -177,6 +211,10 @@ public:
 	
 protected:
 	/*virtual*/ void defineDl();
+	/*virtual*/ float gradientBase(float ca, float sa) const { return (ca+sa)/2.f; }
+	
+	static GLuint unitDl; ///< the unit square without a gradient, used in gradient shader mode
+	friend void CleanupStaticDisplayLists();
 	
 public:
 	Rectangle(double width = 1., double height = 1.);
@@ -185,10 +223,13 @@ public:
 	Rect AABB() const;
 	
 	void setLengths(double l1, double l2) { width = l1; height = l2; }
+	Vec2 lengths() const { return Vec2(width, height); }
 	
 	void draw();
 
 	void copyProperties(const Shape *from);
+	
+	/*virtual*/ bool appendToBatch(Batch &) const;
 };
 
 class Square : public Rectangle {
@@ -206,16 +247,23 @@ public:
 protected:
 
 	/*virtual*/void defineDl();
+	/*virtual*/ float gradientBase(float, float) const { return .5f; }
+	
+	static GLuint unitDl; ///< the unit circle without a gradient, used in gradient shader mode
+	friend void CleanupStaticDisplayLists();
 
 public:
 	Ellipse(double diamX = 1., double diamY = 1.);
 	
 	void draw();
 	void setLengths(double l1, double l2) { xdiameter = l1; ydiameter = l2; }
+	Vec2 lengths() const { return Vec2(xdiameter, ydiameter); }
 	
 	Rect AABB() const;
 	
 	void copyProperties(const Shape *from);
+
+	/*virtual*/ bool appendToBatch(Batch &) const;
 private:
 };
 
@@ -250,17 +298,100 @@ public:
 	Rect AABB() const;
 	
 	void setLengths(double l1, double l2) { diameter = l1; (void)l2; }
+	Vec2 lengths() const { return Vec2(diameter, diameter); }
 	
 	void copyProperties(const Shape *from);
 	
+	/*virtual*/ bool appendToBatch(Batch &) const;
+	
 protected:
 	static GLUquadricObj *quadric;
 	static GLuint dl;
 	
 private:
 	GLfloat lightPosition_xf[4]; ///< tmp buffer used internally for computed lightPosition
+	/// the light and material colors times this sphere's color, as draw() passes them to GL
+	void coloredLighting(GLfloat lAmb[4], GLfloat lDif[4], GLfloat lSpec[4], GLfloat spec[4], GLfloat amb[4], GLfloat dif[4], GLfloat emis[4]) const;
+	/// the light position draw() gives GL if lightIsFixedInSpace, in eye coordinates
+	void fixedLightPosition(GLfloat l[4]) const;
 };
 	
+/** \brief Merges the geometry of many Rectangles, Ellipses and Spheres into one vertex buffer.
+ 
+	Shapes appended via Shape::appendToBatch() get their vertices transformed on the CPU 
+	(position, rotation, scale, distance) and packed together with their color and 
+	gradient texcoord into a streamed VBO.  Spheres are lit on the CPU too, per vertex as 
+	fixed-function GL would, and only their triangles facing the viewer are added, which 
+	is all the depth test lets through for a sphere drawn on its own.  flush() then draws everything accumulated 
+	with one glDrawElements() call per run of shapes sharing the same gradient texture 
+	(or gradient type/min/max in gradient shader mode), 
+	instead of a glPushMatrix/glTranslate/glRotate/glScale/glCallList per shape.
+	Primitive order is preserved, so painter's-algorithm depth ordering still works.
+	Must only be used (and deleted) with the GL context current. */
+class Batch {
+public:
+	Batch();
+	~Batch();
+	
+	/// Appends s, flushing first if s needs a different gradient texture than the current run. Returns false if s is not batchable.
+	bool add(const Shape *s) { return s->appendToBatch(*this); }
+	/// Draws all accumulated shapes and clears the batch.
+	void flush();
+	
+	unsigned count() const { return nShapes; } ///< number of shapes pending in the batch
+	unsigned drawCalls() const { return nDrawCalls; } ///< debug stat, total glDrawElements calls since construction
+	
+	// -- used by Shape subclasses in appendToBatch() --
+	/// Starts a new shape with the given (already scaled by length) size and gradient texture (0 for none).  In gradient shader mode tex is 0 and the gradient is given by gradType/gradMin/gradMax instead.
+	void beginShape(const Shape *s, const Vec2 & scaleXY, GLuint tex, GradientShape::GradType gradType = GradientShape::None, GLfloat gradMin = 0.f, GLfloat gradMax = 0.f);
+	/// Starts a new shape that gives each vertex its own color (smooth shaded), centered on s's canvas position, unrotated and scaled by radius
+	void beginLitShape(const Shape *s, double radius);
+	/// Adds a vertex in shape-local unit coordinates, returns its index relative to this shape
+	inline GLuint vertex(double x, double y, GLfloat texcoord);
+	/// Same, for shapes started with beginLitShape()
+	inline GLuint vertex(double x, double y, const GLfloat rgb[3]);
+	/// Adds a triangle, using indices as returned by vertex()
+	inline void triangle(GLuint a, GLuint b, GLuint c);
+	
+private:
+	struct Vertex { GLfloat x, y, s, r, g, b; };
+	std::vector<Vertex> verts;
+	std::vector<GLuint> idxs;
+	GLuint tex, vbo;
+	GradientShape::GradType gtype; ///< gradient of the current run, in gradient shader mode
+	GLfloat gmin, gmax;
+	bool smooth; ///< the current run has per-vertex colors, from beginLitShape()
+	unsigned nShapes, nDrawCalls;
+	GLuint base; ///< index of first vertex of the current shape
+	// current shape transform
+	double tx, ty, m00, m01, m10, m11;
+	GLfloat cr, cg, cb;
+};
+
+inline GLuint Batch::vertex(double x, double y, GLfloat texcoord)
+{
+	Vertex v;
+	v.x = GLfloat(tx + m00*x + m01*y);
+	v.y = GLfloat(ty + m10*x + m11*y);
+	v.s = texcoord;
+	v.r = cr; v.g = cg; v.b = cb;
+	verts.push_back(v);
+	return GLuint(verts.size()-1) - base;
+}
+
+inline GLuint Batch::vertex(double x, double y, const GLfloat rgb[3])
+{
+	const GLuint i = vertex(x, y, 0.f);
+	Vertex & v (verts.back());
+	v.r = rgb[0]; v.g = rgb[1]; v.b = rgb[2];
+	return i;
+}
+
+inline void Batch::triangle(GLuint a, GLuint b, GLuint c)
+{
+	idxs.push_back(base+a); idxs.push_back(base+b); idxs.push_back(base+c);
+}
+	
 /// call this to pre-create the display lists for Rectangle and Ellipses so that it's ready for us and primed
 void InitStaticDisplayLists();
 void CleanupStaticDisplayLists();
@@ -9,9 +9,13 @@
 #include <QEvent>
 #include "ConnectionThread.h"
 #include <cstdlib>
+#include <iostream>
 #include <QSettings>
 #include <QMetaType>
 #include "StimPlugin.h"
+#include "Benchmark.h"
+#include "SelfTest.h"
+#include "AsyncLog.h"
 #include <QTcpSocket>
 #include <QStatusBar>
 #include <QTimer>
@@ -74,7 +78,7 @@ namespace {
 StimApp * StimApp::singleton = 0;
 
 StimApp::StimApp(int & argc, char ** argv)
-    : QApplication(argc, argv, true), consoleWindow(0), glWindow(0), glWinHasFrame(true), debug(false), initializing(true), server(0), nLinesInLog(0), nLinesInLogMax(1000), glWinSize(DEFAULT_WIN_SIZE) /* default plugin size */, tmphs(0), tmpwc(0)
+    : QApplication(argc, argv, true), consoleWindow(0), glWindow(0), glWinHasFrame(true), debug(false), initializing(true), server(0), nLinesInLog(0), nLinesInLogMax(1000), glWinSize(DEFAULT_WIN_SIZE) /* default plugin size */, fsSlots(0), fsSlotKB(0), tmphs(0), tmpwc(0), bench(0), selfTest(0), asyncLog(0), notifier(0)
 {
     if (singleton) {
         QMessageBox::critical(0, "Invariant Violation", "Only 1 instance of StimApp allowed per application!");
@@ -88,15 +92,46 @@ StimApp::StimApp(int & argc, char ** argv)
     Connect(this, SIGNAL(aboutToQuit()), this, SLOT(quitCleanup()));
     singleton = this;
     if (!::init) ::init = new Init;
+    asyncLog = new AsyncLog;
+    asyncLog->start(QThread::LowPriority);
+    {
+        const QStringList args (arguments());
+        const int i = args.indexOf("--mock-daq");
+        if (i > 0 && i+1 < args.size()) {
+            mockDaqFile = args[i+1];
+            DAQ::SetMockBackend(true);
+        }
+    }
+    DAQ::StartOutputThread();
+    notifier = new StimGL_SpikeGL_Integration::Notifier;
+    notifier->start();
     loadSettings();
 	glWinSize = QSize(globalDefaults.mon_x_pix, globalDefaults.mon_y_pix);
 
+	{
+		Benchmark::Config bcfg;
+		bool ok;
+		if (Benchmark::parseArgs(arguments(), bcfg, ok)) {
+			if (!ok) std::exit(1);
+			bench = new Benchmark(bcfg, this);
+			if (!bench->readParams()) std::exit(1);
+			// the window is created at the param file's size up front, rather than recreated as in loadStim()
+			const StimParams & bp (bench->params());
+			glWinSize = QSize(bp["mon_x_pix"].toUInt(), bp["mon_y_pix"].toUInt());
+		}
+	}
+	{
+		QStringList tests;
+		if (SelfTest::parseArgs(arguments(), tests)) selfTest = new SelfTest(tests, this);
+	}
+
     installEventFilter(this); // filter our own events
 
     consoleWindow = new ConsoleWindow;
     defaultLogColor = consoleWindow->textEdit()->textColor();
 
     Log() << "Application started";
+    if (mockDaqFile.length()) Log() << "DAQ output is mocked, writes will be saved to " << mockDaqFile;
 
     consoleWindow->installEventFilter(this);
     consoleWindow->textEdit()->installEventFilter(this);
@@ -115,6 +150,18 @@ StimApp::StimApp(int & argc, char ** argv)
     delta += 22; // this is a rough guesstimate to correct for window frame size being unknown on X11
 #endif
     consoleWindow->move(0,glWindow->frameSize().height()+delta);
+
+    if (bench || selfTest) {
+        // unthrottled, no network, no calibration -- and leave the saved vsync setting alone
+        glWindow->makeCurrent();
+        Util::setVSyncMode(false);
+        glWindow->initPlugins();
+        initializing = false;
+        if (bench) QTimer::singleShot(0, bench, SLOT(start()));
+        else QTimer::singleShot(0, selfTest, SLOT(start()));
+        return;
+    }
+
     consoleWindow->show();
 
     if (getNProcessors() > 2)
@@ -215,6 +262,10 @@ StimApp::~StimApp()
     Log() << "Deleting Tcp server and closing connections..";
     delete server;
     saveSettings();
+    delete notifier, notifier = 0; // delivers any pending notifications first
+    DAQ::StopOutputThread();
+    if (mockDaqFile.length()) DAQ::MockSaveCSV(mockDaqFile);
+    delete asyncLog, asyncLog = 0; // flushes the last lines
     singleton = 0;
 }
 
@@ -233,6 +284,7 @@ bool StimApp::isDebugMode() const
 void StimApp::setDebugMode(bool d)
 {
     debug = d;
+    Log::setMinLevel(debug ? Log::DebugLevel : Log::InfoLevel);
     saveSettings();
 }
 
@@ -252,6 +304,11 @@ bool StimApp::isSaveParamHistory() const
     return saveParamHistory;
 }
 
+bool StimApp::isSaveFrameTiming() const
+{
+    return saveFrameTiming;
+}
+
 void StimApp::setSaveFrameVars(bool b)
 {
     saveFrameVars = b;
@@ -273,6 +330,16 @@ void StimApp::setSaveParamHistory(bool b)
 		Log() << "Param history save disabled.";
 }
 
+void StimApp::setSaveFrameTiming(bool b)
+{
+    saveFrameTiming = b;
+    saveSettings();
+	if (saveFrameTiming)
+		Log() << "Frame timing save enabled: Saving to directory '" << outputDirectory() << "' on plugin stop.";
+	else
+		Log() << "Frame timing save disabled.";
+}
+
 void StimApp::setNoDropFrameWarn(bool b) {
 	noDropFrameWarn = b;
 	saveSettings();
@@ -282,6 +349,13 @@ bool StimApp::isNoDropFrameWarn() const {
 	return noDropFrameWarn;
 }
 
+void StimApp::setRenderThread(bool b) {
+	renderThread = b;
+	saveSettings();
+	// GLWindow::paintGL() starts the render thread on its own once this is set
+	if (!b && glWindow) glWindow->stopRenderThread();
+}
+
 bool StimApp::isFrameDumpMode() const
 {
     if (glWindow) return glWindow->debugLogFrames;
@@ -380,6 +454,7 @@ bool StimApp::eventFilter(QObject *watched, QEvent *event)
 
 void StimApp::logLine(const QString & line, const QColor & c)
 {
+    if (bench || selfTest) std::cerr << line.toUtf8().constData() << "\n"; // the console window is hidden in benchmark and selftest modes
     qApp->postEvent(consoleWindow, new LogLineEvent(line, c.isValid() ? c : defaultLogColor));
 }
 
@@ -420,9 +495,16 @@ void StimApp::loadSettings()
 
     settings.beginGroup("StimApp");
     debug = settings.value("debug", false).toBool();
+    Log::setMinLevel(debug ? Log::DebugLevel : Log::InfoLevel);
+    logFile = settings.value("logFile", "").toString();
+    if (asyncLog) asyncLog->setLogFile(logFile);
 	noDropFrameWarn = settings.value("noDropFrameWarn", false).toBool();
+	renderThread = settings.value("renderThread", false).toBool();
+	fsSlots = settings.value("frameShareSlots", 0).toUInt();
+	fsSlotKB = settings.value("frameShareSlotKB", 0).toUInt();
 	saveFrameVars = settings.value("saveFrameVars", false).toBool();
 	saveParamHistory = settings.value("saveParamHistory", false).toBool();
+	saveFrameTiming = settings.value("saveFrameTiming", false).toBool();
 	vsyncDisabled = settings.value("noVSync", false).toBool();
     lastFile = settings.value("lastFile", "").toString();
     mut.lock();
@@ -481,8 +563,13 @@ void StimApp::saveSettings()
     settings.beginGroup("StimApp");
     settings.setValue("debug", debug);
 	settings.setValue("noDropFrameWarn", noDropFrameWarn);
+	settings.setValue("renderThread", renderThread);
+	settings.setValue("logFile", logFile);
+	settings.setValue("frameShareSlots", fsSlots);
+	settings.setValue("frameShareSlotKB", fsSlotKB);
 	settings.setValue("saveFrameVars", saveFrameVars);
 	settings.setValue("saveParamHistory", saveParamHistory);
+	settings.setValue("saveFrameTiming", saveFrameTiming);
     settings.setValue("lastFile", lastFile);
 	settings.setValue("lastFMV", lastFMV);
 	settings.setValue("noVSync", vsyncDisabled);
@@ -678,26 +765,8 @@ void StimApp::loadStim()
 				tsparams << line << "\n";
 			}
 			tsparams.flush();
-			{
-				params.clear();
-				GlobalDefaults & defs (globalDefaults);
-				// set params from defaults
-				params["mon_x_pix"] = defs.mon_x_pix;
-				params["mon_y_pix"] = defs.mon_y_pix;
-				params["ftrackbox_x"] = defs.ftrackbox_x;
-				params["ftrackbox_y"] = defs.ftrackbox_y;
-				params["ftrackbox_w"] = defs.ftrackbox_w;
-				params["ftrack_track_color"] = defs.ftrack_track_color;
-				params["ftrack_off_color"] = defs.ftrack_off_color;
-				params["ftrack_change_color"] = defs.ftrack_change_color;
-				params["ftrack_start_color"] = defs.ftrack_start_color;
-				params["ftrack_end_color"] = defs.ftrack_end_color;
-				params["fps_mode"] = defs.fps_mode == 0 ? "single" : (defs.fps_mode == 1 ? "double" : "triple");
-				params["color_order"] = defs.color_order;
-				params["DO_with_vsync"] = defs.DO_with_vsync;
-				params["Nblinks"] = defs.Nblinks;
-				params["nblinks"] = defs.Nblinks; // case insensitive?
-			}
+			params.clear();
+			setParamsFromGlobalDefaults(params);
 			params.fromString(paramsBuf, false);
 
 			{
@@ -753,6 +822,26 @@ void StimApp::loadStim()
     }
 }
 
+void StimApp::setParamsFromGlobalDefaults(StimParams & params) const
+{
+	const GlobalDefaults & defs (globalDefaults);
+	params["mon_x_pix"] = defs.mon_x_pix;
+	params["mon_y_pix"] = defs.mon_y_pix;
+	params["ftrackbox_x"] = defs.ftrackbox_x;
+	params["ftrackbox_y"] = defs.ftrackbox_y;
+	params["ftrackbox_w"] = defs.ftrackbox_w;
+	params["ftrack_track_color"] = defs.ftrack_track_color;
+	params["ftrack_off_color"] = defs.ftrack_off_color;
+	params["ftrack_change_color"] = defs.ftrack_change_color;
+	params["ftrack_start_color"] = defs.ftrack_start_color;
+	params["ftrack_end_color"] = defs.ftrack_end_color;
+	params["fps_mode"] = defs.fps_mode == 0 ? "single" : (defs.fps_mode == 1 ? "double" : "triple");
+	params["color_order"] = defs.color_order;
+	params["DO_with_vsync"] = defs.DO_with_vsync;
+	params["Nblinks"] = defs.Nblinks;
+	params["nblinks"] = defs.Nblinks; // case insensitive?
+}
+
 void StimApp::unloadStim()
 {
     ReentrancyPreventer rp; if (!rp) return;
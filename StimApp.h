@@ -36,6 +36,11 @@ class QTextEdit;
 class ConsoleWindow;
 class GLWindow;
 class QTcpServer;
+class StimParams;
+class Benchmark;
+class SelfTest;
+class AsyncLog;
+namespace StimGL_SpikeGL_Integration { class Notifier; }
 namespace Ui { class HotspotConfig; class WarpingConfig; }
 
 /**
@@ -109,10 +114,20 @@ public:
     bool isDebugMode() const;
 
 	bool isNoDropFrameWarn() const;
+	/// If true, GLWindow draws frames from a dedicated high-priority render thread rather than from the GUI thread
+	bool isRenderThread() const { return renderThread; }
+	/// Geometry of the SpikeGL frame share ring, if this program is the one that creates it.  0 means the default.  Settings only, no UI.
+	unsigned frameShareSlots() const { return fsSlots; }
+	unsigned frameShareSlotKB() const { return fsSlotKB; }
+
+	/// Plugin start/end/params notifications go through this, so they never block on the network
+	StimGL_SpikeGL_Integration::Notifier *spikeGLNotifier() const { return notifier; }
 	
 	bool isSaveFrameVars() const;
 
 	bool isSaveParamHistory() const;
+	/// If true, plugins save the GLWindow::frameTimeline() as a Chrome trace and binary log on stop
+	bool isSaveFrameTiming() const;
 	
 	bool isFrameDumpMode() const;
 	
@@ -162,9 +177,13 @@ public slots:
 
 	void setNoDropFrameWarn(bool);
 	
+	void setRenderThread(bool);
+	
 	void setSaveFrameVars(bool);
 
 	void setSaveParamHistory(bool);
+
+	void setSaveFrameTiming(bool);
 	
 	void setFrameDumpMode(bool);	
 	
@@ -199,6 +218,12 @@ public slots:
     /// Pops up the Global Default Params dialog
     void globalDefaultsDialog();
 
+	/// Sets the params that come from the global defaults (mon_x_pix, ftrackbox_x, fps_mode, etc) as the base for a param file
+	void setParamsFromGlobalDefaults(StimParams & params) const;
+
+	/// True if the program was started with --benchmark, see Benchmark
+	bool isBenchmarkMode() const { return bench != 0; }
+
 signals:
 	void gotCheckFMV(const QString & file);
 	
@@ -235,7 +260,7 @@ private:
     mutable QMutex mut; ///< used to lock outDir param for now
     ConsoleWindow *consoleWindow;
     GLWindow *glWindow;
-    bool glWinHasFrame, debug, noDropFrameWarn, saveFrameVars, saveParamHistory, vsyncDisabled;
+    bool glWinHasFrame, debug, noDropFrameWarn, saveFrameVars, saveParamHistory, saveFrameTiming, vsyncDisabled, renderThread;
     QString lastFile, lastFMV;
     volatile bool initializing;
     QColor defaultLogColor;
@@ -247,9 +272,17 @@ private:
     static StimApp *singleton;
     unsigned nLinesInLog, nLinesInLogMax;
     QSize glWinSize;
+    unsigned fsSlots, fsSlotKB;
 
     Ui::HotspotConfig *tmphs;
     Ui::WarpingConfig *tmpwc;
+
+    Benchmark *bench;
+    SelfTest *selfTest; ///< set in --selftest mode
+    AsyncLog *asyncLog;
+    StimGL_SpikeGL_Integration::Notifier *notifier;
+    QString mockDaqFile; ///< from --mock-daq, DAQ writes are recorded and saved here at exit instead of going to the hardware
+    QString logFile; ///< if not empty, all log lines are appended to this file (settings only, no UI)
 };
 
 #endif
@@ -6,6 +6,11 @@
 #include <QSharedMemory>
 #include <QApplication>
 #include <QMessageBox>
+#include <QTextStream>
+#include <string.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 
 #define LINELEN 4096
 #define GREETING_STRING "HELLO I'M SPIKEGL"
@@ -14,6 +19,8 @@
 #define PLUGIN_PARAMS_STRING "PLUGIN PARAMS"
 #define PLUGIN_PARAMS_END_STRING "END PLUGIN PARAMS"
 #define OK_STRING "OK"
+#define KEEPALIVE_STRING "KEEPALIVE" ///< appended to the greeting by servers that take more than one notification per connection
+#define SEQ_STRING "SEQ" ///< "SEQ <notifier id> <n>", sent before each notification on KEEPALIVE connections
 
 typedef QMap<QString, QVariant> PM;
 Q_DECLARE_METATYPE(PM);
@@ -94,6 +101,22 @@ namespace StimGL_SpikeGL_Integration
         return line;
     }
 
+    /// The notification message, as sent after the greeting
+    static QString buildNotifyMsg(bool isStart, bool isEnd, const QString & pname, const QMap<QString, QVariant>  &pparms)
+    {
+        QString msg;
+        if (isStart || isEnd)
+            msg += QString(isStart ? PLUGIN_START_STRING : PLUGIN_END_STRING) + " " + pname.trimmed() + "\n";
+        msg += QString(PLUGIN_PARAMS_STRING) + "\n";
+        msg += QString("StimGLVersion = %1 (0x%2)\n").arg(VERSION_STR).arg(VERSION,0,16);
+        for (QMap<QString, QVariant> ::const_iterator it = pparms.begin();
+             it != pparms.end();
+             ++it) 
+            msg += QString("%1 = %2\n").arg(it.key()).arg(it.value().toString());
+        msg += QString("%1\n").arg(PLUGIN_PARAMS_END_STRING);
+        return msg;
+    }
+
     static bool doNotify (bool isStart,  
 						  bool isEnd,
                           const QString & pname, 
@@ -121,17 +144,7 @@ namespace StimGL_SpikeGL_Integration
         
         QString line = sockReadLine(sock, timeout_msecs, errStr_out);
         if (line.isNull()) return false;
-		if (isStart || isEnd) {
-			if (!sockSend(sock, QString(isStart ? PLUGIN_START_STRING : PLUGIN_END_STRING) + " " + pname.trimmed() + "\n", timeout_msecs, errStr_out)) return false;
-		}
-        if (!sockSend(sock, QString(PLUGIN_PARAMS_STRING) + "\n", timeout_msecs, errStr_out)) return false;
-        if (!sockSend(sock, QString("StimGLVersion = %1 (0x%2)\n").arg(VERSION_STR).arg(VERSION,0,16), timeout_msecs, errStr_out)) return false;
-        for (QMap<QString, QVariant> ::const_iterator it = pparms.begin();
-             it != pparms.end();
-             ++it) {
-            if (!sockSend(sock, QString("%1 = %2\n").arg(it.key()).arg(it.value().toString()), timeout_msecs, errStr_out)) return false;
-        }
-        if (!sockSend(sock, QString("%1\n").arg(PLUGIN_PARAMS_END_STRING), timeout_msecs, errStr_out)) return false;
+        if (!sockSend(sock, buildNotifyMsg(isStart, isEnd, pname, pparms), timeout_msecs, errStr_out)) return false;
         line = sockReadLine(sock, timeout_msecs, errStr_out);
         if (line.isNull()) return false;
         if (!line.startsWith(OK_STRING)) {
@@ -174,58 +187,96 @@ namespace StimGL_SpikeGL_Integration
         return doNotify(false, false, pname, pparms, errStr_out, host, port, timeout_msecs);
     }
 	
-    void NotifyServer::processConnection(QTcpSocket & sock)
+    void NotifyServer::processLine(QTcpSocket *sock, Conn & c, const QString & line)
     {
-        QString line;
-        setSockContextName("NotifyServerThread");
-        line = QString(GREETING_STRING) + "\n";
-        bool isStart = false, isEnd = false, isParams = false;
-
-        if (!sockSend(sock, line, timeout_msecs)) return;
-        if ((line = sockReadLine(sock, timeout_msecs)).isNull()) return;
-        if (   !(isStart = line.startsWith(PLUGIN_START_STRING)) 
-			&& !(isEnd = line.startsWith(PLUGIN_END_STRING))
-			&& !(isParams = line.startsWith(QString(PLUGIN_PARAMS_STRING))) ) {
-            Error() << sockContextName() << " parse error expected: {" << PLUGIN_START_STRING << "|" << PLUGIN_END_STRING << "|" << PLUGIN_PARAMS_STRING << "} got: " << line;
-            return;
-        }
-        if (isStart)
-            line = line.mid(QString(PLUGIN_START_STRING).length());
-        else if (isEnd)
-            line = line.mid(QString(PLUGIN_END_STRING).length());
-        line = line.trimmed();
-		QString pluginName = "unknown";
-		if (isStart || isEnd) {
-			// manadatory params appear after start/end
-			pluginName = line;
-			if ((line = sockReadLine(sock, timeout_msecs)).isNull()) return;
-			if (!line.startsWith(PLUGIN_PARAMS_STRING)) {
-				Error() << sockContextName() << " parse error expected: " << PLUGIN_PARAMS_STRING << "got: " << line;
-				return;
-			}
-		}
-		// here all modes list params..
-        QMap<QString, QVariant>  params;
-        while (  !(line = sockReadLine(sock, timeout_msecs)).startsWith(PLUGIN_PARAMS_END_STRING)) {
-            QStringList l = line.trimmed().split("=");
-            if (l.count() < 2) { Debug() << "skipping params line that does not contain '=': " << line; continue; }
-            QString n = l.front().trimmed();
-            l.pop_front();
-            QString v = l.join("=").trimmed();
-            params[n] = v;
+        switch (c.state) {
+        case Conn::WantCommand:
+            if (line.startsWith(SEQ_STRING)) {
+                const QStringList l = line.split(" ", QString::SkipEmptyParts);
+                c = Conn();
+                if (l.count() == 3) c.seqFrom = l[1], c.seq = l[2].toUInt();
+                break;
+            }
+            {
+                const Conn prev(c);
+                c = Conn();
+                c.seqFrom = prev.seqFrom, c.seq = prev.seq;
+            }
+            if (line.startsWith(PLUGIN_START_STRING)) {
+                c.isStart = true, c.state = Conn::WantParams;
+                c.pluginName = line.mid(QString(PLUGIN_START_STRING).length()).trimmed();
+            } else if (line.startsWith(PLUGIN_END_STRING)) {
+                c.isEnd = true, c.state = Conn::WantParams;
+                c.pluginName = line.mid(QString(PLUGIN_END_STRING).length()).trimmed();
+            } else if (line.startsWith(PLUGIN_PARAMS_STRING)) {
+                c.pluginName = "unknown", c.state = Conn::InParams;
+            } else if (line.length()) {
+                Error() << "NotifyServer parse error expected: {" << PLUGIN_START_STRING << "|" << PLUGIN_END_STRING << "|" << PLUGIN_PARAMS_STRING << "} got: " << line;
+                sock->disconnectFromHost();
+            }
+            break;
+        case Conn::WantParams:
+            // manadatory params appear after start/end
+            if (!line.startsWith(PLUGIN_PARAMS_STRING)) {
+                Error() << "NotifyServer parse error expected: " << PLUGIN_PARAMS_STRING << " got: " << line;
+                c.state = Conn::WantCommand;
+                sock->disconnectFromHost();
+            } else
+                c.state = Conn::InParams;
+            break;
+        case Conn::InParams:
+            if (line.startsWith(PLUGIN_PARAMS_END_STRING)) {
+                const Conn done(c);
+                c = Conn(); // ready for the next notification on this connection
+                // a repeat is a retry after our OK got lost, so acknowledge it again but don't emit it twice
+                const bool repeat = done.seq && lastSeq.contains(done.seqFrom) && done.seq <= lastSeq[done.seqFrom];
+                if (done.seq && !repeat) lastSeq[done.seqFrom] = done.seq;
+                setSockContextName("NotifyServer");
+                sockSend(*sock, QString(OK_STRING) + "\n", timeout_msecs);
+                if (repeat) Debug() << "NotifyServer: ignoring repeated notification " << done.seq << " from " << done.seqFrom;
+                else emitGotPluginNotification(done.isStart, done.isEnd, done.pluginName, done.params);
+                //Log() << "Received plugin " << (done.isStart ? "start" : "end") << " notificaton from StimGL for plugin " << done.pluginName;
+            } else {
+                QStringList l = line.split("=");
+                if (l.count() < 2) { Debug() << "skipping params line that does not contain '=': " << line; break; }
+                QString n = l.front().trimmed();
+                l.pop_front();
+                c.params[n] = l.join("=").trimmed();
+            }
+            break;
         }
-        line = QString(OK_STRING) + "\n";
-        if (!sockSend(sock, line, timeout_msecs)) return;
-        emitGotPluginNotification(isStart, isEnd, pluginName, params);
-        //Log() << "Received plugin " << (isStart ? "start" : "end") << " notificaton from StimGL for plugin " << pluginName;
     }
  
     void NotifyServer::gotNewConnection() 
     {
-        QTcpSocket *sock = srv.nextPendingConnection();
-        processConnection(*sock);
-        sock->close();
-        delete sock;
+        QTcpSocket *sock;
+        while ((sock = srv.nextPendingConnection())) {
+            conns[sock] = Conn();
+            Connect(sock, SIGNAL(readyRead()), this, SLOT(connReadyRead()));
+            Connect(sock, SIGNAL(disconnected()), this, SLOT(connDisconnected()));
+            setSockContextName("NotifyServer");
+            sockSend(*sock, QString(GREETING_STRING) + " " + KEEPALIVE_STRING + "\n", timeout_msecs);
+        }
+    }
+
+    void NotifyServer::connReadyRead()
+    {
+        QTcpSocket *sock = qobject_cast<QTcpSocket *>(sender());
+        if (!sock) return;
+        while (sock->canReadLine()) {
+            // NB: look it up every line, processLine() may have dropped the connection
+            QMap<QTcpSocket *, Conn>::iterator it = conns.find(sock);
+            if (it == conns.end()) break;
+            processLine(sock, it.value(), QString(sock->readLine(LINELEN)).trimmed());
+        }
+    }
+
+    void NotifyServer::connDisconnected()
+    {
+        QTcpSocket *sock = qobject_cast<QTcpSocket *>(sender());
+        if (!sock) return;
+        conns.remove(sock);
+        sock->deleteLater();
     }
 
     static bool mapMetaTypeRegistered = false;
@@ -268,16 +319,176 @@ namespace StimGL_SpikeGL_Integration
 			emit gotPluginParamsNotification(p, pp);
     }       
 
+
+    Notifier::Notifier(QObject *parent)
+        : QThread(parent), pleaseStop(false), id(QString("%1-%2").arg(QCoreApplication::applicationPid()).arg(qulonglong(getAbsTimeNS()))), nextSeq(1),
+          sock(0), sockPort(0), keepAlive(false), lastRefused(false),
+          nDelivered(0), nFailed(0), nDropped(0), nConnects(0), lastLatency(0.), lastDeliveredTime(0.)
+    {
+    }
+
+    Notifier::~Notifier()
+    {
+        {
+            QMutexLocker l(&mut);
+            pleaseStop = true;
+            cond.wakeAll();
+        }
+        wait();
+    }
+
+    void Notifier::post(Type t, const QString & pname, const QMap<QString, QVariant> & pparms,
+                        const QString & host, unsigned short port, int timeout_msecs)
+    {
+        Msg m;
+        m.payload = buildNotifyMsg(t == Start, t == End, pname, pparms);
+        m.desc = QString("`") + pname + "' " + (t == Start ? "start" : (t == End ? "end" : "params"));
+        m.host = host;
+        m.port = port;
+        m.timeout_msecs = timeout_msecs;
+        m.tQueued = getTime();
+        QMutexLocker l(&mut);
+        m.seq = nextSeq++;
+        if (queue.size() >= MaxQueued) {
+            ++nDropped;
+            l.unlock();
+            Warning() << "SpikeGL notification queue is full, dropped plugin " << m.desc << " notification.";
+            return;
+        }
+        queue.enqueue(m);
+        cond.wakeOne();
+    }
+
+    void Notifier::disconnectSock()
+    {
+        if (!sock) return;
+        sock->abort();
+        delete sock, sock = 0;
+    }
+
+    bool Notifier::deliver(const Msg & m)
+    {
+        if (sock && (sock->state() != QAbstractSocket::ConnectedState || sockHost != m.host || sockPort != m.port))
+            disconnectSock();
+        if (!sock) {
+            sock = new QTcpSocket;
+            sock->connectToHost(m.host, m.port);
+            if (!sock->waitForConnected(m.timeout_msecs) || !sock->isValid()) {
+                lastRefused = sock->error() == QAbstractSocket::ConnectionRefusedError;
+                Debug() << "Notify SpikeGL: could not connect to " << m.host << ":" << m.port << "; " << socketErrorToString(sock->error());
+                return false;
+            }
+            const QString greeting = sockReadLine(*sock, m.timeout_msecs);
+            if (greeting.isNull()) return false;
+            keepAlive = greeting.contains(KEEPALIVE_STRING);
+            sockHost = m.host, sockPort = m.port;
+            QMutexLocker l(&mut);
+            ++nConnects;
+        }
+        lastRefused = false;
+        if (!sockSend(*sock, keepAlive ? QString("%1 %2 %3\n").arg(SEQ_STRING).arg(id).arg(m.seq) + m.payload : m.payload, m.timeout_msecs))
+            return false;
+        const QString line = sockReadLine(*sock, m.timeout_msecs);
+        if (line.isNull()) return false;
+        if (!line.startsWith(OK_STRING)) {
+            Error() << "Notify SpikeGL failed: did not read OK from SpikeGL after sending plugin " << m.desc;
+            return false;
+        }
+        if (!keepAlive) disconnectSock(); // an older SpikeGL, which closes the connection after each notification
+        return true;
+    }
+
+    void Notifier::run()
+    {
+        int tries = 0, backoff = BackoffMinMS;
+        for (;;) {
+            Msg m;
+            {
+                QMutexLocker l(&mut);
+                while (queue.isEmpty() && !pleaseStop) cond.wait(&mut);
+                if (queue.isEmpty()) break; // asked to stop, and everything was delivered
+                m = queue.head();
+            }
+            if (deliver(m)) {
+                QMutexLocker l(&mut);
+                queue.dequeue();
+                ++nDelivered;
+                lastDeliveredTime = getTime();
+                lastLatency = lastDeliveredTime - m.tQueued;
+                tries = 0, backoff = BackoffMinMS;
+                Debug() << "SpikeGL notified of plugin " << m.desc << " " << lastLatency*1e3 << " ms after it was queued";
+                continue;
+            }
+            disconnectSock();
+            if (++tries >= MaxTries || pleaseStop) {
+                {
+                    QMutexLocker l(&mut);
+                    queue.dequeue();
+                    ++nFailed;
+                }
+                if (lastRefused) Debug() << "Notify SpikeGL: gave up on plugin " << m.desc << ", SpikeGL is not listening on " << m.host << ":" << m.port;
+                else Error() << "Notify SpikeGL: gave up on plugin " << m.desc << " after " << tries << " tries";
+                tries = 0, backoff = BackoffMinMS;
+                continue;
+            }
+            // back off before retrying.  post() wakes cond too, so wait out the whole time unless asked to stop.
+            QMutexLocker l(&mut);
+            const double tRetry = getTime() + backoff/1e3;
+            for (double left; !pleaseStop && (left = tRetry - getTime()) > 0.; )
+                cond.wait(&mut, (unsigned long)(left*1e3) + 1);
+            backoff = MIN(backoff*2, int(BackoffMaxMS));
+        }
+        disconnectSock();
+    }
+
+    Notifier::Stats Notifier::stats()
+    {
+        QMutexLocker l(&mut);
+        Stats s;
+        s.delivered = nDelivered;
+        s.failed = nFailed;
+        s.dropped = nDropped;
+        s.pending = queue.size();
+        s.connects = nConnects;
+        s.lastLatency = lastLatency;
+        return s;
+    }
+
+    void Notifier::writeStats(QTextStream & strm)
+    {
+        const Stats s (stats());
+        strm << "spikeGLNotify_delivered = " << s.delivered << "\n"
+             << "spikeGLNotify_failed = " << s.failed << "\n"
+             << "spikeGLNotify_dropped = " << s.dropped << "\n"
+             << "spikeGLNotify_pending = " << s.pending << "\n"
+             << "spikeGLNotify_connects = " << s.connects << "\n"
+             << "spikeGLNotify_lastLatency_ms = " << s.lastLatency*1e3 << "\n";
+    }
+
 	
-	FrameShare::FrameShare() 
+	/* static */ unsigned FrameShare::shmSize(unsigned nslots, unsigned slot_size)
+	{
+		const unsigned data_offset = (sizeof(FrameShareShm) + 4095) & ~4095U; // page-align the frame data
+		return data_offset + nslots*slot_size;
+	}
+
+	FrameShare::FrameShare(unsigned nslots, unsigned slot_size) 
 	{
+		if (!nslots) nslots = FRAME_SHARE_DEFAULT_SLOTS;
+		if (nslots > FRAME_SHARE_MAX_SLOTS) nslots = FRAME_SHARE_MAX_SLOTS;
+		if (!slot_size) slot_size = FRAME_SHARE_DEFAULT_SLOT_SIZE;
+		slot_size = (slot_size + 15) & ~15U;
 		qsm = new QSharedMemory(QString("%1").arg(FRAME_SHARE_SHM_MAGIC), qApp);
 		shm = 0;
 		createdByThisInstance = false;
-		if (!qsm->isAttached() && !qsm->attach() && qsm->create(FRAME_SHARE_SHM_SIZE)) {
+		if (!qsm->isAttached() && !qsm->attach() && qsm->create(shmSize(nslots, slot_size))) {
 			if (lock()) {
 				shm = (volatile FrameShareShm *)qsm->data();
-				memset((void *)shm, 0, FRAME_SHARE_SHM_SIZE);
+				memset((void *)shm, 0, shmSize(nslots, slot_size));
+				shm->version = FRAME_SHARE_SHM_VERSION;
+				shm->nslots = nslots;
+				shm->slot_size = slot_size;
+				shm->data_offset = shmSize(0, 0);
 				shm->magic = FRAME_SHARE_SHM_MAGIC;
 				unlock();
 				createdByThisInstance = true;
@@ -289,15 +500,20 @@ namespace StimGL_SpikeGL_Integration
 			Error() << "INTERNAL ERROR: 'frame share' shared memory segment cannot be attached/created due to the following reason: " << qsm->errorString();
 		else  {
 			shm = const_cast<volatile FrameShareShm *>(reinterpret_cast<FrameShareShm *>(qsm->data()));
-			if (qsm->size() != FRAME_SHARE_SHM_SIZE) {
+			if (qsm->size() < int(sizeof(FrameShareShm))) {
 				Error() << "INTERNAL ERROR: 'frame share' shared memory segment attached correctly but it has an incorrect size. Detaching.";
 				detach();
 				shm = 0;
-			} else if (shm->magic != FRAME_SHARE_SHM_MAGIC) {
-				Error() << "INTERNAL ERROR: 'frame share' shared memory segment attached correctly but it appears corrupted. Detaching.";
+			} else if (shm->magic != FRAME_SHARE_SHM_MAGIC || shm->version != FRAME_SHARE_SHM_VERSION) {
+				Error() << "INTERNAL ERROR: 'frame share' shared memory segment attached correctly but it appears corrupted or is of the wrong version. Detaching.";
 				detach();
 				shm = 0;
-			} 
+			} else if (!shm->nslots || shm->nslots > FRAME_SHARE_MAX_SLOTS || shm->data_offset < sizeof(FrameShareShm)
+					   || qsm->size() < int(shm->data_offset + shm->nslots*shm->slot_size)) {
+				Error() << "INTERNAL ERROR: 'frame share' shared memory segment attached correctly but its ring geometry is invalid. Detaching.";
+				detach();
+				shm = 0;
+			}
 		}
 	}
 	
@@ -325,6 +541,122 @@ namespace StimGL_SpikeGL_Integration
 	
 	int FrameShare::size() const { return qsm->size(); }
 
+	/// full memory barrier, for the slot seqlocks
+	static inline void fsBarrier()
+	{
+#ifdef _MSC_VER
+		_ReadWriteBarrier(); // x86/x64 only: stores aren't reordered with other stores nor loads with other loads
+#else
+		__sync_synchronize();
+#endif
+	}
+
+	/// atomically sets *p to v and returns what it was, with a full barrier
+	static inline int fsExchange(volatile int *p, int v)
+	{
+#ifdef _MSC_VER
+		return int(_InterlockedExchange(reinterpret_cast<volatile long *>(p), long(v)));
+#else
+		return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+#endif
+	}
+
+	bool FrameShare::takeBoxSelectRequest()
+	{
+		// read and clear in one go: a plain read followed by a clear would lose a request SpikeGL made in between
+		return shm && fsExchange(&shm->do_box_select, 0) != 0;
+	}
+
+	void FrameShare::publish(const void *bgra, int w, int h, unsigned frame_num, quint64 frame_abs_time_ns, float box_x, float box_y, float box_w, float box_h)
+	{
+		if (!shm || w <= 0 || h <= 0) return;
+		const unsigned num = shm->write_count + 1, slot = (num-1) % shm->nslots;
+		volatile FrameShareSlot & s (shm->ring[slot]);
+
+		// take a snapshot of what SpikeGL asked for, it may change it at any time
+		int ds = shm->ds_factor;
+		if (ds < 1) ds = 1;
+		float cx = shm->crop_x, cy = shm->crop_y, cw = shm->crop_w, ch = shm->crop_h;
+		if (cw <= 0.f || ch <= 0.f) cx = cy = 0.f, cw = ch = 1.f;
+		int x0 = int(cx*w), y0 = int(cy*h), sw = int(cw*w + 0.5f), sh = int(ch*h + 0.5f);
+		x0 = x0 < 0 ? 0 : (x0 >= w ? w-1 : x0);
+		y0 = y0 < 0 ? 0 : (y0 >= h ? h-1 : y0);
+		if (sw < 1) sw = 1;
+		if (sh < 1) sh = 1;
+		if (x0 + sw > w) sw = w - x0;
+		if (y0 + sh > h) sh = h - y0;
+		const int ow = (sw + ds - 1) / ds;
+		int oh = (sh + ds - 1) / ds;
+		const unsigned rowBytes = ow*4;
+		if (oh*rowBytes > shm->slot_size) oh = shm->slot_size / rowBytes; // frame too big for a slot, truncate it
+		
+		++s.seq; // odd: slot is being written
+		fsBarrier();
+		char *dst = const_cast<char *>(slotData(slot));
+		const quint32 *src = reinterpret_cast<const quint32 *>(bgra);
+		for (int r = 0; r < oh; ++r, dst += rowBytes) {
+			const quint32 *srow = src + (y0 + r*ds)*w + x0;
+			if (ds == 1) memcpy(dst, srow, rowBytes);
+			else {
+				quint32 *drow = reinterpret_cast<quint32 *>(dst);
+				for (int c = 0; c < ow; ++c) drow[c] = srow[c*ds];
+			}
+		}
+		s.write_num = num;
+		s.frame_num = frame_num;
+		s.frame_abs_time_ns = frame_abs_time_ns;
+		s.fmt = FRAME_SHARE_FMT_BGRA;
+		s.w = ow;
+		s.h = oh;
+		s.sz_bytes = oh*rowBytes;
+		s.box_x = box_x, s.box_y = box_y, s.box_w = box_w, s.box_h = box_h;
+		s.ds_factor = ds;
+		s.crop_x = x0/float(w), s.crop_y = y0/float(h), s.crop_w = sw/float(w), s.crop_h = sh/float(h);
+		fsBarrier();
+		++s.seq; // even: slot is complete
+		fsBarrier();
+		shm->write_count = num;
+	}
+
+	bool FrameShare::republish(unsigned frame_num, quint64 frame_abs_time_ns)
+	{
+		if (!shm || !shm->write_count) return false;
+		const unsigned prev = (shm->write_count-1) % shm->nslots, num = shm->write_count + 1, slot = (num-1) % shm->nslots;
+		if (slot == prev) return false; // single slot ring, can't copy a slot onto itself
+		volatile FrameShareSlot & s (shm->ring[slot]);
+		const volatile FrameShareSlot & p (shm->ring[prev]);
+		++s.seq;
+		fsBarrier();
+		memcpy(const_cast<char *>(slotData(slot)), const_cast<const char *>(slotData(prev)), p.sz_bytes);
+		s.fmt = p.fmt, s.w = p.w, s.h = p.h, s.sz_bytes = p.sz_bytes;
+		s.box_x = p.box_x, s.box_y = p.box_y, s.box_w = p.box_w, s.box_h = p.box_h;
+		s.ds_factor = p.ds_factor;
+		s.crop_x = p.crop_x, s.crop_y = p.crop_y, s.crop_w = p.crop_w, s.crop_h = p.crop_h;
+		s.write_num = num;
+		s.frame_num = frame_num;
+		s.frame_abs_time_ns = frame_abs_time_ns;
+		fsBarrier();
+		++s.seq;
+		fsBarrier();
+		shm->write_count = num;
+		return true;
+	}
+
+	bool FrameShare::readFrame(unsigned write_num, FrameShareSlot & hdr, QByteArray & data) const
+	{
+		if (!shm || !write_num) return false;
+		const volatile FrameShareSlot & s (shm->ring[(write_num-1) % shm->nslots]);
+		const unsigned seq = s.seq;
+		if (seq & 0x1) return false; // being written right now
+		fsBarrier();
+		memcpy(&hdr, const_cast<const FrameShareSlot *>(&s), sizeof(hdr));
+		if (hdr.write_num != write_num || hdr.sz_bytes < 0 || unsigned(hdr.sz_bytes) > shm->slot_size) return false;
+		data.resize(hdr.sz_bytes);
+		memcpy(data.data(), const_cast<const char *>(slotData((write_num-1) % shm->nslots)), hdr.sz_bytes);
+		fsBarrier();
+		return s.seq == seq;
+	}
+
 	bool FrameShare::warnUserAlreadyRunning() const
 	{
 		QMessageBox::StandardButton but = QMessageBox::critical
@@ -5,7 +5,13 @@
 #include <QVariant>
 #include <QTcpServer>
 #include <QObject>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QQueue>
 class QSharedMemory;
+class QTcpSocket;
+class QTextStream;
 
 namespace StimGL_SpikeGL_Integration 
 {
@@ -45,8 +51,83 @@ namespace StimGL_SpikeGL_Integration
 							 int timeout_msecs = SPIKE_GL_NOTIFY_DEFAULT_TIMEOUT_MSECS);
 	
 
+    /** Delivers plugin start/end/params notifications to SpikeGL from a
+        background thread, so that the plugin start/stop path (which is also
+        the loop restart path in GLWindow::paintGL) never waits on the network.
+
+        post() serializes the notification right away and queues it.  The
+        thread keeps one connection open to SpikeGL if the NotifyServer on the
+        other end supports it (it says KEEPALIVE in its greeting), and
+        otherwise connects once per notification like Notify_PluginStart()
+        and friends.  Failed deliveries are retried with exponential backoff
+        before being dropped.  Delivery times are measured from post().
+
+        If the OK for a notification is lost (the connection drops after
+        SpikeGL got the message), the retry sends it again.  So on KEEPALIVE
+        connections each notification is preceded by a SEQ line with this
+        Notifier's id and the notification's sequence number, and NotifyServer
+        acknowledges repeats without emitting them a second time.  Servers
+        without KEEPALIVE get no SEQ line and may see a repeat. */
+    class Notifier : public QThread
+    {
+    public:
+        enum Type { Start, End, Params };
+        enum { MaxQueued = 256, MaxTries = 4, BackoffMinMS = 100, BackoffMaxMS = 2000 };
+
+        Notifier(QObject *parent = 0);
+        ~Notifier(); ///< delivers whatever is still queued (waiting up to the timeout for each), then stops
+
+        /// Queues a notification and returns immediately.  Safe to call from any thread.
+        void post(Type t, const QString & pluginName, const QMap<QString, QVariant> & pluginParams,
+                  const QString & host = "127.0.0.1", unsigned short port = SPIKE_GL_NOTIFY_DEFAULT_PORT,
+                  int timeout_msecs = SPIKE_GL_NOTIFY_DEFAULT_TIMEOUT_MSECS);
+
+        struct Stats {
+            unsigned delivered, failed, dropped, pending, connects;
+            double lastLatency; ///< seconds from post() to the OK, for the last delivered notification
+        };
+        Stats stats();
+        /// Writes delivery counts and the last delivery latency, as key = value lines, for the GETSTATS command
+        void writeStats(QTextStream & strm);
+
+    protected:
+        void run();
+
+    private:
+        struct Msg {
+            QString payload; ///< the serialized notification
+            QString desc; ///< for log messages
+            QString host;
+            unsigned short port;
+            int timeout_msecs;
+            double tQueued;
+            unsigned seq;
+        };
+
+        bool deliver(const Msg & m); ///< one try at sending m, connecting first if need be
+        void disconnectSock();
+
+        QMutex mut;
+        QWaitCondition cond;
+        QQueue<Msg> queue;
+        volatile bool pleaseStop;
+        const QString id; ///< sent with the sequence numbers, unique to this Notifier
+        unsigned nextSeq; ///< guarded by mut
+
+        QTcpSocket *sock; ///< only touched by the thread
+        QString sockHost;
+        unsigned short sockPort;
+        bool keepAlive;
+
+        bool lastRefused; ///< iff true the last connection attempt was refused, which just means SpikeGL isn't running
+
+        unsigned nDelivered, nFailed, nDropped, nConnects; ///< guarded by mut
+        double lastLatency, lastDeliveredTime; ///< guarded by mut
+    };
+
     /** Object to  used inside SpikeGL to receive plugin start events
-        from StimGL via the network. */
+        from StimGL via the network.  Accepts any number of notifications
+        per connection, so a Notifier can keep its connection open. */
     class NotifyServer : public QObject
     {
         Q_OBJECT
@@ -71,39 +152,80 @@ namespace StimGL_SpikeGL_Integration
     private slots:
         void gotNewConnection();
         void emitGotPluginNotification(bool isStart, bool isEnd, const QString &, const QMap<QString, QVariant>  &);
-        void processConnection(QTcpSocket & sock);
+        void connReadyRead();
+        void connDisconnected();
 
     private:
+        /// Parse state of a client connection, which is fed one line at a time
+        struct Conn {
+            enum State { WantCommand, WantParams, InParams } state;
+            bool isStart, isEnd;
+            QString pluginName;
+            QMap<QString, QVariant> params;
+            QString seqFrom; ///< the sending Notifier's id from the SEQ line, if any
+            unsigned seq;
+            Conn() : state(WantCommand), isStart(false), isEnd(false), seq(0) {}
+        };
+        void processLine(QTcpSocket *sock, Conn & c, const QString & line);
+
         QTcpServer srv;
         int timeout_msecs;
+        QMap<QTcpSocket *, Conn> conns;
+        QMap<QString, unsigned> lastSeq; ///< per Notifier id, the last sequence number emitted
     };
 	
-#define FRAME_SHARE_SHM_MAGIC 0xf33d53c6
+/** The 'frame share' shm is a ring of nslots frame slots, so that StimGL can
+    publish a frame without ever waiting on SpikeGL, and SpikeGL can read the
+    newest frame (or every frame) without tearing and without taking the 
+    QSharedMemory lock.  Each slot has a seqlock counter, see FrameShareSlot.
+    The shm key is the magic number, so programs built against an older layout
+    won't attach to this one. */
+#define FRAME_SHARE_SHM_MAGIC 0xf33d53c7
+#define FRAME_SHARE_SHM_VERSION 2
+#define FRAME_SHARE_MAX_SLOTS 16
+#define FRAME_SHARE_FMT_BGRA 0x80E1 ///< == GL_BGRA, the only format StimGL currently publishes
 #ifdef Q_OS_DARWIN
-#define FRAME_SHARE_SHM_SIZE (4*1024*1024)	///< size limits in OSX Darwin kernel for max shm size..
+#define FRAME_SHARE_DEFAULT_SLOTS 2
+#define FRAME_SHARE_DEFAULT_SLOT_SIZE (2*1024*1024-4096) ///< size limits in OSX Darwin kernel for max shm size (4MB for the whole segment)..
 #else
-#define FRAME_SHARE_SHM_SIZE (8*1024*1024)	///< on other OS's, use 8MB for the shm, which should be enough..
+#define FRAME_SHARE_DEFAULT_SLOTS 4
+#define FRAME_SHARE_DEFAULT_SLOT_SIZE (8*1024*1024)	///< on other OS's, use 8MB per slot, which should be enough..
 #endif
-#define FRAME_SHARE_SHM_DATA_SIZE (FRAME_SHARE_SHM_SIZE-reinterpret_cast<unsigned long>(&reinterpret_cast<StimGL_SpikeGL_Integration::FrameShareShm *>(0)->data))
+
+	/// Header of one slot of the frame share ring.  seq is a seqlock: StimGL makes it odd before writing the slot and even again once the slot is complete.  A reader that sees the same even seq before and after copying out the slot got an untorn frame.
+	extern "C" struct FrameShareSlot {
+		unsigned seq; ///< seqlock counter, written by StimGL
+		unsigned write_num; ///< which frame this is, in terms of FrameShareShm::write_count
+		unsigned frame_num; ///< the frame count.. written-to by StimGL
+		int fmt, w, h, sz_bytes; ///< the format and other info on the frame data, after any downsample/crop was applied
+		quint64 frame_abs_time_ns; ///< StimGL writes to this to give SpikeGL an indication of the age/time of the frame...
+		float box_x, box_y, box_w, box_h; ///< the exact area of the overlay box relative to the overall StimGL window, coordinate range of values is always 0->1
+		int ds_factor; ///< the downsample factor that was applied to this frame
+		float crop_x, crop_y, crop_w, crop_h; ///< the crop that was applied to this frame, relative to the shared area
+		int reserved[5];
+	};
+
 	extern "C" struct FrameShareShm {
 		unsigned magic; ///< set by whichever program creates the Shm first for sanity checking..
-		int enabled; ///< set to true by SpikeGL when it "wants" frames from StimGL.. if true StimGL will write frames into data and set w,h,fmt,sz_bytes appropriately...
-		unsigned frame_num; ///< the frame count.. written-to by StimGL
-		int fmt, w, h, sz_bytes; ///< the format and other info on the frame data, written by StimGL
-		int do_box_select; ///< SpikeGL writes to this to tell StimGL to do the box selection stuff
+		unsigned version; ///< FRAME_SHARE_SHM_VERSION, set by whichever program creates the Shm, along with the ring geometry below
+		unsigned nslots, slot_size, data_offset; ///< ring geometry: the data for slot i lives at ((char *)shm) + data_offset + i*slot_size
+		int enabled; ///< set to true by SpikeGL when it "wants" frames from StimGL.. if true StimGL will publish frames into the ring
+		unsigned write_count; ///< number of frames StimGL has published so far.  The newest one is in slot (write_count-1) % nslots
+		int do_box_select; ///< SpikeGL writes nonzero to this to tell StimGL to do the box selection stuff.  StimGL takes the request with an atomic exchange, see FrameShare::takeBoxSelectRequest()
 		unsigned stimgl_pid; ///< StimGL writes to this to tell SpikeGL its PID.  If 0, StimGL definitely isn't running
 		unsigned spikegl_pid; ///< SpikeGL writes to this to tell StimGL its PID.  If 0, SpikeGL definitely isn't running
-		float box_x, box_y, box_w, box_h; ///< StimGL writes to this to tell SpikeGL the exact area of the overlay box relative to the overall StimGL window, coordinate range of values is always 0->1
 		int dump_full_window; ///< SpikeGL writes to this to tell StimGL to not use the overlay box area and instead dump entire StimGL window, if true
-		quint64 frame_abs_time_ns; ///< StimGL writes to this to give SpikeGL an indication of the age/time of the frame...
-		int frame_rate_limit; ///< SpikeGL writes to this to tell StimGL at what approx. rate to write frames into the buffer.  Defaults to 10. 0 means don't use a frame rate limit.
-		int reserved[14]; ///< reserved for future implementations and to align the data a bit..
-		char data[1]; ///< the frame data, written-to by StimGL.. real size is obviously bigger than 1!
+		int frame_rate_limit; ///< SpikeGL writes to this to tell StimGL at what approx. rate to publish frames.  0 means don't use a frame rate limit, which is fine now that StimGL never waits on a reader.
+		int ds_factor; ///< SpikeGL writes to this to ask for only every ds_factor'th pixel and row. <= 1 means full resolution
+		float crop_x, crop_y, crop_w, crop_h; ///< SpikeGL writes to this to ask for a sub-area of the shared area, relative 0->1.  crop_w or crop_h <= 0 means no cropping
+		int reserved[16]; ///< reserved for future implementations
+		FrameShareSlot ring[FRAME_SHARE_MAX_SLOTS]; ///< the per-slot headers, the first nslots are used (not named slots, which is a Qt keyword)
 	};
 	
 	class FrameShare {
 	public:
-		FrameShare();
+		/// Attaches to the frame share shm, creating it with nslots slots of slot_size bytes if it doesn't exist yet (0 means the default). If SpikeGL created it, its geometry is used.
+		FrameShare(unsigned nslots = 0, unsigned slot_size = 0);
 		~FrameShare();
 		
 		volatile FrameShareShm *shm;
@@ -116,8 +238,23 @@ namespace StimGL_SpikeGL_Integration
 		bool unlock();
 		
 		bool warnUserAlreadyRunning() const; ///< returns true if the user accepted the situation and hit Yes, or false if they hit No
+
+		/// StimGL side: publishes a w x h BGRA frame into the next ring slot, applying the downsample/crop SpikeGL asked for. Never blocks.  box is the shared area, relative to the window.
+		void publish(const void *bgra, int w, int h, unsigned frame_num, quint64 frame_abs_time_ns, float box_x, float box_y, float box_w, float box_h);
+		/// StimGL side: publishes the newest frame again, with a new frame number and time (eg: for an Nblinks repeat of it)
+		bool republish(unsigned frame_num, quint64 frame_abs_time_ns);
+		/// StimGL side: true if SpikeGL asked for a box selection since the last call.  Clears the request atomically, without the shm lock, so it never blocks and never loses a request.
+		bool takeBoxSelectRequest();
+
+		/// SpikeGL side: number of the newest published frame, 0 if none yet
+		unsigned newestFrame() const { return shm ? shm->write_count : 0; }
+		/// SpikeGL side: copies out frame # write_num (1..newestFrame()).  Returns false if it was already overwritten (reader fell more than nslots frames behind) or was being rewritten while copying -- in the latter case try again with newestFrame().
+		bool readFrame(unsigned write_num, FrameShareSlot & hdr_out, QByteArray & data_out) const;
+
+		static unsigned shmSize(unsigned nslots, unsigned slot_size); ///< the segment size needed for a given ring geometry
 	private:
 		QSharedMemory *qsm;
+		volatile char *slotData(unsigned slot) const { return reinterpret_cast<volatile char *>(shm) + shm->data_offset + slot*shm->slot_size; }
 	};
 	
 } // end namespace StimGL_SpikeGL_Integration
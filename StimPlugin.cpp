@@ -5,6 +5,7 @@
 #include <QDir>
 #include <QGLContext>
 #include <QTimer>
+#include <QThread>
 #include "StimGL_SpikeGL_Integration.h"
 #include <iostream>
 #include <math.h>
@@ -18,6 +19,9 @@ softCleanup(false), dontCloseFVarFileAcrossLoops(false), gotNewParams(false), pl
 {
 	bgImg_tex = bgImg_h = bgImg_w = 0;
 	frameVars = 0;
+	doWithVsyncChan = -1;
+	hwTimedOutput = false;
+	hwScheduleFrom = -1;
     needNotifyStart = true;
     initted = false;
     frameNum = 0x7fffffff;
@@ -61,11 +65,14 @@ bool StimPlugin::saveData(bool use_gui)
 
 void StimPlugin::stop(bool doSave, bool useGui, bool softStop)
 {
+	GLWindow::RenderLock rl(parent);
 	// Next, write to DO that we stopped...
 	QString devChan;
 	if (!softStop && getParam("DO_with_vsync", devChan) && devChan != "off" && devChan.length()) {
 		DAQ::WriteDO(devChan, false);
 	}
+	if (hwTimedOutput) DAQ::StopScheduledOutput(), hwTimedOutput = false; // restarted from frame 0 next loop
+	hwScheduleFrom = -1;
 	
 	// clear the pending param history as we are *done*
 	if (!softStop) { 
@@ -78,6 +85,14 @@ void StimPlugin::stop(bool doSave, bool useGui, bool softStop)
 		}
 		needToSaveParamHistory = false;
 	}
+	// the files are written from a copy, without holding mut or blocking the timeline
+	if (!softStop && stimApp()->isSaveFrameTiming() && parent->frameTimeline().frameCount()) {
+		FrameTimeline::Snapshot ft;
+		parent->frameTimeline().snapshot(ft);
+		const QString prefix = stimApp()->outputDirectory() + "/" + name() + "_FrameTiming";
+		FrameTimeline::saveChromeTrace(ft, Util::makeUniqueFileName(prefix, "json"));
+		FrameTimeline::saveBinary(ft, Util::makeUniqueFileName(prefix, "bin"));
+	}
 	
 	softCleanup = softStop;
     endtime = QDateTime::currentDateTime();
@@ -140,6 +155,7 @@ void StimPlugin::initAODOOnlyFromParams(const ChangedParamMap *aodoonly)
 			for (int i = 0; i < lines.size(); ++i) {
 				PendingDAQWrite p;
 				p.devChanString = lines[i];
+				p.chan = DAQ::ResolveDO(p.devChanString);
 				p.volts = states[i];
 				pendingDOWrites.push_back(p);
 			}
@@ -159,6 +175,7 @@ void StimPlugin::initAODOOnlyFromParams(const ChangedParamMap *aodoonly)
 			for (int i = 0; i < lines.size(); ++i) {
 				PendingDAQWrite p;
 				p.devChanString = lines[i];
+				p.chan = DAQ::ResolveAO(p.devChanString);
 				p.volts = states[i];
 				pendingAOWrites.push_back(p);
 			}
@@ -289,6 +306,9 @@ bool StimPlugin::initFromParams()
 	
 	if ( !getParam( "Nblinks", Nblinks) || !getParam("nblinks", Nblinks) ) Nblinks = 1;
 	if ( Nblinks < 1 ) Nblinks = 1;	
+
+	QString doVsync;
+	doWithVsyncChan = getParam("DO_with_vsync", doVsync) ? DAQ::ResolveDO(doVsync) : -1;
 	
 	QImage bgImg;
 	QString bgimg = "";
@@ -345,6 +365,7 @@ bool StimPlugin::initFromParams()
 
 bool StimPlugin::start(bool startUnpaused)
 {
+    GLWindow::RenderLock rl(parent);
     initted = false;
 	
     parent->pluginStarted(this);
@@ -356,6 +377,8 @@ bool StimPlugin::start(bool startUnpaused)
 		frameVars = new FrameVariables(FrameVariables::makeFileName(stimApp()->outputDirectory() + "/" + name()));
 	
     parent->makeCurrent();
+	
+	if (!softCleanup) parent->frameTimeline().reset(); // loops accumulate into the same timeline
 
     // start out with identity matrix
     glMatrixMode(GL_MODELVIEW);
@@ -398,7 +421,7 @@ bool StimPlugin::start(bool startUnpaused)
 	}
     if (!missedFrames.capacity()) missedFrames.reserve(4096);
     if (!missedFrameTimes.capacity()) missedFrameTimes.reserve(4096);	
-    customStatusBarString = "";
+    setSBString("");
 	softCleanup = false;
 	gotNewParams = false;
 	
@@ -430,6 +453,8 @@ bool StimPlugin::start(bool startUnpaused)
         return false; 
     }
 	
+	startHWTimedOutput();
+
 	if (initDelay()) {
 		needNotifyStart = false; // suppress temporarily until initDone() runs
 		QTimer::singleShot(initDelay(), this, SLOT(initDone()));
@@ -442,6 +467,37 @@ bool StimPlugin::start(bool startUnpaused)
 	return true;
 }
 
+void StimPlugin::startHWTimedOutput()
+{
+	const bool wasOn = hwTimedOutput;
+	hwTimedOutput = false;
+	hwScheduleFrom = -1;
+	int want = 0;
+	DAQ::FrameSchedule s;
+	if (!getParam("hw_timed_output", want) || !want) {
+		if (wasOn) DAQ::StopScheduledOutput();
+		return;
+	}
+	if (!outputSchedule(s)) {
+		if (wasOn) DAQ::StopScheduledOutput();
+		else Warning() << name() << " has no DO/AO output schedule, hw_timed_output ignored.";
+		return;
+	}
+	QString clk;
+	if (!getParam("daq_sample_clock", clk) || !clk.length()) clk = "/Dev1/PFI0";
+	s.frameRate = stimApp()->refreshRate();
+	s.repeat = Nblinks > 1 ? Nblinks : 1; // blink repeats are clock edges too
+	// NB: nothing is output until hwTimedOutputFrame() for the first frame, so the init delay and the delay frames don't advance it
+	if (!(hwTimedOutput = DAQ::SetupScheduledOutput(s, clk)))
+		Warning() << "Could not start hardware-timed DAQ output, falling back to per-frame software writes.";
+}
+
+void StimPlugin::hwTimedOutputFrame(unsigned f)
+{
+	if (hwScheduleFrom >= 0 && f >= unsigned(hwScheduleFrom)) startHWTimedOutput();
+	if (hwTimedOutput) DAQ::RunScheduledOutput(f);
+}
+
 void StimPlugin::initDone()
 {
 	initted = true;
@@ -788,13 +844,17 @@ QList<QByteArray> StimPlugin::getFrameDump(unsigned num, unsigned numframes,
 										   GLenum datatype)
 {
 	QList<QByteArray> ret;
+    GLWindow::RenderLock rl(parent);
 	
     if (parent->runningPlugin() != this) {
         Warning() << name() << " wasn't the currently-running plugin, stopping current and restarting with `" << name() << "' this may not work 100% for some plugins!";        
         parent->runningPlugin()->stop();
         start(false);
-    } else if (num < frameNum) {
-        Warning() << "Got non-increasing read of frame # " << num << ", restarting plugin and fast-forwarding to frame # " << num << " (this is slower than a sequential read).  This may not work 100% for some plugins (in particular CheckerFlicker!!)";
+    } else if (num < frameNum || parent->renderAheadCount()) {
+        if (num < frameNum)
+            Warning() << "Got non-increasing read of frame # " << num << ", restarting plugin and fast-forwarding to frame # " << num << " (this is slower than a sequential read).  This may not work 100% for some plugins (in particular CheckerFlicker!!)";
+        else
+            Warning() << "Plugin state is " << parent->renderAheadCount() << " prerendered frames ahead (renderAhead), restarting plugin and fast-forwarding to frame # " << num;
 		QMutexLocker l(&mut);
 		QStack<ParamHistoryEntry> originalHistory(rebuildOriginalParamHistory());
         stop();
@@ -820,6 +880,8 @@ QList<QByteArray> StimPlugin::getFrameDump(unsigned num, unsigned numframes,
 	if (cs.h <= 0) cs.h = h;
 	if (cs.w + o.x > w) cs.w = w-o.x;
 	if (cs.h + o.y > h) cs.h = h-o.y;
+	const bool cropped = o.x || o.y || cs.w != w || cs.h != h;
+	if (cropped) setFrameDumpCrop(o, cs);
 	
 	unsigned long datasize = cs.w*cs.h*3, datasize_scaled = floor(cs.w*scale.x)*floor(cs.h*scale.y)*3.; // R, G, B broken out per pix.
 	const unsigned long typeSize = dataTypeToSize(datatype);
@@ -843,6 +905,7 @@ QList<QByteArray> StimPlugin::getFrameDump(unsigned num, unsigned numframes,
 					tmpScaled.fill(bgcolor*255.,datasize_scaled);
 			} catch (const std::bad_alloc & e) {
 				Error() << "Bad_alloc caught when attempting to allocate " << datasize << " of data for the frames buffer (" << e.what() << ")";
+				if (cropped) setFrameDumpCrop(o, Vec2iZero);
 				return ret;
 			}				
 			
@@ -867,6 +930,7 @@ QList<QByteArray> StimPlugin::getFrameDump(unsigned num, unsigned numframes,
         afterVSync(true);
 		doRealtimeParamUpdateHousekeeping();
     } while (frameNum < num+numframes && parent->runningPlugin() == this);
+	if (cropped) setFrameDumpCrop(o, Vec2iZero);
     //glClear(GL_COLOR_BUFFER_BIT);
 	clearScreen();
     return ret;
@@ -876,11 +940,11 @@ void StimPlugin::notifySpikeGLAboutStart()
 {
     StimApp::SpikeGLNotifyParams & p(stimApp()->spikeGLNotifyParams);
     
-    StimGL_SpikeGL_Integration::Notify_PluginStart(name(), getParams(),
-                                                    0,
-                                                    p.hostname,
-                                                    p.port,
-                                                    p.timeout_ms);
+    if (stimApp()->spikeGLNotifier())
+        stimApp()->spikeGLNotifier()->post(StimGL_SpikeGL_Integration::Notifier::Start, name(), getParams(),
+                                           p.hostname,
+                                           p.port,
+                                           p.timeout_ms);
     needNotifyStart = false;
 }
 
@@ -888,11 +952,11 @@ void StimPlugin::notifySpikeGLAboutStop()
 {
         StimApp::SpikeGLNotifyParams & p(stimApp()->spikeGLNotifyParams);
 
-        StimGL_SpikeGL_Integration::Notify_PluginEnd(name(), getParams(),
-                                                        0,
-                                                        p.hostname,
-                                                        p.port,
-                                                        p.timeout_ms);
+        if (stimApp()->spikeGLNotifier())
+            stimApp()->spikeGLNotifier()->post(StimGL_SpikeGL_Integration::Notifier::End, name(), getParams(),
+                                               p.hostname,
+                                               p.port,
+                                               p.timeout_ms);
         needNotifyStart = true;
 }
 
@@ -900,11 +964,11 @@ void StimPlugin::notifySpikeGLAboutParams()
 {
 	StimApp::SpikeGLNotifyParams & p(stimApp()->spikeGLNotifyParams);
 	
-	StimGL_SpikeGL_Integration::Notify_PluginParams(name(), getParams(),
-													 0,
-													 p.hostname,
-													 p.port,
-													 p.timeout_ms);
+	if (stimApp()->spikeGLNotifier())
+		stimApp()->spikeGLNotifier()->post(StimGL_SpikeGL_Integration::Notifier::Params, name(), getParams(),
+										   p.hostname,
+										   p.port,
+										   p.timeout_ms);
 	needNotifyStart = false;
 }
 
@@ -1038,6 +1102,15 @@ template <> bool StimPlugin::getParam<long>(const QString & name, long & out) co
 }
 
 void StimPlugin::waitForInitialization() const {
+	if (QThread::currentThread() != stimApp()->thread()) {
+		// render thread: initDone() runs in the GUI thread, so poll rather than wait on our own (empty) event queue
+		while (!initted) {
+			QCoreApplication::processEvents();
+			parent->renderThreadCheckPark();
+			QThread::msleep(1);
+		}
+		return;
+	}
 	while (!initted) {
 		stimApp()->processEvents(QEventLoop::WaitForMoreEvents|QEventLoop::ExcludeUserInputEvents|QEventLoop::ExcludeSocketNotifiers);
 	}
@@ -1046,6 +1119,8 @@ void StimPlugin::waitForInitialization() const {
 /* virtual */
 bool StimPlugin::applyNewParamsAtRuntime() { return true; }
 
+void StimPlugin::setFrameDumpCrop(const Vec2i & cropOrigin, const Vec2i & cropSize) { (void)cropOrigin; (void)cropSize; }
+
 bool StimPlugin::applyNewParamsAtRuntime_Base() 
 {
 	return initFromParams();
@@ -1501,6 +1576,9 @@ void StimPlugin::doRealtimeParamUpdateHousekeeping()
 				mut.unlock();
 			} else
 				newParamsAccepted();
+			int hw = 0;
+			if (hwTimedOutput || (getParam("hw_timed_output", hw) && hw))
+				hwScheduleFrom = int(frameNum); // the schedule may have changed, redo it when this frame is shown
 		}
 		gotNewParams = false;
 	}
@@ -28,6 +28,8 @@
 #include <QQueue>
 #include "FrameVariables.h"
 
+namespace DAQ { struct FrameSchedule; }
+
 enum FPS_Mode {
 	FPS_Single = 0, FPS_Dual, FPS_Triple, FPS_Quad = FPS_Triple,
 	FPS_N_Mode
@@ -113,8 +115,10 @@ public:
     unsigned getNextFrameNum() const { return frameNum; }
     /// Returns the frame number of the last frame that was rendered (or -1 if no frame has ever been rendered)
     int getFrameNum() const { return static_cast<int>(frameNum)-1; }
-    /// Returns the status bar string that this plugin would like the UI to display
-    const QString & getSBString() const { return customStatusBarString; }
+    /// Returns the status bar string that this plugin would like the UI to display.  Thread-safe.
+    QString getSBString() const { QMutexLocker l(&sbMut); return customStatusBarString; }
+    /// Sets the status bar string.  Use this rather than writing customStatusBarString directly, as frames may be drawn from the render thread while the GUI thread reads it.
+    void setSBString(const QString & s) { QMutexLocker l(&sbMut); customStatusBarString = s; }
     /// Returns the number of missed frames that the plugin has encountered thus far
     unsigned getNumMissedFrames() const { return unsigned(missedFrames.size()); }
 
@@ -268,6 +272,9 @@ protected:
     /// at this point before the next frame is to be drawn.
     /// If isSimulated = true this means we are in getFrameNum() call
     /// and not actually drawing to screen. 
+    /// With renderAhead=K (see canRenderAhead()) this instead runs once per
+    /// prerendered frame, right after it is drawn, which may be up to K frames
+    /// before that frame's real vsync.
     virtual void afterVSync(bool isSimulated = false);
 	
 	/// \brief Called immediately after the frametrack box is drawn
@@ -284,6 +291,36 @@ protected:
 	/// Return the delay you wish for your plugin, in milliseconds.  Default implementation returns 0.
 	virtual unsigned initDelay(void);
 
+	/// \brief Return true if drawFrame() may be called ahead of the frame actually being displayed.
+	///
+	/// With the global renderAhead=K param GLWindow prerenders up to K frames into offscreen FBOs, so drawFrame(),
+	/// afterVSync() and the param housekeeping run for frame frameNum+k before frame frameNum hits the screen.
+	/// afterVSync() is then called once per prerendered frame, right after it is drawn (with frameNum already
+	/// advanced to the frame after it), and not once per actual vsync -- so it must only prepare the next frame,
+	/// not track what is on screen.
+	/// Only return true if your drawFrame() does no direct DAQ I/O and never stops the plugin.  Default returns false.
+	virtual bool canRenderAhead() const { return false; }
+
+	/// \brief Save/restore the state drawFrame() advances from frame to frame, for renderAhead.
+	///
+	/// GLWindow saves it before prerendering each frame.  When a realtime param update arrives while frames are
+	/// prerendered, it restores the state of the next frame to be shown, applies the update there and prerenders the
+	/// rest again.  If saveRenderAheadState() returns false (the default) the update instead takes effect after the
+	/// frames already prerendered, and renderAhead is turned off for the rest of the run.
+	virtual bool saveRenderAheadState(QByteArray & s) const { (void)s; return false; }
+	virtual void restoreRenderAheadState(const QByteArray & s) { (void)s; }
+
+	/// Reimplement this to declare the per-frame DO/AO values for one loop cycle up front, if your plugin has any.
+	///
+	/// With the hw_timed_output=1 param they are played by a sample-clocked DAQ task, clocked by the frame signal
+	/// (daq_sample_clock param), and hwTimedOutput is set, in which case skip your own per-frame writes to those
+	/// channels.  Frame f outputs values[f % nFrames], like a software write from drawFrame() for frame f would.
+	/// Fill in nFrames and the chans, return true.  Default returns false (no schedule).
+	/// It's asked again after realtime param changes, and the task is redone if the schedule changed.
+	virtual bool outputSchedule(DAQ::FrameSchedule & s) const { (void)s; return false; }
+	bool hwTimedOutput; ///< true while the outputSchedule() is being played by the DAQ hardware
+	int hwScheduleFrom; ///< if >= 0, new params took effect at this frame, so outputSchedule() is redone when it's shown
+
     GLWindow *parent;
 
     volatile bool initted;
@@ -311,10 +348,14 @@ protected:
 
 	struct PendingDAQWrite {
 		QString devChanString;
+		int chan; ///< DAQ::ChanId of devChanString, resolved when the write is queued
 		double volts;
 	};
 	
 	QVector<PendingDAQWrite> pendingDOWrites, pendingAOWrites;
+	int doWithVsyncChan; ///< DAQ::ChanId of the DO_with_vsync line, or -1 if it's off.  Resolved in initFromParams().
+	void startHWTimedOutput(); ///< sets up the outputSchedule() task, from start() after init() and after param changes
+	void hwTimedOutputFrame(unsigned frameNum); ///< called by GLWindow right before frame frameNum is swapped in, starts the task clocking at that frame
 	
 public:
 	enum FTState {
@@ -383,12 +424,13 @@ protected:
     /// ran0() function specified in Numerical Recipes.
         ran0Gen;
 
-    /// \brief Write to this variable to optionally inform the application that you want a custom message printed to the status bar.
+    /// \brief Set this via setSBString() to optionally inform the application that you want a custom message printed to the status bar.
     ///
     /// Update this periodically to have the ConsoleWindow status bar include additional
     /// plugin-specific information -- may or may not appear right away
     /// typically the status bar is refreshed every 250ms by StimApp.cpp
     QString customStatusBarString;
+    mutable QMutex sbMut; ///< guards customStatusBarString
 
     /// the output stream you should use in your "save()" method reimplementation -- already opened for you if your save() method is being called
     QTextStream outStream;
@@ -419,6 +461,11 @@ protected:
 	/// So far only CheckerFlicker reimplements this to add locking here..
 	virtual bool applyNewParamsAtRuntime_Base();
 
+	/// Called by getFrameDump() with the window area it is about to read back (if that's less than the whole
+	/// window), and again with a 0 cropSize when it's done.  Plugins that can skip work outside of that area
+	/// may reimplement this.  Default implementation does nothing.
+	virtual void setFrameDumpCrop(const Vec2i & cropOrigin, const Vec2i & cropSize);
+
 	/// The stim params, as they came in from either config file or matlab.  getParam() references these.
 	StimParams params, previous_params, previous_previous_params;
 	
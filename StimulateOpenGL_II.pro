@@ -8,6 +8,8 @@ DEPENDPATH += .
 INCLUDEPATH += . SFMT
 
 CONFIG += qt thread warn_on
+# DEFINES += NO_DEBUG_LOG # uncomment to compile out all Debug() output
+# DEFINES += STIMGL_BENCH_ALLOCS # uncomment to count operator new calls in --benchmark reports (replaces the global operator new/delete)
 QT += core network gui opengl
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -19,7 +21,8 @@ HEADERS +=  Version.h StimApp.h Util.h RNG.h ConsoleWindow.h GLHeaders.h \
             FrameVariables.h Flicker.h Flicker_RGBW.h Sawtooth.h DAQ.h \
             TypeDefs.h Shapes.h MovingObjects.h Movie.h GifReader.h \
             FastMovieFormat.h FastMovieReader.h GLBoxSelector.h \
-    DummyPlugin.h
+    DummyPlugin.h FrameTimeline.h Benchmark.h AsyncLog.h LockFreeQueue.h \
+    FastMovieThreads.h FrameScaler.h FramePool.h SelfTest.h
 SOURCES +=  main.cpp StimApp.cpp Util.cpp RNG.cpp ConsoleWindow.cpp \
             GLWindow.cpp osdep.cpp ConnectionThread.cpp \
             StimPlugin.cpp CalibPlugin.cpp MovingObjects_Old.cpp \
@@ -28,7 +31,8 @@ SOURCES +=  main.cpp StimApp.cpp Util.cpp RNG.cpp ConsoleWindow.cpp \
             Flicker.cpp Flicker_RGBW.cpp Sawtooth.cpp DAQ.cpp Shapes.cpp \
             MovingObjects.cpp Movie.cpp GifReader.cpp FastMovieFormat.cpp \
             FastMovieReader.cpp GLBoxSelector.cpp \
-    DummyPlugin.cpp
+    DummyPlugin.cpp FrameTimeline.cpp Benchmark.cpp AsyncLog.cpp FrameScaler.cpp FramePool.cpp \
+    SelfTest.cpp
 
 FORMS += SpikeGLIntegration.ui ParamDefaultsWindow.ui \
     HotspotConfig.ui \
@@ -43,6 +47,14 @@ unix {
         QMAKE_CXXFLAGS_RELEASE += -msse2 -march=pentium4 -O3
         QMAKE_CFLAGS_WARN_ON += -Wno-unused-private-field -Wno-deprecated-declarations -Wno-unused-function
         QMAKE_CXXFLAGS_WARN_ON += -Wno-unused-private-field -Wno-deprecated-declarations -Wno-unused-function
+
+        # `make bench' runs the canned --benchmark suite, see Benchmarks/run_benchmarks.sh
+        bench.commands = $${PWD}/Benchmarks/run_benchmarks.sh ./$(TARGET)
+        bench.depends = $(TARGET)
+        # `make check' runs the --selftest suite, under xvfb-run if there is no display
+        check.commands = if [ -z \"$$DISPLAY\" ]; then xvfb-run -a ./$(TARGET) --selftest; else ./$(TARGET) --selftest; fi
+        check.depends = $(TARGET)
+        QMAKE_EXTRA_TARGETS += bench check
 }
 macx {
         LIBS += -framework CoreServices
@@ -62,7 +74,7 @@ win32 {
         QMAKE_CFLAGS_RELEASE += -D_WIN32_WINNT=0x0400
         QMAKE_CXXFLAGS_DEBUG += -D_WIN32_WINNT=0x0400
         QMAKE_CXXFLAGS_RELEASE += -D_WIN32_WINNT=0x0400
-        LIBS += $${PWD}/NI/NIDAQmx.lib WS2_32.lib DelayImp.lib
+        LIBS += $${PWD}/NI/NIDAQmx.lib WS2_32.lib DelayImp.lib Psapi.lib
         DEFINES += HAVE_NIDAQmx WIN32
         RC_FILE += WinResources.rc
         QMAKE_CFLAGS_RELEASE -= /O2 /O1 -O1 -O2
@@ -7,6 +7,7 @@
 #include <QMutex>
 #include <QTextEdit>
 #include <QTime>
+#include <QDateTime>
 #include <QThread>
 #include <QFile>
 #include <iostream>
@@ -14,6 +15,7 @@
 #include "StimApp.h"
 #include "Util.h"
 #include "GLWindow.h"
+#include "AsyncLog.h"
 
 namespace Util {
 
@@ -80,42 +82,41 @@ bool glCheckFBStatus()
 	return true;
 }
 
-Log::Log()
-    : doprt(true), str(""), s(&str, QIODevice::WriteOnly)
+volatile int Log::minLvl = Log::InfoLevel; // StimApp lowers this to DebugLevel in debug mode
+
+Log::Log(Level l)
+    : level(l), s(0)
 {
+    if (l >= minLvl) s = new QTextStream(&str, QIODevice::WriteOnly);
 }
 
 Log::~Log()
 {    
-    if (doprt) {        
-        s.flush(); // does nothing probably..
-        QString theString = QString("[Thread ") + QString::number((unsigned long)QThread::currentThreadId()) + " "  + QDateTime::currentDateTime().toString("M/dd/yy hh:mm:ss.zzz") + "] " + str;
-
-        if (stimApp()) {
-            stimApp()->logLine(theString, color);
+    if (s) {        
+        s->flush(); // does nothing probably..
+        delete s;
+        if (AsyncLog::instance()) {
+            AsyncLog::instance()->post(level, str); // NB: if the ring is full the line is dropped (and counted)
         } else {
-            // just print to console for now..
-            std::cerr << theString.toUtf8().constData() << "\n";
+            QString theString = AsyncLog::format(quintptr(QThread::currentThreadId()), QDateTime::currentMSecsSinceEpoch(), str);
+            if (stimApp()) {
+                stimApp()->logLine(theString, levelColor(level));
+            } else {
+                // just print to console for now..
+                std::cerr << theString.toUtf8().constData() << "\n";
+            }
         }
     }
 }
 
-Debug::~Debug()
-{
-    if (!stimApp() || !stimApp()->isDebugMode())
-        doprt = false;
-    color = Qt::darkBlue;
-}
-
-
-Error::~Error()
+/* static */ QColor Log::levelColor(int level)
 {
-    color = Qt::darkRed;
-}
-
-Warning::~Warning()
-{
-    color = Qt::darkMagenta;
+    switch (level) {
+        case DebugLevel: return Qt::darkBlue;
+        case WarningLevel: return Qt::darkMagenta;
+        case ErrorLevel: return Qt::darkRed;
+        default: return QColor(); // console's default color
+    }
 }
 
 
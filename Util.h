@@ -112,6 +112,9 @@ extern void socketNoNagle(long sock);
 /// returns the number of bytes of physical memory of the current machine.
 extern unsigned long long getHWPhysMem();
 
+/// returns the peak resident set size (max RSS) of this process in bytes, or 0 if unknown on this platform
+extern unsigned long long getPeakRSS();
+
 /// \brief True if the platform we are running on has a 'get refresh rate' function
 ///
 /// true on Windows 
@@ -171,21 +174,36 @@ T rol(T x, unsigned int moves)
 	return (x << moves) | (x >> (sizeof(T)*8 - moves));
 }
 	
-/// Super class of Debug, Warning, Error classes.  
+/** \brief Super class of Debug, Warning, Error classes.  
+
+    Messages below minLevel() are discarded before anything is formatted, so a
+    disabled Debug() costs a compare.  Build with DEFINES += NO_DEBUG_LOG to 
+    compile Debug() out entirely.  Finished lines are handed to the AsyncLog
+    background writer, which does the console and log file output. */
 class Log 
 {
 public:
-    Log();
+    enum Level { DebugLevel = 0, InfoLevel, WarningLevel, ErrorLevel };
+
+    Log(Level l = InfoLevel);
     virtual ~Log();
     
-    template <class T> Log & operator<<(const T & t) {  s << t; return *this;  }
+    template <class T> Log & operator<<(const T & t) {  if (s) *s << t; return *this;  }
+
+    static Level minLevel() { return Level(minLvl); }
+    static void setMinLevel(Level l) { minLvl = l; }
+    static QColor levelColor(int level); ///< the console color for lines of this level
+
 protected:
-    bool doprt;
-    QColor color;
+    Level level;
 
 private:    
     QString str;
-    QTextStream s;
+    QTextStream *s; ///< only created if level is enabled
+    static volatile int minLvl;
+
+    Log(const Log &);
+    Log & operator=(const Log &);
 };
 
 /** \brief Stream-like class to print a debug message to the app's console window
@@ -194,11 +212,19 @@ private:
         Debug() << "This is a debug message"; // would print a debug message to the console window
    \endcode
  */
+#ifdef NO_DEBUG_LOG
+class Debug
+{
+public:
+    template <class T> Debug & operator<<(const T &) { return *this; }
+};
+#else
 class Debug : public Log
 {
 public:
-    virtual ~Debug();
+    Debug() : Log(DebugLevel) {}
 };
+#endif
 
 /** \brief Stream-like class to print an error message to the app's console window
     Example: 
@@ -209,7 +235,7 @@ public:
 class Error : public Log
 {
 public:
-    virtual ~Error();
+    Error() : Log(ErrorLevel) {}
 };
 
 /** \brief Stream-like class to print a warning message to the app's console window
@@ -222,7 +248,7 @@ public:
 class Warning : public Log
 {
 public:
-    virtual ~Warning();
+    Warning() : Log(WarningLevel) {}
 };
 
 /// Stream-like class to print a message to the app's status bar
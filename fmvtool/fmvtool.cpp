@@ -0,0 +1,602 @@
+/*
+ *  fmvtool.cpp
+ *  StimulateOpenGL_II
+ *
+ *  Headless command-line tool for .fmv files, built on FastMovieFormat.cpp
+ *  with NO_QT so it runs anywhere there's a C++ compiler and zlib.  See
+ *  fmvtool.pro, or just:
+ *
+ *    g++ -O2 -DNO_QT -I.. fmvtool.cpp ../FastMovieFormat.cpp -lz -lpthread -o fmvtool
+ *
+ */
+#ifndef NO_QT
+#define NO_QT
+#endif
+#include "../FastMovieFormat.h"
+#include "../FastMovieThreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <time.h>
+#include <errno.h>
+
+#ifdef _MSC_VER
+#define strcasecmp _stricmp
+#define fseeko _fseeki64
+#endif
+
+static void usage();
+
+static bool endsWith(const std::string & s, const char *suffix)
+{
+	const size_t n = strlen(suffix);
+	return s.length() >= n && !strcasecmp(s.c_str() + s.length() - n, suffix);
+}
+
+/// returns true and parses the number if opt is argv[i] and has an argument, advancing i
+static bool uintOpt(int argc, char **argv, int & i, const char *opt, unsigned & val)
+{
+	if (strcmp(argv[i], opt)) return false;
+	if (i+1 >= argc) { fprintf(stderr, "%s needs an argument\n", opt); exit(1); }
+	char *end = 0;
+	const long v = strtol(argv[++i], &end, 10);
+	if (!end || *end || v < 0) { fprintf(stderr, "%s: bad number `%s'\n", opt, argv[i]); exit(1); }
+	val = unsigned(v);
+	return true;
+}
+
+/// parses -opt x,y,w,h into r[4]
+static bool rectOpt(int argc, char **argv, int & i, const char *opt, unsigned r[4])
+{
+	if (strcmp(argv[i], opt)) return false;
+	if (i+1 >= argc) { fprintf(stderr, "%s needs an argument\n", opt); exit(1); }
+	if (sscanf(argv[++i], "%u,%u,%u,%u", &r[0], &r[1], &r[2], &r[3]) != 4 || !r[2] || !r[3]) {
+		fprintf(stderr, "%s: bad rectangle `%s', must be x,y,width,height\n", opt, argv[i]);
+		exit(1);
+	}
+	return true;
+}
+
+static double nowSecs()
+{
+#ifdef FM_WIN32_THREADS
+	return double(GetTickCount()) / 1000.;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return double(ts.tv_sec) + double(ts.tv_nsec) / 1e9;
+#endif
+}
+
+/// reads a P5 (8 bit greyscale) .pgm into pix.  Returns false on error
+static bool readPGM(FILE *f, unsigned & w, unsigned & h, std::vector<char> & pix)
+{
+	char magic[3] = { 0, 0, 0 };
+	if (fread(magic, 2, 1, f) != 1 || strcmp(magic, "P5")) return false;
+	unsigned vals[3];
+	for (int i = 0; i < 3; ++i) {
+		int ch;
+		while ((ch = fgetc(f)) != EOF && (ch == ' ' || ch == '\t' || ch == '\r' || ch == '\n' || ch == '#'))
+			if (ch == '#') while ((ch = fgetc(f)) != EOF && ch != '\n') {}
+		if (ch == EOF) return false;
+		ungetc(ch, f);
+		if (fscanf(f, "%u", &vals[i]) != 1) return false;
+	}
+	fgetc(f); // the single whitespace before the pixels
+	w = vals[0], h = vals[1];
+	if (!w || !h || vals[2] > 255) return false;
+	pix.resize(size_t(w)*h);
+	return fread(&pix[0], pix.size(), 1, f) == 1;
+}
+
+/// FM_Open, but also works on movies that were never finalized (by scanning for the frames)
+static FM_Context *openFMV(const char *path)
+{
+	std::string err;
+	FM_Context *c = FM_Open(path, &err, true);
+	if (!c) fprintf(stderr, "%s: %s\n", path, err.c_str());
+	return c;
+}
+
+static unsigned bytesPerPixel(unsigned fmt)
+{
+	switch (fmt) {
+		case FM_RGB: case FM_BGR: return 3;
+		case FM_RGBA: case FM_ARGB: return 4;
+		default: return 1;
+	}
+}
+
+static const char *fmtName(unsigned fmt)
+{
+	static const char * const names[] = { "luminosity", "rgb", "bgr", "rgba", "argb" };
+	return fmt < sizeof(names)/sizeof(names[0]) ? names[fmt] : "unknown";
+}
+
+/// the tile size of frame i as stored, 0 x 0 if it isn't tiled
+static void tileSize(FM_Context *c, unsigned i, unsigned & tw, unsigned & th)
+{
+	FM_ImageDescriptor d;
+	FM_TileTable t;
+	tw = th = 0;
+	if (!fseeko(c->file, c->imgOffsets[i], SEEK_SET) && fread(&d, sizeof(d), 1, c->file) == 1
+		&& d.comp == FM_ZLib_Tiled_Comp && fread(&t, sizeof(t), 1, c->file) == 1 && t.magic == FM_TILE_TABLE_MAGIC)
+		tw = t.tileWidth, th = t.tileHeight;
+}
+
+/// size of frame i in the file, descriptor included
+static uint64_t storedSize(const FM_Context *c, unsigned i)
+{
+	const uint64_t next = i+1 < c->imgOffsets.size() ? c->imgOffsets[i+1] : c->fileLengthBytes;
+	return next - c->imgOffsets[i];
+}
+
+/// splits frames [0,n) into nThreads contiguous chunks and runs func(arg, thread#, first, end) on each, in parallel
+static void parallelFor(unsigned n, unsigned nThreads, void (*func)(void *, unsigned, unsigned, unsigned), void *arg)
+{
+	struct Chunk { void (*func)(void *, unsigned, unsigned, unsigned); void *arg; unsigned t, first, end; };
+	struct Tramp { static void run(void *p) { Chunk *ch = (Chunk *)p; ch->func(ch->arg, ch->t, ch->first, ch->end); } };
+	if (!nThreads) nThreads = 1;
+	std::vector<Chunk> chunks(nThreads);
+	std::vector<FM_Thread *> threads;
+	for (unsigned t = 0; t < nThreads; ++t) {
+		Chunk ch = { func, arg, t, unsigned(uint64_t(n)*t/nThreads), unsigned(uint64_t(n)*(t+1)/nThreads) };
+		chunks[t] = ch;
+		threads.push_back(new FM_Thread(Tramp::run, &chunks[t]));
+	}
+	for (unsigned t = 0; t < nThreads; ++t) delete threads[t]; // joins
+}
+
+/*-----------------------------------------------------------------------------
+ encode
+ -----------------------------------------------------------------------------*/
+static int cmdEncode(int argc, char **argv)
+{
+	unsigned w = 0, h = 0, level = 1, threads = 0, mb = FM_DEFAULT_ENCODER_MB, tile = 0;
+	std::vector<std::string> args;
+	for (int i = 0; i < argc; ++i) {
+		if (uintOpt(argc, argv, i, "-w", w) || uintOpt(argc, argv, i, "-h", h)
+			|| uintOpt(argc, argv, i, "-l", level) || uintOpt(argc, argv, i, "-t", threads)
+			|| uintOpt(argc, argv, i, "-m", mb) || uintOpt(argc, argv, i, "-T", tile))
+			continue;
+		args.push_back(argv[i]);
+	}
+	if (args.size() < 2) { usage(); return 1; }
+	if (level > 9) level = 9;
+
+	FM_Context *c = FM_Create(args[0].c_str());
+	if (!c) { fprintf(stderr, "%s: cannot create: %s\n", args[0].c_str(), strerror(errno)); return 1; }
+	FM_SetTileSize(c, tile, tile);
+	FM_StartEncoder(c, threads, mb);
+
+	const double t0 = nowSecs();
+	unsigned nFrames = 0;
+	double nBytes = 0.;
+	bool ok = true;
+	std::vector<char> pix;
+	for (size_t a = 1; ok && a < args.size(); ++a) {
+		const std::string & in = args[a];
+		FILE *f = in == "-" ? stdin : fopen(in.c_str(), "rb");
+		if (!f) { fprintf(stderr, "%s: %s\n", in.c_str(), strerror(errno)); ok = false; break; }
+		if (endsWith(in, ".pgm")) {
+			unsigned pw, ph;
+			if (!readPGM(f, pw, ph, pix)) {
+				fprintf(stderr, "%s: not an 8-bit binary (P5) pgm\n", in.c_str());
+				ok = false;
+			} else if (!FM_SubmitFrame(c, &pix[0], pw, ph, level)) {
+				fprintf(stderr, "%s: error writing frame %u\n", in.c_str(), nFrames);
+				ok = false;
+			} else
+				++nFrames, nBytes += pix.size();
+		} else {
+			// raw: back-to-back w x h 8-bit frames
+			if (!w || !h) { fprintf(stderr, "%s: raw input needs -w and -h\n", in.c_str()); ok = false; }
+			else pix.resize(size_t(w)*h);
+			while (ok && fread(&pix[0], pix.size(), 1, f) == 1) {
+				if (!FM_SubmitFrame(c, &pix[0], w, h, level)) {
+					fprintf(stderr, "%s: error writing frame %u\n", in.c_str(), nFrames);
+					ok = false;
+				} else
+					++nFrames, nBytes += pix.size();
+			}
+		}
+		if (f != stdin) fclose(f);
+	}
+	if (!FM_FlushEncoder(c)) {
+		fprintf(stderr, "%s: write error, the file ends at frame %u\n", args[0].c_str(), unsigned(c->imgOffsets.size()));
+		ok = false;
+	}
+	const uint64_t outBytes = c->writePos;
+	FM_Close(c);
+	const double secs = nowSecs() - t0;
+	printf("%s: %u frames, %.1f MB in, %.1f MB out, %.2f s (%.1f frames/s, %.1f MB/s)\n",
+		   args[0].c_str(), nFrames, nBytes/1048576., double(outBytes)/1048576., secs,
+		   secs > 0. ? nFrames/secs : 0., secs > 0. ? nBytes/1048576./secs : 0.);
+	return ok ? 0 : 1;
+}
+
+/*-----------------------------------------------------------------------------
+ info
+ -----------------------------------------------------------------------------*/
+static int cmdInfo(int argc, char **argv)
+{
+	bool verbose = false;
+	std::vector<std::string> args;
+	for (int i = 0; i < argc; ++i) {
+		if (!strcmp(argv[i], "-v")) verbose = true;
+		else args.push_back(argv[i]);
+	}
+	if (args.empty()) { usage(); return 1; }
+	int ret = 0;
+	for (size_t a = 0; a < args.size(); ++a) {
+		const char *path = args[a].c_str();
+		FILE *f = fopen(path, "rb");
+		FM_Header h;
+		memset(&h, 0, sizeof(h));
+		const bool haveHeader = f && fread(&h, sizeof(h), 1, f) == 1;
+		if (f) fclose(f);
+		FM_Context *c = haveHeader ? openFMV(path) : 0;
+		if (!c) { if (!haveHeader) fprintf(stderr, "%s: cannot read header\n", path); ret = 1; continue; }
+		const unsigned n = unsigned(c->imgOffsets.size());
+		std::string err;
+		FM_Image *img = n ? FM_ReadFrame(c, 0, &err) : 0;
+		uint64_t stored = 0;
+		for (unsigned i = 0; i < n; ++i) stored += storedSize(c, i);
+		printf("%s:\n", path);
+		printf("  magic        %.16s\n", h.magic);
+		printf("  frames       %u\n", n);
+		printf("  size         %u x %u\n", c->width, c->height);
+		printf("  index        %s\n", h.indexRecordOffset ? "yes" : "MISSING (not finalized, frames found by scanning; fix with reindex)");
+		printf("  checksums    %s\n", c->crcs.size() == n && n ? "crc32c per frame" : "none");
+		printf("  file bytes   %llu\n", (unsigned long long)c->fileLengthBytes);
+		if (img) {
+			// assumes all frames are laid out like frame 0, which is what the writers do
+			const double raw = double(n) * img->desc.width * img->desc.height * bytesPerPixel(img->desc.fmt);
+			unsigned tw, th;
+			tileSize(c, 0, tw, th);
+			printf("  format       %s, %u bytes/pixel\n", fmtName(img->desc.fmt), bytesPerPixel(img->desc.fmt));
+			printf("  compression  %.2f:1\n", stored ? raw / double(stored) : 0.);
+			if (tw) printf("  tiles        %u x %u\n", tw, th);
+			delete img;
+		} else if (n) {
+			printf("  frame 0      UNREADABLE: %s\n", err.c_str());
+			ret = 1;
+		}
+		if (verbose) {
+			printf("  %8s %14s %10s\n", "frame", "offset", "bytes");
+			for (unsigned i = 0; i < n; ++i)
+				printf("  %8u %14llu %10llu\n", i, (unsigned long long)c->imgOffsets[i], (unsigned long long)storedSize(c, i));
+		}
+		FM_Close(c);
+	}
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ verify
+ -----------------------------------------------------------------------------*/
+/// FM_Verify callbacks
+struct VerifyCB
+{
+	const char *path;
+	std::string err;
+	static bool progress(void *arg, int pct) { fprintf(stderr, "\rverifying %s: %d%%", ((VerifyCB *)arg)->path, pct); return true; }
+	static void error(void *arg, const std::string & msg) { ((VerifyCB *)arg)->err = msg; }
+};
+
+static int cmdVerify(int argc, char **argv)
+{
+	unsigned threads = 0;
+	bool quiet = false, decode = false;
+	std::vector<std::string> args;
+	for (int i = 0; i < argc; ++i) {
+		if (uintOpt(argc, argv, i, "-t", threads)) continue;
+		if (!strcmp(argv[i], "-q")) { quiet = true; continue; }
+		if (!strcmp(argv[i], "-d")) { decode = true; continue; }
+		args.push_back(argv[i]);
+	}
+	if (args.empty()) { usage(); return 1; }
+	int ret = 0;
+	for (size_t a = 0; a < args.size(); ++a) {
+		const char *path = args[a].c_str();
+		VerifyCB cb;
+		cb.path = path;
+		const double t0 = nowSecs();
+		const bool ok = FM_Verify(path, threads, decode, &cb, quiet ? 0 : VerifyCB::progress, VerifyCB::error);
+		if (!quiet) fprintf(stderr, "\n");
+		if (!ok) {
+			printf("%s: ERROR: %s\n", path, cb.err.length() ? cb.err.c_str() : "verification failed");
+			ret = 1;
+		} else
+			printf("%s: OK, verified in %.2f s\n", path, nowSecs() - t0);
+	}
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ reindex
+ -----------------------------------------------------------------------------*/
+static bool printProgress(void *arg, int pct)
+{
+	fprintf(stderr, "\r%s: %d%%", (const char *)arg, pct);
+	return true;
+}
+
+static void printError(void *arg, const std::string & msg)
+{
+	fprintf(stderr, "\n%s: %s\n", (const char *)arg, msg.c_str());
+}
+
+static int cmdReindex(int argc, char **argv)
+{
+	if (argc < 1) { usage(); return 1; }
+	int ret = 0;
+	for (int i = 0; i < argc; ++i) {
+		if (FM_RebuildIndex(argv[i], argv[i], printProgress, printError))
+			fprintf(stderr, "\r%s: index rebuilt\n", argv[i]);
+		else
+			ret = 1;
+	}
+	return ret;
+}
+
+/*-----------------------------------------------------------------------------
+ transcode
+ -----------------------------------------------------------------------------*/
+static int cmdTranscode(int argc, char **argv)
+{
+	unsigned level = 1, threads = 0, mb = FM_DEFAULT_ENCODER_MB, tile = 0;
+	bool comp = true;
+	std::vector<std::string> args;
+	for (int i = 0; i < argc; ++i) {
+		if (uintOpt(argc, argv, i, "-l", level) || uintOpt(argc, argv, i, "-t", threads) || uintOpt(argc, argv, i, "-m", mb)
+			|| uintOpt(argc, argv, i, "-T", tile))
+			continue;
+		if (!strcmp(argv[i], "-c") && i+1 < argc) {
+			const char *codec = argv[++i];
+			if (!strcmp(codec, "zlib")) comp = true;
+			else if (!strcmp(codec, "none")) comp = false;
+			else { fprintf(stderr, "-c: unknown codec `%s', must be zlib or none\n", codec); return 1; }
+			continue;
+		}
+		args.push_back(argv[i]);
+	}
+	if (args.size() != 2) { usage(); return 1; }
+	if (level > 9) level = 9;
+	FM_Context *in = openFMV(args[0].c_str());
+	if (!in) return 1;
+	FM_Context *out = FM_Create(args[1].c_str());
+	if (!out) { fprintf(stderr, "%s: cannot create: %s\n", args[1].c_str(), strerror(errno)); FM_Close(in); return 1; }
+	FM_SetTileSize(out, tile, tile);
+	FM_StartEncoder(out, threads, mb);
+
+	const double t0 = nowSecs();
+	const unsigned n = unsigned(in->imgOffsets.size());
+	int lastPct = -1;
+	bool ok = true;
+	for (unsigned i = 0; ok && i < n; ++i) {
+		std::string err;
+		FM_Image *img = FM_ReadFrame(in, i, &err);
+		if (!img) { fprintf(stderr, "\n%s: %s\n", args[0].c_str(), err.c_str()); ok = false; break; }
+		const FM_ImageDescriptor & d (img->desc);
+		if (!FM_SubmitFrame(out, img->data, d.width, d.height, level, bytesPerPixel(d.fmt)*8, FM_Fmt(d.fmt), comp, d.duration)) {
+			fprintf(stderr, "\n%s: error writing frame %u\n", args[1].c_str(), i);
+			ok = false;
+		}
+		delete img;
+		if (int(uint64_t(i+1)*100/n) > lastPct) fprintf(stderr, "\rtranscoding: %d%%", lastPct = int(uint64_t(i+1)*100/n));
+	}
+	if (lastPct >= 0) fprintf(stderr, "\n");
+	if (!FM_FlushEncoder(out)) { fprintf(stderr, "%s: write error\n", args[1].c_str()); ok = false; }
+	const uint64_t inBytes = in->fileLengthBytes, outBytes = out->writePos;
+	FM_Close(out);
+	FM_Close(in);
+	printf("%s -> %s: %u frames, %.1f MB -> %.1f MB, %.2f s\n", args[0].c_str(), args[1].c_str(), n, 
+		   double(inBytes)/1048576., double(outBytes)/1048576., nowSecs() - t0);
+	return ok ? 0 : 1;
+}
+
+/*-----------------------------------------------------------------------------
+ extract
+ -----------------------------------------------------------------------------*/
+static int cmdExtract(int argc, char **argv)
+{
+	unsigned first = 0, count = ~0U, rect[4] = { 0, 0, ~0U, ~0U };
+	std::vector<std::string> args;
+	for (int i = 0; i < argc; ++i) {
+		if (uintOpt(argc, argv, i, "-f", first) || uintOpt(argc, argv, i, "-n", count) || rectOpt(argc, argv, i, "-r", rect)) continue;
+		args.push_back(argv[i]);
+	}
+	if (args.size() != 2) { usage(); return 1; }
+	FM_Context *c = openFMV(args[0].c_str());
+	if (!c) return 1;
+	const unsigned n = unsigned(c->imgOffsets.size());
+	const unsigned end = count > n || first + count > n ? n : first + count;
+	const std::string & out = args[1];
+	const bool pnm = endsWith(out, ".pgm") || endsWith(out, ".ppm");
+	if (pnm && end - first > 1 && out.find('%') == std::string::npos) {
+		fprintf(stderr, "%s: extracting more than one frame to .pgm/.ppm needs a printf pattern for the frame number, eg frame%%05d.pgm\n", out.c_str());
+		FM_Close(c);
+		return 1;
+	}
+	FILE *raw = 0;
+	if (!pnm && !(raw = out == "-" ? stdout : fopen(out.c_str(), "wb"))) {
+		fprintf(stderr, "%s: %s\n", out.c_str(), strerror(errno));
+		FM_Close(c);
+		return 1;
+	}
+	bool ok = true;
+	for (unsigned i = first; ok && i < end; ++i) {
+		std::string err;
+		FM_Image *img = FM_ReadFrameRect(c, i, rect[0], rect[1], rect[2], rect[3], 0, &err);
+		if (!img) { fprintf(stderr, "%s: %s\n", args[0].c_str(), err.c_str()); ok = false; break; }
+		const FM_ImageDescriptor & d (img->desc);
+		FILE *f = raw;
+		if (pnm) {
+			const unsigned bpp = bytesPerPixel(d.fmt);
+			if (bpp != 1 && d.fmt != FM_RGB) {
+				fprintf(stderr, "frame %u: %s frames can only be extracted raw\n", i, fmtName(d.fmt));
+				ok = false;
+			} else {
+				char name[1024];
+				snprintf(name, sizeof(name), out.c_str(), i);
+				if (!(f = fopen(name, "wb"))) { fprintf(stderr, "%s: %s\n", name, strerror(errno)); ok = false; }
+				else fprintf(f, "%s\n%u %u\n255\n", bpp == 1 ? "P5" : "P6", d.width, d.height);
+			}
+		}
+		if (ok && d.length && fwrite(img->data, d.length, 1, f) != 1) {
+			fprintf(stderr, "%s: %s\n", out.c_str(), strerror(errno));
+			ok = false;
+		}
+		if (pnm && f) fclose(f);
+		delete img;
+	}
+	if (raw && raw != stdout) fclose(raw);
+	FM_Close(c);
+	if (ok) fprintf(stderr, "extracted frames %u-%u of %u\n", first, end ? end-1 : 0, n);
+	return ok ? 0 : 1;
+}
+
+/*-----------------------------------------------------------------------------
+ bench
+ -----------------------------------------------------------------------------*/
+struct BenchJob
+{
+	std::string path;
+	unsigned rect[4];
+	FM_Mutex mut;
+	uint64_t bytes, compBytes;
+	bool failed;
+
+	static void run(void *arg, unsigned, unsigned first, unsigned end)
+	{
+		BenchJob *j = (BenchJob *)arg;
+		uint64_t bytes = 0, compBytes = 0;
+		bool failed = false;
+		FM_Context *c = FM_Open(j->path.c_str(), 0, true);
+		for (unsigned i = first; c && i < end; ++i) {
+			int cfs = 0;
+			FM_Image *img = FM_ReadFrameRect(c, i, j->rect[0], j->rect[1], j->rect[2], j->rect[3], 1, 0, &cfs);
+			if (!img) { failed = true; break; }
+			bytes += img->desc.length;
+			compBytes += unsigned(cfs);
+			delete img;
+		}
+		if (c) FM_Close(c); else failed = true;
+		FM_Locker l(j->mut);
+		j->bytes += bytes, j->compBytes += compBytes;
+		j->failed = j->failed || failed;
+	}
+};
+
+static int cmdBench(int argc, char **argv)
+{
+	unsigned maxThreads = 0, nFrames = 0, rect[4] = { 0, 0, ~0U, ~0U };
+	std::vector<std::string> args;
+	for (int i = 0; i < argc; ++i) {
+		if (uintOpt(argc, argv, i, "-t", maxThreads) || uintOpt(argc, argv, i, "-n", nFrames) || rectOpt(argc, argv, i, "-r", rect)) continue;
+		args.push_back(argv[i]);
+	}
+	if (args.size() != 1) { usage(); return 1; }
+	if (!maxThreads) maxThreads = FM_NumCPUs();
+	FM_Context *c = openFMV(args[0].c_str());
+	if (!c) return 1;
+	const unsigned n = nFrames && nFrames < c->imgOffsets.size() ? nFrames : unsigned(c->imgOffsets.size());
+	FM_Close(c);
+	if (!n) { fprintf(stderr, "%s: no frames\n", args[0].c_str()); return 1; }
+
+	std::vector<unsigned> counts;
+	for (unsigned t = 1; t < maxThreads; t *= 2) counts.push_back(t);
+	counts.push_back(maxThreads);
+
+	printf("%s: decoding %u frames\n", args[0].c_str(), n);
+	printf("%8s %12s %12s %12s\n", "threads", "frames/s", "MB/s", "file MB/s");
+	for (size_t k = 0; k <= counts.size(); ++k) {
+		// the first pass only warms up the page cache and isn't reported
+		const unsigned nt = k ? counts[k-1] : maxThreads;
+		BenchJob j;
+		j.path = args[0];
+		memcpy(j.rect, rect, sizeof(rect));
+		j.bytes = j.compBytes = 0;
+		j.failed = false;
+		const double t0 = nowSecs();
+		parallelFor(n, nt, BenchJob::run, &j);
+		const double secs = nowSecs() - t0;
+		if (j.failed) { fprintf(stderr, "%s: decode error, run verify\n", args[0].c_str()); return 1; }
+		if (!k) continue;
+		printf("%8u %12.1f %12.1f %12.1f\n", nt, n/secs, double(j.bytes)/1048576./secs, double(j.compBytes)/1048576./secs);
+	}
+	return 0;
+}
+
+/*-----------------------------------------------------------------------------
+ main
+ -----------------------------------------------------------------------------*/
+struct Command
+{
+	const char *name;
+	int (*func)(int, char **);
+	const char *help;
+};
+
+static const Command commands[] =
+{
+	{ "info", cmdInfo,
+	  "info [-v] file.fmv...\n"
+	  "    Prints the header, frame count, pixel format, compression ratio and tile\n"
+	  "    size, if tiled.  -v also lists every frame's offset and stored size." },
+	{ "verify", cmdVerify,
+	  "verify [-t threads] [-d] [-q] file.fmv...\n"
+	  "    Checks every frame, on one thread per CPU (or -t): against its checksum\n"
+	  "    if the file has them, otherwise (or with -d, also) by decompressing it.\n"
+	  "    Exit status is 1 on errors." },
+	{ "reindex", cmdReindex,
+	  "reindex file.fmv...\n"
+	  "    Rebuilds the index of a movie that was never finalized or whose index is\n"
+	  "    damaged, in place." },
+	{ "transcode", cmdTranscode,
+	  "transcode [-c zlib|none] [-l level] [-T tile] [-t threads] [-m MB] in.fmv out.fmv\n"
+	  "    Rewrites a movie with another codec and/or zlib level (default zlib, 1).\n"
+	  "    -T cuts the frames into tile x tile tiles, compressed separately, so that\n"
+	  "    part of a frame can be decoded alone (eg 256; default 0, not tiled)." },
+	{ "extract", cmdExtract,
+	  "extract [-f first] [-n count] [-r x,y,w,h] in.fmv out\n"
+	  "    Decodes frames first..first+count-1 (default all), or with -r just that\n"
+	  "    rectangle of them (of tiled movies, only the tiles needed).  If out ends in .pgm\n"
+	  "    (or .ppm for rgb movies) each frame gets its own file, out being a printf\n"
+	  "    pattern like frame%05d.pgm; otherwise the raw pixels are concatenated\n"
+	  "    into out (`-' being stdout)." },
+	{ "bench", cmdBench,
+	  "bench [-t maxthreads] [-n frames] [-r x,y,w,h] file.fmv\n"
+	  "    Decodes the movie with 1, 2, 4 .. maxthreads threads (default one per\n"
+	  "    CPU) and reports frames/s, decoded MB/s and file MB/s for each.  -r\n"
+	  "    decodes just that rectangle of each frame." },
+	{ "encode", cmdEncode,
+	  "encode [-w W -h H] [-l level] [-T tile] [-t threads] [-m MB] out.fmv input...\n"
+	  "    Compresses frames into a new .fmv with one thread per CPU (or -t).  Inputs\n"
+	  "    are 8-bit binary .pgm files (one frame each) or raw files of back-to-back\n"
+	  "    8-bit W x H frames, `-' being stdin.  -l is the zlib level (default 1),\n"
+	  "    -m the memory budget for frames in flight (default 256), -T the tile size\n"
+	  "    as for transcode." },
+};
+static const int nCommands = sizeof(commands)/sizeof(commands[0]);
+
+static void usage()
+{
+	fprintf(stderr, "usage: fmvtool <command> [args]\n\ncommands:\n");
+	for (int i = 0; i < nCommands; ++i)
+		fprintf(stderr, "  %s\n\n", commands[i].help);
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) { usage(); return 1; }
+	for (int i = 0; i < nCommands; ++i)
+		if (!strcmp(argv[1], commands[i].name))
+			return commands[i].func(argc-2, argv+2);
+	fprintf(stderr, "unknown command `%s'\n\n", argv[1]);
+	usage();
+	return 1;
+}
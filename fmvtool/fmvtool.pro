@@ -0,0 +1,31 @@
+######################################################################
+# fmvtool -- headless .fmv utility.  Doesn't use Qt at all (NO_QT), qmake
+# is only used to build it.  Without qmake:
+#
+#   g++ -O2 -DNO_QT -I.. fmvtool.cpp ../FastMovieFormat.cpp -lz -lpthread -o fmvtool
+######################################################################
+
+TEMPLATE = app
+TARGET = fmvtool
+CONFIG += console thread warn_on
+CONFIG -= qt app_bundle
+DEFINES += NO_QT
+INCLUDEPATH += ..
+DEPENDPATH += ..
+
+HEADERS += ../FastMovieFormat.h ../FastMovieThreads.h
+SOURCES += fmvtool.cpp ../FastMovieFormat.cpp
+
+unix {
+        LIBS += -lz -lpthread
+        QMAKE_CXXFLAGS_RELEASE += -O3
+}
+win32 {
+        # the zlib that ships with the mex
+        INCLUDEPATH += ../Matlab/FastMovieWriterMex
+        contains(QMAKE_TARGET.arch, x86_64) {
+            LIBS += $${PWD}/../Matlab/FastMovieWriterMex/zlibstat64.lib
+        } else {
+            LIBS += $${PWD}/../Matlab/FastMovieWriterMex/zlibstat.lib
+        }
+}
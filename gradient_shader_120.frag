@@ -0,0 +1,38 @@
+#version 120
+
+// Procedural version of the 256-texel GL_NEAREST/GL_REPEAT gradient textures
+// from GradientShape::TexCache::createTex().  Must stay in sync with
+// GradientShape::gradientFunction() and GradientShape::gradientValue().
+
+uniform int grad_type; // GradientShape::GradType: 1=Cos 2=Sin 3=Saw 4=Tri 5=Squ
+uniform float grad_min;
+uniform float grad_max;
+
+varying float grad_s;
+
+const float TEXWIDTH = 256.0;
+const float PI = 3.14159265358979;
+
+void main(void)
+{
+    // same texel the 1D texture lookup would pick
+    float x = min(floor(fract(grad_s) * TEXWIDTH), TEXWIDTH - 1.0) / (TEXWIDTH - 1.0);
+    float f;
+    if (grad_type == 5) { // Squ
+        f = x < 0.5 ? 0.0 : 1.0;
+    } else if (grad_type == 3) { // Saw
+        float swfact = 1.0 / 0.95;
+        f = x * swfact;
+        if (f >= 1.0) f = 1.0 - ((f - 1.0) / (swfact - 1.0));
+    } else if (grad_type == 4) { // Tri
+        f = x * 2.0;
+        if (f > 1.0) f = 1.0 - (f - 1.0);
+    } else if (grad_type == 2) { // Sin
+        f = (sin(x * 2.0 * PI) + 1.0) / 2.0;
+    } else { // Cos
+        f = (cos(x * 2.0 * PI) + 1.0) / 2.0;
+    }
+    f = clamp(f, 0.0, 1.0);
+    f = f * (grad_max - grad_min) + grad_min;
+    gl_FragColor = vec4(f, f, f, gl_Color.a);
+}
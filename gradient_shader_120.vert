@@ -0,0 +1,16 @@
+#version 120
+
+// Gradient coordinate for Shapes::GradientShape, computed per-vertex as
+// s = grad_xform.x*texcoord + dot(vertex.xy, grad_xform.yz) + grad_xform.w
+// Single shapes pass the gradient as a function of the unit-shape vertex (x = 0),
+// Shapes::Batch passes the precomputed coordinate in the texcoord (x = 1, rest 0).
+uniform vec4 grad_xform;
+
+varying float grad_s;
+
+void main(void)
+{
+    gl_Position = ftransform();
+    gl_FrontColor = gl_Color;
+    grad_s = grad_xform.x * gl_MultiTexCoord0.s + dot(gl_Vertex.xy, grad_xform.yz) + grad_xform.w;
+}
@@ -0,0 +1,31 @@
+#version 120
+#extension GL_ARB_texture_rectangle : enable
+
+// Movie plugin frames, uploaded in their native pixel format: GL_LUMINANCE
+// (one channel) or RGB.  In the dual and triple fps modes all the subframes
+// are drawn in one pass, subframe k going to the color channel(s) in chan_k.
+// See Movie::drawFrameUsingTextures().
+
+uniform sampler2DRect sub0;
+uniform sampler2DRect sub1;
+uniform sampler2DRect sub2;
+
+uniform int nSubFrames;
+uniform int luminance; // 1 = one channel frames
+uniform vec3 chan0;
+uniform vec3 chan1;
+uniform vec3 chan2;
+
+void main(void)
+{
+    vec2 st = gl_TexCoord[0].st;
+    vec4 c0 = texture2DRect(sub0, st);
+
+    if (nSubFrames < 2) {
+        gl_FragColor = luminance != 0 ? vec4(c0.rrr, 1.0) : vec4(c0.rgb, 1.0);
+        return;
+    }
+    vec3 c = chan0 * c0.r + chan1 * texture2DRect(sub1, st).r;
+    if (nSubFrames > 2) c += chan2 * texture2DRect(sub2, st).r;
+    gl_FragColor = vec4(c, 1.0);
+}
@@ -11,6 +11,7 @@
 #include <io.h>
 #include <windows.h>
 #include <wingdi.h>
+#include <psapi.h>
 #include <GL/gl.h>
 #endif
 
@@ -39,6 +40,11 @@
 #include <sys/stat.h>
 #endif
 
+#if defined(Q_OS_LINUX) || defined(Q_OS_DARWIN)
+// for getrusage
+#include <sys/resource.h>
+#endif
+
 #include <string.h>
 #include <iostream>
 #include <QHostInfo>
@@ -107,6 +113,13 @@ unsigned long long getHWPhysMem()
 	} 
 	return 512ULL*1024ULL*1024ULL; // return 512 MB?
 }
+unsigned long long getPeakRSS()
+{
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc)))
+		return pmc.PeakWorkingSetSize;
+	return 0;
+}
 #elif defined(Q_OS_LINUX)
 void setRTPriority()
 {
@@ -169,6 +182,13 @@ unsigned long long getHWPhysMem()
 	if (!memory) memory = 512*1024*1024;
 	return memory;
 }
+
+unsigned long long getPeakRSS()
+{
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru)) return 0;
+	return (unsigned long long)ru.ru_maxrss * 1024ULL; // linux reports kilobytes
+}
 	
 #else /* !WIN and !LINUX */
 void setRTPriority()
@@ -217,6 +237,13 @@ unsigned long long getHWPhysMem()
 	if (!mem) mem = 512ULL*1024ULL*1024ULL;
 	return mem;
 }
+
+unsigned long long getPeakRSS()
+{
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru)) return 0;
+	return (unsigned long long)ru.ru_maxrss; // darwin reports bytes
+}
 #else
 #include <QTime>
 namespace Util {
@@ -234,6 +261,7 @@ u64 getAbsTimeNS()
 }
 
 unsigned long long getHWPhysMem() { return 512ULL*1024ULL*1024ULL; }
+unsigned long long getPeakRSS() { return 0; }
 #endif // !Q_OS_DARWIN
 
 #endif 
@@ -0,0 +1,334 @@
+/*
+ *  FmvTests.cpp
+ *  StimulateOpenGL_II tests
+ *
+ *  FastMovieFormat.  The movies are written to the current directory and
+ *  removed again.
+ *
+ */
+#include "Tests.h"
+#include "FastMovieFormat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+	/// frame i of a w x h movie: a gradient that moves with i plus some noise, so it compresses but not to nothing
+	void makeFrame(std::vector<uint8_t> & px, unsigned w, unsigned h, unsigned i, unsigned bpp = 1)
+	{
+		px.resize(size_t(w)*h*bpp);
+		unsigned r = 12345u + i*7919u;
+		for (size_t p = 0; p < px.size(); ++p) {
+			r = r*1103515245u + 12345u;
+			const size_t x = (p / bpp) % w, y = (p / bpp) / w;
+			px[p] = uint8_t(x + 2*y + 3*i + (p % bpp)*50 + ((r >> 16) & 7));
+		}
+	}
+
+	bool copyFile(const char *from, const char *to)
+	{
+		FILE *in = fopen(from, "rb"), *out = in ? fopen(to, "wb") : 0;
+		bool ok = in && out;
+		char buf[65536];
+		for (size_t n; ok && (n = fread(buf, 1, sizeof(buf), in)) > 0; )
+			ok = fwrite(buf, 1, n, out) == n;
+		if (in) fclose(in);
+		if (out && fclose(out)) ok = false;
+		return ok;
+	}
+
+	/// true if the movie has exactly nFrames frames, frame i being makeFrame(.., i)
+	bool framesMatch(FM_Context *c, unsigned nFrames, unsigned w, unsigned h, std::string & err)
+	{
+		if (c->imgOffsets.size() != nFrames) {
+			std::ostringstream os;
+			os << c->imgOffsets.size() << " frames, expected " << nFrames;
+			err = os.str();
+			return false;
+		}
+		std::vector<uint8_t> px;
+		for (unsigned i = 0; i < nFrames; ++i) {
+			FM_Image *img = FM_ReadFrame(c, i, &err);
+			makeFrame(px, w, h, i);
+			const bool ok = img && img->desc.width == w && img->desc.height == h && !memcmp(img->data, &px[0], px.size());
+			delete img;
+			if (!ok) {
+				std::ostringstream os;
+				os << "frame " << i << " differs " << err;
+				err = os.str();
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+/// an output movie that was never closed (a crash) can be opened, with the index rebuilt, up to its last checkpoint
+bool testFmvCheckpointRecovery(std::string & err)
+{
+	const char *fn = "tests_checkpoint.fmv", *crashed = "tests_checkpoint_crashed.fmv";
+	const unsigned w = 64, h = 48;
+	std::vector<uint8_t> px;
+	// a small write buffer, so that frames past the checkpoint are partly on disk too
+	FM_Context *out = FM_Create(fn, 4096, 4);
+	TEST_CHECK(out);
+	for (unsigned i = 0; i < 10; ++i) {
+		makeFrame(px, w, h, i);
+		TEST_CHECK(FM_AddFrame(out, &px[0], w, h));
+	}
+	bool ok = copyFile(fn, crashed);
+	FM_Context *in = ok ? FM_Open(crashed) : 0;
+	const bool openedWithoutIndex = in != 0;
+	if (in) FM_Close(in);
+	in = ok ? FM_Open(crashed, &err, true) : 0;
+	ok = ok && !openedWithoutIndex && in && framesMatch(in, 8, w, h, err); // checkpointed at 4 and 8
+	if (in) FM_Close(in), in = 0;
+	// an explicit checkpoint covers every frame added so far
+	ok = ok && FM_Checkpoint(out) && copyFile(fn, crashed) && (in = FM_Open(crashed, &err, true)) && framesMatch(in, 10, w, h, err);
+	if (in) FM_Close(in), in = 0;
+	FM_Close(out);
+	// and once closed it has its index
+	ok = ok && (in = FM_Open(fn, &err)) && framesMatch(in, 10, w, h, err);
+	if (in) FM_Close(in), in = 0;
+	remove(fn), remove(crashed);
+	TEST_CHECK(!openedWithoutIndex);
+	if (!ok && err.empty()) err = "could not write, copy or reopen the movie";
+	return ok;
+}
+
+namespace {
+	/// one bit at a time, straight from the definition
+	uint32_t crc32cBitwise(const uint8_t *p, size_t len)
+	{
+		uint32_t crc = ~0U;
+		while (len--) {
+			crc ^= *p++;
+			for (int k = 0; k < 8; ++k) crc = (crc >> 1) ^ (0x82F63B78U & (0U - (crc & 1U)));
+		}
+		return ~crc;
+	}
+
+	void collectError(void *arg, const std::string & e) { *(std::string *)arg = e; }
+}
+
+bool testFmvCRC32C(std::string & err)
+{
+	// the check value, and the iSCSI test vectors of RFC 3720 B.4
+	TEST_CHECK(FM_CRC32C(0, "123456789", 9) == 0xE3069283U);
+	uint8_t v[32];
+	memset(v, 0, sizeof(v));
+	TEST_CHECK(FM_CRC32C(0, v, sizeof(v)) == 0x8A9136AAU);
+	memset(v, 0xff, sizeof(v));
+	TEST_CHECK(FM_CRC32C(0, v, sizeof(v)) == 0x62A8AB43U);
+	for (unsigned i = 0; i < 32; ++i) v[i] = uint8_t(i);
+	TEST_CHECK(FM_CRC32C(0, v, sizeof(v)) == 0x46DD794EU);
+	TEST_CHECK(FM_CRC32C(0, v, 0) == 0);
+	// every alignment and length around the 8 byte steps, whole and split in two
+	std::vector<uint8_t> buf;
+	makeFrame(buf, 97, 11, 3);
+	for (size_t off = 0; off < 16; ++off)
+		for (size_t len = 0; len + off <= buf.size(); len += len < 40 ? 1 : 61) {
+			const uint8_t *p = &buf[off];
+			const uint32_t ref = crc32cBitwise(p, len);
+			TEST_CHECK(FM_CRC32C(0, p, len) == ref);
+			const size_t split = len / 3;
+			TEST_CHECK(FM_CRC32C(FM_CRC32C(0, p, split), p + split, len - split) == ref);
+		}
+	return true;
+}
+
+/// FM_Verify() catches a flipped bit in a frame through its checksum alone, and names the frame
+bool testFmvVerifyChecksums(std::string & err)
+{
+	const char *fn = "tests_verify.fmv";
+	const unsigned w = 80, h = 60, nFrames = 12, bad = 7;
+	std::vector<uint8_t> px;
+	FM_Context *c = FM_Create(fn);
+	TEST_CHECK(c);
+	for (unsigned i = 0; i < nFrames; ++i) {
+		makeFrame(px, w, h, i);
+		TEST_CHECK(FM_AddFrame(c, &px[0], w, h));
+	}
+	FM_Close(c);
+	std::string verr;
+	bool ok = FM_Verify(fn, 4, false, &verr, 0, collectError);
+	uint64_t off = 0;
+	if ((c = FM_Open(fn, &err))) {
+		ok = ok && c->crcs.size() == nFrames;
+		off = c->imgOffsets[bad] + sizeof(FM_ImageDescriptor) + 5;
+		FM_Close(c);
+	}
+	FILE *f = off ? fopen(fn, "r+b") : 0;
+	if (f) {
+		uint8_t b = 0;
+		ok = ok && !fseeko(f, off, SEEK_SET) && fread(&b, 1, 1, f) == 1;
+		b ^= 0x10;
+		ok = ok && !fseeko(f, off, SEEK_SET) && fwrite(&b, 1, 1, f) == 1;
+		fclose(f);
+	}
+	std::string verr2;
+	const bool caught = !FM_Verify(fn, 4, false, &verr2, 0, collectError);
+	remove(fn);
+	TEST_CHECK(verr.empty());
+	TEST_CHECK(ok && off);
+	TEST_CHECK(caught);
+	TEST_CHECK(verr2.find("Frame 7:") != std::string::npos);
+	return true;
+}
+
+namespace {
+	/// the w x h rectangle at x,y of makeFrame(.., i), clipped to the frame like FM_ReadFrameRect()
+	bool rectMatches(FM_Context *c, unsigned i, unsigned fw, unsigned fh, unsigned bpp,
+					 unsigned x, unsigned y, unsigned w, unsigned h, unsigned nThreads, std::string & err)
+	{
+		std::vector<uint8_t> px;
+		makeFrame(px, fw, fh, i, bpp);
+		if (w > fw - x) w = fw - x;
+		if (h > fh - y) h = fh - y;
+		FM_Image *img = FM_ReadFrameRect(c, i, x, y, w, h, nThreads, &err);
+		bool ok = img && img->desc.width == w && img->desc.height == h && img->desc.length == w*h*bpp;
+		for (unsigned r = 0; ok && r < h; ++r)
+			ok = !memcmp(img->data + size_t(r)*w*bpp, &px[(size_t(y+r)*fw + x)*bpp], size_t(w)*bpp);
+		delete img;
+		if (!ok) {
+			std::ostringstream os;
+			os << "frame " << i << " rect " << x << "," << y << " " << w << "x" << h << " with " << nThreads << " threads differs " << err;
+			err = os.str();
+		}
+		return ok;
+	}
+}
+
+/// FM_ReadFrameRect() gives the same pixels for tiled and untiled frames, whole or in part, on any number of threads
+bool testFmvTiledReadRect(std::string & err)
+{
+	const char *fn = "tests_tiled.fmv";
+	const unsigned fw = 100, fh = 70; // not a multiple of the tile size, so the last column and row of tiles are partial
+	// frames 0-2 luminance tiled, 3 untiled, 4-5 RGB tiled, 6 tiled but fits in one tile
+	const unsigned bpps[] = { 1, 1, 1, 1, 3, 3, 1 };
+	const unsigned nFrames = sizeof(bpps)/sizeof(*bpps);
+	std::vector<uint8_t> px;
+	FM_Context *c = FM_Create(fn);
+	TEST_CHECK(c);
+	TEST_CHECK(!FM_SetTileSize(c, 32, 0));
+	for (unsigned i = 0; i < nFrames; ++i) {
+		TEST_CHECK(FM_SetTileSize(c, i == 3 ? 0 : (i == 6 ? 128 : 32), i == 3 ? 0 : (i == 6 ? 128 : 16)));
+		makeFrame(px, fw, fh, i, bpps[i]);
+		TEST_CHECK(FM_AddFrame(c, &px[0], fw, fh, 1, bpps[i]*8, bpps[i] == 3 ? FM_RGB : FM_LUMINOSITY));
+	}
+	FM_Close(c);
+	c = FM_Open(fn, &err);
+	bool ok = c != 0;
+	// inside one tile, across tiles, touching and past the right and bottom edges, the whole frame
+	const unsigned rects[][4] = { {0,0,fw,fh}, {3,2,10,10}, {30,14,5,5}, {31,15,40,20}, {64,48,36,22}, {90,60,50,50}, {99,69,1,1}, {0,33,fw,1}, {47,0,1,fh} };
+	for (unsigned i = 0; ok && i < nFrames; ++i) {
+		FM_Image *whole = FM_ReadFrame(c, i, &err);
+		makeFrame(px, fw, fh, i, bpps[i]);
+		ok = whole && whole->desc.length == px.size() && !memcmp(whole->data, &px[0], px.size());
+		delete whole;
+		// and was stored tiled, or not, as intended
+		FM_ImageDescriptor d;
+		ok = ok && !fseeko(c->file, c->imgOffsets[i], SEEK_SET) && fread(&d, sizeof(d), 1, c->file) == 1
+		        && (d.comp == FM_ZLib_Tiled_Comp) == (i != 3 && i != 6);
+		if (!ok) { err = "frame " + std::string(1, char('0'+i)) + " differs or isn't stored as intended " + err; break; }
+		for (unsigned r = 0; ok && r < sizeof(rects)/sizeof(*rects); ++r)
+			for (unsigned nThreads = 1; ok && nThreads <= 4; nThreads += 3)
+				ok = rectMatches(c, i, fw, fh, bpps[i], rects[r][0], rects[r][1], rects[r][2], rects[r][3], nThreads, err);
+	}
+	if (ok) {
+		// a rectangle wholly outside the frame is an error
+		FM_Image *img = FM_ReadFrameRect(c, 0, fw, 0, 5, 5);
+		ok = !img;
+		delete img;
+		if (!ok) err = "rectangle outside the frame was not rejected";
+	}
+	if (c) FM_Close(c);
+	remove(fn);
+	return ok;
+}
+
+/// FM_Transpose8() against the obvious loop, for sizes around and between its 16x16 blocks, and transposing back gives the original
+bool testFmvTranspose8(std::string & err)
+{
+	const unsigned sizes[] = { 1, 2, 15, 16, 17, 31, 32, 33, 48, 61, 480, 640 };
+	const unsigned nSizes = sizeof(sizes)/sizeof(*sizes);
+	std::vector<uint8_t> src, dst, back;
+	for (unsigned a = 0; a < nSizes; ++a)
+		for (unsigned b = 0; b < nSizes; ++b) {
+			const unsigned w = sizes[a], h = sizes[b];
+			makeFrame(src, w, h, a*nSizes + b);
+			dst.assign(src.size(), 0);
+			back.assign(src.size(), 0);
+			FM_Transpose8(&src[0], w, h, &dst[0]);
+			for (unsigned y = 0; y < h; ++y)
+				for (unsigned x = 0; x < w; ++x)
+					if (dst[size_t(x)*h + y] != src[size_t(y)*w + x]) {
+						std::ostringstream os;
+						os << w << "x" << h << ": pixel " << x << "," << y << " misplaced";
+						err = os.str();
+						return false;
+					}
+			FM_Transpose8(&dst[0], h, w, &back[0]);
+			TEST_CHECK(back == src);
+		}
+	return true;
+}
+
+/** The multithreaded encoder: with several workers and a budget of a few
+    frames, frames come out in the order they were submitted, and once a write
+    fails FM_SubmitFrame() and FM_FlushEncoder() say so and the file ends at 
+    the last frame written. */
+bool testFmvEncoder(std::string & err)
+{
+	const char *fn = "tests_encoder.fmv";
+	const unsigned w = 512, h = 512, nFrames = 60, nGood = 20;
+	std::vector<uint8_t> px;
+	FM_Context *out = FM_Create(fn, 4096);
+	TEST_CHECK(out);
+	TEST_CHECK(FM_StartEncoder(out, 4, 1)); // 1MB, 4 raw frames
+	for (unsigned i = 0; i < nFrames; ++i) {
+		makeFrame(px, w, h, i);
+		// levels and raw frames mixed so that the workers finish out of order
+		TEST_CHECK(FM_SubmitFrame(out, &px[0], w, h, 1 + (i*5) % 6, 8, FM_LUMINOSITY, i % 7 != 3));
+	}
+	TEST_CHECK(FM_FlushEncoder(out));
+	FM_Close(out);
+	FM_Context *in = FM_Open(fn, &err);
+	bool ok = in && framesMatch(in, nFrames, w, h, err);
+	if (in) FM_Close(in);
+	if (!ok) { remove(fn); return false; }
+
+	// make writes fail after nGood frames by swapping the file for a read-only one
+	out = FM_Create(fn, 4096);
+	TEST_CHECK(out);
+	TEST_CHECK(FM_StartEncoder(out, 4, 1));
+	for (unsigned i = 0; ok && i < nGood; ++i) {
+		makeFrame(px, w, h, i);
+		ok = FM_SubmitFrame(out, &px[0], w, h);
+	}
+	ok = ok && FM_FlushEncoder(out);
+	FILE *ro = 0;
+	// checkpointed, so the frames so far can be recovered after the failure
+	if (ok && (ok = FM_Checkpoint(out))) ok = (ro = fopen(fn, "rb")) != 0;
+	if (ro) {
+		FILE *rw = out->file;
+		out->file = ro;
+		fclose(rw);
+	}
+	bool submitFailed = false;
+	for (unsigned i = nGood; ok && !submitFailed && i < nFrames; ++i) {
+		makeFrame(px, w, h, i);
+		submitFailed = !FM_SubmitFrame(out, &px[0], w, h);
+	}
+	const bool flushFailed = !FM_FlushEncoder(out);
+	FM_Close(out); // can't write the index either
+	TEST_CHECK(ok);
+	TEST_CHECK(submitFailed);
+	TEST_CHECK(flushFailed);
+	in = FM_Open(fn, &err, true);
+	ok = in && framesMatch(in, nGood, w, h, err);
+	if (in) FM_Close(in);
+	remove(fn);
+	return ok;
+}
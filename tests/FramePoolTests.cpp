@@ -0,0 +1,81 @@
+/*
+ *  FramePoolTests.cpp
+ *  StimulateOpenGL_II tests
+ *
+ *  The Qt-free part of FramePool, its FrameBudget.
+ *
+ */
+#include "Tests.h"
+#include "FramePool.h"
+#include <vector>
+
+bool testFrameBudgetAccounting(std::string & err)
+{
+	FrameBudget b;
+	b.setBudget(1000);
+	TEST_CHECK(b.budget() == 1000 && b.used() == 0 && b.peak() == 0);
+	TEST_CHECK(b.reserve(600));
+	TEST_CHECK(b.reserve(400));
+	TEST_CHECK(!b.reserve(1)); // full
+	TEST_CHECK(b.used() == 1000);
+	TEST_CHECK(b.reserve(300, true)); // the frame playback is waiting for goes over the budget
+	TEST_CHECK(b.used() == 1300 && b.peak() == 1300);
+	b.unreserve(300);
+	// a frame decoded smaller, then one bigger than reserved
+	b.settle(500, 600);
+	TEST_CHECK(b.used() == 900);
+	b.settle(450, 400);
+	TEST_CHECK(b.used() == 950 && b.peak() == 1300);
+	b.resetPeak();
+	TEST_CHECK(b.peak() == 950);
+	TEST_CHECK(!b.reserve(100));
+	b.unreserve(500), b.unreserve(450); // the frames went away
+	TEST_CHECK(b.used() == 0 && b.peak() == 950);
+	TEST_CHECK(b.reserve(1000) && !b.reserve(1));
+	return true;
+}
+
+namespace {
+	enum { NThreads = 4, PerThread = 50000, Budget = 10000 };
+
+	struct Worker {
+		FrameBudget *b;
+		unsigned id, nReserved, nOver;
+	};
+
+	/// reserves, settles to a different size and frees frames of various sizes, checking the budget is never exceeded
+	void churn(void *arg)
+	{
+		Worker & w (*(Worker *)arg);
+		unsigned r = w.id + 1;
+		for (unsigned i = 0; i < PerThread; ++i) {
+			r = r*1103515245u + 12345u;
+			const s64 bytes = 1 + (r >> 16) % 1000, actual = bytes - (r >> 8) % 8;
+			if (!w.b->reserve(bytes)) continue;
+			++w.nReserved;
+			if (w.b->used() > Budget) ++w.nOver;
+			w.b->settle(actual, bytes);
+			w.b->unreserve(actual);
+		}
+	}
+}
+
+bool testFrameBudgetThreads(std::string & err)
+{
+	FrameBudget b;
+	b.setBudget(Budget);
+	Worker w[NThreads];
+	std::vector<FM_Thread *> threads;
+	for (unsigned i = 0; i < NThreads; ++i) {
+		w[i].b = &b, w[i].id = i, w[i].nReserved = w[i].nOver = 0;
+		threads.push_back(new FM_Thread(churn, &w[i]));
+	}
+	for (size_t i = 0; i < threads.size(); ++i) delete threads[i];
+	for (unsigned i = 0; i < NThreads; ++i) {
+		TEST_CHECK(w[i].nReserved > 0);
+		TEST_CHECK(!w[i].nOver);
+	}
+	TEST_CHECK(b.used() == 0);
+	TEST_CHECK(b.peak() > 0 && b.peak() <= Budget);
+	return true;
+}
@@ -0,0 +1,135 @@
+/*
+ *  FrameScalerTests.cpp
+ *  StimulateOpenGL_II tests
+ *
+ */
+#include "Tests.h"
+#include "FrameScaler.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace {
+	unsigned rnd = 1;
+	unsigned nextRand() { rnd = rnd*1103515245u + 12345u; return (rnd >> 16) & 0x7fff; }
+
+	void randomFrame(std::vector<unsigned char> & px, size_t n)
+	{
+		px.resize(n);
+		for (size_t i = 0; i < n; ++i) px[i] = (unsigned char)nextRand();
+	}
+
+	/// the weight of each source pixel in destination pixel d, as FrameScaler.h describes it, in doubles
+	void refWeights(std::vector<double> & w, int src, int dst, FrameScaler::Filter f, double shift, int d)
+	{
+		const double s = double(src) / double(dst);
+		w.assign(src, 0.);
+		if (f == FrameScaler::Nearest) {
+			const int i = int(floor((d + .5 - shift) * s));
+			w[i < 0 ? 0 : (i > src-1 ? src-1 : i)] = 1.;
+		} else if (f == FrameScaler::Bilinear) {
+			const double c = (d + .5 - shift) * s - .5;
+			const int i = int(floor(c));
+			w[i < 0 ? 0 : (i > src-1 ? src-1 : i)] += 1. - (c - i);
+			w[i+1 < 0 ? 0 : (i+1 > src-1 ? src-1 : i+1)] += c - i;
+		} else {
+			const double a = (d - shift) * s, b = (d + 1 - shift) * s;
+			for (int i = int(floor(a)); i < b; ++i) {
+				const double o = (b < i+1 ? b : i+1) - (a > i ? a : i);
+				if (o > 0.) w[i < 0 ? 0 : (i > src-1 ? src-1 : i)] += o / s;
+			}
+		}
+	}
+
+	/// max difference between f.scale(src) and the exact result
+	int maxErrorVsReference(const FrameScaler & f, const std::vector<unsigned char> & src, int sw, int sh, int bpp,
+							FrameScaler::Filter filt, double shiftX, double shiftY)
+	{
+		const int dw = f.dstWidth(), dh = f.dstHeight();
+		std::vector<unsigned char> dst(f.dstBytes());
+		f.scale(&src[0], &dst[0]);
+		std::vector<std::vector<double> > wx(dw), wy(dh);
+		for (int x = 0; x < dw; ++x) refWeights(wx[x], sw, dw, filt, shiftX, x);
+		for (int y = 0; y < dh; ++y) refWeights(wy[y], sh, dh, filt, shiftY, y);
+		int worst = 0;
+		for (int y = 0; y < dh; ++y)
+			for (int x = 0; x < dw; ++x)
+				for (int c = 0; c < bpp; ++c) {
+					double v = 0.;
+					for (int sy = 0; sy < sh; ++sy) {
+						if (wy[y][sy] == 0.) continue;
+						double row = 0.;
+						for (int sx = 0; sx < sw; ++sx) row += wx[x][sx] * src[(size_t(sy)*sw + sx)*bpp + c];
+						v += wy[y][sy] * row;
+					}
+					const int e = abs(int(dst[(size_t(y)*dw + x)*bpp + c]) - int(floor(v + .5)));
+					if (e > worst) worst = e;
+				}
+		return worst;
+	}
+}
+
+/// same size and no shift gives back the input exactly, with every filter
+bool testFrameScalerIdentity(std::string & err)
+{
+	std::vector<unsigned char> src, dst;
+	for (int bpp = 1; bpp <= 3; bpp += 2)
+		for (int filt = FrameScaler::Nearest; filt <= FrameScaler::Area; ++filt) {
+			const int w = 37, h = 19;
+			randomFrame(src, size_t(w)*h*bpp);
+			FrameScaler f;
+			f.setup(w, h, w, h, bpp, FrameScaler::Filter(filt));
+			TEST_CHECK(f.dstBytes() == int(src.size()));
+			dst.assign(src.size(), 0);
+			f.scale(&src[0], &dst[0]);
+			TEST_CHECK(dst == src);
+		}
+	// whole pixel shifts with nearest just move the picture, repeating the edge
+	const int w = 20, h = 9;
+	randomFrame(src, size_t(w)*h);
+	FrameScaler f;
+	f.setup(w, h, w, h, 1, FrameScaler::Nearest, 3., -2.);
+	dst.assign(src.size(), 0);
+	f.scale(&src[0], &dst[0]);
+	for (int y = 0; y < h; ++y)
+		for (int x = 0; x < w; ++x) {
+			const int sx = x - 3 < 0 ? 0 : x - 3, sy = y + 2 > h-1 ? h-1 : y + 2;
+			TEST_CHECK(dst[y*w + x] == src[sy*w + sx]);
+		}
+	return true;
+}
+
+/// up, down and odd scale factors, sub-pixel shifts, widths that aren't a multiple of the SSE2 step: within 1 of the exact result.
+/// A constant frame stays exactly constant, as the fixed point weights add up to exactly 1.
+bool testFrameScalerAccuracy(std::string & err)
+{
+	std::vector<unsigned char> src, dst;
+	rnd = 12345;
+	for (int it = 0; it < 150; ++it) {
+		const int sw = 1 + nextRand() % 40, sh = 1 + nextRand() % 40, dw = 1 + nextRand() % 60, dh = 1 + nextRand() % 60,
+		          bpp = it % 2 ? 3 : 1;
+		const FrameScaler::Filter filt = FrameScaler::Filter(it % 3);
+		const double shiftX = it % 4 ? (int(nextRand() % 200) - 100) / 37. : 0., shiftY = it % 5 ? (int(nextRand() % 200) - 100) / 41. : 0.;
+		FrameScaler f;
+		f.setup(sw, sh, dw, dh, bpp, filt, shiftX, shiftY);
+		TEST_CHECK(f.dstWidth() == dw && f.dstHeight() == dh && f.dstBytes() == dw*dh*bpp);
+		randomFrame(src, size_t(sw)*sh*bpp);
+		const int e = maxErrorVsReference(f, src, sw, sh, bpp, filt, shiftX, shiftY);
+		if (e > 1) {
+			std::ostringstream os;
+			os << sw << "x" << sh << " -> " << dw << "x" << dh << " bpp " << bpp << " filter " << int(filt)
+			   << " shift " << shiftX << "," << shiftY << ": off by " << e;
+			err = os.str();
+			return false;
+		}
+		src.assign(src.size(), (unsigned char)(it * 37));
+		dst.assign(f.dstBytes(), 0);
+		f.scale(&src[0], &dst[0]);
+		for (size_t i = 0; i < dst.size(); ++i) TEST_CHECK(dst[i] == src[0]);
+	}
+	FrameScaler::Filter filt;
+	TEST_CHECK(FrameScaler::filterFromString("area", filt) && filt == FrameScaler::Area);
+	TEST_CHECK(!FrameScaler::filterFromString("bicubic", filt));
+	return true;
+}
@@ -0,0 +1,89 @@
+/*
+ *  LockFreeQueueTests.cpp
+ *  StimulateOpenGL_II tests
+ *
+ */
+#include "Tests.h"
+#include "LockFreeQueue.h"
+#include "FastMovieThreads.h"
+#include <vector>
+#if !defined(_WIN32) && !defined(WIN32)
+#  include <sched.h>
+#endif
+
+bool testLockFreeQueueFIFO(std::string & err)
+{
+	LockFreeQueue<unsigned, 8> q;
+	unsigned v = 0, next = 0, expect = 0;
+	TEST_CHECK(!q.pop(v));
+	// fill and drain it unevenly, so the positions wrap around the cells many times
+	for (int round = 0; round < 1000; ++round) {
+		int pushed = 0;
+		while (q.push(next)) ++next, ++pushed;
+		TEST_CHECK(pushed <= 8);
+		for (int i = 0; i < 3 + round % 6 && q.pop(v); ++i)
+			TEST_CHECK(v == expect++);
+	}
+	while (q.pop(v)) TEST_CHECK(v == expect++);
+	TEST_CHECK(expect == next);
+	TEST_CHECK(!q.pop(v));
+	// full at exactly N
+	for (unsigned i = 0; i < 8; ++i) TEST_CHECK(q.push(i));
+	TEST_CHECK(!q.push(8));
+	TEST_CHECK(q.pop(v) && v == 0);
+	TEST_CHECK(q.push(8));
+	return true;
+}
+
+namespace {
+	enum { NProducers = 4, PerProducer = 200000 };
+
+	/// lets the other side run when the queue is full or empty, which matters on a single CPU
+	void yield()
+	{
+#if defined(_WIN32) || defined(WIN32)
+		SwitchToThread();
+#else
+		sched_yield();
+#endif
+	}
+
+	struct Producer {
+		LockFreeQueue<unsigned, 64> *q;
+		unsigned id;
+	};
+
+	void produce(void *arg)
+	{
+		Producer & p (*(Producer *)arg);
+		for (unsigned i = 0; i < PerProducer; ++i)
+			while (!p.q->push(p.id << 24 | i)) yield();
+	}
+}
+
+/// several threads pushing into a small queue while this one pops: nothing lost, duplicated or reordered within a producer
+bool testLockFreeQueueProducers(std::string & err)
+{
+	LockFreeQueue<unsigned, 64> q;
+	Producer prod[NProducers];
+	std::vector<FM_Thread *> threads;
+	for (unsigned i = 0; i < NProducers; ++i) {
+		prod[i].q = &q, prod[i].id = i;
+		threads.push_back(new FM_Thread(produce, &prod[i]));
+	}
+	std::vector<unsigned> nextSeq(NProducers, 0);
+	unsigned nPopped = 0, v;
+	bool ok = true;
+	while (nPopped < NProducers*PerProducer) {
+		if (!q.pop(v)) { yield(); continue; }
+		++nPopped;
+		const unsigned id = v >> 24, seq = v & 0xffffff;
+		if (id >= NProducers || seq != nextSeq[id]) ok = false; // keep draining so the producers finish
+		else ++nextSeq[id];
+	}
+	for (size_t i = 0; i < threads.size(); ++i) delete threads[i];
+	TEST_CHECK(ok);
+	TEST_CHECK(!q.pop(v));
+	for (unsigned i = 0; i < NProducers; ++i) TEST_CHECK(nextSeq[i] == PerProducer);
+	return true;
+}
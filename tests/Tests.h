@@ -0,0 +1,42 @@
+/*
+ *  Tests.h
+ *  StimulateOpenGL_II
+ *
+ *  The NO_QT unit tests, see tests.pro.  Each test is a TestFunc listed in
+ *  main.cpp's allTests[], like the --selftest ones in SelfTest.cpp.
+ *
+ */
+#ifndef Tests_H
+#define Tests_H
+
+#include <string>
+#include <sstream>
+
+/// returns false and sets err on failure
+typedef bool (*TestFunc)(std::string & err);
+
+/// fails the enclosing TestFunc, saying where and what, unless cond holds
+#define TEST_CHECK(cond) \
+	do { if (!(cond)) { std::ostringstream os_; os_ << __FILE__ << ":" << __LINE__ << ": " #cond; err = os_.str(); return false; } } while (0)
+
+// LockFreeQueueTests.cpp
+bool testLockFreeQueueFIFO(std::string & err);
+bool testLockFreeQueueProducers(std::string & err);
+
+// FmvTests.cpp
+bool testFmvCheckpointRecovery(std::string & err);
+bool testFmvCRC32C(std::string & err);
+bool testFmvVerifyChecksums(std::string & err);
+bool testFmvTiledReadRect(std::string & err);
+bool testFmvTranspose8(std::string & err);
+bool testFmvEncoder(std::string & err);
+
+// FrameScalerTests.cpp
+bool testFrameScalerIdentity(std::string & err);
+bool testFrameScalerAccuracy(std::string & err);
+
+// FramePoolTests.cpp
+bool testFrameBudgetAccounting(std::string & err);
+bool testFrameBudgetThreads(std::string & err);
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ *  main.cpp
+ *  StimulateOpenGL_II tests
+ *
+ *  Usage: tests [testname ...]
+ *  Runs the named tests (all of them if none are named), printing one
+ *  PASS/FAIL line per test.  Exit status is 0 if they all passed, 1 otherwise.
+ *
+ */
+#include "Tests.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#if defined(_WIN32) || defined(WIN32)
+#  ifndef WIN32_LEAN_AND_MEAN
+#    define WIN32_LEAN_AND_MEAN
+#  endif
+#  include <windows.h>
+#else
+#  include <time.h>
+#endif
+
+namespace {
+	const struct {
+		const char *name;
+		TestFunc func;
+	} allTests[] = {
+		{ "lockfreequeue_fifo", testLockFreeQueueFIFO },
+		{ "lockfreequeue_producers", testLockFreeQueueProducers },
+		{ "fmv_checkpoint_recovery", testFmvCheckpointRecovery },
+		{ "fmv_crc32c", testFmvCRC32C },
+		{ "fmv_verify_checksums", testFmvVerifyChecksums },
+		{ "fmv_tiled_read_rect", testFmvTiledReadRect },
+		{ "fmv_transpose8", testFmvTranspose8 },
+		{ "fmv_encoder", testFmvEncoder },
+		{ "framescaler_identity", testFrameScalerIdentity },
+		{ "framescaler_accuracy", testFrameScalerAccuracy },
+		{ "framepool_accounting", testFrameBudgetAccounting },
+		{ "framepool_threads", testFrameBudgetThreads },
+	};
+	const int nTests = int(sizeof(allTests)/sizeof(*allTests));
+
+	double now()
+	{
+#if defined(_WIN32) || defined(WIN32)
+		return double(GetTickCount64())*1e-3;
+#else
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return double(ts.tv_sec) + double(ts.tv_nsec)*1e-9;
+#endif
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<const char *> tests;
+	for (int i = 1; i < argc; ++i) tests.push_back(argv[i]);
+	if (tests.empty())
+		for (int i = 0; i < nTests; ++i) tests.push_back(allTests[i].name);
+	int nFailed = 0;
+	for (size_t t = 0; t < tests.size(); ++t) {
+		int i = 0;
+		while (i < nTests && strcmp(tests[t], allTests[i].name)) ++i;
+		std::string err;
+		const double t0 = now();
+		const bool ok = i < nTests ? allTests[i].func(err) : (err = "no such test", false);
+		if (!ok) ++nFailed;
+		printf("%s %s (%d ms)", ok ? "PASS" : "FAIL", tests[t], int((now()-t0)*1e3));
+		if (!ok) printf(": %s", err.c_str());
+		printf("\n");
+		fflush(stdout);
+	}
+	printf("%d/%d tests passed\n", int(tests.size()) - nFailed, int(tests.size()));
+	return nFailed ? 1 : 0;
+}
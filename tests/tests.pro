@@ -0,0 +1,36 @@
+######################################################################
+# tests -- unit tests for the parts of the program that don't need Qt or
+# a display (NO_QT, like fmvtool).  The rest is tested by the program's own
+# --selftest mode.  `make check' (or just running ./tests) runs them all,
+# ./tests name ... runs just those.  Without qmake:
+#
+#   g++ -O2 -DNO_QT -I.. *.cpp ../FastMovieFormat.cpp ../FrameScaler.cpp ../FramePool.cpp -lz -lpthread -o tests
+######################################################################
+
+TEMPLATE = app
+TARGET = tests
+CONFIG += console thread warn_on
+CONFIG -= qt app_bundle
+DEFINES += NO_QT
+INCLUDEPATH += ..
+DEPENDPATH += ..
+
+HEADERS += Tests.h ../LockFreeQueue.h ../FastMovieThreads.h ../FastMovieFormat.h ../FrameScaler.h ../FramePool.h
+SOURCES += main.cpp LockFreeQueueTests.cpp FmvTests.cpp FrameScalerTests.cpp FramePoolTests.cpp \
+           ../FastMovieFormat.cpp ../FrameScaler.cpp ../FramePool.cpp
+
+unix {
+        LIBS += -lz -lpthread
+        check.commands = ./$(TARGET)
+        check.depends = $(TARGET)
+        QMAKE_EXTRA_TARGETS += check
+}
+win32 {
+        # the zlib that ships with the mex
+        INCLUDEPATH += ../Matlab/FastMovieWriterMex
+        contains(QMAKE_TARGET.arch, x86_64) {
+            LIBS += $${PWD}/../Matlab/FastMovieWriterMex/zlibstat64.lib
+        } else {
+            LIBS += $${PWD}/../Matlab/FastMovieWriterMex/zlibstat.lib
+        }
+}